@@ -0,0 +1,335 @@
+#include <bitset>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bitbase.hpp"
+#include "bitboard.hpp"
+#include "defs.hpp"
+#include "movegen.hpp"
+#include "position.hpp"
+#include "utils.hpp"
+
+namespace Maestro::Bitbases {
+
+namespace {
+
+// Positions: 2 sides to move * 24 pawn squares * 64 * 64 king squares
+constexpr unsigned MAX_INDEX = 2 * 24 * 64 * 64;
+
+// One bit per position (Set if white wins)
+std::bitset<MAX_INDEX> KPKBitbase;
+std::thread generator;
+// Time the generation took on its thread (ms)
+double generationMs = 0;
+
+// Index layout:
+// bit  0- 5: white king square
+// bit  6-11: black king square
+// bit    12: side to move
+// bit 13-14: pawn file (FILE_A to FILE_D)
+// bit 15-17: RANK_7 - pawn rank (RANK_7 to RANK_2)
+unsigned index(Colour stm, Square bksq, Square wksq, Square psq) {
+  return wksq | (bksq << 6) | (stm << 12) | (fileOf(psq) << 13) |
+         ((RANK_7 - rankOf(psq)) << 15);
+}
+
+enum Result : uint8_t { INVALID = 0, UNKNOWN = 1, DRAW = 2, WIN = 4 };
+
+Result &operator|=(Result &r, Result v) { return r = Result(r | v); }
+
+// Squares and side to move of a position index
+struct KPKPosition {
+  explicit KPKPosition(unsigned idx)
+      : us(Colour((idx >> 12) & 0x01)),
+        ksq{Square((idx >> 0) & 0x3F), Square((idx >> 6) & 0x3F)},
+        psq(toSquare(File((idx >> 13) & 0x3),
+                     Rank(RANK_7 - ((idx >> 15) & 0x7)))) {}
+
+  Colour us;
+  Square ksq[COLOUR_N], psq;
+};
+
+// Result of a position that doesn't depend on its children
+Result initialResult(unsigned idx) {
+  const KPKPosition p(idx);
+
+  const Bitboard whiteKingAttacks = pseudoAttacks[KING][p.ksq[WHITE]];
+  const Bitboard blackKingAttacks = pseudoAttacks[KING][p.ksq[BLACK]];
+
+  // Two pieces on the same square or a king can be captured
+  if (distance(p.ksq[WHITE], p.ksq[BLACK]) <= 1 || p.ksq[WHITE] == p.psq ||
+      p.ksq[BLACK] == p.psq ||
+      (p.us == WHITE && (pawnAttacksBB<WHITE>(p.psq) & p.ksq[BLACK])))
+    return INVALID;
+
+  // The pawn promotes without getting captured
+  if (p.us == WHITE && rankOf(p.psq) == RANK_7 && p.ksq[WHITE] != p.psq + N &&
+      (distance(p.ksq[BLACK], p.psq + N) > 1 ||
+       (whiteKingAttacks & (p.psq + N))))
+    return WIN;
+
+  // Stalemate or the black king captures an undefended pawn
+  if (p.us == BLACK &&
+      (!(blackKingAttacks &
+         ~(whiteKingAttacks | pawnAttacksBB<WHITE>(p.psq))) ||
+       (blackKingAttacks & p.psq & ~whiteKingAttacks)))
+    return DRAW;
+
+  // Position will be classified later
+  return UNKNOWN;
+}
+
+// White to move wins if any move reaches a win, black to move draws if any
+// move reaches a draw. Unknown until all moves are classified.
+template <Colour us>
+Result classify(const KPKPosition &p, const std::vector<Result> &db) {
+  constexpr Colour them = ~us;
+  constexpr Result good = us == WHITE ? WIN : DRAW;
+  constexpr Result bad = us == WHITE ? DRAW : WIN;
+
+  Result r = INVALID;
+  Bitboard bb = pseudoAttacks[KING][p.ksq[us]];
+
+  while (bb) {
+    const Square sq = popLSB(bb);
+    r |= us == WHITE ? db[index(them, p.ksq[them], sq, p.psq)]
+                     : db[index(them, sq, p.ksq[them], p.psq)];
+  }
+
+  if (us == WHITE) {
+    // Single push
+    if (rankOf(p.psq) < RANK_7)
+      r |= db[index(them, p.ksq[them], p.ksq[us], p.psq + N)];
+
+    // Double push
+    if (rankOf(p.psq) == RANK_2 && p.psq + N != p.ksq[us] &&
+        p.psq + N != p.ksq[them])
+      r |= db[index(them, p.ksq[them], p.ksq[us], p.psq + N + N)];
+  }
+
+  return r & good ? good : r & UNKNOWN ? UNKNOWN : bad;
+}
+
+// Build a FEN string for a KPK position
+std::string toFen(Square wksq, Square wpsq, Square bksq, Colour stm) {
+  std::string fen;
+
+  for (Rank r = RANK_8; r >= RANK_1; --r) {
+    int empty = 0;
+    for (File f = FILE_A; f <= FILE_H; ++f) {
+      const Square sq = toSquare(f, r);
+      const char c = sq == wksq ? 'K' : sq == wpsq ? 'P' : sq == bksq ? 'k' : 0;
+      if (!c) {
+        ++empty;
+        continue;
+      }
+      if (empty)
+        fen += std::to_string(empty), empty = 0;
+      fen += c;
+    }
+    if (empty)
+      fen += std::to_string(empty);
+    if (r != RANK_1)
+      fen += '/';
+  }
+
+  return fen + (stm == WHITE ? " w - - 0 1" : " b - - 0 1");
+}
+
+// Result of the position after a promotion, black to move, from black's
+// replies (Independent of the generator, which assumes the new queen wins
+// unless it is captured)
+Result promotionResult(Position &pos) {
+  // A lone minor piece can't mate
+  if (!pos.count<QUEEN>() && !pos.count<ROOK>())
+    return DRAW;
+
+  MoveList<ALL> replies(pos);
+  if (replies.empty())
+    return pos.isInCheck() ? WIN : DRAW;
+
+  for (Move reply : replies)
+    if (pos.isCapture(reply))
+      return DRAW;
+
+  // KQK and KRK are won with white to move
+  return WIN;
+}
+
+// Classify every position by retrograde analysis
+void generate() {
+  const auto start = std::chrono::steady_clock::now();
+  // One byte per position and a list of the unknown ones, so each pass only
+  // visits the positions left to classify
+  std::vector<Result> db(MAX_INDEX);
+  std::vector<unsigned> unknown;
+
+  // Initialize positions with known results
+  for (unsigned idx = 0; idx < MAX_INDEX; ++idx)
+    if ((db[idx] = initialResult(idx)) == UNKNOWN)
+      unknown.push_back(idx);
+
+  // Iterate until no unknown position can be classified, the results are
+  // written in place so a pass sees those of the positions before it
+  for (size_t left = 0; left != unknown.size();) {
+    left = unknown.size();
+    size_t kept = 0;
+
+    for (const unsigned idx : unknown) {
+      const KPKPosition p(idx);
+      const Result r =
+          p.us == WHITE ? classify<WHITE>(p, db) : classify<BLACK>(p, db);
+
+      if (r == UNKNOWN)
+        unknown[kept++] = idx;
+      else
+        db[idx] = r;
+    }
+
+    unknown.resize(kept);
+  }
+
+  // Store the wins
+  for (unsigned idx = 0; idx < MAX_INDEX; ++idx)
+    if (db[idx] == WIN)
+      KPKBitbase.set(idx);
+
+  generationMs = std::chrono::duration<double, std::milli>(
+                     std::chrono::steady_clock::now() - start)
+                     .count();
+}
+
+} // namespace
+
+bool probe(Square wksq, Square wpsq, Square bksq, Colour stm) {
+  return KPKBitbase[index(stm, bksq, wksq, wpsq)];
+}
+
+void init() { generator = std::thread(generate); }
+
+void waitForInit() {
+  if (generator.joinable())
+    generator.join();
+}
+
+double generationTime() { return generationMs; }
+
+void verify() {
+  std::cout << "\n\n	KPK Bitbase Test\n" << std::endl;
+  TimePt start = getTimeMs();
+
+  waitForInit();
+
+  // Outcome of each move: a position index, or a terminal result
+  constexpr unsigned TERMINAL_DRAW = MAX_INDEX, TERMINAL_WIN = MAX_INDEX + 1;
+
+  std::vector<std::vector<unsigned>> children(MAX_INDEX);
+  std::vector<Result> results(MAX_INDEX, INVALID);
+
+  Position pos;
+  BoardState st{}, next{};
+
+  // Expand every legal position with the move generator
+  for (unsigned idx = 0; idx < MAX_INDEX; ++idx) {
+    const Square wksq = Square(idx & 0x3F), bksq = Square((idx >> 6) & 0x3F);
+    const Colour stm = Colour((idx >> 12) & 0x01);
+    const Square psq =
+        toSquare(File((idx >> 13) & 0x3), Rank(RANK_7 - ((idx >> 15) & 0x7)));
+
+    // Skip illegal positions
+    if (distance(wksq, bksq) <= 1 || wksq == psq || bksq == psq ||
+        (stm == WHITE && (pawnAttacksBB<WHITE>(psq) & bksq)))
+      continue;
+
+    pos.set(toFen(wksq, psq, bksq, stm), st);
+    MoveList<ALL> moves(pos);
+
+    results[idx] = UNKNOWN;
+
+    // Black is mated, or either side is stalemated
+    if (moves.empty()) {
+      results[idx] = (stm == BLACK && pos.isInCheck()) ? WIN : DRAW;
+      continue;
+    }
+
+    for (Move move : moves) {
+      pos.makeMove(move, next);
+
+      if (move.is<PROMOTION>())
+        children[idx].push_back(promotionResult(pos) == WIN ? TERMINAL_WIN
+                                                            : TERMINAL_DRAW);
+      else if (!pos.count<PAWN>())
+        children[idx].push_back(TERMINAL_DRAW);
+      else
+        children[idx].push_back(index(~stm, pos.square<KING>(BLACK),
+                                      pos.square<KING>(WHITE),
+                                      pos.square<PAWN>(WHITE)));
+
+      pos.unmakeMove(move);
+    }
+  }
+
+  // Solve by iterating until nothing changes, unresolved positions are draws
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (unsigned idx = 0; idx < MAX_INDEX; ++idx) {
+      if (results[idx] != UNKNOWN)
+        continue;
+
+      const Result good = (idx >> 12) & 0x01 ? DRAW : WIN;
+      Result r = INVALID;
+      for (unsigned child : children[idx])
+        r |= child == TERMINAL_WIN    ? WIN
+             : child == TERMINAL_DRAW ? DRAW
+                                      : results[child];
+
+      const Result result = r & good               ? good
+                            : r & UNKNOWN          ? UNKNOWN
+                            : good == WIN ? DRAW : WIN;
+      if (result != UNKNOWN)
+        results[idx] = result, changed = true;
+    }
+  }
+
+  // Compare with the bitbase
+  U64 positions = 0, wins = 0, errors = 0;
+  for (unsigned idx = 0; idx < MAX_INDEX; ++idx) {
+    if (results[idx] == INVALID)
+      continue;
+
+    const bool win = results[idx] == WIN;
+    ++positions, wins += win;
+
+    if (win != KPKBitbase[idx]) {
+      if (++errors <= 10)
+        std::cout << "	Mismatch: "
+                  << toFen(Square(idx & 0x3F),
+                           toSquare(File((idx >> 13) & 0x3),
+                                    Rank(RANK_7 - ((idx >> 15) & 0x7))),
+                           Square((idx >> 6) & 0x3F),
+                           Colour((idx >> 12) & 0x01))
+                  << " Expected: " << (win ? "win" : "draw") << std::endl;
+    }
+  }
+
+  U64 duration = getTimeMs() - start;
+
+  std::cout << "\n==========================================\n" << std::endl;
+  std::cout << "	Positions:	" << positions << std::endl;
+  std::cout << "	Wins:		" << wins << std::endl;
+  std::cout << "	Mismatches:	" << errors << std::endl;
+  std::cout << "	Generation:	" << generationTime() << " ms (Budget "
+            << GENERATION_BUDGET << " ms)" << std::endl;
+  std::cout << "	Duration:	" << duration << " ms" << std::endl;
+  std::cout << "	Result:		" << (errors ? "Failed" : "Passed") << std::endl;
+  // The generation time depends on the load of the machine, so it only warns
+  if (generationTime() > GENERATION_BUDGET)
+    std::cout << "	Warning:	Generation over budget" << std::endl;
+  std::cout << "\n==========================================\n\n";
+}
+
+} // namespace Maestro::Bitbases
@@ -0,0 +1,44 @@
+#ifndef BITBASE_HPP
+#pragma once
+#define BITBASE_HPP
+
+#include "defs.hpp"
+
+namespace Maestro {
+
+/******************************************\
+|==========================================|
+|              KPK Bitbase                 |
+|==========================================|
+\******************************************/
+
+// https://www.chessprogramming.org/KPK
+
+namespace Bitbases {
+
+// Start generating the KPK bitbase by retrograde analysis on a background
+// thread, it overlaps the rest of the startup
+void init();
+
+// Wait for the generation started by init, before the first probe
+void waitForInit();
+
+// Time the generation took on its thread (ms), once waitForInit returned
+double generationTime();
+
+// Startup budget of the generation (ms), reported by verify and
+// --startup-profile. It runs while the engine starts and waits for the GUI, and
+// is only joined before the first evaluation.
+constexpr double GENERATION_BUDGET = 20;
+
+// Probe the bitbase (White is the strong side and the pawn is on files A-D)
+bool probe(Square wksq, Square wpsq, Square bksq, Colour stm);
+
+// Verify the bitbase against a brute force solve using the move generator
+void verify();
+
+} // namespace Bitbases
+
+} // namespace Maestro
+
+#endif // BITBASE_HPP
@@ -2,11 +2,185 @@
 #include <string>
 
 #include "bitboard.hpp"
+#include "cpu.hpp"
 #include "defs.hpp"
 #include "utils.hpp"
 
+#ifdef ATTACK_FILLS
+#include <immintrin.h>
+#endif
+
 namespace Maestro {
 
+/******************************************\
+|==========================================|
+|            Attacks on the fly            |
+|==========================================|
+\******************************************/
+
+// Calculate the attacks of a piece on the fly (Slow approach used to populate
+// tables)
+template <PieceType pt>
+static constexpr Bitboard attacksOnTheFly(Square sq, Bitboard occupied) {
+  // Directions for rook and bishop
+  constexpr Direction rookDir[4] = {N, E, W, S};
+  constexpr Direction bishopDir[4] = {NE, NW, SE, SW};
+
+  // Get the corresponding attack pattern for the piece
+  Bitboard attacks = EMPTYBB;
+  for (Direction d : (pt == BISHOP) ? bishopDir : rookDir) {
+    Square to = sq;
+    // While the shift is valid and the square is not occupied
+    while (shift(to, d) && !(occupied & to))
+      attacks |= (to += d);
+  }
+
+  return attacks;
+}
+
+// Squares whose occupancy changes the attacks of a slider. Edges of the board
+// are not included because it doesn't matter if there is a blocker there or
+// not, except in the cases where the attacking piece is on the edge.
+template <PieceType pt> static constexpr Bitboard sliderMask(Square sq) {
+  const Bitboard edges = ((rankBB(RANK_1) | rankBB(RANK_8)) & ~rankBB(sq)) |
+                         ((fileBB(FILE_A) | fileBB(FILE_H)) & ~fileBB(sq));
+  return attacksOnTheFly<pt>(sq, EMPTYBB) & ~edges;
+}
+
+/******************************************\
+|==========================================|
+|          Compile Time Tables             |
+|==========================================|
+\******************************************/
+
+namespace {
+
+using SquareTable = Array<Bitboard, SQ_N, SQ_N>;
+
+constexpr Array<Bitboard, PIECE_TYPE_N, SQ_N> initPseudoAttacks() {
+  Array<Bitboard, PIECE_TYPE_N, SQ_N> attacks{};
+
+  for (Square sq = A1; sq <= H8; ++sq) {
+    for (Direction d : {NNE, NNW, NEE, NWW, SEE, SWW, SSE, SSW})
+      attacks[KNIGHT][sq] |= shift(sq, d);
+    for (Direction d : {N, NE, NW, E, W, SE, SW, S})
+      attacks[KING][sq] |= shift(sq, d);
+    attacks[BISHOP][sq] = attacksOnTheFly<BISHOP>(sq, EMPTYBB);
+    attacks[ROOK][sq] = attacksOnTheFly<ROOK>(sq, EMPTYBB);
+    attacks[QUEEN][sq] = attacks[BISHOP][sq] | attacks[ROOK][sq];
+  }
+
+  return attacks;
+}
+
+constexpr Array<Bitboard, COLOUR_N, SQ_N> initPawnAttacks() {
+  Array<Bitboard, COLOUR_N, SQ_N> attacks{};
+
+  for (Square sq = A1; sq <= H8; ++sq) {
+    attacks[WHITE][sq] = shift<NW>(squareBB(sq)) | shift<NE>(squareBB(sq));
+    attacks[BLACK][sq] = shift<SW>(squareBB(sq)) | shift<SE>(squareBB(sq));
+  }
+
+  return attacks;
+}
+
+// Line, between, pin and check bitboards of the squares a slider of type pt
+// sees from each other
+template <PieceType pt>
+constexpr void initLines(SquareTable &line, SquareTable &between,
+                         SquareTable &pin, SquareTable &check) {
+  for (Square from = A1; from <= H8; ++from) {
+    const Bitboard attacked = attacksOnTheFly<pt>(from, EMPTYBB);
+
+    for (Square to = A1; to <= H8; ++to) {
+      if (!(attacked & to))
+        continue;
+
+      line[from][to] = (attacked & attacksOnTheFly<pt>(to, EMPTYBB)) |
+                       (from | to);
+      between[from][to] = attacksOnTheFly<pt>(from, squareBB(to)) &
+                          attacksOnTheFly<pt>(to, squareBB(from));
+      pin[from][to] = between[from][to] | to;
+      // The square behind the king is attacked too (If on the board)
+      check[from][to] = between[from][to] | from |
+                        shift(from, -direction(from, to));
+    }
+  }
+}
+
+struct LineTables {
+  SquareTable line{}, between{}, pin{}, check{};
+};
+
+constexpr LineTables initLineTables() {
+  LineTables t;
+  initLines<BISHOP>(t.line, t.between, t.pin, t.check);
+  initLines<ROOK>(t.line, t.between, t.pin, t.check);
+  return t;
+}
+
+constexpr LineTables lineTables = initLineTables();
+
+constexpr Array<Castling, SQ_N> initCastlingRights() {
+  Array<Castling, SQ_N> rights{};
+
+  for (Square sq = A1; sq <= H8; ++sq)
+    rights[sq] = ANY_SIDE;
+
+  // Remove White castling rights if the king is moved
+  rights[E1] &= ~WHITE_SIDE;
+  // Remove Black castling rights if the king is moved
+  rights[E8] &= ~BLACK_SIDE;
+  // Remove White King side castling rights if the rook on H1 is moved
+  rights[H1] &= ~WK_SIDE;
+  // Remove White Queen side castling rights if the rook on A1 is moved
+  rights[A1] &= ~WQ_SIDE;
+  // Remove Black King side castling rights if the rook on H8 is moved
+  rights[H8] &= ~BK_SIDE;
+  // Remove Black Queen side castling rights if the rook on A8 is moved
+  rights[A8] &= ~BQ_SIDE;
+
+  return rights;
+}
+
+#ifdef SLIDERS_HYPERBOLA
+// Squares reached from sq going in direction d
+constexpr Bitboard ray(Square sq, Direction d) {
+  Bitboard bb = EMPTYBB;
+  for (Square to = sq; shift(to, d); to += d)
+    bb |= shift(to, d);
+  return bb;
+}
+
+constexpr Array<SliderMasks, SQ_N> initSliderMasks() {
+  Array<SliderMasks, SQ_N> masks{};
+
+  for (Square sq = A1; sq <= H8; ++sq) {
+    masks[sq].file = ray(sq, N) | ray(sq, S);
+    masks[sq].diagonal = ray(sq, NE) | ray(sq, SW);
+    masks[sq].antiDiagonal = ray(sq, NW) | ray(sq, SE);
+  }
+
+  return masks;
+}
+
+constexpr Array<uint8_t, FILE_N, 64> initFirstRankAttacks() {
+  Array<uint8_t, FILE_N, 64> attacks{};
+
+  for (File f = FILE_A; f <= FILE_H; ++f) {
+    const Square sq = Square(f);
+    // The slider itself is left out of the occupancy
+    for (Bitboard inner = 0; inner < 64; ++inner)
+      attacks[f][inner] = uint8_t(
+          attacksOnTheFly<ROOK>(sq, (inner << 1) & ~squareBB(sq)) & RANK_1BB);
+  }
+
+  return attacks;
+}
+#endif
+
+} // namespace
+
 /******************************************\
 |==========================================|
 |              Lookup Tables               |
@@ -14,29 +188,33 @@ namespace Maestro {
 \******************************************/
 
 // Pseudo attacks for all pieces except pawns
-Array<Bitboard, PIECE_TYPE_N, SQ_N> pseudoAttacks;
+constinit const Array<Bitboard, PIECE_TYPE_N, SQ_N> pseudoAttacks =
+    initPseudoAttacks();
 // Pseudo attacks for pawns
-Array<Bitboard, COLOUR_N, SQ_N> pawnAttacks;
-// Bishop magics
-Array<Magic, SQ_N> bishopAttacks;
-// Rook magics
-Array<Magic, SQ_N> rookAttacks;
-// Bishop attack tables
-Bitboard bishopTable[0x1480]{};
-// Rook attack tables
-Bitboard rookTable[0x19000]{};
-// Square distance lookup table
-Array<int, SQ_N, SQ_N> dist;
+constinit const Array<Bitboard, COLOUR_N, SQ_N> pawnAttacks = initPawnAttacks();
+
+#ifdef SLIDERS_HYPERBOLA
+// Lines through each square
+constinit const Array<SliderMasks, SQ_N> sliderMasks = initSliderMasks();
+// Rank attacks of a slider on the first rank
+constinit const Array<uint8_t, FILE_N, 64> firstRankAttacks =
+    initFirstRankAttacks();
+#endif
+
+#ifdef PEXT_DISPATCH
+// Slider attacks indexed with pext instead of magics
+bool usePext = false;
+#endif
 // Line the two squares lie on [from][to]
-Array<Bitboard, SQ_N, SQ_N> lineBB;
+constinit const Array<Bitboard, SQ_N, SQ_N> lineBB = lineTables.line;
 // In between bitboards [from][to]
-Array<Bitboard, SQ_N, SQ_N> betweenBB;
+constinit const Array<Bitboard, SQ_N, SQ_N> betweenBB = lineTables.between;
 // Pins [king][attacker]
-Array<Bitboard, SQ_N, SQ_N> pinBB;
+constinit const Array<Bitboard, SQ_N, SQ_N> pinBB = lineTables.pin;
 // Checks [king][attacker]
-Array<Bitboard, SQ_N, SQ_N> checkBB;
+constinit const Array<Bitboard, SQ_N, SQ_N> checkBB = lineTables.check;
 // Castling rights lookup table
-Array<Castling, SQ_N> castlingRights;
+constinit const Array<Castling, SQ_N> castlingRights = initCastlingRights();
 
 /******************************************\
 |==========================================|
@@ -68,219 +246,410 @@ void Bitboards::print(Bitboard bb) {
 
 /******************************************\
 |==========================================|
-|            Attacks on the fly            |
+|              Slider Tables               |
 |==========================================|
 \******************************************/
 
-// Calculate the attacks of a piece on the fly (Slow approach used to populate
-// tables)
+// The attack tables of every backend are built at compile time. Builds that
+// pick pext at startup have the tables of both indexings, and point the magics
+// at the pext ones in Bitboards::init.
+
+#ifndef SLIDERS_HYPERBOLA
+namespace {
+
+// Same as attacksOnTheFly on plain integers. Each of the ~100000 entries
+// walks the rays, which takes most of the build time of this file through
+// the calls of shift and the Square operators.
 template <PieceType pt>
-static inline Bitboard attacksOnTheFly(Square sq, Bitboard occupied) {
-  // Directions for rook and bishop
-  constexpr Direction rookDir[4] = {N, E, W, S};
-  constexpr Direction bishopDir[4] = {NE, NW, SE, SW};
+constexpr Bitboard tableAttacks(Square sq, Bitboard occupied) {
+  constexpr int rookDir[4][2] = {{0, 1}, {1, 0}, {-1, 0}, {0, -1}};
+  constexpr int bishopDir[4][2] = {{1, 1}, {-1, 1}, {1, -1}, {-1, -1}};
 
-  // Get the corresponding attack pattern for the piece
   Bitboard attacks = EMPTYBB;
-  for (Direction d : (pt == BISHOP) ? bishopDir : rookDir) {
-    Square to = sq;
-    // While the shift is valid and the square is not occupied
-    while (shift(to, d) && !(occupied & to))
-      attacks |= (to += d);
-  }
+  for (const auto &d : pt == BISHOP ? bishopDir : rookDir)
+    for (int file = (sq & 7) + d[0], rank = (sq >> 3) + d[1];
+         file >= 0 && file < 8 && rank >= 0 && rank < 8;
+         file += d[0], rank += d[1]) {
+      const Bitboard to = Bitboard(1) << (rank * 8 + file);
+      attacks |= to;
+      if (occupied & to)
+        break;
+    }
 
   return attacks;
 }
 
-/******************************************\
-|==========================================|
-|               Init Magics                |
-|==========================================|
-\******************************************/
-
-template <PieceType pt>
-constexpr void initMagics(Bitboard table[], Array<Magic, SQ_N> &magics) {
-#ifndef USE_PEXT
-  int cnt = 0, epoch[4096] = {0};
-  Bitboard occupancy[4096], reference[4096];
+} // namespace
 #endif
-  int size = 0;
-  Bitboard edges, occupied;
 
+#if defined(SLIDERS_BLACK_MAGIC)
+// Black magics index a table per square with ((occupied | ~mask) * magic) >>
+// shift. The tables of all squares are packed into one, overlapping where
+// their entries are unused or equal.
+struct BlackMagic {
+  Bitboard magic;
+  unsigned offset; // In sliderTable
+};
+
+// Found offline for these masks and shifts, with the offsets packing the
+// tables into 104973 entries (Fancy magics need 107648)
+constexpr BlackMagic BishopBlackMagics[SQ_N] = {
+    {0x4A02880200822401ULL, 88360}, {0x2042882220840840ULL, 50449},
+    {0x20081228C4124011ULL, 49684}, {0x000303006402020AULL, 51382},
+    {0x8021868222004000ULL, 51450}, {0x1A40A21280895558ULL, 52276},
+    {0x0A30410809008001ULL, 49294}, {0x5808104202108086ULL, 18530},
+    {0x08A0060444042002ULL, 49358}, {0x400802C404008411ULL, 50581},
+    {0x0000082228C41000ULL, 49232}, {0x0081061854101000ULL, 51638},
+    {0x9833218680F670B0ULL, 51709}, {0x606C90A25280D9D8ULL, 52349},
+    {0x00880A0221040281ULL, 49485}, {0x4042248084014140ULL, 50325},
+    {0x50243190C5212016ULL, 50200}, {0x40120C446410C010ULL, 50262},
+    {0x8005024410480850ULL, 99732}, {0x56ED01DA02E4027AULL, 95835},
+    {0x6002101C2200832CULL, 95584}, {0xA20D084A20608090ULL, 95960},
+    {0x18B881D0C404411FULL, 49747}, {0x307F805909512035ULL, 49620},
+    {0xA0A7F46A9542A078ULL, 51770}, {0x90F60A0BC2A2403FULL, 52154},
+    {0x92182402C8202FF5ULL, 16365}, {0xD08100413C040401ULL, 68643},
+    {0x000A84010A802008ULL, 90496}, {0xBE19C0601032C038ULL, 98610},
+    {0x30A28280B890A0A0ULL, 52216}, {0xC0B58360B0505019ULL, 51259},
+    {0x2400502480900410ULL, 51323}, {0x4880238842840B04ULL, 51901},
+    {0xB000086064300140ULL, 96082}, {0x000A040400780210ULL, 89984},
+    {0xEB8283FEC0A40100ULL, 91007}, {0xF2004056078720C0ULL, 58329},
+    {0x800081A111508A87ULL, 51833}, {0x60404094269AC143ULL, 52084},
+    {0x2100425014201002ULL, 49558}, {0x0000046308410403ULL, 49872},
+    {0x36000552A8028501ULL, 96329}, {0x87E5B00514089800ULL, 95709},
+    {0x4445803018603C00ULL, 96205}, {0xF88021304E00F720ULL, 96453},
+    {0xA84042409122F5C0ULL, 50138}, {0x21A050B18500A880ULL, 51959},
+    {0x0100010402A20800ULL, 50509}, {0x0940089084108010ULL, 50702},
+    {0x0002000851244060ULL, 49934}, {0x0321080180C30000ULL, 52406},
+    {0x1008000105414401ULL, 52020}, {0x0000818624144100ULL, 49808},
+    {0x4002424801011210ULL, 50773}, {0x4001081109082802ULL, 50645},
+    {0x25440021080210E1ULL, 88607}, {0x2C23000202210442ULL, 50386},
+    {0x208A080008512427ULL, 50066}, {0x4100200000184603ULL, 51582},
+    {0x402008840C018180ULL, 51518}, {0x0108000048218120ULL, 49998},
+    {0x0060008881044084ULL, 49421}, {0x2800022424409011ULL, 88866}
+};
+
+constexpr BlackMagic RookBlackMagics[SQ_N] = {
+    {0x4980001397400008ULL, 0}, {0x0540200040001004ULL, 16491},
+    {0xBE801002E00A8003ULL, 22664}, {0x9300072003041004ULL, 30848},
+    {0x4080020800940080ULL, 60498}, {0xD600088A0000C514ULL, 28803},
+    {0x640000B62698000DULL, 39015}, {0x2A00017884000441ULL, 4090},
+    {0x0004004082010400ULL, 65614}, {0x0401401000200030ULL, 100878},
+    {0x0802802000100084ULL, 57307}, {0x0000800800500180ULL, 96572},
+    {0x8020800884008001ULL, 98721}, {0x8981000804010001ULL, 67657},
+    {0x30E40021ABFF9CE6ULL, 82124}, {0x57320006779C000DULL, 32892},
+    {0x4001020024804200ULL, 14318}, {0x294821E008100008ULL, 81110},
+    {0x6390068020017E8CULL, 101901}, {0x661009000C200300ULL, 71197},
+    {0x504EFF00301C3800ULL, 18571}, {0x0008808002000400ULL, 59474},
+    {0xBCFDBC006A280F50ULL, 70175}, {0x0040020010A40021ULL, 20617},
+    {0x4003C00080008830ULL, 102925}, {0xADFF022200308010ULL, 69152},
+    {0xCECC0F01003DE001ULL, 72220}, {0x6041D0001C001878ULL, 87170},
+    {0x89D00391001800FFULL, 62546}, {0x38400C0080800200ULL, 56283},
+    {0xCC8BE7E4004A40D0ULL, 99855}, {0x8BE0249E00110C3CULL, 12271},
+    {0x3FC00014D08005A1ULL, 26756}, {0xFF7F806B03004002ULL, 63569},
+    {0x0104002044008100ULL, 64591}, {0x6560031DE5001000ULL, 75283},
+    {0x0680020046003428ULL, 74260}, {0x0001080101000400ULL, 97595},
+    {0x5E04008184001952ULL, 73242}, {0xFE2000186A000C49ULL, 24711},
+    {0x3320000802161001ULL, 34939}, {0xAF8C000808301000ULL, 79073},
+    {0x0110002000838010ULL, 58450}, {0x5E800204500A0018ULL, 78057},
+    {0xEA8800010A05000CULL, 55263}, {0x4A40940001010048ULL, 19595},
+    {0x2448009D20202002ULL, 88164}, {0x8C80001090284006ULL, 36971},
+    {0x0300080502100190ULL, 76065}, {0x210004C210040850ULL, 86167},
+    {0xA0C0014028149200ULL, 85159}, {0x00000102400C00C0ULL, 88960},
+    {0x404000100821CE00ULL, 84147}, {0x9060006438870100ULL, 80096},
+    {0x08C800A0220004A0ULL, 83139}, {0x84000008004C0C20ULL, 45119},
+    {0x9100081420408112ULL, 91505}, {0xF900008841102412ULL, 51206},
+    {0xD24000201089440AULL, 53234}, {0xD436100001160A15ULL, 41054},
+    {0x5A4A0000426C448AULL, 47158}, {0x532200001B9CB782ULL, 43087},
+    {0x8DC0001D9581449CULL, 49192}, {0xC731000010436923ULL, 8181}
+};
+
+namespace {
+
+// Fill the entries of the black magics of a slider. Packed tables only share
+// the entries with the same attacks, else the offsets are wrong.
+template <PieceType pt, size_t N>
+constexpr void fillBlackMagics(Array<Bitboard, N> &table,
+                               const BlackMagic known[]) {
   for (Square sq = A1; sq <= H8; ++sq) {
-    // Edges of the board are not included in the attack lookup because it
-    // doesn't matter if there is a blocker there or not Except in the cases
-    // where the attacking piece is on the edge.
-    edges = ((rankBB(RANK_1) | rankBB(RANK_8)) & ~rankBB(sq)) |
-            ((fileBB(FILE_A) | fileBB(FILE_H)) & ~fileBB(sq));
+    const Bitboard mask = sliderMask<pt>(sq);
+    const unsigned shift = 64 - countBits(mask);
 
-    // Get the corresponding magic bitboard entry
-    Magic &m = magics[sq];
-    // Generate attack mask (Remove edges)
-    m.mask = attacksOnTheFly<pt>(sq, EMPTYBB) & ~edges;
+    // Carry Rippler trick over the subsets of the mask
+    Bitboard occupied = EMPTYBB;
+    do {
+      Bitboard &entry =
+          table[known[sq].offset +
+                unsigned(((occupied | ~mask) * known[sq].magic) >> shift)];
+      const Bitboard attacks = tableAttacks<pt>(sq, occupied);
 
-#ifndef USE_PEXT
-    // Get the shift value for the mask/square (Fancy magic bitboard)
+      if (entry && entry != attacks)
+        throw "Black magic tables overlap";
+
+      entry = attacks;
+      occupied = (occupied - mask) & mask;
+    } while (occupied);
+  }
+}
+
+constexpr Array<Bitboard, 104973> initBlackMagicTable() {
+  Array<Bitboard, 104973> table{};
+  fillBlackMagics<BISHOP>(table, BishopBlackMagics);
+  fillBlackMagics<ROOK>(table, RookBlackMagics);
+  return table;
+}
+
+template <PieceType pt>
+constexpr Array<Magic, SQ_N> initBlackMagics(const Bitboard *table,
+                                             const BlackMagic known[]) {
+  Array<Magic, SQ_N> magics{};
+
+  for (Square sq = A1; sq <= H8; ++sq) {
+    Magic &m = magics[sq];
+    m.mask = sliderMask<pt>(sq);
+    m.magic = known[sq].magic;
     m.shift = 64 - countBits(m.mask);
-#endif
+    m.attacks = table + known[sq].offset;
+  }
 
-    // Assign the attacks pointer to the corresponding index in the attacks
-    // table The table is like a 2D array but each row has different length
-    // correspoding to the number of possible subset of bits in a mask
-    m.attacks = (sq == A1) ? table : magics[sq - 1].attacks + size;
+  return magics;
+}
+
+} // namespace
+
+// Attack table shared by all the black magics (See BlackMagic)
+constinit const Array<Bitboard, 104973> sliderTable = initBlackMagicTable();
+// Bishop magics
+constinit Array<Magic, SQ_N> bishopAttacks =
+    initBlackMagics<BISHOP>(sliderTable.data(), BishopBlackMagics);
+// Rook magics
+constinit Array<Magic, SQ_N> rookAttacks =
+    initBlackMagics<ROOK>(sliderTable.data(), RookBlackMagics);
+
+#elif !defined(SLIDERS_HYPERBOLA)
+
+// Magics for these masks and shifts (Checked for collisions when the tables
+// are built). Also the layout of the tables in pext builds.
+constexpr Bitboard BishopMagics[SQ_N] = {
+    0x2920200102002042ULL, 0x4220011400808120ULL, 0x8010042040400100ULL,
+    0x0348085500800611ULL, 0x0064050400002041ULL, 0x8024300410002024ULL,
+    0x014582A41040A000ULL, 0x60008048020120BEULL, 0x6040208224210400ULL,
+    0x0022A00104208A88ULL, 0x4028188A2400A009ULL, 0x4000040408808800ULL,
+    0x0020040420200400ULL, 0x0101020802098000ULL, 0x0048D21801049004ULL,
+    0x0000004108411000ULL, 0x00040C1004280820ULL, 0x0851004401020C08ULL,
+    0x14C2000104010200ULL, 0x8048001104110401ULL, 0x446401C200940205ULL,
+    0x9801008A10108400ULL, 0x2900400434040402ULL, 0x8000404221045000ULL,
+    0x0020850008100420ULL, 0x0050024004082210ULL, 0x0000404004010202ULL,
+    0x0044080000220040ULL, 0x20108400C0802004ULL, 0x0010820001012080ULL,
+    0x00008C021082080CULL, 0x0010820001012080ULL, 0x8010020901207888ULL,
+    0x00050C02C0703044ULL, 0x20E0180C00080142ULL, 0x0411040400480210ULL,
+    0x5020188400008020ULL, 0x4241280200002200ULL, 0x0210030340620236ULL,
+    0x00010A0028C58420ULL, 0x1082189C40100421ULL, 0x0040420884802000ULL,
+    0x3302020A02000902ULL, 0x0088102017081800ULL, 0x0484010212000401ULL,
+    0x0840500A05300080ULL, 0x00820408020100A0ULL, 0x1001080204820440ULL,
+    0x014582A41040A000ULL, 0x0040410410028000ULL, 0x0440002402082000ULL,
+    0x0462048242088000ULL, 0x0440D02810340240ULL, 0x4000200410008508ULL,
+    0x0020440118010800ULL, 0x4220011400808120ULL, 0x60008048020120BEULL,
+    0x0000004108411000ULL, 0x0000004108411000ULL, 0x0100004241048802ULL,
+    0x0A00120010320220ULL, 0x00040C1004280820ULL, 0x6040208224210400ULL,
+    0x2920200102002042ULL};
+
+constexpr Bitboard RookMagics[SQ_N] = {
+    0x0080002080104000ULL, 0x2040001000200044ULL, 0x4480200080100208ULL,
+    0x0500100020050008ULL, 0x8200020044095020ULL, 0x86000200082C1001ULL,
+    0x04000810008C2B06ULL, 0x6480042151000280ULL, 0xA080802040008000ULL,
+    0x0420402000401000ULL, 0x0102801000802002ULL, 0x04C0801000080080ULL,
+    0x0002000804201200ULL, 0x0000808002000400ULL, 0x8041000100020084ULL,
+    0x0081000080410002ULL, 0x0010888000400020ULL, 0x8100810040002101ULL,
+    0x0009010040102000ULL, 0x3080808008001001ULL, 0x1804050011004801ULL,
+    0x0000808002000400ULL, 0x0400040001080210ULL, 0x0000020000408401ULL,
+    0x1000800080204006ULL, 0x4020042440005000ULL, 0x8100100080200083ULL,
+    0x5200200900100102ULL, 0x0010040080800800ULL, 0x040A000200090410ULL,
+    0x440A080400419012ULL, 0x310400A200010044ULL, 0x1020244002800081ULL,
+    0x0420402000401000ULL, 0x0820002880801000ULL, 0x00A0100009002102ULL,
+    0x0010040080800800ULL, 0x0081000401000802ULL, 0x4151000401000200ULL,
+    0x8000008042000104ULL, 0x008000600444C001ULL, 0x204020100040C000ULL,
+    0x4020001000808020ULL, 0x1081001001A30009ULL, 0x0B24004080080800ULL,
+    0x0405000804010002ULL, 0x0400100208840001ULL, 0x0081000080410002ULL,
+    0x0000800040002080ULL, 0x1000200040008880ULL, 0x0070200088100080ULL,
+    0x04C0801000080080ULL, 0x0002000804201200ULL, 0x8900800400020080ULL,
+    0x0008800200010080ULL, 0x0008031044028A00ULL, 0x0802421081042202ULL,
+    0x8002400500881021ULL, 0x212A000880204012ULL, 0x0401010420100109ULL,
+    0x0806000820041002ULL, 0x8001000802040001ULL, 0x40C2212208500084ULL,
+    0x0013000040208201ULL};
+namespace {
+
+// Attack table of a slider, a block per square with an entry per subset of
+// its mask. Entries are indexed by the magic, or by pext: the Carry Rippler
+// trick visits the subsets in the order of their pext index.
+template <PieceType pt, size_t N, bool pext>
+constexpr Array<Bitboard, N> initSliderTable() {
+  Array<Bitboard, N> table{};
+  unsigned offset = 0;
+
+  for (Square sq = A1; sq <= H8; ++sq) {
+    const Bitboard mask = sliderMask<pt>(sq);
+    const Bitboard magic = pt == BISHOP ? BishopMagics[sq] : RookMagics[sq];
+    const unsigned shift = 64 - countBits(mask);
 
-    // Reset occupied and size as we are starting to fill the m.attacks array
-    occupied = EMPTYBB;
-    size = 0;
+    Bitboard occupied = EMPTYBB;
+    unsigned subset = 0;
     do {
+      Bitboard &entry =
+          table[offset + (pext ? subset : unsigned((occupied * magic) >> shift))];
+      const Bitboard attacks = tableAttacks<pt>(sq, occupied);
 
-#ifndef USE_PEXT
-      // Using the index function to calculate the corresponding index for the
-      // occupancy bitboard, and generate the corresponding attacks (with
-      // blockers) and store it at that index in the table
-      reference[size] = attacksOnTheFly<pt>(sq, occupied);
-      // Save occupancy bitboard
-      occupancy[size] = occupied;
-#else
-      // Save the corresponding attack bitboard
-      m.attacks[m.index(occupied)] = attacksOnTheFly<pt>(sq, occupied);
-#endif
+      // Slider attacks are never empty, so an empty entry is free
+      if (entry && entry != attacks)
+        throw "Magic collision";
 
-      // Increment size
-      size++;
-      // Carry Rippler trick from
-      // https://www.chessprogramming.org/Traversing_Subsets_of_a_Set
-      occupied = (occupied - m.mask) & m.mask;
+      entry = attacks;
+      ++subset;
+      occupied = (occupied - mask) & mask;
     } while (occupied);
 
-#ifndef USE_PEXT
-    PRNG rng;
-
-    // Find a magic for a specific mask/square until we find one that passes the
-    // verification test
-    for (int i = 0; i < size;) {
-      for (m.magic = 0; countBits((m.magic * m.mask) >> 56) < 6;) {
-        m.magic = rng.getSparseRandom<Bitboard>();
-
-        // A valid magic must map every possible occupancy to an index that
-        // looks up the correct sliding atttack in the attacks lookup table.
-        for (++cnt, i = 0; i < size; ++i) {
-          unsigned idx = m.index(occupancy[i]);
-
-          // Trick to speed up the search for magic numbers
-          // The m.attacks table will be slowly replaced with the attacks
-          // generated by the new magic number Avoid resetting m.attacks every
-          // time
-          if (epoch[idx] < cnt) {
-            epoch[idx] = cnt;
-            m.attacks[idx] = reference[i];
-            // If the attack is not the same as the reference attack, break as
-            // the magic number is not valid
-          } else if (m.attacks[idx] != reference[i]) {
-            break;
-          }
-        }
-      }
-    }
+    offset += subset;
   }
+
+  return table;
+}
+
+template <PieceType pt>
+constexpr Array<Magic, SQ_N> initMagics(const Bitboard *table) {
+  Array<Magic, SQ_N> magics{};
+
+  for (Square sq = A1; sq <= H8; ++sq) {
+    Magic &m = magics[sq];
+    m.mask = sliderMask<pt>(sq);
+#ifndef USE_PEXT
+    m.magic = pt == BISHOP ? BishopMagics[sq] : RookMagics[sq];
+    m.shift = 64 - countBits(m.mask);
 #endif
+    // Blocks of the squares before
+    m.attacks = sq == A1 ? table
+                         : magics[sq - 1].attacks +
+                               (Bitboard(1) << countBits(magics[sq - 1].mask));
+  }
+
+  return magics;
 }
 
+#ifdef USE_PEXT
+constexpr bool pextTables = true;
+#else
+constexpr bool pextTables = false;
+#endif
+
+} // namespace
+
+// Bishop attack tables
+constinit const Array<Bitboard, 0x1480> bishopTable =
+    initSliderTable<BISHOP, 0x1480, pextTables>();
+// Rook attack tables
+constinit const Array<Bitboard, 0x19000> rookTable =
+    initSliderTable<ROOK, 0x19000, pextTables>();
+#ifdef PEXT_DISPATCH
+// Attack tables indexed by pext, for CPUs with a fast one
+constinit const Array<Bitboard, 0x1480> bishopPextTable =
+    initSliderTable<BISHOP, 0x1480, true>();
+constinit const Array<Bitboard, 0x19000> rookPextTable =
+    initSliderTable<ROOK, 0x19000, true>();
+#endif
+// Bishop magics
+constinit Array<Magic, SQ_N> bishopAttacks =
+    initMagics<BISHOP>(bishopTable.data());
+// Rook magics
+constinit Array<Magic, SQ_N> rookAttacks = initMagics<ROOK>(rookTable.data());
+
+#endif
+
 /******************************************\
 |==========================================|
-|              Init Bitboards              |
+|               Attack Maps                |
 |==========================================|
 \******************************************/
 
-// initialize bitboards lookup tables
-void Bitboards::init() {
-  // Init square distances
-  for (Square sq1 = A1; sq1 <= H8; ++sq1)
-    for (Square sq2 = A1; sq2 <= H8; ++sq2)
-      dist[sq1][sq2] = std::max(static_cast<int>(rankDist(sq1, sq2)),
-                                static_cast<int>(fileDist(sq1, sq2)));
-
-  // Init magics bitboards
-  initMagics<BISHOP>(bishopTable, bishopAttacks);
-  initMagics<ROOK>(rookTable, rookAttacks);
-
-  // std::cout << std::hex;
-
-  // for (auto &attacks : bishopAttacks)
-  //   std::cout << attacks.magic << std::endl;
+#ifdef ATTACK_FILLS
+// Slider attack maps with Kogge-Stone fills
+bool useAttackFills = false;
+
+// https://www.chessprogramming.org/Kogge-Stone_Algorithm
+// The lanes hold the directions N, E, NE, NW going up the board (Left shifts)
+// and S, W, SW, SE going down (Right shifts), each with the files its shift
+// must not wrap into
+__attribute__((target("avx2"))) Bitboard
+sliderFillsBB(Bitboard bishops, Bitboard rooks, Bitboard occupied) {
+  const Bitboard notA = ~fileBB(FILE_A), notH = ~fileBB(FILE_H);
+  const __m256i shifts = _mm256_setr_epi64x(8, 1, 9, 7);
+  const __m256i upMask = _mm256_setr_epi64x(FULLBB, notA, notA, notH);
+  const __m256i downMask = _mm256_setr_epi64x(FULLBB, notH, notH, notA);
+  const __m256i empty = _mm256_set1_epi64x(~occupied);
+  const __m256i sliders = _mm256_setr_epi64x(rooks, rooks, bishops, bishops);
+
+  // Generators are the sliders, propagators the empty squares
+  __m256i upGen = sliders, downGen = sliders;
+  __m256i upPro = _mm256_and_si256(empty, upMask);
+  __m256i downPro = _mm256_and_si256(empty, downMask);
+
+  // Fill 1, 2 then 4 steps along each direction
+  __m256i steps = shifts;
+  for (int i = 0; i < 3; ++i) {
+    upGen = _mm256_or_si256(
+        upGen, _mm256_and_si256(upPro, _mm256_sllv_epi64(upGen, steps)));
+    downGen = _mm256_or_si256(
+        downGen, _mm256_and_si256(downPro, _mm256_srlv_epi64(downGen, steps)));
+    upPro = _mm256_and_si256(upPro, _mm256_sllv_epi64(upPro, steps));
+    downPro = _mm256_and_si256(downPro, _mm256_srlv_epi64(downPro, steps));
+    steps = _mm256_add_epi64(steps, steps);
+  }
 
-  // for (auto &attacks : rookAttacks)
-  //   std::cout << attacks.magic << std::endl;
+  // One more step reaches the blockers
+  const __m256i attacks = _mm256_or_si256(
+      _mm256_and_si256(_mm256_sllv_epi64(upGen, shifts), upMask),
+      _mm256_and_si256(_mm256_srlv_epi64(downGen, shifts), downMask));
 
-  // std::cout << std::dec;
+  // Union of the lanes
+  const __m128i half = _mm_or_si128(_mm256_castsi256_si128(attacks),
+                                    _mm256_extracti128_si256(attacks, 1));
+  return Bitboard(_mm_cvtsi128_si64(half)) |
+         Bitboard(_mm_extract_epi64(half, 1));
+}
+#endif
 
-  // Init pseudo attacks for knights and kings
-  for (Square sq = A1; sq <= H8; ++sq) {
-    // Init pseudo attacks for pawn
-    pawnAttacks[WHITE][sq] = shift<NW>(squareBB(sq)) | shift<NE>(squareBB(sq));
-    pawnAttacks[BLACK][sq] = shift<SW>(squareBB(sq)) | shift<SE>(squareBB(sq));
-    // Init pseudo attacks for knights
-    for (Direction d : {NNE, NNW, NEE, NWW, SEE, SWW, SSE, SSW})
-      pseudoAttacks[KNIGHT][sq] |= shift(sq, d);
-    // Init pseudo attacks for king
-    for (Direction d : {N, NE, NW, E, W, SE, SW, S})
-      pseudoAttacks[KING][sq] |= shift(sq, d);
-    // Init pseudo attacks for bishop
-    pseudoAttacks[BISHOP][sq] = bishopAttacks[sq][EMPTYBB];
-    pseudoAttacks[ROOK][sq] = rookAttacks[sq][EMPTYBB];
-    pseudoAttacks[QUEEN][sq] =
-        pseudoAttacks[BISHOP][sq] | pseudoAttacks[ROOK][sq];
-  }
+/******************************************\
+|==========================================|
+|              Init Bitboards              |
+|==========================================|
+\******************************************/
 
-  for (Square from = A1; from <= H8; ++from) {
-    // Get the squares attacked by the bishop
-    Bitboard attacked = attacksBB<BISHOP>(from, EMPTYBB);
-
-    // For each square attacked by the bishop, calculate the line it lies on
-    while (attacked) {
-      Square to = popLSB(attacked);
-      lineBB[from][to] =
-          (attacksBB<BISHOP>(from, EMPTYBB) & attacksBB<BISHOP>(to, EMPTYBB)) |
-          (from | to);
-      betweenBB[from][to] = attacksBB<BISHOP>(from, squareBB(to)) &
-                            attacksBB<BISHOP>(to, squareBB(from));
-      pinBB[from][to] = betweenBB[from][to] | to;
-      checkBB[from][to] =
-          betweenBB[from][to] | from | (from - direction(from, to));
-    }
+// initialize bitboards lookup tables
+void Bitboards::init() {
+#ifdef PEXT_DISPATCH
+  // Index slider attacks with pext if the CPU has a fast one
+  usePext = CPU::features().fastPext;
+#endif
+#ifdef ATTACK_FILLS
+  useAttackFills = CPU::features().avx2;
+#endif
 
-    // Get the squares attacked by the rook
-    attacked = attacksBB<ROOK>(from, EMPTYBB);
-
-    // For each square attacked by the bishop, calculate the line it lies on
-    while (attacked) {
-      Square to = popLSB(attacked);
-      lineBB[from][to] =
-          (attacksBB<ROOK>(from, EMPTYBB) & attacksBB<ROOK>(to, EMPTYBB)) |
-          (from | to);
-      betweenBB[from][to] = attacksBB<ROOK>(from, squareBB(to)) &
-                            attacksBB<ROOK>(to, squareBB(from));
-      pinBB[from][to] = betweenBB[from][to] | to;
-      checkBB[from][to] =
-          betweenBB[from][to] | from | (from - direction(from, to));
+#ifdef PEXT_DISPATCH
+  // Same blocks in the pext tables (Every table is built at compile time)
+  if (usePext)
+    for (Square sq = A1; sq <= H8; ++sq) {
+      Magic &bishop = bishopAttacks[sq], &rook = rookAttacks[sq];
+      bishop.attacks = &bishopPextTable[bishop.attacks - bishopTable.data()];
+      rook.attacks = &rookPextTable[rook.attacks - rookTable.data()];
     }
-  }
+#endif
+}
 
-  // Init castling rights array
-  std::fill_n(castlingRights.begin(), std::size(castlingRights), ANY_SIDE);
-  // Special cases
-  // Remove White castling rights if the king is moved
-  castlingRights[E1] &= ~WHITE_SIDE;
-  // Remove Black castling rights if the king is moved
-  castlingRights[E8] &= ~BLACK_SIDE;
-  // Remove White King side castling rights if the rook on H1 is moved
-  castlingRights[H1] &= ~WK_SIDE;
-  // Remove White Queen side castling rights if the rook on A1 is moved
-  castlingRights[A1] &= ~WQ_SIDE;
-  // Remove Black King side castling rights if the rook on H8 is moved
-  castlingRights[H8] &= ~BK_SIDE;
-  // Remove Black Queen side castling rights if the rook on A8 is moved
-  castlingRights[A8] &= ~BQ_SIDE;
+const char *Bitboards::sliderBackend() {
+#if defined(SLIDERS_HYPERBOLA)
+  return "hyperbola";
+#elif defined(SLIDERS_BLACK_MAGIC)
+  return "black magic";
+#else
+  return usePext ? "pext" : "magic";
+#endif
 }
 
 } // namespace Maestro
\ No newline at end of file
@@ -4,7 +4,7 @@
 
 // #define USE_PEXT 1
 
-#ifdef USE_PEXT
+#if defined(USE_PEXT) || defined(__BMI2__)
 #include <immintrin.h>
 #endif
 
@@ -29,10 +29,13 @@ void init();
 // Bitboard print function
 void print(Bitboard bb);
 
+// Name of the slider attack lookup of the build
+const char *sliderBackend();
+
 } // namespace Bitboards
 
 // U32 the number of set bits in a bitboard
-inline int countBits(Bitboard bb) { return __builtin_popcountll(bb); }
+constexpr int countBits(Bitboard bb) { return __builtin_popcountll(bb); }
 
 // Get the least significant bit from a nonzero bitboard
 inline Square getLSB(Bitboard bb) { return (Square)__builtin_ctzll(bb); }
@@ -50,10 +53,17 @@ inline Square popLSB(Bitboard &bb) {
 // Get the least significant bit from a nonzero bitboard (return Bitboard)
 inline Bitboard lsbBB(Bitboard bb) { return bb & -bb; }
 
-#ifdef USE_PEXT
-// Parallel bit extraction
+#if defined(USE_PEXT) || defined(__BMI2__) || defined(__x86_64__)
+#define HAS_PEXT
+// Parallel bit extraction (Only call it when the CPU supports BMI2)
 inline Square pext(Bitboard bb, Bitboard mask) {
+#if defined(USE_PEXT) || defined(__BMI2__)
   return (Square)_pext_u64(bb, mask);
+#else
+  Bitboard res;
+  asm("pextq %2, %1, %0" : "=r"(res) : "r"(bb), "rm"(mask));
+  return (Square)res;
+#endif
 }
 #endif
 
@@ -77,14 +87,14 @@ constexpr Bitboard rankBB(Rank r) { return 0xFFULL << (r << 3); }
 // Get rank bitboard (square)
 constexpr Bitboard rankBB(Square sq) { return rankBB(rankOf(sq)); }
 // File bitboards (variadic)
-template <typename... Bitboards>
-constexpr inline Bitboard fileBB(Bitboard file, Bitboards... files) {
-  return file | fileBB(files...);
+template <typename... Files>
+constexpr inline Bitboard fileBB(File file, Files... files) {
+  return fileBB(file) | fileBB(files...);
 }
 // Rank bitboards (variadic)
-template <typename... Bitboards>
-constexpr inline Bitboard rankBB(Bitboard rank, Bitboards... ranks) {
-  return rank | rankBB(ranks...);
+template <typename... Ranks>
+constexpr inline Bitboard rankBB(Rank rank, Ranks... ranks) {
+  return rankBB(rank) | rankBB(ranks...);
 }
 
 /******************************************\
@@ -163,9 +173,26 @@ constexpr Bitboard &operator^=(Bitboard &bb, Square sq) {
 |==========================================|
 \******************************************/
 
+// Slider attack lookup, chosen at build time (MAESTRO_SLIDERS in CMake):
+//   SLIDERS_MAGIC        Fancy magics, a table per square
+//   SLIDERS_BLACK_MAGIC  Black magics, one table shared by all squares
+//   USE_PEXT             pext indexing (BMI2 builds)
+//   SLIDERS_HYPERBOLA    Hyperbola quintessence, no attack tables
+// By default slider attacks are indexed with pext when the CPU has a fast one
+// (Chosen at startup from CPUID), and with fancy magics otherwise
+#if defined(USE_PEXT)
+constexpr bool usePext = true;
+#elif defined(HAS_PEXT) && !defined(SLIDERS_MAGIC) &&                         \
+    !defined(SLIDERS_BLACK_MAGIC) && !defined(SLIDERS_HYPERBOLA)
+#define PEXT_DISPATCH
+extern bool usePext;
+#else
+constexpr bool usePext = false;
+#endif
+
 struct Magic {
   // Pointer to attacks table block
-  Bitboard *attacks;
+  const Bitboard *attacks;
   // Attack mask for slider piece on a particular square
   Bitboard mask;
 #ifndef USE_PEXT
@@ -176,9 +203,16 @@ struct Magic {
 #endif
   // Calculate index in attacks table
   unsigned int index(Bitboard occupied) {
-#ifdef USE_PEXT
+#if defined(USE_PEXT)
     return pext(occupied, mask);
+#elif defined(SLIDERS_BLACK_MAGIC)
+    // The squares outside the mask are set instead of the ones inside cleared
+    return unsigned(((occupied | ~mask) * magic) >> shift);
 #else
+#ifdef PEXT_DISPATCH
+    if (usePext)
+      return pext(occupied, mask);
+#endif
     return unsigned(((occupied & mask) * magic) >> shift);
 #endif
   }
@@ -188,27 +222,34 @@ struct Magic {
 
 // Pseudo attacks for all pieces except pawns
 // extern Bitboard pseudoAttacks[PIECE_TYPE_N][SQ_N];
-extern Array<Bitboard, PIECE_TYPE_N, SQ_N> pseudoAttacks;
+extern const Array<Bitboard, PIECE_TYPE_N, SQ_N> pseudoAttacks;
 // Pseudo attacks for pawns
-extern Array<Bitboard, COLOUR_N, SQ_N> pawnAttacks;
+extern const Array<Bitboard, COLOUR_N, SQ_N> pawnAttacks;
+#ifdef SLIDERS_HYPERBOLA
+// Lines through a square, without the square itself
+struct SliderMasks {
+  Bitboard file, diagonal, antiDiagonal;
+};
+
+extern const Array<SliderMasks, SQ_N> sliderMasks;
+// Rank attacks of a slider on the first rank [file][inner 6 squares occupied]
+extern const Array<uint8_t, FILE_N, 64> firstRankAttacks;
+#else
 // Bishop magics
 extern Array<Magic, SQ_N> bishopAttacks;
 // Rook magics
 extern Array<Magic, SQ_N> rookAttacks;
-// Bishop attack tables
-extern Bitboard bishopTable[0x1480];
-// Rook attack tables
-extern Bitboard rookTable[0x19000];
+#endif
 // Line the two squares lie on [from][to]
-extern Array<Bitboard, SQ_N, SQ_N> lineBB;
+extern const Array<Bitboard, SQ_N, SQ_N> lineBB;
 // In between bitboards [from][to]
-extern Array<Bitboard, SQ_N, SQ_N> betweenBB;
+extern const Array<Bitboard, SQ_N, SQ_N> betweenBB;
 // Pins [king][attacker]
-extern Array<Bitboard, SQ_N, SQ_N> pinBB;
+extern const Array<Bitboard, SQ_N, SQ_N> pinBB;
 // Checks [king][attacker]
-extern Array<Bitboard, SQ_N, SQ_N> checkBB;
+extern const Array<Bitboard, SQ_N, SQ_N> checkBB;
 // Castling rights lookup table
-extern Array<Castling, SQ_N> castlingRights;
+extern const Array<Castling, SQ_N> castlingRights;
 
 /******************************************\
 |==========================================|
@@ -291,6 +332,41 @@ constexpr Direction direction(Square from, Square to) {
 |==========================================|
 \******************************************/
 
+#ifdef SLIDERS_HYPERBOLA
+// Attacks along a file or a diagonal, the byte swap mirrors the ranks so the
+// subtraction trick works in both directions
+inline Bitboard lineAttacks(Square sq, Bitboard occupied, Bitboard line) {
+  Bitboard forward = occupied & line;
+  Bitboard reverse = __builtin_bswap64(forward);
+  forward -= 2 * squareBB(sq);
+  reverse -= 2 * squareBB(flipRank(sq));
+  return (forward ^ __builtin_bswap64(reverse)) & line;
+}
+
+// Attacks along a rank
+inline Bitboard rankAttacks(Square sq, Bitboard occupied) {
+  const int rankShift = sq & 56;
+  return Bitboard(firstRankAttacks[fileOf(sq)][(occupied >> (rankShift + 1)) &
+                                               63])
+         << rankShift;
+}
+#endif
+
+// Get slider attacks with the backend of the build
+template <PieceType pt>
+inline Bitboard sliderAttacksBB(Square sq, Bitboard occupied) {
+#ifdef SLIDERS_HYPERBOLA
+  const SliderMasks &masks = sliderMasks[sq];
+  if constexpr (pt == BISHOP)
+    return lineAttacks(sq, occupied, masks.diagonal) |
+           lineAttacks(sq, occupied, masks.antiDiagonal);
+  else
+    return lineAttacks(sq, occupied, masks.file) | rankAttacks(sq, occupied);
+#else
+  return (pt == BISHOP ? bishopAttacks : rookAttacks)[sq][occupied];
+#endif
+}
+
 // Get attacks bitboard for a piece on a square (With occupancy)
 template <PieceType pt>
 Bitboard attacksBB(Square sq, Bitboard occupied = 0ULL) {
@@ -300,11 +376,12 @@ Bitboard attacksBB(Square sq, Bitboard occupied = 0ULL) {
   case KING:
     return pseudoAttacks[KING][sq];
   case BISHOP:
-    return bishopAttacks[sq][occupied];
+    return sliderAttacksBB<BISHOP>(sq, occupied);
   case ROOK:
-    return rookAttacks[sq][occupied];
+    return sliderAttacksBB<ROOK>(sq, occupied);
   case QUEEN:
-    return bishopAttacks[sq][occupied] | rookAttacks[sq][occupied];
+    return sliderAttacksBB<BISHOP>(sq, occupied) |
+           sliderAttacksBB<ROOK>(sq, occupied);
   default:
     return Bitboard(0);
   }
@@ -318,16 +395,53 @@ inline Bitboard attacksBB(PieceType pt, Square sq, Bitboard occupied = 0ULL) {
   case KING:
     return pseudoAttacks[KING][sq];
   case BISHOP:
-    return bishopAttacks[sq][occupied];
+    return sliderAttacksBB<BISHOP>(sq, occupied);
   case ROOK:
-    return rookAttacks[sq][occupied];
+    return sliderAttacksBB<ROOK>(sq, occupied);
   case QUEEN:
-    return bishopAttacks[sq][occupied] | rookAttacks[sq][occupied];
+    return sliderAttacksBB<BISHOP>(sq, occupied) |
+           sliderAttacksBB<ROOK>(sq, occupied);
   default:
     return Bitboard(0);
   }
 }
 
+// Slider attack maps (All the sliders at once). With AVX2 the eight
+// directions can be Kogge-Stone filled in two vectors (Chosen at startup from
+// CPUID)
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define ATTACK_FILLS
+extern bool useAttackFills;
+// Only call it when the CPU supports AVX2
+Bitboard sliderFillsBB(Bitboard bishops, Bitboard rooks, Bitboard occupied);
+#else
+constexpr bool useAttackFills = false;
+#endif
+
+// Slider attack map with a lookup per slider
+inline Bitboard sliderLookupsBB(Bitboard bishops, Bitboard rooks,
+                                Bitboard occupied) {
+  Bitboard attacks = EMPTYBB;
+
+  while (bishops)
+    attacks |= attacksBB<BISHOP>(popLSB(bishops), occupied);
+  while (rooks)
+    attacks |= attacksBB<ROOK>(popLSB(rooks), occupied);
+
+  return attacks;
+}
+
+// Get slider attack map (Queens in both bishops and rooks). The fills cost the
+// same for any number of sliders, so a few lookups are still faster
+inline Bitboard sliderAttackMapBB(Bitboard bishops, Bitboard rooks,
+                                  Bitboard occupied) {
+#ifdef ATTACK_FILLS
+  if (useAttackFills && countBits(bishops) + countBits(rooks) > 3)
+    return sliderFillsBB(bishops, rooks, occupied);
+#endif
+  return sliderLookupsBB(bishops, rooks, occupied);
+}
+
 // Get pawn attacks bitboard (Entire bitboard)
 template <Colour c> inline Bitboard pawnAttacksBB(Bitboard bb) {
   return (c == WHITE) ? shift<NW>(bb) | shift<NE>(bb)
@@ -338,6 +452,12 @@ inline Bitboard pawnAttacksBB(Colour c, Bitboard bb) {
   return (c == WHITE) ? pawnAttacksBB<WHITE>(bb) : pawnAttacksBB<BLACK>(bb);
 }
 
+// Get knight attacks bitboard (Entire bitboard)
+inline Bitboard knightAttacksBB(Bitboard bb) {
+  return shift<NNE>(bb) | shift<NNW>(bb) | shift<NEE>(bb) | shift<NWW>(bb) |
+         shift<SEE>(bb) | shift<SWW>(bb) | shift<SSE>(bb) | shift<SSW>(bb);
+}
+
 // Get double pawn attacks bitboard (Entire bitboard)
 template <Colour c> inline Bitboard doublePawnAttacksBB(Bitboard bb) {
   return (c == WHITE) ? shift<NW>(bb) & shift<NE>(bb)
@@ -356,7 +476,7 @@ inline Bitboard pawnAttacksBB(Colour c, Square sq) {
 
 // Get adjacent files bitboard
 constexpr Bitboard adjacentFilesBB(Square sq) {
-  return shift<E>(squareBB(sq)) | shift<W>(squareBB(sq));
+  return shift<E>(fileBB(sq)) | shift<W>(fileBB(sq));
 }
 
 // Get forward ranks bitboard
@@ -370,9 +490,14 @@ constexpr Bitboard forwardFileBB(Colour c, Square sq) {
   return forwardRanksBB(c, sq) & fileBB(sq);
 }
 
+// Get the squares a pawn can attack as it advances (adjacent files ahead)
+constexpr Bitboard pawnAttackSpan(Colour c, Square sq) {
+  return forwardRanksBB(c, sq) & adjacentFilesBB(sq);
+}
+
 // Get passed pawn bitboard
 constexpr Bitboard passedPawnSpan(Colour c, Square sq) {
-  return forwardFileBB(c, sq) & (adjacentFilesBB(sq) | fileBB(sq));
+  return pawnAttackSpan(c, sq) | forwardFileBB(c, sq);
 }
 
 // Check if 3 squares are collinear
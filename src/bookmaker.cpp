@@ -0,0 +1,518 @@
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <queue>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "bookmaker.hpp"
+#include "defs.hpp"
+#include "movegen.hpp"
+#include "polyglot.hpp"
+#include "position.hpp"
+#include "utils.hpp"
+
+namespace Maestro {
+
+namespace {
+
+// Weight of a move in a position
+struct BookRecord {
+  Key key;
+  U16 move;
+  U32 weight;
+
+  bool operator<(const BookRecord &r) const {
+    return key < r.key || (key == r.key && move < r.move);
+  }
+};
+
+// Game of the input, or position of an EPD with its best moves
+struct Game {
+  std::string fen; // Empty for the starting position
+  std::vector<std::string> moves;
+  int result = -1; // Score of white (2 win, 1 draw, 0 loss, -1 unknown)
+  bool epd = false;
+};
+
+/******************************************\
+|==========================================|
+|               Input Files                |
+|==========================================|
+\******************************************/
+
+// Score of white from a PGN result, -1 if it is not one
+int parseResult(const std::string &token) {
+  if (token == "1-0")
+    return 2;
+  if (token == "1/2-1/2")
+    return 1;
+  if (token == "0-1")
+    return 0;
+  return -1;
+}
+
+// Streams the games of a PGN file (Comments, variations and NAGs skipped)
+class PGNReader {
+public:
+  explicit PGNReader(std::istream &in) : _in(in) {}
+
+  bool next(Game &game) {
+    game = Game();
+    bool inMoves = false;
+    int comment = 0, variation = 0;
+    std::string line;
+
+    // First tag of this game, read while looking for the end of the last one
+    if (!_pending.empty()) {
+      parseTag(_pending, game);
+      _pending.clear();
+    }
+
+    while (std::getline(_in, line)) {
+      // Tag pair, or the start of the next game if the result was missing
+      if (!comment && !line.empty() && line[0] == '[') {
+        if (inMoves) {
+          _pending = line;
+          return true;
+        }
+        parseTag(line, game);
+        continue;
+      }
+
+      std::string token;
+      for (size_t i = 0; i <= line.size(); ++i) {
+        const char c = i < line.size() ? line[i] : ' ';
+
+        if (comment) {
+          comment = c != '}';
+          continue;
+        }
+
+        if (c == '{' || c == ';' || c == '(' || c == ')' || c == ' ' ||
+            c == '\t' || c == '\r') {
+          if (!token.empty() && !variation && addToken(token, game))
+            return true;
+          token.clear();
+
+          if (c == '{')
+            comment = 1;
+          else if (c == ';')
+            break;
+          else if (c == '(')
+            ++variation;
+          else if (c == ')')
+            variation = std::max(variation - 1, 0);
+          continue;
+        }
+
+        token += c;
+        inMoves = true;
+      }
+    }
+
+    // Last game of the file without a result
+    return inMoves;
+  }
+
+private:
+  void parseTag(const std::string &line, Game &game) {
+    const size_t space = line.find(' ');
+    const size_t open = line.find('"'), close = line.rfind('"');
+    if (space == std::string::npos || open == close)
+      return;
+
+    const std::string name = line.substr(1, space - 1);
+    const std::string value = line.substr(open + 1, close - open - 1);
+    if (name == "FEN")
+      game.fen = value;
+    else if (name == "Result")
+      game.result = parseResult(value);
+  }
+
+  // Add a token of the movetext, true at the end of the game
+  bool addToken(std::string token, Game &game) {
+    if (token == "*")
+      return true;
+
+    const int result = parseResult(token);
+    if (result >= 0) {
+      game.result = result;
+      return true;
+    }
+
+    // Move numbers (12. or 12...), possibly joined to the move
+    size_t i = 0;
+    while (i < token.size() && std::isdigit((unsigned char)token[i]))
+      ++i;
+    if (i < token.size() && token[i] == '.') {
+      while (i < token.size() && token[i] == '.')
+        ++i;
+      token.erase(0, i);
+    }
+
+    if (!token.empty() && token[0] != '$')
+      game.moves.push_back(token);
+
+    return false;
+  }
+
+  std::istream &_in;
+  std::string _pending;
+};
+
+// Streams the positions of an EPD file with their bm moves
+bool nextEPD(std::istream &in, Game &game) {
+  std::string line;
+
+  while (std::getline(in, line)) {
+    game = Game();
+    game.epd = true;
+
+    std::istringstream is(line);
+    game.fen = readEPDPosition(is);
+    std::string field;
+
+    // Best moves up to the end of the opcode
+    while (is >> field)
+      if (field == "bm")
+        while (is >> field) {
+          const bool last = field.back() == ';';
+          if (last)
+            field.pop_back();
+          game.moves.push_back(field);
+          if (last)
+            break;
+        }
+
+    if (!game.moves.empty())
+      return true;
+  }
+
+  return false;
+}
+
+/******************************************\
+|==========================================|
+|               Book Table                 |
+|==========================================|
+\******************************************/
+
+// Weights of the moves in memory, sharded by key so the threads replaying
+// games rarely wait on each other
+class BookTable {
+public:
+  // Add a batch of records (Sorted so each shard is locked once)
+  void add(std::vector<BookRecord> &records) {
+    std::sort(records.begin(), records.end());
+
+    for (auto it = records.begin(); it != records.end();) {
+      Shard &shard = _shards[shardIndex(it->key)];
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      const size_t before = shard.weights.size();
+
+      for (const size_t index = shardIndex(it->key);
+           it != records.end() && shardIndex(it->key) == index; ++it)
+        shard.weights[{it->key, it->move}] += it->weight;
+
+      _size += shard.weights.size() - before;
+    }
+  }
+
+  // Entries in the table
+  size_t size() const { return _size; }
+
+  // Sorted records of the table, which is left empty
+  std::vector<BookRecord> extract() {
+    std::vector<BookRecord> records;
+    records.reserve(_size);
+
+    for (Shard &shard : _shards) {
+      for (const auto &[entry, weight] : shard.weights)
+        records.push_back({entry.key, entry.move, weight});
+      shard.weights = {};
+    }
+
+    _size = 0;
+    std::sort(records.begin(), records.end());
+    return records;
+  }
+
+  // Estimated bytes of an entry (Node and bucket of the hash map)
+  static constexpr size_t EntryBytes = 64;
+
+private:
+  static constexpr int ShardBits = 6;
+
+  struct EntryKey {
+    Key key;
+    U16 move;
+    bool operator==(const EntryKey &e) const {
+      return key == e.key && move == e.move;
+    }
+  };
+
+  struct EntryHash {
+    size_t operator()(const EntryKey &e) const {
+      return size_t(e.key ^ (U64(e.move) * 0x9E3779B97F4A7C15ULL));
+    }
+  };
+
+  struct Shard {
+    std::mutex mutex;
+    std::unordered_map<EntryKey, U32, EntryHash> weights;
+  };
+
+  static size_t shardIndex(Key key) { return key >> (64 - ShardBits); }
+
+  Shard _shards[1 << ShardBits];
+  std::atomic<size_t> _size{0};
+};
+
+/******************************************\
+|==========================================|
+|               Book Writer                |
+|==========================================|
+\******************************************/
+
+// Sorted records of a run spilled to disk, or of the table
+class RunReader {
+public:
+  explicit RunReader(const std::string &path)
+      : _file(path, std::ios::binary) {}
+  explicit RunReader(std::vector<BookRecord> records)
+      : _records(std::move(records)) {}
+
+  bool next(BookRecord &record) {
+    if (_file.is_open())
+      return bool(_file.read(reinterpret_cast<char *>(&record), sizeof record));
+
+    if (_index == _records.size())
+      return false;
+
+    record = _records[_index++];
+    return true;
+  }
+
+private:
+  std::ifstream _file;
+  std::vector<BookRecord> _records;
+  size_t _index = 0;
+};
+
+// Merge the runs into the book, returns the number of positions
+size_t writeBook(std::vector<RunReader> &runs, std::ofstream &out,
+                 size_t &entries) {
+  using Head = std::pair<BookRecord, size_t>;
+  auto later = [](const Head &a, const Head &b) { return b.first < a.first; };
+  std::priority_queue<Head, std::vector<Head>, decltype(later)> heads(later);
+
+  BookRecord record;
+  for (size_t i = 0; i < runs.size(); ++i)
+    if (runs[i].next(record))
+      heads.push({record, i});
+
+  std::vector<std::pair<U16, U64>> moves;
+  size_t positions = 0;
+  Key key = 0;
+
+  // Write the moves of a position, heaviest first, with the weights scaled
+  // down to 16 bits if needed
+  auto flush = [&]() {
+    if (moves.empty())
+      return;
+
+    U64 maxWeight = 0;
+    for (const auto &m : moves)
+      maxWeight = std::max(maxWeight, m.second);
+
+    std::stable_sort(moves.begin(), moves.end(),
+                     [](const auto &a, const auto &b) {
+                       return a.second > b.second;
+                     });
+
+    for (const auto &[move, weight] : moves) {
+      const U64 scaled =
+          maxWeight > 0xFFFF ? std::max<U64>(weight * 0xFFFF / maxWeight, 1)
+                             : weight;
+      const PolyBook::Entry entry{Key(__builtin_bswap64(key)),
+                                  __builtin_bswap16(move),
+                                  __builtin_bswap16(U16(scaled)), 0};
+      out.write(reinterpret_cast<const char *>(&entry), sizeof entry);
+    }
+
+    entries += moves.size();
+    ++positions;
+    moves.clear();
+  };
+
+  while (!heads.empty()) {
+    auto [top, run] = heads.top();
+    heads.pop();
+
+    if (top.key != key) {
+      flush();
+      key = top.key;
+    }
+
+    // The same move can come from several runs
+    if (!moves.empty() && moves.back().first == top.move)
+      moves.back().second += top.weight;
+    else
+      moves.push_back({top.move, top.weight});
+
+    if (runs[run].next(record))
+      heads.push({record, run});
+  }
+
+  flush();
+  return positions;
+}
+
+} // namespace
+
+/******************************************\
+|==========================================|
+|               Make Book                  |
+|==========================================|
+\******************************************/
+
+void makeBook(const std::string &input, const std::string &output,
+              const BookOptions &options) {
+  std::ifstream in(input);
+  if (!in.is_open()) {
+    std::cout << "info string Could not open " << input << std::endl;
+    return;
+  }
+
+  std::ofstream out(output, std::ios::binary);
+  if (!out.is_open()) {
+    std::cout << "info string Could not open " << output << std::endl;
+    return;
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  const bool epd =
+      input.size() > 4 && input.compare(input.size() - 4, 4, ".epd") == 0;
+  const int threads =
+      options.threads > 0
+          ? options.threads
+          : int(std::max(std::thread::hardware_concurrency(), 1u));
+  const size_t maxEntries =
+      std::max<size_t>(options.memory * 1024 * 1024 / BookTable::EntryBytes,
+                       1024);
+
+  BookTable table;
+  PGNReader pgn(in);
+  std::vector<std::string> runPaths;
+  std::atomic<U64> games{0}, skipped{0};
+
+  // Replay the games of a chunk, each thread on every threads-th game
+  auto replay = [&](const std::vector<Game> &chunk, int id) {
+    std::vector<BookRecord> records;
+    std::vector<BoardState> states(options.depth + 1);
+    Position pos;
+
+    for (size_t i = id; i < chunk.size(); i += threads) {
+      const Game &game = chunk[i];
+      const std::string fen = game.fen.empty() ? std::string(startPos) : game.fen;
+
+      // Games without a result give no weights
+      if ((!game.epd && game.result < 0) || !validBoard(fen)) {
+        ++skipped;
+        continue;
+      }
+
+      pos.set(fen, states[0]);
+      const int plies = std::min(int(game.moves.size()), options.depth);
+
+      for (int ply = 0; ply < plies; ++ply) {
+        const Move move = sanToMove(pos, game.moves[ply]);
+        if (!move) {
+          ++skipped;
+          break;
+        }
+
+        const U32 weight = game.epd ? 1
+                           : pos.sideToMove() == WHITE ? game.result
+                                                       : 2 - game.result;
+        if (weight)
+          records.push_back({PolyBook::polyKey(pos),
+                             PolyBook::engineMoveToPolyMove(move), weight});
+
+        // The best moves of an EPD are all from its position
+        if (!game.epd)
+          pos.makeMove(move, states[ply + 1]);
+      }
+
+      ++games;
+    }
+
+    table.add(records);
+  };
+
+  // Write the table to a sorted run on disk
+  auto spill = [&]() {
+    const std::vector<BookRecord> records = table.extract();
+    runPaths.push_back(output + ".run" + std::to_string(runPaths.size()));
+    std::ofstream run(runPaths.back(), std::ios::binary);
+    run.write(reinterpret_cast<const char *>(records.data()),
+              records.size() * sizeof(BookRecord));
+  };
+
+  const size_t chunkSize = 1024 * size_t(threads);
+  std::vector<Game> chunk;
+  Game game;
+  bool more = true;
+
+  while (more) {
+    chunk.clear();
+    while (chunk.size() < chunkSize &&
+           (more = epd ? nextEPD(in, game) : pgn.next(game)))
+      chunk.push_back(std::move(game));
+
+    std::vector<std::thread> workers;
+    for (int id = 1; id < threads; ++id)
+      workers.emplace_back(replay, std::cref(chunk), id);
+    replay(chunk, 0);
+    for (std::thread &worker : workers)
+      worker.join();
+
+    if (table.size() > maxEntries)
+      spill();
+  }
+
+  // Merge the runs with what is left in memory
+  std::vector<RunReader> runs;
+  for (const std::string &path : runPaths)
+    runs.emplace_back(path);
+  runs.emplace_back(table.extract());
+
+  size_t entries = 0;
+  const size_t positions = writeBook(runs, out, entries);
+  out.close();
+
+  runs.clear();
+  for (const std::string &path : runPaths)
+    std::remove(path.c_str());
+
+  const double seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+          .count();
+
+  std::cout << "info string Book " << output << ": " << positions
+            << " positions, " << entries << " moves from " << games
+            << " games (" << skipped << " skipped or cut short), "
+            << runPaths.size() << " runs spilled, " << seconds << " s"
+            << std::endl;
+}
+
+} // namespace Maestro
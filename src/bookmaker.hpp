@@ -0,0 +1,33 @@
+#ifndef BOOKMAKER_HPP
+#pragma once
+#define BOOKMAKER_HPP
+
+#include <cstddef>
+#include <string>
+
+namespace Maestro {
+
+/******************************************\
+|==========================================|
+|               Book Maker                 |
+|==========================================|
+\******************************************/
+
+struct BookOptions {
+  // Plies of each game added to the book
+  int depth = 40;
+  // Threads replaying the games (0 for all the hardware threads)
+  int threads = 0;
+  // Memory for the weights (MB), sorted runs are spilled to disk beyond it
+  size_t memory = 256;
+};
+
+// Build a polyglot book from a PGN file, or an EPD file with bm opcodes (.epd
+// extension). A move of a game weighs 2 for a win, 1 for a draw and 0 for a
+// loss of the side playing it, each best move of an EPD weighs 1.
+void makeBook(const std::string &input, const std::string &output,
+              const BookOptions &options);
+
+} // namespace Maestro
+
+#endif // BOOKMAKER_HPP
@@ -0,0 +1,159 @@
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "cpu.hpp"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+namespace Maestro::CPU {
+
+namespace {
+
+Features detected;
+
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+
+// Query a CPUID leaf (eax, ebx, ecx, edx)
+void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t regs[4]) {
+#if defined(_MSC_VER)
+  __cpuidex((int *)regs, int(leaf), int(subleaf));
+#else
+  __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// Register state enabled by the OS (XCR0)
+uint64_t xgetbv() {
+#if defined(_MSC_VER)
+  return _xgetbv(0);
+#else
+  uint32_t eax, edx;
+  __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+  return (uint64_t(edx) << 32) | eax;
+#endif
+}
+
+void detect() {
+  uint32_t regs[4];
+
+  cpuid(0, 0, regs);
+  const uint32_t maxLeaf = regs[0];
+
+  char vendor[13] = {};
+  std::memcpy(vendor, &regs[1], 4);
+  std::memcpy(vendor + 4, &regs[3], 4);
+  std::memcpy(vendor + 8, &regs[2], 4);
+
+  cpuid(1, 0, regs);
+  const uint32_t family = ((regs[0] >> 8) & 0xF) + ((regs[0] >> 20) & 0xFF);
+  const bool osxsave = regs[2] & (1u << 27);
+
+  detected.popcnt = regs[2] & (1u << 23);
+  detected.sse41 = regs[2] & (1u << 19);
+  detected.sse42 = regs[2] & (1u << 20);
+
+  // The OS must save the YMM (and ZMM) registers on context switches
+  const uint64_t xcr0 = osxsave ? xgetbv() : 0;
+  const bool osAVX = (xcr0 & 0x06) == 0x06;
+  const bool osAVX512 = (xcr0 & 0xE6) == 0xE6;
+
+  if (maxLeaf < 7)
+    return;
+
+  cpuid(7, 0, regs);
+  const uint32_t maxSubLeaf = regs[0];
+
+  detected.avx2 = osAVX && (regs[1] & (1u << 5));
+  detected.bmi1 = regs[1] & (1u << 3);
+  detected.bmi2 = regs[1] & (1u << 8);
+  detected.avx512 =
+      osAVX512 && (regs[1] & (1u << 16)) && (regs[1] & (1u << 30));
+  detected.vnni =
+      detected.avx512 && (regs[1] & (1u << 31)) && (regs[2] & (1u << 11));
+
+  if (maxSubLeaf >= 1) {
+    cpuid(7, 1, regs);
+    detected.avxVnni = detected.avx2 && (regs[0] & (1u << 4));
+  }
+
+  // pext is microcoded (Very slow) on AMD before Zen 3
+  detected.fastPext =
+      detected.bmi2 && !(!std::strcmp(vendor, "AuthenticAMD") && family < 0x19);
+}
+
+#else
+
+void detect() {}
+
+#endif
+
+} // namespace
+
+void init() {
+  detected = Features();
+  detect();
+}
+
+const Features &features() { return detected; }
+
+std::string str() {
+  std::string s;
+
+  if (detected.popcnt)
+    s += " popcnt";
+  if (detected.sse41)
+    s += " sse4.1";
+  if (detected.sse42)
+    s += " sse4.2";
+  if (detected.avx2)
+    s += " avx2";
+  if (detected.bmi1)
+    s += " bmi1";
+  if (detected.bmi2)
+    s += detected.fastPext ? " bmi2" : " bmi2(slow pext)";
+  if (detected.avx512)
+    s += " avx512";
+  if (detected.vnni)
+    s += " vnni";
+  if (detected.avxVnni)
+    s += " avxvnni";
+
+  return s.empty() ? "none" : s.substr(1);
+}
+
+std::string missing() {
+  std::string s;
+
+  // popcnt and SSE4.2 are the baseline of every build
+  if (!detected.popcnt)
+    s += " popcnt";
+  if (!detected.sse41)
+    s += " sse4.1";
+  if (!detected.sse42)
+    s += " sse4.2";
+#ifdef __AVX2__
+  if (!detected.avx2)
+    s += " avx2";
+#endif
+#ifdef __BMI__
+  if (!detected.bmi1)
+    s += " bmi1";
+#endif
+#ifdef __BMI2__
+  if (!detected.bmi2)
+    s += " bmi2";
+#endif
+#if defined(__AVX512F__) || defined(__AVX512BW__)
+  if (!detected.avx512)
+    s += " avx512";
+#endif
+
+  return s.empty() ? s : s.substr(1);
+}
+
+} // namespace Maestro::CPU
@@ -0,0 +1,50 @@
+#ifndef CPU_HPP
+#pragma once
+#define CPU_HPP
+
+#include <string>
+
+namespace Maestro {
+
+/******************************************\
+|==========================================|
+|              CPU Features                |
+|==========================================|
+\******************************************/
+
+// https://www.chessprogramming.org/CPUID
+
+namespace CPU {
+
+// Instruction set extensions used by the engine
+struct Features {
+  bool popcnt = false;
+  bool sse41 = false;
+  bool sse42 = false;
+  bool avx2 = false;
+  bool bmi1 = false;
+  bool bmi2 = false;
+  bool fastPext = false; // BMI2 with a fast pext (Not microcoded)
+  bool avx512 = false;   // AVX-512 F + BW
+  bool vnni = false;     // AVX-512 VNNI + VL
+  bool avxVnni = false;  // AVX-VNNI (VEX encoded, 256 bit)
+};
+
+// Detect the features of the host CPU (Including OS support for AVX state)
+void init();
+
+// Detected features
+const Features &features();
+
+// List of the detected features
+std::string str();
+
+// Features the build was compiled to require but the CPU lacks (Empty if it
+// can run)
+std::string missing();
+
+} // namespace CPU
+
+} // namespace Maestro
+
+#endif // CPU_HPP
@@ -39,6 +39,7 @@ constexpr Value VAL_INFINITE = 32001;
 constexpr Value VAL_MATE = 32000;
 constexpr Value VAL_MATE_BOUND = VAL_MATE - MAX_PLY;
 constexpr Value VAL_ZERO = 0;
+constexpr Value VAL_KNOWN_WIN = 10000;
 
 /******************************************\
 |==========================================|
@@ -0,0 +1,260 @@
+#include <algorithm>
+#include <unordered_map>
+
+#include "bitbase.hpp"
+#include "bitboard.hpp"
+#include "defs.hpp"
+#include "endgame.hpp"
+#include "hash.hpp"
+#include "position.hpp"
+#include "utils.hpp"
+
+namespace Maestro::Endgames {
+
+namespace {
+
+// Registered endgames, indexed by material key
+std::unordered_map<Key, std::pair<EvalFn, Colour>> endgames;
+
+// Drive a king towards the edge of the board
+int pushToEdge(Square sq) {
+  const int r = rankOf(sq) >= RANK_5 ? RANK_8 - rankOf(sq) : rankOf(sq);
+  const int f = fileDistToEdge(sq);
+  return 90 - (7 * f * f / 2 + 7 * r * r / 2);
+}
+
+// Drive a king towards the corners of the a1-h8 diagonal
+int pushToCorner(Square sq) { return std::abs(7 - rankOf(sq) - fileOf(sq)); }
+
+// Bring two pieces closer / further apart
+int pushClose(Square sq1, Square sq2) { return 140 - 20 * distance(sq1, sq2); }
+int pushAway(Square sq1, Square sq2) { return 120 - pushClose(sq1, sq2); }
+
+// Convert a value from the strong side to the side to move
+Value relative(const Position &pos, Colour strong, Value v) {
+  return strong == pos.sideToMove() ? v : -v;
+}
+
+// KBN vs K, drive the king to a corner of the bishop's colour
+Value KBNK(const Position &pos, Colour strong) {
+  const Colour weak = ~strong;
+  const Square strongKing = pos.square<KING>(strong);
+  const Square weakKing = pos.square<KING>(weak);
+  const Square bishop = pos.square<BISHOP>(strong);
+
+  // Dark squared bishops mate on a1/h8, light squared ones on a8/h1
+  const Square corner = (DarkSquares & bishop) ? weakKing : flipFile(weakKing);
+
+  const Value result = VAL_KNOWN_WIN + 3520 +
+                       pushClose(strongKing, weakKing) +
+                       420 * pushToCorner(corner);
+
+  return relative(pos, strong, result);
+}
+
+// KP vs K, exact win/draw from the bitbase
+Value KPK(const Position &pos, Colour strong) {
+  // Normalise so the strong side is white and the pawn is on files A-D
+  Square strongKing = relativeSquare(strong, pos.square<KING>(strong));
+  Square weakKing = relativeSquare(strong, pos.square<KING>(~strong));
+  Square pawn = relativeSquare(strong, pos.square<PAWN>(strong));
+
+  if (fileOf(pawn) >= FILE_E) {
+    strongKing = flipFile(strongKing);
+    weakKing = flipFile(weakKing);
+    pawn = flipFile(pawn);
+  }
+
+  const Colour us = strong == pos.sideToMove() ? WHITE : BLACK;
+
+  if (!Bitbases::probe(strongKing, pawn, weakKing, us))
+    return VAL_ZERO;
+
+  const Value result = VAL_KNOWN_WIN + PieceValue[PAWN] + rankOf(pawn);
+
+  return relative(pos, strong, result);
+}
+
+// KR vs KP, based on how far the kings are from the pawn
+Value KRKP(const Position &pos, Colour strong) {
+  const Colour weak = ~strong;
+  const Square strongKing = relativeSquare(strong, pos.square<KING>(strong));
+  const Square weakKing = relativeSquare(strong, pos.square<KING>(weak));
+  const Square rook = relativeSquare(strong, pos.square<ROOK>(strong));
+  const Square pawn = relativeSquare(strong, pos.square<PAWN>(weak));
+  const Square queening = toSquare(fileOf(pawn), RANK_1);
+
+  Value result;
+
+  // The strong king is in front of the pawn
+  if (forwardFileBB(WHITE, strongKing) & pawn)
+    result = PieceValue[ROOK] - distance(strongKing, pawn);
+  // The weak king is too far from the pawn and the rook
+  else if (distance(weakKing, pawn) >= 3 + (pos.sideToMove() == weak) &&
+           distance(weakKing, rook) >= 3)
+    result = PieceValue[ROOK] - distance(strongKing, pawn);
+  // The pawn is far advanced and supported by the weak king
+  else if (rankOf(weakKing) <= RANK_3 && distance(weakKing, pawn) == 1 &&
+           rankOf(strongKing) >= RANK_4 &&
+           distance(strongKing, pawn) > 2 + (pos.sideToMove() == strong))
+    result = 80 - 8 * distance(strongKing, pawn);
+  else
+    result = 200 - 8 * (distance(strongKing, pawn + S) -
+                        distance(weakKing, pawn + S) -
+                        distance(pawn, queening));
+
+  return relative(pos, strong, result);
+}
+
+// KR vs KB, a draw in most cases, drive the king to the edge
+Value KRKB(const Position &pos, Colour strong) {
+  return relative(pos, strong, pushToEdge(pos.square<KING>(~strong)));
+}
+
+// KR vs KN, drive the king to the edge and away from its knight
+Value KRKN(const Position &pos, Colour strong) {
+  const Square weakKing = pos.square<KING>(~strong);
+  const Square knight = pos.square<KNIGHT>(~strong);
+  return relative(pos, strong,
+                  pushToEdge(weakKing) + pushAway(weakKing, knight));
+}
+
+// KQ vs KP, a win unless the pawn is a supported rook or bishop pawn on the
+// seventh rank
+Value KQKP(const Position &pos, Colour strong) {
+  const Colour weak = ~strong;
+  const Square strongKing = pos.square<KING>(strong);
+  const Square weakKing = pos.square<KING>(weak);
+  const Square pawn = pos.square<PAWN>(weak);
+
+  Value result = pushClose(strongKing, weakKing);
+
+  if (relativeRank(weak, pawn) != RANK_7 || distance(weakKing, pawn) != 1 ||
+      !((FILE_ABB | FILE_CBB | FILE_FBB | FILE_HBB) & pawn))
+    result += PieceValue[QUEEN] - PieceValue[PAWN];
+
+  return relative(pos, strong, result);
+}
+
+// KQ vs KR, a win, drive the king to the edge
+Value KQKR(const Position &pos, Colour strong) {
+  const Square strongKing = pos.square<KING>(strong);
+  const Square weakKing = pos.square<KING>(~strong);
+
+  const Value result = PieceValue[QUEEN] - PieceValue[ROOK] +
+                       pushToEdge(weakKing) + pushClose(strongKing, weakKing);
+
+  return relative(pos, strong, result);
+}
+
+// Register an endgame for both colours
+void add(const std::string &code, EvalFn fn) {
+  for (Colour c : {WHITE, BLACK})
+    endgames[materialKey(code, c)] = {fn, c};
+}
+
+} // namespace
+
+void init() {
+  endgames.clear();
+
+  add("KPvK", KPK);
+  add("KNNvK", draw);
+  add("KBNvK", KBNK);
+  add("KRvKP", KRKP);
+  add("KRvKB", KRKB);
+  add("KRvKN", KRKN);
+  add("KQvKP", KQKP);
+  add("KQvKR", KQKR);
+}
+
+Key materialKey(const std::string &code, Colour strong) {
+  int counts[PIECE_N] = {};
+  Colour c = strong;
+
+  for (char ch : code) {
+    if (ch == 'v') {
+      c = ~strong;
+      continue;
+    }
+    const PieceType pt = PieceType(std::string(" PNBRQK").find(ch));
+    ++counts[toPiece(c, pt)];
+  }
+
+  Key key = 0ULL;
+  for (int pc = 0; pc < PIECE_N; ++pc)
+    for (int i = 0; i < counts[pc]; ++i)
+      key ^= Zobrist::pieceSquareKeys[pc][i];
+
+  return key;
+}
+
+EvalFn probe(Key key, Colour &strong) {
+  const auto it = endgames.find(key);
+  if (it == endgames.end())
+    return nullptr;
+  strong = it->second.second;
+  return it->second.first;
+}
+
+// Insufficient material to win
+Value draw(const Position &, Colour) { return VAL_ZERO; }
+
+// Mating material vs a lone king, drive the king to the edge
+Value KXK(const Position &pos, Colour strong) {
+  const Colour weak = ~strong;
+  const Square strongKing = pos.square<KING>(strong);
+  const Square weakKing = pos.square<KING>(weak);
+
+  // Stalemate
+  if (pos.sideToMove() == weak && !pos.isInCheck() &&
+      !(attacksBB<KING>(weakKing, EMPTYBB) & ~pos.attacked()))
+    return VAL_ZERO;
+
+  Value result = pos.nonPawnMaterial(strong) +
+                 pos.count(toPiece(strong, PAWN)) * PieceValue[PAWN] +
+                 pushToEdge(weakKing) + pushClose(strongKing, weakKing);
+
+  const Bitboard bishops = pos.pieces(strong, BISHOP);
+  if (pos.pieces(strong, QUEEN, ROOK) ||
+      (bishops && pos.pieces(strong, KNIGHT)) ||
+      ((bishops & DarkSquares) && (bishops & ~DarkSquares)))
+    // Kept below the tablebase wins of the search (VAL_MATE_BOUND - ply - 1)
+    result = std::min(result + VAL_KNOWN_WIN, VAL_MATE_BOUND - MAX_PLY - 1);
+
+  return relative(pos, strong, result);
+}
+
+// KB and rook pawns vs K, a draw if the bishop doesn't control the queening
+// square and the weak king reaches it
+int KBPsK(const Position &pos, Colour strong) {
+  const Colour weak = ~strong;
+  const Bitboard pawns = pos.pieces(strong, PAWN);
+
+  if (pos.pieces(weak, PAWN) || ((pawns & ~FILE_ABB) && (pawns & ~FILE_HBB)))
+    return SCALE_NONE;
+
+  const Square queening =
+      relativeSquare(strong, toSquare(fileOf(getLSB(pawns)), RANK_8));
+  const Square bishop = pos.square<BISHOP>(strong);
+
+  if (bool(DarkSquares & bishop) != bool(DarkSquares & queening) &&
+      distance(queening, pos.square<KING>(weak)) <= 1)
+    return SCALE_DRAW;
+
+  return SCALE_NONE;
+}
+
+// K and pawns on a single rook file vs K, a draw if the weak king is in front
+int KPsK(const Position &pos, Colour strong) {
+  const Bitboard pawns = pos.pieces(strong, PAWN);
+  const Square weakKing = pos.square<KING>(~strong);
+
+  if (!(pawns & ~(FILE_ABB | FILE_HBB)) &&
+      !(pawns & ~passedPawnSpan(~strong, weakKing)))
+    return SCALE_DRAW;
+
+  return SCALE_NONE;
+}
+
+} // namespace Maestro::Endgames
@@ -0,0 +1,53 @@
+#ifndef ENDGAME_HPP
+#pragma once
+#define ENDGAME_HPP
+
+#include <string>
+
+#include "defs.hpp"
+#include "position.hpp"
+
+namespace Maestro {
+
+/******************************************\
+|==========================================|
+|           Endgame Evaluation             |
+|==========================================|
+\******************************************/
+
+// Scale factors applied to the evaluation of the stronger side
+enum ScaleFactor : int {
+  SCALE_DRAW = 0,
+  SCALE_NORMAL = 64,
+  SCALE_NONE = 255
+};
+
+namespace Endgames {
+
+// Specialised evaluation (Returns a value relative to the side to move)
+using EvalFn = Value (*)(const Position &pos, Colour strong);
+// Specialised scaling (Returns SCALE_NONE if it doesn't apply)
+using ScaleFn = int (*)(const Position &pos, Colour strong);
+
+// Register the endgames by material key
+void init();
+
+// Material key of an endgame code like "KRvK" (Strong side on the left)
+Key materialKey(const std::string &code, Colour strong);
+
+// Find a specialised evaluation function for a material key
+EvalFn probe(Key key, Colour &strong);
+
+// Generic evaluation functions (Used for families of material configurations)
+Value draw(const Position &pos, Colour strong);
+Value KXK(const Position &pos, Colour strong);
+
+// Generic scaling functions
+int KBPsK(const Position &pos, Colour strong);
+int KPsK(const Position &pos, Colour strong);
+
+} // namespace Endgames
+
+} // namespace Maestro
+
+#endif // ENDGAME_HPP
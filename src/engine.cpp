@@ -1,49 +1,145 @@
+#include <chrono>
+#include <iomanip>
 #include <iostream>
+#include <thread>
 
+#include "bitbase.hpp"
 #include "bitboard.hpp"
+#include "cpu.hpp"
 #include "defs.hpp"
+#include "endgame.hpp"
 #include "engine.hpp"
 #include "eval.hpp"
 #include "hash.hpp"
 #include "movegen.hpp"
 #include "nnue.hpp"
+#include "output.hpp"
 #include "perft.hpp"
 #include "polyglot.hpp"
 #include "position.hpp"
 #include "search.hpp"
+#include "syzygy.hpp"
 #include "uci.hpp"
 #include "utils.hpp"
 
 namespace Maestro {
 
+namespace {
+
+// Time of each startup phase, reported with --startup-profile
+class StartupProfile {
+public:
+  explicit StartupProfile(bool enabled)
+      : _enabled(enabled), _start(Clock::now()), _last(_start) {}
+
+  // End the current phase
+  void phase(const char *name) {
+    const Clock::time_point now = Clock::now();
+    if (_enabled)
+      report(name, now - _last);
+    _last = now;
+  }
+
+  // Report the whole startup
+  void total() const {
+    if (_enabled)
+      report("total", Clock::now() - _start);
+  }
+
+  // Report work timed on another thread, next to its budget (It competes
+  // with the phases above for the CPU, so this is not a check)
+  void background(const char *name, double ms, double budget) const {
+    if (_enabled)
+      std::cout << "info string startup " << std::left << std::setw(10) << name
+                << std::right << std::fixed << std::setprecision(3) << ms
+                << " ms on its thread (Budget " << budget << " ms)"
+                << std::defaultfloat << std::endl;
+  }
+
+  bool enabled() const { return _enabled; }
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  static void report(const char *name, Clock::duration time) {
+    std::cout << "info string startup " << std::left << std::setw(10) << name
+              << std::right << std::fixed << std::setprecision(3)
+              << std::chrono::duration<double, std::milli>(time).count()
+              << " ms" << std::defaultfloat << std::endl;
+  }
+
+  bool _enabled;
+  Clock::time_point _start, _last;
+};
+
+} // namespace
+
 // Engine constructor
-Engine::Engine() : states(new std::deque<BoardState>(1)) {
+Engine::Engine(bool startupProfile)
+    : states(new std::deque<BoardState>(1)), positionFen(startPos),
+      evalFile(EVAL_FILE) {
+  StartupProfile profile(startupProfile);
   // Initialize bitboards
   Bitboards::init();
+  profile.phase("bitboards");
   // Initialize zobrist keys
   Zobrist::init();
+  profile.phase("zobrist");
+  // Generate the KPK bitbase in the background (See loadNet)
+  Bitbases::init();
+  profile.phase("kpk spawn");
+  // Initialize endgames
+  Endgames::init();
+  profile.phase("endgames");
   // Initialize evaluation
   Eval::initEval();
+  profile.phase("eval");
   // Initialize threads
   threads.set(THREADS, searchState);
-  // Initialize transposition table
-  tt.resize(HASH_SIZE, threads);
+  profile.phase("threads");
+  // Initialize transposition table, cleared with the histories before the
+  // first search (See prepareSearch)
+  tt.resize(HASH_SIZE);
+  profile.phase("hash");
   // Set starting position
   pos.set(startPos.data(), states->back());
+  profile.phase("position");
   // Initialize polyglot book
   if (USE_BOOK)
     book.init(BOOK_FILE);
-  // Initialize nnue
-  nnue_init(); // added for emdedded net - JA
+  profile.phase("book");
+  // Select the nnue kernels, the net is loaded on first use (See loadNet)
+  nnue_init();
+  profile.phase("nnue");
+  // The KPK generation overlaps the phases above, it is joined here when
+  // profiling and before the first evaluation otherwise (See loadNet)
+  if (profile.enabled()) {
+    Bitbases::waitForInit();
+    profile.phase("kpk join");
+    profile.background("kpk", Bitbases::generationTime(),
+                       Bitbases::GENERATION_BUDGET);
+  }
+  profile.total();
+  // Report the code paths chosen for this CPU
+  std::cout << "info string CPU features: " << CPU::str() << std::endl;
+  std::cout << "info string Using " << nnue_kernels_name(nullptr)
+            << " NNUE kernels and " << Bitboards::sliderBackend()
+            << " slider attacks" << std::endl;
 }
 
 // Engine destructor
-Engine::~Engine() { waitForSearchFinish(); }
+Engine::~Engine() {
+  waitForSearchFinish();
+  Bitbases::waitForInit();
+  nnue_free(net);
+}
 
 // Wait for search to finish
 void Engine::waitForSearchFinish() {
   threads.main()->waitForThread();
   threads.waitForThreads();
+  // Keep the search output ahead of what the UCI thread prints next
+  Output::sync();
 }
 
 std::string Engine::fen() const { return pos.fen(); }
@@ -54,42 +150,213 @@ void Engine::print() const { pos.print(); }
 // Set position
 void Engine::setPosition(const std::string fen,
                          const std::vector<std::string> &moves) {
-  states = StateListPtr(new std::deque<BoardState>(1));
-  pos.set(fen, states->back());
+  // GUIs send the whole game before each move, so keep the moves in common
+  // with the last position
+  size_t common = 0;
+
+  if (fen != positionFen) {
+    positionFen = fen;
+    positionMoves.clear();
+    states = StateListPtr(new std::deque<BoardState>(1));
+    pos.set(fen, states->back());
+  } else {
+    while (common < std::min(moves.size(), positionMoves.size()) &&
+           moves[common] == move2Str(positionMoves[common]))
+      ++common;
 
-  for (const std::string &move : moves) {
-    Move m = UCI::toMove(pos, move);
+    // Taken back moves free states the last search may still read
+    if (common < positionMoves.size())
+      waitForSearchFinish();
+
+    for (; positionMoves.size() > common; positionMoves.pop_back()) {
+      pos.unmakeMove(positionMoves.back());
+      states->pop_back();
+    }
+  }
+
+  for (size_t i = common; i < moves.size(); ++i) {
+    Move m = UCI::toMove(pos, moves[i]);
     if (!m)
       break;
     states->emplace_back();
     pos.makeMove(m, states->back());
+    positionMoves.push_back(m);
   }
 }
 
 void Engine::setOption(const std::string &name, const std::string &value) {
   if (compareStr(name, "Hash")) {
     size_t mb = std::stoi(value);
-    if (mb != tt.size())
-      tt.resize(mb, threads);
+    if (mb != tt.size()) {
+      tt.resize(mb);
+      tablesCleared = false;
+    }
   } else if (compareStr(name, "Threads")) {
     size_t n = std::stoi(value);
-    if (n != threads.size())
+    if (n != threads.size()) {
       threads.set(n, searchState);
+      tablesCleared = false;
+    }
+  } else if (compareStr(name, "SyzygyPath")) {
+    Tablebases::init(value);
+  } else if (compareStr(name, "SyzygyProbeDepth")) {
+    // Out of range values leave the depth unchanged (min 1 max 100)
+    Depth depth;
+    if (parseNumber(value, depth) && depth >= 1 && depth <= 100)
+      searchState.tbConfig.probeDepth = depth;
+  } else if (compareStr(name, "EvalFile")) {
+    evalFile = value;
+    netLoaded = false;
+  }
+}
+
+// Load the net of EvalFile, the default name is the embedded net
+void Engine::loadNet() {
+  if (netLoaded)
+    return;
+
+  waitForSearchFinish();
+  netLoaded = true;
+  // Every command that evaluates loads the net first, so the KPK bitbase is
+  // ready before the first probe
+  Bitbases::waitForInit();
+
+  TimePt start = getTimeMs();
+  bool embedded = evalFile.empty() || evalFile == EVAL_FILE;
+  NNUENet *loaded = nnue_load(embedded ? nullptr : evalFile.c_str());
+
+  if (!loaded) {
+    std::cout << "info string " << evalFile << " is not a NNUE file or an "
+              << "export for the " << nnue_kernels_name(nullptr)
+              << " kernels, using the embedded net" << std::endl;
+    embedded = true;
+    loaded = nnue_load(nullptr);
   }
+
+  if (!loaded) {
+    std::cout << "info string Embedded NNUE data not valid!" << std::endl;
+    return;
+  }
+
+  std::cout << "info string NNUE " << (embedded ? "embedded" : evalFile)
+            << (nnue_mapped(loaded) ? " mapped" : " loaded") << " in "
+            << getTimeMs() - start << " ms" << std::endl;
+
+  // No search uses the previous net anymore
+  nnue_free(net);
+  net = loaded;
+  searchState.net = net;
+}
+
+// Load the net, and clear the hash and the histories left from startup or an
+// option change. isready runs it, so the first go doesn't spend its time on it.
+void Engine::prepareSearch() {
+  loadNet();
+
+  if (tablesCleared)
+    return;
+
+  waitForSearchFinish();
+  tablesCleared = true;
+  tt.clear(threads);
+  threads.clear();
+}
+
+// Write the loaded net in the layout of the selected kernels, to be mapped
+// through EvalFile
+void Engine::exportNet(const std::string &path) {
+  loadNet();
+
+  if (nnue_export(net, path.c_str()))
+    std::cout << "info string Exported " << nnue_kernels_name(net)
+              << " weights to " << path << std::endl;
+  else
+    std::cout << "info string Failed to write " << path << std::endl;
 }
 
 void Engine::perft(Limits &limits) { perftTest(pos, limits.depth); }
 
 void Engine::bench() { perftBench(BENCH_FILE.data(), threads); }
 
+void Engine::sliderBench() { Maestro::sliderBench(BENCH_FILE.data()); }
+
+void Engine::attackMapBench() { Maestro::attackMapBench(BENCH_FILE.data()); }
+
+// Time from stop to the written bestmove, over infinite searches of the
+// current position stopped after 20 to 200 ms
+void Engine::stopLatency() {
+  using Clock = std::chrono::steady_clock;
+  constexpr int runs = 10;
+  double total = 0, worst = 0;
+
+  for (int i = 0; i < runs; ++i) {
+    Limits limits{};
+    limits.infinite = true;
+    limits.startTime = getTimeMs();
+    go(limits);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(20 + 20 * i));
+
+    const Clock::time_point start = Clock::now();
+    stop();
+    waitForSearchFinish();
+    const double us =
+        std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+
+    total += us;
+    worst = std::max(worst, us);
+  }
+
+  std::cout << "info string Stop to bestmove: " << total / runs
+            << " us average, " << worst << " us worst over " << runs
+            << " searches" << std::endl;
+}
+
+void Engine::verifyBitbase() { Bitbases::verify(); }
+
+void Engine::verifyTablebases() { Tablebases::verify(); }
+
+void Engine::testNNUE() {
+  loadNet();
+  Eval::testNNUE(BENCH_FILE.data(), net);
+}
+
+void Engine::testHalfKA(const std::string &file) { Eval::testHalfKA(file); }
+
+void Engine::evalBatch(const std::string &file, const std::string &output) {
+  loadNet();
+  Eval::evalBatch(file, output, net);
+}
+
+void Engine::makeBook(const std::string &input, const std::string &output,
+                      const BookOptions &options) {
+  Maestro::makeBook(input, output, options);
+}
+
+void Engine::runEPD(const std::string &file, const EPDOptions &options) {
+  loadNet();
+  waitForSearchFinish();
+  Maestro::runEPD(file, options, searchState);
+}
+
+void Engine::selfPlay(const SelfPlayOptions &options) {
+  loadNet();
+  waitForSearchFinish();
+  runSelfPlay(options, searchState);
+}
+
 void Engine::go(Limits &limits) {
+  prepareSearch();
 
   threads.stop = threads.abortedSearch = false;
+  threads.ponder = limits.ponder;
 
   if constexpr (USE_BOOK) {
     Move move = book.probe(pos);
     if (move) {
-      std::cout << "bestmove " << move2Str(move) << std::endl;
+      // Keep the bestmove of a running search first
+      waitForSearchFinish();
+      Output::post("bestmove " + move2Str(move));
       return;
     }
   }
@@ -99,6 +366,15 @@ void Engine::go(Limits &limits) {
 
 void Engine::stop() { threads.stop = threads.abortedSearch = true; }
 
+// The input thread and the queued command both call it, only the first one
+// sets the time the limits apply from
+void Engine::ponderhit(TimePt received) {
+  if (threads.ponder) {
+    threads.ponderhitTime = received;
+    threads.ponder = false;
+  }
+}
+
 void Engine::clear() { waitForSearchFinish(); }
 
 }; // namespace Maestro
\ No newline at end of file
@@ -5,10 +5,13 @@
 #include <string>
 #include <vector>
 
+#include "bookmaker.hpp"
 #include "defs.hpp"
+#include "epd.hpp"
 #include "polyglot.hpp"
 #include "position.hpp"
 #include "search.hpp"
+#include "selfplay.hpp"
 #include "thread.hpp"
 #include "utils.hpp"
 
@@ -22,7 +25,8 @@ namespace Maestro {
 
 class Engine {
 public:
-  Engine();
+  // Print the time of each init phase if startupProfile is set
+  explicit Engine(bool startupProfile = false);
   ~Engine();
 
   void waitForSearchFinish();
@@ -31,8 +35,24 @@ public:
 
   void perft(Limits &limits);
   void bench();
+  void sliderBench();
+  void attackMapBench();
+  void stopLatency();
+  void verifyBitbase();
+  void verifyTablebases();
+  void testNNUE();
+  void testHalfKA(const std::string &file);
+  void evalBatch(const std::string &file, const std::string &output);
+  void makeBook(const std::string &input, const std::string &output,
+                const BookOptions &options);
+  void runEPD(const std::string &file, const EPDOptions &options);
+  void selfPlay(const SelfPlayOptions &options);
+  void loadNet();
+  void prepareSearch();
+  void exportNet(const std::string &path);
   void go(Limits &limits);
   void stop();
+  void ponderhit(TimePt received);
   bool stopped() const { return threads.stop; }
   void clear();
 
@@ -44,8 +64,17 @@ public:
 private:
   Position pos;
   StateListPtr states;
+  // Position command of pos, to only make the moves it is extended with
+  std::string positionFen;
+  std::vector<Move> positionMoves;
   PolyBook book;
 
+  std::string evalFile;
+  bool netLoaded = false;
+  NNUENet *net = nullptr; // Net of the searches (See loadNet)
+  // Hash and histories cleared since they were allocated
+  bool tablesCleared = false;
+
   ThreadPool threads;
   TTable tt;
   SearchState searchState{threads, tt};
@@ -0,0 +1,244 @@
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "epd.hpp"
+#include "hash.hpp"
+#include "movegen.hpp"
+#include "position.hpp"
+#include "search.hpp"
+#include "thread.hpp"
+#include "uci.hpp"
+
+namespace Maestro {
+
+namespace {
+
+// Position of the suite with the moves of its bm and am opcodes
+struct EPDPosition {
+  std::string id, fen;
+  std::vector<Move> best, avoid;
+
+  bool solvedBy(Move move) const {
+    return (best.empty() ||
+            std::find(best.begin(), best.end(), move) != best.end()) &&
+           std::find(avoid.begin(), avoid.end(), move) == avoid.end();
+  }
+};
+
+// Search result of a position
+struct EPDResult {
+  Move move = Move::none();
+  TimePt time = -1; // Time to solution (ms), -1 if not solved
+  U64 nodes = 0;    // Nodes to solution
+  U64 total = 0;    // Nodes of the whole search
+};
+
+// Read the positions with a bm or am opcode, returns the number of lines
+// skipped (Invalid board, or none of the moves legal)
+size_t readEPD(const std::string &file, std::vector<EPDPosition> &positions) {
+  std::ifstream in(file);
+  std::string line;
+  size_t lineNumber = 0, skipped = 0;
+
+  while (std::getline(in, line)) {
+    ++lineNumber;
+
+    std::istringstream is(line);
+    EPDPosition epd;
+    epd.fen = readEPDPosition(is);
+
+    if (epd.fen.empty())
+      continue;
+
+    if (!validBoard(epd.fen)) {
+      ++skipped;
+      continue;
+    }
+
+    BoardState state;
+    Position pos;
+    pos.set(epd.fen, state);
+
+    // Opcodes end with a semicolon: bm Qg6 Rf7; id "WAC.001";
+    std::string op;
+    while (std::getline(is, op, ';')) {
+      std::istringstream os(op);
+      std::string code, operand;
+      os >> code;
+
+      if (code == "id") {
+        std::getline(os >> std::ws, epd.id);
+        epd.id.erase(std::remove(epd.id.begin(), epd.id.end(), '"'),
+                     epd.id.end());
+      } else if (code == "bm" || code == "am") {
+        while (os >> operand)
+          if (Move move = sanToMove(pos, operand))
+            (code == "bm" ? epd.best : epd.avoid).push_back(move);
+      }
+    }
+
+    if (epd.best.empty() && epd.avoid.empty()) {
+      ++skipped;
+      continue;
+    }
+
+    if (epd.id.empty())
+      epd.id = "line " + std::to_string(lineNumber);
+
+    positions.push_back(std::move(epd));
+  }
+
+  return skipped;
+}
+
+// Searches one position at a time, with its own thread, histories and hash
+// (Or the shared one)
+class EPDSearcher {
+public:
+  EPDSearcher(const SearchState &settings, TTable *sharedTT, size_t hash)
+      : _search(
+            settings,
+            [this](const PrintInfo &info, Move best) {
+              update(info.timeMs, info.nodes, best);
+            },
+            sharedTT) {
+    _search.init(1, hash);
+  }
+
+  ThreadPool &threads() { return _search.threads(); }
+
+  EPDResult search(const EPDPosition &epd, Limits limits) {
+    // Nothing learnt from the previous position
+    _search.clear();
+
+    StateListPtr states(new std::deque<BoardState>(1));
+    Position pos;
+    pos.set(epd.fen, states->back());
+
+    _epd = &epd;
+    _result = EPDResult();
+
+    limits.startTime = getTimeMs();
+    _result.move = _search.search(pos, states, limits);
+    _result.total = _search.threads().nodesSearched();
+
+    // The last depth can be cut short with another best move
+    update(getTimeMs() - limits.startTime, _result.total, _result.move);
+
+    return _result;
+  }
+
+private:
+  // Keep the time and nodes of the depth from which the best move solves
+  void update(TimePt time, U64 nodes, Move best) {
+    if (!_epd->solvedBy(best))
+      _result.time = -1;
+    else if (_result.time < 0) {
+      _result.time = time;
+      _result.nodes = nodes;
+    }
+  }
+
+  PrivateSearch _search;
+
+  const EPDPosition *_epd = nullptr;
+  EPDResult _result;
+};
+
+} // namespace
+
+void runEPD(const std::string &file, const EPDOptions &options,
+            const SearchState &settings) {
+  std::vector<EPDPosition> positions;
+  const size_t skipped = readEPD(file, positions);
+
+  if (positions.empty()) {
+    std::cout << "info string No position with a bm or am opcode in " << file
+              << std::endl;
+    return;
+  }
+
+  const size_t threads =
+      std::min(positions.size(),
+               options.threads > 0
+                   ? size_t(options.threads)
+                   : size_t(std::max(1u, std::thread::hardware_concurrency())));
+
+  TTable sharedTT;
+  std::vector<std::unique_ptr<EPDSearcher>> searchers;
+
+  for (size_t i = 0; i < threads; ++i)
+    searchers.push_back(std::make_unique<EPDSearcher>(
+        settings, options.sharedHash ? &sharedTT : nullptr, options.hash));
+
+  if (options.sharedHash) {
+    sharedTT.resize(options.hash * threads);
+    sharedTT.clear(searchers[0]->threads());
+    // One generation for the run, the searchers don't write it concurrently
+    sharedTT.newSearch();
+  }
+
+  Limits limits{};
+  limits.movetime = options.movetime;
+  limits.nodes = options.nodes;
+
+  std::vector<EPDResult> results(positions.size());
+  std::atomic<size_t> next{0};
+  std::mutex outputMutex;
+  const TimePt start = getTimeMs();
+
+  // Each runner takes the next position until there is none left
+  std::vector<std::thread> runners;
+  for (auto &searcher : searchers)
+    runners.emplace_back([&, searcher = searcher.get()] {
+      for (size_t i; (i = next++) < positions.size();) {
+        const EPDResult &result = results[i] =
+            searcher->search(positions[i], limits);
+
+        std::lock_guard<std::mutex> lock(outputMutex);
+        std::cout << "info string " << positions[i].id << ": "
+                  << move2Str(result.move);
+        if (result.time >= 0)
+          std::cout << " solved in " << result.time << " ms (" << result.nodes
+                    << " nodes)" << std::endl;
+        else
+          std::cout << " not solved" << std::endl;
+      }
+    });
+
+  for (std::thread &runner : runners)
+    runner.join();
+
+  const TimePt elapsed = std::max<TimePt>(getTimeMs() - start, 1);
+  size_t solved = 0;
+  TimePt solveTime = 0;
+  U64 nodes = 0;
+
+  for (const EPDResult &result : results) {
+    nodes += result.total;
+    if (result.time >= 0)
+      ++solved, solveTime += result.time;
+  }
+
+  std::cout << "info string EPD " << file << ": " << solved << "/"
+            << positions.size() << " solved";
+  if (solved)
+    std::cout << ", " << solveTime / TimePt(solved)
+              << " ms average time to solution";
+  if (skipped)
+    std::cout << " (" << skipped << " lines skipped)";
+  std::cout << std::endl;
+
+  std::cout << "info string " << threads << " searches at once, " << nodes
+            << " nodes in " << elapsed << " ms, " << nodes * 1000 / elapsed
+            << " nps" << std::endl;
+}
+
+} // namespace Maestro
@@ -0,0 +1,42 @@
+#ifndef EPD_HPP
+#pragma once
+#define EPD_HPP
+
+#include <cstddef>
+#include <string>
+
+#include "defs.hpp"
+#include "utils.hpp"
+
+namespace Maestro {
+
+struct SearchState;
+
+/******************************************\
+|==========================================|
+|                EPD Runner                |
+|==========================================|
+\******************************************/
+
+struct EPDOptions {
+  // Limit of each search: time (ms) or nodes
+  TimePt movetime = 0;
+  U64 nodes = 0;
+  // Positions searched at once, one thread each (0 for all the hardware
+  // threads)
+  int threads = 0;
+  // Hash of each search (MB), cleared before each position
+  size_t hash = 16;
+  // One hash of hash * threads MB for all the searches instead
+  bool sharedHash = false;
+};
+
+// Search the positions of an EPD test suite and check the bm and am opcodes.
+// Reports the positions solved, the time to solution and the total nps. The
+// settings (Tablebases) are taken from the engine search state.
+void runEPD(const std::string &file, const EPDOptions &options,
+            const SearchState &settings);
+
+} // namespace Maestro
+
+#endif // EPD_HPP
@@ -1,11 +1,21 @@
 #include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <iterator>
 #include <sstream>
+#include <vector>
 
 #include "defs.hpp"
 #include "eval.hpp"
+#include "material.hpp"
 
+#include "movegen.hpp"
 #include "nnue.hpp"
+#include "nnue_halfka.hpp"
+#include "perft.hpp"
 #include "position.hpp"
 #include "uci.hpp"
 #include "utils.hpp"
@@ -124,11 +134,8 @@ int nnuePieces[PIECE_N] = {blank, wpawn,  wknight, wbishop, wrook,   wqueen,
 
 int toNNUEPiece(Piece piece) { return nnuePieces[piece]; }
 
-inline Value evaluate_nnue(const Position &pos) {
-  Bitboard bitboard;
-  Square sq;
-  int pieces[33];
-  int squares[33];
+// Fill the NNUE piece and square lists of a position (Kings first)
+static void nnueInput(const Position &pos, int *pieces, int *squares) {
   int index = 0;
 
   // Set king squares
@@ -154,25 +161,50 @@ inline Value evaluate_nnue(const Position &pos) {
 
   pieces[index] = 0;
   squares[index] = 0;
+}
 
-  if (pos.state()->plies > 2) {
-    // Get previous nnue accumulator data
-    NNUEdata *data[3];
-    data[0] = &(pos.state()->nnueData);
-    data[1] = &(pos.state()->previous->nnueData);
-    data[2] = &(pos.state()->previous->previous->nnueData);
+inline Value evaluate_nnue(const Position &pos, const NNUENet *net) {
+  int pieces[33];
+  int squares[33];
 
-    return nnue_evaluate_incremental(pos.sideToMove(), pieces, squares, data);
-  } else
-    return nnue_evaluate(pos.sideToMove(), pieces, squares);
+  nnueInput(pos, pieces, squares);
+
+  // Accumulators are only computed here, the kernels update from the closest
+  // computed one with the moves made since
+  NNUEdata *data[NNUE_HISTORY];
+  BoardState *st = pos.state();
+  int n = 0;
+  while (st && n < NNUE_HISTORY) {
+    data[n++] = &st->nnueData;
+    st = st->previous;
+  }
+  if (n < NNUE_HISTORY)
+    data[n] = nullptr;
+
+  return nnue_evaluate_incremental(net, pos.sideToMove(), pieces, squares,
+                                   data);
 }
 
 // Evaluate the position
-Value evaluate(const Position &pos) {
+Value evaluate(const Position &pos, Material::Table &materialTable,
+               const NNUENet *net) {
+
+  Material::Entry *me = Material::probe(pos, materialTable);
 
-  Value nnue = evaluate_nnue(pos);
+  Value v;
 
-  Value v = nnue * 5 / 4 + 28;
+  // Known endgames don't need the network
+  if (me->specialisedEval())
+    v = me->evaluate(pos);
+  else {
+    Value nnue = evaluate_nnue(pos, net);
+
+    v = nnue * 5 / 4 + 28;
+
+    // Scale down drawish material configurations
+    const Colour strong = v > 0 ? pos.sideToMove() : ~pos.sideToMove();
+    v = v * me->scaleFactor(pos, strong) / SCALE_NORMAL;
+  }
 
   v = v * (100 - pos.fiftyMove()) / 100;
 
@@ -181,4 +213,500 @@ Value evaluate(const Position &pos) {
   return v;
 }
 
+/******************************************\
+|==========================================|
+|             NNUE Kernel Test             |
+|==========================================|
+\******************************************/
+
+// Position of the test corpus, with the move from its parent
+struct NNUESample {
+  int player;
+  int pieces[33];
+  int squares[33];
+  int parent;
+  DirtyPiece dirtyPiece;
+};
+
+static void addSample(std::vector<NNUESample> &samples, const Position &pos,
+                      int parent) {
+  NNUESample sample{};
+  sample.player = pos.sideToMove();
+  nnueInput(pos, sample.pieces, sample.squares);
+  sample.parent = parent;
+  sample.dirtyPiece = pos.state()->nnueData.dirtyPiece;
+  samples.push_back(sample);
+}
+
+// Accumulator updates timed by nnuetest, by the move from the parent
+enum UpdatePattern { QUIET, CAPTURE, CASTLING, KING_MOVE, REFRESH, PATTERN_N };
+
+static const char *patternNames[PATTERN_N] = {"Quiet", "Capture", "Castling",
+                                              "King", "Refresh"};
+
+static UpdatePattern updatePattern(const NNUESample &sample) {
+  if (sample.parent < 0)
+    return REFRESH;
+
+  const DirtyPiece &dp = sample.dirtyPiece;
+  if (dp.pc[0] == wking || dp.pc[0] == bking)
+    return dp.dirtyNum == 2 && dp.to[1] != NO_SQ ? CASTLING : KING_MOVE;
+
+  // Captures and promotions change 3 features
+  return dp.dirtyNum == 1 ? QUIET : CAPTURE;
+}
+
+static Board sampleBoard(NNUESample &sample, const void *weights,
+                         NNUEdata *data, NNUEdata *parentData,
+                         NNUEdata *grandparentData = nullptr) {
+  Board board;
+  board.weights = weights;
+  board.player = sample.player;
+  board.pieces = sample.pieces;
+  board.squares = sample.squares;
+  board.nnue[0] = data;
+  board.nnue[1] = parentData;
+  if (parentData) {
+    board.nnue[2] = grandparentData;
+    if (grandparentData)
+      board.nnue[3] = nullptr;
+  }
+  return board;
+}
+
+// Compare the NNUE kernels usable on this CPU with the scalar ones over the
+// bench positions and the positions two plies after them, then time them
+void testNNUE(const std::string &benchFile, NNUENet *net) {
+  std::cout << "\n\n	NNUE Kernel Test\n" << std::endl;
+
+  const NNUEKernels *kernels[8];
+  const void *weights[8];
+  const unsigned numKernels = nnue_kernels_list(net, kernels, weights, 8);
+
+  // Build the corpus
+  std::vector<NNUESample> samples;
+  Position pos;
+  BoardState st{}, st1{}, st2{};
+
+  for (const PerftPosition &p : readBenchFile(benchFile)) {
+    pos.set(p.fen, st);
+    const int root = samples.size();
+    addSample(samples, pos, -1);
+
+    for (Move move : MoveList<ALL>(pos)) {
+      pos.makeMove(move, st1);
+      const int child = samples.size();
+      addSample(samples, pos, root);
+
+      for (Move reply : MoveList<ALL>(pos)) {
+        pos.makeMove(reply, st2);
+        addSample(samples, pos, child);
+        pos.unmakeMove(reply);
+      }
+
+      pos.unmakeMove(move);
+    }
+  }
+
+  const size_t n = samples.size();
+  std::vector<int> reference(n);
+  std::vector<NNUEdata> data(n);
+  U64 errors = 0;
+
+  std::vector<Board> boards(n);
+  std::vector<Board *> batch(n);
+  std::vector<int> scores(n);
+
+  // Evaluate the samples in batches, with the accumulators to refresh
+  auto evaluateBatches = [&](unsigned k) {
+    constexpr size_t BATCH = 256;
+    for (size_t start = 0; start < n; start += BATCH) {
+      const size_t end = std::min(n, start + BATCH);
+      for (size_t i = start; i < end; ++i) {
+        data[i].accumulator.computedAccumulation = 0;
+        boards[i] = sampleBoard(samples[i], weights[k], &data[i], nullptr);
+        batch[i] = &boards[i];
+      }
+      kernels[k]->evaluate_batch(&batch[start], &scores[start], end - start);
+    }
+  };
+
+  for (unsigned k = 0; k < numKernels; ++k) {
+    U64 fullErrors = 0, incErrors = 0, batchErrors = 0;
+
+    for (size_t i = 0; i < n; ++i) {
+      NNUESample &sample = samples[i];
+
+      // Full refresh of the accumulator
+      data[i].accumulator.computedAccumulation = 0;
+      Board board = sampleBoard(sample, weights[k], &data[i], nullptr);
+      const int full = kernels[k]->evaluate_pos(&board);
+
+      if (k == 0)
+        reference[i] = full;
+      else if (full != reference[i] && ++fullErrors <= 5)
+        std::cout << "	Mismatch (" << kernels[k]->name << ", full): sample "
+                  << i << " " << full << " Expected: " << reference[i]
+                  << std::endl;
+
+      if (sample.parent < 0)
+        continue;
+
+      // Incremental update from the parent's accumulator
+      NNUEdata child;
+      child.accumulator.computedAccumulation = 0;
+      child.dirtyPiece = sample.dirtyPiece;
+      board = sampleBoard(sample, weights[k], &child, &data[sample.parent]);
+      const int inc = kernels[k]->evaluate_pos(&board);
+
+      if (inc != reference[i] && ++incErrors <= 5)
+        std::cout << "	Mismatch (" << kernels[k]->name
+                  << ", incremental): sample " << i << " " << inc
+                  << " Expected: " << reference[i] << std::endl;
+
+      const int grandparent = samples[sample.parent].parent;
+      if (grandparent < 0)
+        continue;
+
+      // Deferred update from the grandparent, the parent never evaluated
+      NNUEdata parent;
+      parent.accumulator.computedAccumulation = 0;
+      parent.dirtyPiece = samples[sample.parent].dirtyPiece;
+      child.accumulator.computedAccumulation = 0;
+      board = sampleBoard(sample, weights[k], &child, &parent,
+                          &data[grandparent]);
+      const int deferred = kernels[k]->evaluate_pos(&board);
+
+      if (deferred != reference[i] && ++incErrors <= 5)
+        std::cout << "	Mismatch (" << kernels[k]->name
+                  << ", deferred): sample " << i << " " << deferred
+                  << " Expected: " << reference[i] << std::endl;
+    }
+
+    evaluateBatches(k);
+
+    for (size_t i = 0; i < n; ++i)
+      if (scores[i] != reference[i] && ++batchErrors <= 5)
+        std::cout << "	Mismatch (" << kernels[k]->name << ", batch): sample "
+                  << i << " " << scores[i] << " Expected: " << reference[i]
+                  << std::endl;
+
+    // Time the evaluations with a full refresh, then with the accumulators
+    // already computed (Transform and hidden layers only), then in a batch
+    double ns[3];
+    for (int mode = 0; mode < 3; ++mode) {
+      constexpr int REPEATS = 4;
+      int sum = 0;
+      const auto start = std::chrono::steady_clock::now();
+
+      for (int r = 0; r < REPEATS; ++r) {
+        if (mode == 2) {
+          evaluateBatches(k);
+          sum += scores[r];
+          continue;
+        }
+
+        for (size_t i = 0; i < n; ++i) {
+          data[i].accumulator.computedAccumulation = mode;
+          Board board =
+              sampleBoard(samples[i], weights[k], &data[i], nullptr);
+          sum += kernels[k]->evaluate_pos(&board);
+        }
+      }
+
+      const auto duration = std::chrono::steady_clock::now() - start;
+      ns[mode] =
+          double(std::chrono::duration_cast<std::chrono::nanoseconds>(duration)
+                     .count()) /
+          (REPEATS * n);
+      // Keep the evaluations from being optimised away
+      if (sum == 0x7FFFFFFF)
+        std::cout << sum;
+    }
+
+    // Time the accumulator updates alone (The parents are computed by the
+    // batch timing above)
+    double updates[PATTERN_N];
+    for (int pattern = 0; pattern < PATTERN_N; ++pattern) {
+      constexpr int REPEATS = 4;
+      size_t count = 0;
+      NNUEdata child;
+      const auto start = std::chrono::steady_clock::now();
+
+      for (int r = 0; r < REPEATS; ++r)
+        for (size_t i = 0; i < n; ++i) {
+          NNUESample &sample = samples[i];
+          if (updatePattern(sample) != pattern)
+            continue;
+
+          child.accumulator.computedAccumulation = 0;
+          child.dirtyPiece = sample.dirtyPiece;
+          Board board =
+              sampleBoard(sample, weights[k], &child,
+                          sample.parent < 0 ? nullptr : &data[sample.parent]);
+          kernels[k]->compute_accumulator(&board);
+          ++count;
+        }
+
+      const auto duration = std::chrono::steady_clock::now() - start;
+      const auto ns =
+          std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+      updates[pattern] = ns ? count * 1000.0 / ns : 0;
+    }
+
+    errors += fullErrors + incErrors + batchErrors;
+    std::cout << "	" << kernels[k]->name << ":	" << (k ? "" : "(Reference) ")
+              << "Mismatches: " << fullErrors << " full, " << incErrors
+              << " incremental, " << batchErrors << " batch, " << std::fixed
+              << std::setprecision(1) << ns[0] << " ns/eval (Refresh), "
+              << ns[1] << " ns/eval (Cached accumulator), " << ns[2]
+              << " ns/eval (Batch)" << std::endl;
+
+    std::cout << "	" << kernels[k]->name << ":	Updates: ";
+    for (int pattern = 0; pattern < PATTERN_N; ++pattern)
+      std::cout << (pattern ? ", " : "") << updates[pattern] << " M/s ("
+                << patternNames[pattern] << ")";
+    std::cout << std::endl;
+  }
+
+  std::cout << "\n==========================================\n" << std::endl;
+  std::cout << "	Positions:	" << n << std::endl;
+  std::cout << "	Kernels:	" << numKernels << std::endl;
+  std::cout << "	Selected:	" << nnue_kernels_name(net) << std::endl;
+  std::cout << "	Result:		" << (errors ? "Failed" : "Passed") << std::endl;
+  std::cout << "\n==========================================\n\n";
+}
+
+/******************************************\
+|==========================================|
+|          HalfKAv2_hm Format Test         |
+|==========================================|
+\******************************************/
+
+// Weight of the synthetic net: a hash of its index in a section of the file,
+// spread over [-range, range]
+static int synthWeight(uint32_t section, uint32_t i, int range) {
+  uint32_t x = i * 0x9E3779B1u + section * 0x85EBCA77u;
+  x ^= x >> 15;
+  x *= 0x2C1B3C6Du;
+  x ^= x >> 12;
+  x *= 0x297A2D39u;
+  x ^= x >> 15;
+  return int(x % uint32_t(2 * range + 1)) - range;
+}
+
+// Write a HalfKAv2_hm net (Stockfish 14.1 file format) with synthetic weights
+static bool writeSynthHalfKA(const std::string &file) {
+  std::vector<char> d;
+  auto put = [&](uint32_t v, int bytes) {
+    for (int b = 0; b < bytes; ++b)
+      d.push_back(char(v >> (8 * b)));
+  };
+
+  const std::string description = "Maestro synthetic HalfKAv2_hm";
+  put(HALFKA_VERSION, 4);
+  put(halfka_transformer_hash() ^ halfka_network_hash(), 4);
+  put(description.size(), 4);
+  d.insert(d.end(), description.begin(), description.end());
+
+  put(halfka_transformer_hash(), 4);
+  for (uint32_t i = 0; i < HALFKA_HALF_DIMS; ++i)
+    put(synthWeight(0, i, 40), 2);
+  for (uint32_t i = 0; i < HALFKA_INPUTS * HALFKA_HALF_DIMS; ++i)
+    put(synthWeight(1, i, 20), 2);
+  for (uint32_t i = 0; i < HALFKA_INPUTS * HALFKA_PSQT_BUCKETS; ++i)
+    put(synthWeight(2, i, 300), 4);
+
+  // The padding of the fc1 rows is not zero, the kernels must skip it
+  for (uint32_t b = 0; b < HALFKA_LAYER_STACKS; ++b) {
+    const uint32_t section = 16 + 8 * b;
+    put(halfka_network_hash(), 4);
+    for (uint32_t o = 0; o < HALFKA_FC0_OUTPUTS + 1; ++o)
+      put(synthWeight(section, o, 2000), 4);
+    for (uint32_t i = 0; i < (HALFKA_FC0_OUTPUTS + 1) * 2 * HALFKA_HALF_DIMS;
+         ++i)
+      put(synthWeight(section + 1, i, 4), 1);
+    for (uint32_t o = 0; o < HALFKA_FC1_OUTPUTS; ++o)
+      put(synthWeight(section + 2, o, 2000), 4);
+    for (uint32_t i = 0; i < HALFKA_FC1_OUTPUTS * HALFKA_FC1_INPUTS; ++i)
+      put(synthWeight(section + 3, i, 30), 1);
+    put(synthWeight(section + 4, 0, 2000), 4);
+    for (uint32_t i = 0; i < HALFKA_FC1_OUTPUTS; ++i)
+      put(synthWeight(section + 5, i, 40), 1);
+  }
+
+  std::ofstream out(file, std::ios::binary);
+  out.write(d.data(), d.size());
+  return bool(out);
+}
+
+// Scores of the synthetic net, computed by a reference implementation of the
+// Stockfish 14.1 inference written from its sources, one piece count bucket
+// and king side each at least
+static const std::pair<const char *, int> halfkaScores[] = {
+    {"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", 1},
+    {"rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq - 0 1", -31},
+    {"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+     52},
+    {"r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1", 123},
+    {"rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8", -28},
+    {"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1", -261},
+    {"2k5/8/8/8/8/8/6Q1/K7 b - - 0 1", 143},
+    {"4k3/8/8/8/8/8/8/4K2R w K - 0 1", -34},
+    {"8/8/8/3k4/8/8/1K6/8 b - - 0 1", -37},
+};
+
+// Check the HalfKAv2_hm kernels against the scores of a synthetic net written
+// to file, which is kept if given
+void testHalfKA(const std::string &file) {
+  std::cout << "\n\n	HalfKAv2_hm Format Test\n" << std::endl;
+
+  const std::string path = file.empty() ? "halfka_test.nnue" : file;
+  NNUENet *net = writeSynthHalfKA(path) ? nnue_load(path.c_str()) : nullptr;
+  if (file.empty())
+    std::remove(path.c_str());
+
+  if (!net) {
+    std::cout << "	Could not write or load " << path << std::endl;
+    std::cout << "	Result:		Failed" << std::endl;
+    return;
+  }
+
+  const NNUEKernels *kernels[8];
+  const void *weights[8];
+  const unsigned numKernels = nnue_kernels_list(net, kernels, weights, 8);
+
+  Position pos;
+  BoardState st{};
+  U64 errors = 0;
+
+  for (unsigned k = 0; k < numKernels; ++k) {
+    U64 kernelErrors = 0;
+
+    for (const auto &[fen, expected] : halfkaScores) {
+      pos.set(fen, st);
+      std::vector<NNUESample> samples;
+      addSample(samples, pos, -1);
+
+      NNUEdata data;
+      data.accumulator.computedAccumulation = 0;
+      Board board = sampleBoard(samples[0], weights[k], &data, nullptr);
+      const int score = kernels[k]->evaluate_pos(&board);
+
+      if (score != expected && ++kernelErrors <= 5)
+        std::cout << "	Mismatch (" << kernels[k]->name << "): " << fen << " "
+                  << score << " Expected: " << expected << std::endl;
+    }
+
+    errors += kernelErrors;
+    std::cout << "	" << kernels[k]->name << ":	Mismatches: " << kernelErrors
+              << std::endl;
+  }
+
+  std::cout << "\n==========================================\n" << std::endl;
+  std::cout << "	Positions:	" << std::size(halfkaScores) << std::endl;
+  std::cout << "	Kernels:	" << numKernels << std::endl;
+  std::cout << "	Result:		" << (errors ? "Failed" : "Passed") << std::endl;
+  std::cout << "\n==========================================\n\n";
+
+  nnue_free(net);
+}
+
+/******************************************\
+|==========================================|
+|           NNUE Batch Evaluation          |
+|==========================================|
+\******************************************/
+
+// Score the positions of a FEN or EPD file with the NNUE, in batches. Each
+// position is written as EPD with its score (Side to move) in a ce opcode.
+void evalBatch(const std::string &file, const std::string &output,
+               const NNUENet *net) {
+  std::ifstream in(file);
+  if (!in.is_open()) {
+    std::cout << "info string Could not open " << file << std::endl;
+    return;
+  }
+
+  std::ofstream outFile;
+  if (!output.empty()) {
+    outFile.open(output);
+    if (!outFile.is_open()) {
+      std::cout << "info string Could not open " << output << std::endl;
+      return;
+    }
+  }
+  std::ostream &out = output.empty() ? std::cout : outFile;
+
+  constexpr size_t BATCH = 1024;
+  std::vector<NNUESample> samples;
+  std::vector<std::string> epds;
+  std::vector<NNUEdata> data(BATCH);
+  std::vector<Board> boards(BATCH);
+  std::vector<Board *> batch(BATCH);
+  std::vector<int> scores(BATCH);
+
+  Position pos;
+  BoardState st{};
+  U64 evaluated = 0, skipped = 0;
+  std::chrono::nanoseconds evalTime{0};
+  const auto start = std::chrono::steady_clock::now();
+
+  auto evaluateSamples = [&]() {
+    const size_t n = samples.size();
+    for (size_t i = 0; i < n; ++i) {
+      data[i].accumulator.computedAccumulation = 0;
+      boards[i] = sampleBoard(samples[i], nullptr, &data[i], nullptr);
+      batch[i] = &boards[i];
+    }
+
+    const auto evalStart = std::chrono::steady_clock::now();
+    nnue_evaluate_batch(net, batch.data(), scores.data(), n);
+    evalTime += std::chrono::steady_clock::now() - evalStart;
+
+    for (size_t i = 0; i < n; ++i)
+      out << epds[i] << " ce " << scores[i] << ";\n";
+
+    evaluated += n;
+    samples.clear();
+    epds.clear();
+  };
+
+  std::string line;
+  while (std::getline(in, line)) {
+    std::istringstream is(line);
+    const std::string epd = readEPDPosition(is);
+
+    if (epd.empty() || epd[0] == '#')
+      continue;
+
+    if (!validBoard(epd)) {
+      ++skipped;
+      continue;
+    }
+
+    pos.set(epd, st);
+    addSample(samples, pos, -1);
+    epds.push_back(epd);
+
+    if (samples.size() == BATCH)
+      evaluateSamples();
+  }
+
+  if (!samples.empty())
+    evaluateSamples();
+  out.flush();
+
+  const double seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+          .count();
+  const double evalSeconds = std::chrono::duration<double>(evalTime).count();
+
+  std::cout << "info string Evaluated " << evaluated << " positions ("
+            << skipped << " skipped) in " << U64(seconds * 1000) << " ms, "
+            << U64(evaluated / std::max(seconds, 1e-9)) << " positions/s, "
+            << U64(evaluated / std::max(evalSeconds, 1e-9))
+            << " evals/s (NNUE)" << std::endl;
+}
+
 } // namespace Maestro::Eval
\ No newline at end of file
@@ -3,6 +3,7 @@
 #define EVAL_HPP
 
 #include "defs.hpp"
+#include "material.hpp"
 
 #include "position.hpp"
 
@@ -16,7 +17,19 @@ void initEval();
 
 int toNNUEPiece(Piece piece);
 
-Value evaluate(const Position &pos);
+Value evaluate(const Position &pos, Material::Table &materialTable,
+               const NNUENet *net);
+
+// Check the NNUE kernels against the scalar ones and time them
+void testNNUE(const std::string &benchFile, NNUENet *net);
+
+// Check the HalfKAv2_hm kernels on a synthetic net written to file (A
+// temporary one if empty) against scores of a reference implementation
+void testHalfKA(const std::string &file);
+
+// Score the positions of a FEN or EPD file with the NNUE
+void evalBatch(const std::string &file, const std::string &output,
+               const NNUENet *net);
 
 } // namespace Eval
 
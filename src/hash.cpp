@@ -154,7 +154,7 @@ int TTable::hashFull(int maxAge) const {
   return cnt / TT_BUCKET_N;
 }
 // Resize the transposition table
-void TTable::resize(size_t mb, ThreadPool &threads) {
+void TTable::resize(size_t mb) {
   constexpr size_t MB = 1ULL << 20;
   U64 keySize = 16ULL;
 
@@ -182,8 +182,6 @@ void TTable::resize(size_t mb, ThreadPool &threads) {
   _hashMask = _count - 1;
 
   _mb = mb;
-
-  clear(threads);
 }
 
 // Clear the transposition table
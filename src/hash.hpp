@@ -141,8 +141,8 @@ public:
   std::tuple<bool, TTData, TTWriter> probe(Key key);
   // Estimate the utilization of the transposition table
   int hashFull(int maxAge = 0) const;
-  // Resize the transposition table
-  void resize(size_t mb, ThreadPool &);
+  // Resize the transposition table (Not cleared, see clear)
+  void resize(size_t mb);
   // Return size of transposition table
   size_t size() const { return _mb; }
   // Clear the transposition table
@@ -1,17 +1,35 @@
 #include <cstring>
 #include <iostream>
 
+#include "cpu.hpp"
 #include "movepicker.hpp"
 #include "perft.hpp"
 #include "uci.hpp"
 
 using namespace Maestro;
 
-int main() {
+int main(int argc, char *argv[]) {
 
-  UCI uci;
+  // Refuse to run on a CPU without the instructions the build relies on
+  CPU::init();
+  const std::string missing = CPU::missing();
+  if (!missing.empty()) {
+    std::cout << "info string Unsupported CPU, this build needs: " << missing
+              << std::endl;
+    return 1;
+  }
 
-  uci.loop();
+  // Time the engine init phases (Not passed on as a command)
+  bool startupProfile = false;
+  if (argc > 1 && !std::strcmp(argv[1], "--startup-profile")) {
+    startupProfile = true;
+    argv[1] = argv[0];
+    --argc, ++argv;
+  }
+
+  UCI uci(startupProfile);
+
+  uci.loop(argc, argv);
 
   // std::istringstream pos(
   //     "position fen r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w
@@ -0,0 +1,69 @@
+#include "defs.hpp"
+#include "endgame.hpp"
+#include "material.hpp"
+#include "position.hpp"
+
+namespace Maestro::Material {
+
+namespace {
+
+// Check if a side has only its king left
+bool isLoneKing(const Position &pos, Colour c) {
+  return !pos.nonPawnMaterial(c) && !pos.count(toPiece(c, PAWN));
+}
+
+} // namespace
+
+Entry *probe(const Position &pos, Table &table) {
+  const Key key = pos.materialKey();
+  Entry *entry = table[key];
+
+  if (entry->key == key)
+    return entry;
+
+  *entry = Entry();
+  entry->key = key;
+
+  // Specialised endgames
+  if ((entry->evaluationFunction = Endgames::probe(key, entry->strongSide)))
+    return entry;
+
+  for (Colour c : {WHITE, BLACK}) {
+    // Mating material vs a lone king
+    if (isLoneKing(pos, ~c) && pos.nonPawnMaterial(c) >= PieceValue[ROOK]) {
+      entry->evaluationFunction = Endgames::KXK;
+      entry->strongSide = c;
+      return entry;
+    }
+  }
+
+  for (Colour c : {WHITE, BLACK}) {
+    const int pawns = pos.count(toPiece(c, PAWN));
+    const Value npm = pos.nonPawnMaterial(c);
+
+    // Bishop and rook pawns (Wrong bishop)
+    if (npm == PieceValue[BISHOP] && pos.count(toPiece(c, BISHOP)) == 1 &&
+        pawns)
+      entry->scalingFunction[c] = Endgames::KBPsK;
+
+    // Pawns vs a lone king (Blocked rook pawns)
+    else if (!npm && pawns >= 2 && isLoneKing(pos, ~c))
+      entry->scalingFunction[c] = Endgames::KPsK;
+
+    // Without pawns, a side needs more than a minor piece advantage to win
+    if (!pawns && npm - pos.nonPawnMaterial(~c) <= PieceValue[BISHOP])
+      entry->factor[c] = npm < PieceValue[ROOK]                    ? SCALE_DRAW
+                         : pos.nonPawnMaterial(~c) <= PieceValue[BISHOP] ? 4
+                                                                        : 14;
+  }
+
+  // Neither side can win (KvK, KvK+minor, minor vs minor...)
+  if (entry->factor[WHITE] == SCALE_DRAW && entry->factor[BLACK] == SCALE_DRAW) {
+    entry->evaluationFunction = Endgames::draw;
+    entry->strongSide = WHITE;
+  }
+
+  return entry;
+}
+
+} // namespace Maestro::Material
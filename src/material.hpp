@@ -0,0 +1,57 @@
+#ifndef MATERIAL_HPP
+#pragma once
+#define MATERIAL_HPP
+
+#include "defs.hpp"
+#include "endgame.hpp"
+#include "position.hpp"
+#include "utils.hpp"
+
+namespace Maestro {
+
+/******************************************\
+|==========================================|
+|             Material Table               |
+|==========================================|
+\******************************************/
+
+// https://www.chessprogramming.org/Material_Hash_Table
+
+namespace Material {
+
+// Material hash entry, stores the specialised evaluation and scale factors of
+// a material configuration (indexed by the material key)
+struct Entry {
+
+  // Check if the material configuration has a specialised evaluation
+  bool specialisedEval() const { return evaluationFunction != nullptr; }
+
+  // Specialised evaluation (Relative to the side to move)
+  Value evaluate(const Position &pos) const {
+    return evaluationFunction(pos, strongSide);
+  }
+
+  // Scale factor for the evaluation when the given side is ahead
+  int scaleFactor(const Position &pos, Colour c) const {
+    const int sf = scalingFunction[c] ? scalingFunction[c](pos, c) : SCALE_NONE;
+    return sf != SCALE_NONE ? sf : factor[c];
+  }
+
+  Key key = ~Key(0);
+  Endgames::EvalFn evaluationFunction = nullptr;
+  Endgames::ScaleFn scalingFunction[COLOUR_N] = {nullptr, nullptr};
+  Colour strongSide = WHITE;
+  int factor[COLOUR_N] = {SCALE_NORMAL, SCALE_NORMAL};
+};
+
+// Material hash table (One per search thread)
+using Table = HashTable<Entry, 8192>;
+
+// Probe the material hash table, computing the entry on a miss
+Entry *probe(const Position &pos, Table &table);
+
+} // namespace Material
+
+} // namespace Maestro
+
+#endif // MATERIAL_HPP
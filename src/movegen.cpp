@@ -4,6 +4,7 @@
 #include "position.hpp"
 #include "utils.hpp"
 #include <iostream>
+#include <string_view>
 
 namespace Maestro {
 
@@ -84,6 +85,10 @@ void refreshMasks(const Position &pos) {
   const Square kingSquare = pos.square<KING>(us);
   BoardState *st = pos.state();
 
+  st->masksReady = true;
+
+  refreshCheckSquares(pos);
+
   // Define king attacks bitboard
   st->kingAttacks = attacksBB<KING>(kingSquare, EMPTYBB);
 
@@ -125,6 +130,25 @@ void refreshMasks(const Position &pos) {
   st->kingBan |= st->attacked;
 }
 
+// Refresh check squares and discovered check candidates
+void refreshCheckSquares(const Position &pos) {
+  const Colour us = pos.sideToMove();
+  const Square enemyKing = pos.square<KING>(~us);
+  BoardState *st = pos.state();
+  Bitboard pinners;
+
+  st->checkSquares[PAWN] = pawnAttacksBB(~us, enemyKing);
+  st->checkSquares[KNIGHT] = attacksBB<KNIGHT>(enemyKing, EMPTYBB);
+  st->checkSquares[BISHOP] = attacksBB<BISHOP>(enemyKing, pos.occupied());
+  st->checkSquares[ROOK] = attacksBB<ROOK>(enemyKing, pos.occupied());
+  st->checkSquares[QUEEN] = st->checkSquares[BISHOP] | st->checkSquares[ROOK];
+  st->checkSquares[KING] = EMPTYBB;
+
+  st->discoverers =
+      pos.sliderBlockers(pos.occupied(us), enemyKing, pinners) &
+      pos.occupied(us);
+}
+
 // Refresh en passant pin
 void refreshEPPin(const Position &pos) {
   const Colour us = pos.sideToMove();
@@ -475,6 +499,7 @@ Move *generateKingMoves(Move *moves, const Position &pos) {
 }
 
 template <GenType gt> Move *generateMoves(Move *moves, const Position &pos) {
+  pos.ensureMasks();
 
   if (pos.sideToMove() == WHITE)
     moves = generateKingMoves<gt, WHITE>(moves, pos);
@@ -503,4 +528,134 @@ template Move *generateMoves<ALL>(Move *moves, const Position &pos);
 template Move *generateMoves<CAPTURES>(Move *moves, const Position &pos);
 template Move *generateMoves<QUIETS>(Move *moves, const Position &pos);
 
-} // namespace Maestro
\ No newline at end of file
+/******************************************\
+|==========================================|
+|               SAN Parsing                |
+|==========================================|
+\******************************************/
+
+// Convert a move in standard algebraic notation, none if it is not legal
+Move sanToMove(const Position &pos, std::string san) {
+  // Check marks and annotations
+  while (!san.empty() && std::string_view("+#!?").find(san.back()) !=
+                             std::string_view::npos)
+    san.pop_back();
+
+  if (san == "O-O" || san == "0-0" || san == "O-O-O" || san == "0-0-0") {
+    const bool kingSide = san.size() == 3;
+    for (Move m : MoveList<ALL>(pos))
+      if (m.is<CASTLE>() && (m.to() > m.from()) == kingSide)
+        return m;
+    return Move::none();
+  }
+
+  // Promotion (e8=Q or e8Q)
+  PieceType promoted = NO_PIECE_TYPE;
+  if (san.size() > 2 && std::string_view("NBRQ").find(san.back()) !=
+                            std::string_view::npos) {
+    promoted = PieceType(std::string_view(" PNBRQK").find(san.back()));
+    san.pop_back();
+    if (san.back() == '=')
+      san.pop_back();
+  }
+
+  if (san.size() < 2)
+    return Move::none();
+
+  const char file = san[san.size() - 2], rank = san.back();
+  if (file < 'a' || file > 'h' || rank < '1' || rank > '8')
+    return Move::none();
+
+  const Square to = toSquare(File(file - 'a'), Rank(rank - '1'));
+  san.resize(san.size() - 2);
+
+  PieceType pt = PAWN;
+  if (!san.empty() && std::string_view("NBRQK").find(san[0]) !=
+                          std::string_view::npos) {
+    pt = PieceType(std::string_view(" PNBRQK").find(san[0]));
+    san.erase(0, 1);
+  }
+
+  // Disambiguation by file, rank or both (Captures are implied)
+  int fromFile = -1, fromRank = -1;
+  for (char c : san) {
+    if (c >= 'a' && c <= 'h')
+      fromFile = c - 'a';
+    else if (c >= '1' && c <= '8')
+      fromRank = c - '1';
+    else if (c != 'x')
+      return Move::none();
+  }
+
+  Move found = Move::none();
+  for (Move m : MoveList<ALL>(pos)) {
+    if (m.to() != to || m.is<CASTLE>() || pos.pieceTypeOn(m.from()) != pt)
+      continue;
+    if ((fromFile >= 0 && fileOf(m.from()) != fromFile) ||
+        (fromRank >= 0 && rankOf(m.from()) != fromRank))
+      continue;
+    if (m.is<PROMOTION>() ? m.promoted() != promoted
+                          : promoted != NO_PIECE_TYPE)
+      continue;
+    // Ambiguous
+    if (found)
+      return Move::none();
+    found = m;
+  }
+
+  return found;
+}
+
+std::string moveToSan(Position &pos, Move move) {
+  std::string san;
+
+  if (move.is<CASTLE>()) {
+    san = move.to() > move.from() ? "O-O" : "O-O-O";
+  } else {
+    const PieceType pt = pos.pieceTypeOn(move.from());
+    const Square from = move.from(), to = move.to();
+
+    if (pt != PAWN) {
+      san = " PNBRQK"[pt];
+
+      // Other pieces of the type reaching the square
+      bool ambiguous = false, sameFile = false, sameRank = false;
+      for (Move m : MoveList<ALL>(pos)) {
+        if (m == move || m.to() != to || m.is<CASTLE>() ||
+            pos.pieceTypeOn(m.from()) != pt)
+          continue;
+        ambiguous = true;
+        sameFile |= fileOf(m.from()) == fileOf(from);
+        sameRank |= rankOf(m.from()) == rankOf(from);
+      }
+
+      if (ambiguous && (!sameFile || sameRank))
+        san += char('a' + fileOf(from));
+      if (ambiguous && sameFile)
+        san += char('1' + rankOf(from));
+    } else if (pos.isCapture(move)) {
+      san = char('a' + fileOf(from));
+    }
+
+    if (pos.isCapture(move))
+      san += 'x';
+
+    san += char('a' + fileOf(to));
+    san += char('1' + rankOf(to));
+
+    if (move.is<PROMOTION>()) {
+      san += '=';
+      san += " PNBRQK"[move.promoted()];
+    }
+  }
+
+  BoardState state;
+  pos.makeMove(move, state);
+  if (pos.isInCheck())
+    san += MoveList<ALL>(pos).empty() ? '#' : '+';
+  pos.unmakeMove(move);
+
+  return san;
+}
+
+} // namespace Maestro
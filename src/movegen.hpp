@@ -2,6 +2,8 @@
 #pragma once
 #define MOVEGEN_HPP
 
+#include <string>
+
 #include "defs.hpp"
 #include "position.hpp"
 
@@ -16,9 +18,19 @@ void refreshMasks(const Position &pos);
 // Refresh en passant pin
 void refreshEPPin(const Position &pos);
 
+// Refresh check squares and discovered check candidates
+void refreshCheckSquares(const Position &pos);
+
 // Generate moves
 template <GenType gt> Move *generateMoves(Move *moves, const Position &pos);
 
+// Convert a move in standard algebraic notation, none if it is not legal
+Move sanToMove(const Position &pos, std::string san);
+
+// Convert a legal move to standard algebraic notation, the move is made and
+// unmade to find check and mate
+std::string moveToSan(Position &pos, Move move);
+
 template <GenType T> struct MoveList {
 
   explicit MoveList(const Position &pos) : last(generateMoves<T>(moves, pos)) {}
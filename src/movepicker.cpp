@@ -15,9 +15,10 @@ namespace Maestro {
 MovePicker::MovePicker(const Position &pos, const Move ttMove,
                        const Depth depth, const int ply, HistoryTable &ht,
                        KillerTable &kt, CaptureHistoryTable &cht,
-                       Continuation **ch)
+                       Continuation **ch, const Pawns::Entry *pawns)
     : _pos(pos), _ttMove(ttMove), _depth(depth), _ht(&ht), _cht(&cht),
-      _skipQuiets(depth == DEPTH_QS), _ply(ply), _cur(0), _end(0), _ch(ch) {
+      _skipQuiets(depth == DEPTH_QS), _ply(ply), _cur(0), _end(0), _ch(ch),
+      _pawns(pawns) {
   _killer1 = kt.probe(ply, 0);
   _killer2 = kt.probe(ply, 1);
 
@@ -52,6 +53,14 @@ template <GenType Type> void MovePicker::score() {
       _values[i] += _ch[1]->probe(_pos, m);
       _values[i] += _ch[2]->probe(_pos, m);
       _values[i] += _ch[3]->probe(_pos, m);
+
+      // Quiet checks
+      if (_pos.checkSquares(_pos.pieceTypeOn(m.from())) & m.to())
+        _values[i] += 4096;
+
+      // Passed pawn pushes, the further advanced the better
+      if (_pawns && _pawns->isPassedPush(_pos.sideToMove(), m))
+        _values[i] += 400 * relativeRank(_pos.sideToMove(), m.to());
     }
   }
 }
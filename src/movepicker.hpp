@@ -7,6 +7,7 @@
 #include "history.hpp"
 #include "move.hpp"
 #include "movegen.hpp"
+#include "pawns.hpp"
 #include "position.hpp"
 #include "utils.hpp"
 
@@ -41,7 +42,7 @@ public:
   // Main Move Picker constructor
   MovePicker(const Position &, const Move, const Depth, const int,
              HistoryTable &, KillerTable &, CaptureHistoryTable &,
-             Continuation **);
+             Continuation **, const Pawns::Entry * = nullptr);
 
   // Probe Cut Move Picker Constructor
   MovePicker(const Position &, const Move, CaptureHistoryTable &,
@@ -67,6 +68,7 @@ private:
   HistoryTable *_ht;
   CaptureHistoryTable *_cht;
   Continuation **_ch;
+  const Pawns::Entry *_pawns;
 
   const Position &_pos;
 
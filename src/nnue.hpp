@@ -64,8 +64,13 @@ typedef struct DirtyPiece {
   int to[3];
 } DirtyPiece;
 
+// Widest accumulator of the supported nets (HalfKP: 256, HalfKAv2_hm: 512)
+#define NNUE_MAX_HALF_DIMS 512
+#define NNUE_PSQT_BUCKETS 8
+
 typedef struct Accumulator {
-  alignas(64) int16_t accumulation[2][256];
+  alignas(64) int16_t accumulation[2][NNUE_MAX_HALF_DIMS];
+  int32_t psqtAccumulation[2][NNUE_PSQT_BUCKETS];
   int computedAccumulation;
 } Accumulator;
 
@@ -78,23 +83,71 @@ typedef struct NNUEdata {
  * position data structure passed to core subroutines
  *  See @nnue_evaluate for a description of parameters
  */
+// Plies searched back for a computed accumulator to update from. The dirty
+// pieces of the plies in between are applied in one pass.
+#define NNUE_HISTORY 8
+
 typedef struct Board {
   int player;
   int *pieces;
   int *squares;
-  NNUEdata *nnue[3];
+  NNUEdata *nnue[NNUE_HISTORY]; // Current ply first, NULL after the last one
+  const void *weights; // Of the net, set by nnue_evaluate_pos
 } Board;
 
-int nnue_evaluate_pos(Board *pos);
+/**
+ * A loaded net (See nnue_load). Nets are read-only once loaded, so several
+ * can be used at once from any thread.
+ */
+typedef struct NNUENet NNUENet;
+
+int nnue_evaluate_pos(const NNUENet *net, Board *pos);
+
+/**
+ * Evaluate n positions into scores, one layer at a time. The first hidden
+ * layer runs on several positions per pass over its weights where the kernels
+ * support it. Every position needs its own NNUEdata.
+ */
+void nnue_evaluate_batch(const NNUENet *net, Board **pos, int *scores,
+                         unsigned n);
+
+/**
+ * Kernels compiled for one instruction set (See nnue_kernels.cpp). They read
+ * the weights of each position from Board.weights, a batch shares those of
+ * the first one.
+ */
+typedef struct NNUEKernels {
+  const char *name;
+  size_t weights_size; // Size of the permuted weights, 64 byte aligned
+  void (*init_weights)(void *weights, const char *transformer);
+  int (*evaluate_pos)(Board *pos);
+  void (*evaluate_batch)(Board **pos, int *scores, unsigned n);
+  void (*compute_accumulator)(Board *pos); // Accumulator only (Benchmarks)
+} NNUEKernels;
+
+/**
+ * Name of the kernels net runs on, the HalfKP ones selected for this CPU by
+ * nnue_init if net is NULL
+ */
+const char *nnue_kernels_name(const NNUENet *net);
+
+/**
+ * Kernels usable on this CPU for net, from the scalar reference to the
+ * selected ones, and the weights of net in their layout (Read on the first
+ * call). Returns how many were stored in list and weights.
+ */
+unsigned nnue_kernels_list(NNUENet *net, const NNUEKernels **list,
+                           const void **weights, unsigned max);
 
 /************************************************************************
  *         EXTERNAL INTERFACES
  *
  * Load a NNUE file using
  *
- *   nnue_init(file_path)
+ *   nnue_init()
+ *   net = nnue_load(file_path)
  *
- * and then probe score using one of three functions, whichever
+ * and then probe score of net using one of three functions, whichever
  * is convenient. From easy to hard
  *
  *   a) nnue_evaluate_fen         - accepts a fen string for evaluation
@@ -105,21 +158,38 @@ int nnue_evaluate_pos(Board *pos);
  **************************************************************************/
 
 /**
- * Load NNUE file
+ * Select the kernels for this CPU
+ */
+void nnue_init();
+
+/**
+ * Load a net: a standard NNUE file, read into the selected kernels, or a blob
+ * written by nnue_export for them, used in place. NULL loads the embedded net.
+ * Returns NULL on failure, free the net with nnue_free.
+ */
+NNUENet *nnue_load(const char *evalFile /** Path to NNUE file or NULL */
+);
+
+void nnue_free(NNUENet *net);
+
+/**
+ * True if the weights of net are mapped from a blob instead of read
  */
- 
- void nnue_init();  // added for emdedded net - ja
- 
- 
-//static void nnue_init(const char *evalFile /** Path to NNUE file */
-//);
+bool nnue_mapped(const NNUENet *net);
+
+/**
+ * Write the weights of net in the layout of its kernels
+ */
+bool nnue_export(const NNUENet *net, const char *path);
 
 /**
  * Evaluate on FEN string
  * Returns
  *   Score relative to side to move in approximate centi-pawns
  */
-int nnue_evaluate_fen(const char *fen /** FEN string to probe evaluation for */
+int nnue_evaluate_fen(
+    const NNUENet *net, /** Net to evaluate with */
+    const char *fen     /** FEN string to probe evaluation for */
 );
 
 /**
@@ -141,8 +211,9 @@ int nnue_evaluate_fen(const char *fen /** FEN string to probe evaluation for */
  *   Score relative to side to move in approximate centi-pawns
  */
 int nnue_evaluate(
-    int player,  /** Side to move: white=0 black=1 */
-    int *pieces, /** Array of pieces */
+    const NNUENet *net, /** Net to evaluate with */
+    int player,         /** Side to move: white=0 black=1 */
+    int *pieces,        /** Array of pieces */
     int *squares /** Corresponding array of squares each piece stands on */
 );
 
@@ -154,12 +225,18 @@ int nnue_evaluate(
  * nnue_data
  *    nnue_data[0] is pointer to NNUEdata for ply i.e. current position
  *    nnue_data[1] is pointer to NNUEdata for ply - 1
- *    nnue_data[2] is pointer to NNUEdata for ply - 2
+ *    ..
+ *    nnue_data[n] is pointer to NNUEdata for ply - n, up to NNUE_HISTORY
+ *    entries followed by NULL if fewer
+ *
+ * Only the plies back to the closest computed accumulator are read, so
+ * accumulators can be left uncomputed until a position is evaluated.
  */
 int nnue_evaluate_incremental(
-    int player,      /** Side to move: white=0 black=1 */
-    int *pieces,     /** Array of pieces */
-    int *squares,    /** Corresponding array of squares each piece stands on */
+    const NNUENet *net, /** Net to evaluate with */
+    int player,         /** Side to move: white=0 black=1 */
+    int *pieces,        /** Array of pieces */
+    int *squares, /** Corresponding array of squares each piece stands on */
     NNUEdata *data[] /** Pointer to NNUEdata* for current and previous plies */
 );
 
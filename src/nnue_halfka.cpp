@@ -0,0 +1,504 @@
+// HalfKAv2_hm NNUE kernels, compiled once per instruction set like
+// nnue_kernels.cpp (See nnue_halfka.hpp for the net)
+//
+// The accumulator updates use the vector types of nnue_simd.hpp, the
+// transform clip and fc0 have SSE4.1, AVX2 and AVX-512 kernels. fc1 and fc2
+// take a few hundred multiplies and stay plain loops.
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+//-------------------
+#include "misc.hpp"
+#include "nnue.hpp"
+#include "nnue_halfka.hpp"
+#include "nnue_simd.hpp"
+
+#ifndef NNUE_ARCH
+#error "NNUE_ARCH must name the kernel variant"
+#endif
+
+#define NNUE_CONCAT_(a, b) a##b
+#define NNUE_CONCAT(a, b) NNUE_CONCAT_(a, b)
+#define NNUE_STR_(a) #a
+#define NNUE_STR(a) NNUE_STR_(a)
+
+namespace NNUE_CONCAT(halfka_, NNUE_ARCH) {
+
+#define KING(c) ((c) ? bking : wking)
+
+enum {
+  HalfDims = HALFKA_HALF_DIMS,
+  Inputs = HALFKA_INPUTS,
+  PsqtBuckets = HALFKA_PSQT_BUCKETS,
+  Fc0Outputs = HALFKA_FC0_OUTPUTS + 1,
+  Fc1Inputs = HALFKA_FC0_OUTPUTS,
+  Fc1Outputs = HALFKA_FC1_OUTPUTS,
+  OutputScale = 16,
+  WeightScaleBits = 6,
+  MaxActive = 32
+};
+
+static_assert(HalfDims <= NNUE_MAX_HALF_DIMS, "Accumulator too small");
+static_assert(PsqtBuckets <= NNUE_PSQT_BUCKETS, "PSQT accumulator too small");
+static_assert(HalfDims % 64 == 0, "HalfDims not a multiple of 64");
+
+enum {
+  PS_W_PAWN = 0,
+  PS_B_PAWN = 1 * 64,
+  PS_W_KNIGHT = 2 * 64,
+  PS_B_KNIGHT = 3 * 64,
+  PS_W_BISHOP = 4 * 64,
+  PS_B_BISHOP = 5 * 64,
+  PS_W_ROOK = 6 * 64,
+  PS_B_ROOK = 7 * 64,
+  PS_W_QUEEN = 8 * 64,
+  PS_B_QUEEN = 9 * 64,
+  PS_KING = 10 * 64 // Both kings
+};
+
+static const uint32_t PieceToIndex[2][14] = {
+    {0, PS_KING, PS_W_QUEEN, PS_W_ROOK, PS_W_BISHOP, PS_W_KNIGHT, PS_W_PAWN,
+     PS_KING, PS_B_QUEEN, PS_B_ROOK, PS_B_BISHOP, PS_B_KNIGHT, PS_B_PAWN, 0},
+    {0, PS_KING, PS_B_QUEEN, PS_B_ROOK, PS_B_BISHOP, PS_B_KNIGHT, PS_B_PAWN,
+     PS_KING, PS_W_QUEEN, PS_W_ROOK, PS_W_BISHOP, PS_W_KNIGHT, PS_W_PAWN, 0}};
+
+// Weights in the layout of the kernels (See init_weights), each Board points
+// to those of its net
+typedef struct LayerStack {
+  alignas(64) int8_t fc0_weights[Fc0Outputs][2 * HalfDims];
+  alignas(64) int8_t fc1_weights[Fc1Outputs][Fc1Inputs];
+  alignas(64) int8_t fc2_weights[Fc1Outputs];
+  int32_t fc0_biases[Fc0Outputs];
+  int32_t fc1_biases[Fc1Outputs];
+  int32_t fc2_bias;
+} LayerStack;
+
+typedef struct NetWeights {
+  alignas(64) int16_t ft_biases[HalfDims];
+  alignas(64) int16_t ft_weights[Inputs * HalfDims];
+  alignas(64) int32_t psqt_weights[Inputs * PsqtBuckets];
+  LayerStack stacks[HALFKA_LAYER_STACKS];
+} NetWeights;
+
+INLINE const NetWeights *net_weights(const Board *pos) {
+  return (const NetWeights *)pos->weights;
+}
+
+typedef struct {
+  size_t size;
+  unsigned values[MaxActive];
+} IndexList;
+
+// Own king on the e-h files, board flipped for black
+INLINE int orient(int c, int s, int ksq) {
+  return s ^ (c == white ? 0x00 : 0x38) ^ ((ksq & 7) < 4 ? 0x07 : 0x00);
+}
+
+// Bucket of the own king, from its oriented rank and mirrored file
+INLINE int king_bucket(int c, int ksq) {
+  const int rank = (c == white ? ksq : ksq ^ 0x38) >> 3;
+  const int file = (ksq & 7) < 4 ? ksq & 7 : 7 - (ksq & 7);
+  return (7 - rank) * 4 + file;
+}
+
+INLINE unsigned make_index(int c, int s, int pc, int ksq) {
+  return orient(c, s, ksq) + PieceToIndex[c][pc] +
+         HALFKA_PS_NB * king_bucket(c, ksq);
+}
+
+static void append_active_indices(const Board *pos, int c, IndexList *active) {
+  const int ksq = pos->squares[c];
+  for (int i = 0; pos->pieces[i]; i++)
+    active->values[active->size++] =
+        make_index(c, pos->squares[i], pos->pieces[i], ksq);
+}
+
+// Record a feature change, cancelling it against the opposite one
+INLINE void push_change(IndexList *list, IndexList *opposite, unsigned index) {
+  for (size_t k = 0; k < opposite->size; k++)
+    if (opposite->values[k] == index) {
+      opposite->values[k] = opposite->values[--opposite->size];
+      return;
+    }
+  list->values[list->size++] = index;
+}
+
+static void append_changed_indices(const Board *pos, int c,
+                                   const DirtyPiece *dp, IndexList *removed,
+                                   IndexList *added) {
+  const int ksq = pos->squares[c];
+  for (int i = 0; i < dp->dirtyNum; i++) {
+    const int pc = dp->pc[i];
+    if (dp->from[i] != 64)
+      push_change(removed, added, make_index(c, dp->from[i], pc, ksq));
+    if (dp->to[i] != 64)
+      push_change(added, removed, make_index(c, dp->to[i], pc, ksq));
+  }
+}
+
+INLINE void add_feature(const NetWeights *net, int16_t *acc, int32_t *psqt,
+                        unsigned index) {
+  const int16_t *column = &net->ft_weights[index * HalfDims];
+  const int32_t *psqtColumn = &net->psqt_weights[index * PsqtBuckets];
+#ifdef VECTOR
+  for (unsigned j = 0; j < HalfDims / (SIMD_WIDTH / 16); j++)
+    ((vec16_t *)acc)[j] =
+        vec_add_16(((vec16_t *)acc)[j], ((const vec16_t *)column)[j]);
+#else
+  for (unsigned j = 0; j < HalfDims; j++)
+    acc[j] += column[j];
+#endif
+  for (unsigned j = 0; j < PsqtBuckets; j++)
+    psqt[j] += psqtColumn[j];
+}
+
+INLINE void sub_feature(const NetWeights *net, int16_t *acc, int32_t *psqt,
+                        unsigned index) {
+  const int16_t *column = &net->ft_weights[index * HalfDims];
+  const int32_t *psqtColumn = &net->psqt_weights[index * PsqtBuckets];
+#ifdef VECTOR
+  for (unsigned j = 0; j < HalfDims / (SIMD_WIDTH / 16); j++)
+    ((vec16_t *)acc)[j] =
+        vec_sub_16(((vec16_t *)acc)[j], ((const vec16_t *)column)[j]);
+#else
+  for (unsigned j = 0; j < HalfDims; j++)
+    acc[j] -= column[j];
+#endif
+  for (unsigned j = 0; j < PsqtBuckets; j++)
+    psqt[j] -= psqtColumn[j];
+}
+
+// Accumulator of one perspective from the biases
+static void refresh_perspective(const Board *pos, Accumulator *acc, int c) {
+  const NetWeights *net = net_weights(pos);
+  IndexList active;
+  active.size = 0;
+  append_active_indices(pos, c, &active);
+
+  memcpy(acc->accumulation[c], net->ft_biases, HalfDims * sizeof(int16_t));
+  memset(acc->psqtAccumulation[c], 0, PsqtBuckets * sizeof(int32_t));
+
+  for (size_t k = 0; k < active.size; k++)
+    add_feature(net, acc->accumulation[c], acc->psqtAccumulation[c],
+                active.values[k]);
+}
+
+// Perspective c from prevAcc with numAdded and numRemoved changes (At most 2)
+// in one pass, instead of a copy and a pass per change. The counts are
+// constants at the call sites, so the inner loops unroll.
+INLINE void fused_update(const NetWeights *net, Accumulator *acc,
+                         const Accumulator *prevAcc, int c,
+                         const IndexList *removed, const IndexList *added,
+                         const unsigned numAdded, const unsigned numRemoved) {
+  const int16_t *addCols[2], *subCols[2];
+  const int32_t *addPsqt[2], *subPsqt[2];
+  for (unsigned k = 0; k < numAdded; k++) {
+    addCols[k] = &net->ft_weights[added->values[k] * HalfDims];
+    addPsqt[k] = &net->psqt_weights[added->values[k] * PsqtBuckets];
+  }
+  for (unsigned k = 0; k < numRemoved; k++) {
+    subCols[k] = &net->ft_weights[removed->values[k] * HalfDims];
+    subPsqt[k] = &net->psqt_weights[removed->values[k] * PsqtBuckets];
+  }
+
+#ifdef VECTOR
+  for (unsigned j = 0; j < HalfDims / (SIMD_WIDTH / 16); j++) {
+    vec16_t v = ((const vec16_t *)prevAcc->accumulation[c])[j];
+    for (unsigned k = 0; k < numRemoved; k++)
+      v = vec_sub_16(v, ((const vec16_t *)subCols[k])[j]);
+    for (unsigned k = 0; k < numAdded; k++)
+      v = vec_add_16(v, ((const vec16_t *)addCols[k])[j]);
+    ((vec16_t *)acc->accumulation[c])[j] = v;
+  }
+#else
+  for (unsigned j = 0; j < HalfDims; j++) {
+    int16_t v = prevAcc->accumulation[c][j];
+    for (unsigned k = 0; k < numRemoved; k++)
+      v -= subCols[k][j];
+    for (unsigned k = 0; k < numAdded; k++)
+      v += addCols[k][j];
+    acc->accumulation[c][j] = v;
+  }
+#endif
+
+  for (unsigned j = 0; j < PsqtBuckets; j++) {
+    int32_t v = prevAcc->psqtAccumulation[c][j];
+    for (unsigned k = 0; k < numRemoved; k++)
+      v -= subPsqt[k][j];
+    for (unsigned k = 0; k < numAdded; k++)
+      v += addPsqt[k][j];
+    acc->psqtAccumulation[c][j] = v;
+  }
+}
+
+// Accumulator from the closest computed one within NNUE_HISTORY plies, with
+// the dirty pieces in between applied at once. Perspectives whose king moved
+// are refreshed.
+static void update_accumulator(Board *pos) {
+  Accumulator *acc = &pos->nnue[0]->accumulator;
+  if (acc->computedAccumulation)
+    return;
+
+  const NetWeights *net = net_weights(pos);
+
+  int ply = 1;
+  while (ply < NNUE_HISTORY && pos->nnue[ply] &&
+         !pos->nnue[ply]->accumulator.computedAccumulation)
+    ply++;
+  const Accumulator *prevAcc =
+      ply < NNUE_HISTORY && pos->nnue[ply] ? &pos->nnue[ply]->accumulator
+                                           : NULL;
+
+  for (int c = 0; c < 2; c++) {
+    bool reset = !prevAcc;
+    for (int i = 0; i < ply && !reset; i++) {
+      const DirtyPiece *dp = &pos->nnue[i]->dirtyPiece;
+      reset = dp->dirtyNum && dp->pc[0] == KING(c);
+    }
+
+    if (reset) {
+      refresh_perspective(pos, acc, c);
+      continue;
+    }
+
+    IndexList removed, added;
+    removed.size = added.size = 0;
+    for (int i = 0; i < ply; i++)
+      append_changed_indices(pos, c, &pos->nnue[i]->dirtyPiece, &removed,
+                             &added);
+
+    // Quiet moves, captures and castling of the other side
+    if (added.size == 1 && removed.size == 1)
+      fused_update(net, acc, prevAcc, c, &removed, &added, 1, 1);
+    else if (added.size == 1 && removed.size == 2)
+      fused_update(net, acc, prevAcc, c, &removed, &added, 1, 2);
+    else if (added.size == 2 && removed.size == 2)
+      fused_update(net, acc, prevAcc, c, &removed, &added, 2, 2);
+    else {
+      memcpy(acc->accumulation[c], prevAcc->accumulation[c],
+             HalfDims * sizeof(int16_t));
+      memcpy(acc->psqtAccumulation[c], prevAcc->psqtAccumulation[c],
+             PsqtBuckets * sizeof(int32_t));
+
+      for (size_t k = 0; k < removed.size; k++)
+        sub_feature(net, acc->accumulation[c], acc->psqtAccumulation[c],
+                    removed.values[k]);
+      for (size_t k = 0; k < added.size; k++)
+        add_feature(net, acc->accumulation[c], acc->psqtAccumulation[c],
+                    added.values[k]);
+    }
+  }
+
+  acc->computedAccumulation = 1;
+}
+
+// Clipped accumulators, side to move first. Returns the PSQT output.
+static int32_t transform(Board *pos, uint8_t *output, int bucket) {
+  update_accumulator(pos);
+
+  const Accumulator *acc = &pos->nnue[0]->accumulator;
+  const int perspectives[2] = {pos->player, !pos->player};
+
+  for (int p = 0; p < 2; p++) {
+    const int16_t *in = acc->accumulation[perspectives[p]];
+    uint8_t *out = &output[p * HalfDims];
+#if defined(USE_AVX512) || defined(USE_AVX2)
+    // vec_packs interleaves the 128-bit lanes of its operands, put the 64-bit
+    // halves back in order
+#if defined(USE_AVX512)
+    const __m512i order = _mm512_setr_epi64(0, 2, 4, 6, 1, 3, 5, 7);
+#define vec_order(a) _mm512_permutexvar_epi64(order, a)
+#else
+#define vec_order(a) _mm256_permute4x64_epi64(a, 0xD8)
+#endif
+    for (unsigned j = 0; j < HalfDims / (SIMD_WIDTH / 8); j++) {
+      const vec16_t s0 = ((const vec16_t *)in)[2 * j];
+      const vec16_t s1 = ((const vec16_t *)in)[2 * j + 1];
+      ((vec8_t *)out)[j] = vec_order(vec_clip_8(vec_packs(s0, s1)));
+    }
+#undef vec_order
+#elif defined(USE_SSE41)
+    for (unsigned j = 0; j < HalfDims / 16; j++) {
+      const __m128i s0 = ((const __m128i *)in)[2 * j];
+      const __m128i s1 = ((const __m128i *)in)[2 * j + 1];
+      ((__m128i *)out)[j] =
+          _mm_max_epi8(_mm_packs_epi16(s0, s1), _mm_setzero_si128());
+    }
+#else
+    for (unsigned j = 0; j < HalfDims; j++)
+      out[j] = in[j] < 0 ? 0 : in[j] > 127 ? 127 : in[j];
+#endif
+  }
+
+  return (acc->psqtAccumulation[perspectives[0]][bucket] -
+          acc->psqtAccumulation[perspectives[1]][bucket]) /
+         2;
+}
+
+INLINE uint8_t clipped_relu(int32_t v) {
+  v >>= WeightScaleBits;
+  return v < 0 ? 0 : v > 127 ? 127 : v;
+}
+
+// Dot product of the clipped features with a row of fc0
+INLINE int32_t fc0_row(const uint8_t *input, const int8_t *row) {
+#if defined(USE_AVX512)
+  const __m512i *iv = (const __m512i *)input;
+  const __m512i *w = (const __m512i *)row;
+  __m512i sum = _mm512_setzero_si512();
+#if defined(USE_VNNI)
+  // Two chains, vpdpbusd has a latency of several cycles
+  __m512i sum1 = _mm512_setzero_si512();
+  for (unsigned j = 0; j < 2 * HalfDims / 64; j += 2) {
+    sum = _mm512_dpbusd_epi32(sum, iv[j], w[j]);
+    sum1 = _mm512_dpbusd_epi32(sum1, iv[j + 1], w[j + 1]);
+  }
+  sum = _mm512_add_epi32(sum, sum1);
+#else
+  for (unsigned j = 0; j < 2 * HalfDims / 64; j++) {
+    const __m512i prod = _mm512_maddubs_epi16(iv[j], w[j]);
+    sum = _mm512_add_epi32(sum, _mm512_madd_epi16(prod, _mm512_set1_epi16(1)));
+  }
+#endif
+  return _mm512_reduce_add_epi32(sum);
+
+#elif defined(USE_AVX2)
+  const __m256i *iv = (const __m256i *)input;
+  const __m256i *w = (const __m256i *)row;
+  __m256i sum = _mm256_setzero_si256();
+#if defined(USE_VNNI)
+  __m256i sum1 = _mm256_setzero_si256();
+  for (unsigned j = 0; j < 2 * HalfDims / 32; j += 2) {
+    sum = dpbusd_256(sum, iv[j], w[j]);
+    sum1 = dpbusd_256(sum1, iv[j + 1], w[j + 1]);
+  }
+  sum = _mm256_add_epi32(sum, sum1);
+#else
+  for (unsigned j = 0; j < 2 * HalfDims / 32; j++) {
+    const __m256i prod = _mm256_maddubs_epi16(iv[j], w[j]);
+    sum = _mm256_add_epi32(sum, _mm256_madd_epi16(prod, _mm256_set1_epi16(1)));
+  }
+#endif
+  __m128i sum128 = _mm_add_epi32(_mm256_castsi256_si128(sum),
+                                 _mm256_extracti128_si256(sum, 1));
+  sum128 = _mm_add_epi32(sum128, _mm_shuffle_epi32(sum128, 0x1b));
+  return _mm_cvtsi128_si32(sum128) + _mm_extract_epi32(sum128, 1);
+
+#elif defined(USE_SSE41)
+  const __m128i *iv = (const __m128i *)input;
+  const __m128i *w = (const __m128i *)row;
+  __m128i sum = _mm_setzero_si128();
+  for (unsigned j = 0; j < 2 * HalfDims / 16; j++) {
+    const __m128i prod = _mm_maddubs_epi16(iv[j], w[j]);
+    sum = _mm_add_epi32(sum, _mm_madd_epi16(prod, _mm_set1_epi16(1)));
+  }
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x1b));
+  return _mm_cvtsi128_si32(sum) + _mm_extract_epi32(sum, 1);
+
+#else
+  int32_t sum = 0;
+  for (unsigned i = 0; i < 2 * HalfDims; i++)
+    sum += input[i] * row[i];
+  return sum;
+#endif
+}
+
+// Layer stack of the bucket on the transformed features
+static int32_t propagate(const LayerStack *s, const uint8_t *input) {
+  int32_t fc0[Fc0Outputs];
+  for (unsigned o = 0; o < Fc0Outputs; o++)
+    fc0[o] = fc0_row(input, s->fc0_weights[o]) + s->fc0_biases[o];
+
+  uint8_t ac0[Fc1Inputs];
+  for (unsigned i = 0; i < Fc1Inputs; i++)
+    ac0[i] = clipped_relu(fc0[i]);
+
+  uint8_t ac1[Fc1Outputs];
+  for (unsigned o = 0; o < Fc1Outputs; o++) {
+    int32_t sum = s->fc1_biases[o];
+    for (unsigned i = 0; i < Fc1Inputs; i++)
+      sum += ac0[i] * s->fc1_weights[o][i];
+    ac1[o] = clipped_relu(sum);
+  }
+
+  int32_t out = s->fc2_bias;
+  for (unsigned i = 0; i < Fc1Outputs; i++)
+    out += ac1[i] * s->fc2_weights[i];
+
+  // The skipped output is scaled so 127 << WeightScaleBits is 600 units
+  const int32_t fwd = fc0[Fc1Inputs] * (600 * OutputScale) /
+                      (127 * (1 << WeightScaleBits));
+  return out + fwd;
+}
+
+// Evaluation function
+static int evaluate_pos(Board *pos) {
+  alignas(64) uint8_t input[2 * HalfDims];
+
+  int count = 0;
+  while (pos->pieces[count])
+    count++;
+  const int bucket = (count - 1) / 4;
+
+  const int32_t psqt = transform(pos, input, bucket);
+  const int32_t positional =
+      propagate(&net_weights(pos)->stacks[bucket], input);
+
+  return (psqt + positional) / OutputScale;
+}
+
+static void evaluate_batch(Board **pos, int *scores, unsigned n) {
+  for (unsigned i = 0; i < n; i++)
+    scores[i] = evaluate_pos(pos[i]);
+}
+
+// Compute the accumulator only, for the update benchmark of nnuetest
+static void compute_accumulator(Board *pos) { update_accumulator(pos); }
+
+// Read the weights, starting at the feature transformer header
+static void init_weights(void *weights, const char *transformer) {
+  NetWeights *w = (NetWeights *)weights;
+  const char *d = transformer + 4;
+
+  for (unsigned i = 0; i < HalfDims; i++, d += 2)
+    w->ft_biases[i] = readu_le_u16(d);
+  for (unsigned i = 0; i < Inputs * HalfDims; i++, d += 2)
+    w->ft_weights[i] = readu_le_u16(d);
+  for (unsigned i = 0; i < Inputs * PsqtBuckets; i++, d += 4)
+    w->psqt_weights[i] = readu_le_u32(d);
+
+  for (unsigned b = 0; b < HALFKA_LAYER_STACKS; b++) {
+    LayerStack *s = &w->stacks[b];
+    d += 4;
+
+    for (unsigned o = 0; o < Fc0Outputs; o++, d += 4)
+      s->fc0_biases[o] = readu_le_u32(d);
+    for (unsigned o = 0; o < Fc0Outputs; o++)
+      for (unsigned i = 0; i < 2 * HalfDims; i++)
+        s->fc0_weights[o][i] = *d++;
+
+    for (unsigned o = 0; o < Fc1Outputs; o++, d += 4)
+      s->fc1_biases[o] = readu_le_u32(d);
+    for (unsigned o = 0; o < Fc1Outputs; o++)
+      for (unsigned i = 0; i < HALFKA_FC1_INPUTS; i++, d++)
+        if (i < Fc1Inputs)
+          s->fc1_weights[o][i] = *d;
+
+    s->fc2_bias = readu_le_u32(d);
+    d += 4;
+    for (unsigned i = 0; i < Fc1Outputs; i++)
+      s->fc2_weights[i] = *d++;
+  }
+}
+
+} // namespace NNUE_CONCAT(halfka_, NNUE_ARCH)
+
+extern const NNUEKernels NNUE_CONCAT(nnue_halfka_, NNUE_ARCH) = {
+    "halfka-" NNUE_STR(NNUE_ARCH),
+    sizeof(NNUE_CONCAT(halfka_, NNUE_ARCH)::NetWeights),
+    NNUE_CONCAT(halfka_, NNUE_ARCH)::init_weights,
+    NNUE_CONCAT(halfka_, NNUE_ARCH)::evaluate_pos,
+    NNUE_CONCAT(halfka_, NNUE_ARCH)::evaluate_batch,
+    NNUE_CONCAT(halfka_, NNUE_ARCH)::compute_accumulator};
@@ -0,0 +1,63 @@
+#ifndef NNUE_HALFKA_H
+#define NNUE_HALFKA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * HalfKAv2_hm network (Stockfish 14.1 format)
+ *
+ *   Features: (king bucket, piece, square) for both kings included, with the
+ *             own king mirrored to the e-h files: 32 buckets x 11 x 64
+ *   Layers:   22528 -> 512x2 -> 8 layer stacks of 16 -> 32 -> 1, the stack
+ *             and the PSQT bucket picked by the piece count
+ *
+ * The 16th output of the first layer skips the next ones and is added to the
+ * output.
+ */
+enum {
+  HALFKA_VERSION = 0x7AF32F20,
+  HALFKA_PS_NB = 11 * 64,
+  HALFKA_INPUTS = 32 * HALFKA_PS_NB,
+  HALFKA_HALF_DIMS = 512,
+  HALFKA_PSQT_BUCKETS = 8,
+  HALFKA_LAYER_STACKS = 8,
+  HALFKA_FC0_OUTPUTS = 15,
+  HALFKA_FC1_OUTPUTS = 32,
+  HALFKA_FC1_INPUTS = 32 // Padded from HALFKA_FC0_OUTPUTS
+};
+
+// Sizes of the sections of the file
+enum {
+  HALFKA_TRANSFORMER_SIZE = 4 + 2 * HALFKA_HALF_DIMS +
+                            2 * HALFKA_HALF_DIMS * HALFKA_INPUTS +
+                            4 * HALFKA_PSQT_BUCKETS * HALFKA_INPUTS,
+  HALFKA_STACK_SIZE =
+      4 + (HALFKA_FC0_OUTPUTS + 1) * (4 + 2 * HALFKA_HALF_DIMS) +
+      HALFKA_FC1_OUTPUTS * (4 + HALFKA_FC1_INPUTS) + (4 + HALFKA_FC1_OUTPUTS)
+};
+
+// Layer hashes, chained like the layers (Input -> affine -> clipped ReLU ...)
+
+static inline uint32_t halfka_affine_hash(uint32_t outputs, uint32_t prev) {
+  return (0xCC03DAE4u + outputs) ^ (prev >> 1) ^ (prev << 31);
+}
+
+static inline uint32_t halfka_relu_hash(uint32_t prev) {
+  return 0x538D24C7u + prev;
+}
+
+// Hash of the feature transformer header
+static inline uint32_t halfka_transformer_hash() {
+  return 0x7F234CB8u ^ (2 * HALFKA_HALF_DIMS);
+}
+
+// Hash in front of every layer stack
+static inline uint32_t halfka_network_hash() {
+  uint32_t h = 0xEC42E90Du ^ (2 * HALFKA_HALF_DIMS);
+  h = halfka_relu_hash(halfka_affine_hash(HALFKA_FC0_OUTPUTS + 1, h));
+  h = halfka_relu_hash(halfka_affine_hash(HALFKA_FC1_OUTPUTS, h));
+  return halfka_affine_hash(1, h);
+}
+
+#endif
@@ -0,0 +1,1641 @@
+// NNUE kernels, compiled once per instruction set (See CMakeLists.txt)
+//
+// NNUE_ARCH names the variant and USE_* selects its SIMD code paths. Every
+// variant lives in its own namespace and exports an NNUEKernels table, which
+// nnue.cpp picks at startup from the CPU features.
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//-------------------
+#include "misc.hpp"
+#include "nnue.hpp"
+#include "nnue_simd.hpp"
+
+#ifndef NNUE_ARCH
+#error "NNUE_ARCH must name the kernel variant"
+#endif
+
+#define NNUE_CONCAT_(a, b) a##b
+#define NNUE_CONCAT(a, b) NNUE_CONCAT_(a, b)
+#define NNUE_STR_(a) #a
+#define NNUE_STR(a) NNUE_STR_(a)
+
+namespace NNUE_CONCAT(nnue_, NNUE_ARCH) {
+
+
+#define KING(c) ((c) ? bking : wking)
+#define IS_KING(p) (((p) == wking) || ((p) == bking))
+//-------------------
+
+// Old gcc on Windows is unable to provide a 32-byte aligned stack.
+// We need to hack around this when using AVX2 and AVX512.
+#if defined(__GNUC__) && (__GNUC__ < 9) && defined(_WIN32) &&                  \
+    !defined(__clang__) && !defined(__INTEL_COMPILER) && defined(USE_AVX2)
+#define ALIGNMENT_HACK
+#endif
+
+#if defined(USE_NEON) && !defined(IS_64BIT)
+INLINE int16x8_t vmovl_high_s16(int8x16_t v) {
+  return vmovl_s16(vget_high_s16(v));
+}
+#endif
+
+enum {
+  PS_W_PAWN = 1,
+  PS_B_PAWN = 1 * 64 + 1,
+  PS_W_KNIGHT = 2 * 64 + 1,
+  PS_B_KNIGHT = 3 * 64 + 1,
+  PS_W_BISHOP = 4 * 64 + 1,
+  PS_B_BISHOP = 5 * 64 + 1,
+  PS_W_ROOK = 6 * 64 + 1,
+  PS_B_ROOK = 7 * 64 + 1,
+  PS_W_QUEEN = 8 * 64 + 1,
+  PS_B_QUEEN = 9 * 64 + 1,
+  PS_END = 10 * 64 + 1
+};
+
+uint32_t PieceToIndex[2][14] = {
+    {0, 0, PS_W_QUEEN, PS_W_ROOK, PS_W_BISHOP, PS_W_KNIGHT, PS_W_PAWN, 0,
+     PS_B_QUEEN, PS_B_ROOK, PS_B_BISHOP, PS_B_KNIGHT, PS_B_PAWN, 0},
+    {0, 0, PS_B_QUEEN, PS_B_ROOK, PS_B_BISHOP, PS_B_KNIGHT, PS_B_PAWN, 0,
+     PS_W_QUEEN, PS_W_ROOK, PS_W_BISHOP, PS_W_KNIGHT, PS_W_PAWN, 0}};
+
+// Constants used in evaluation value calculation
+enum { FV_SCALE = 16, SHIFT = 6 };
+
+enum {
+  kHalfDimensions = 256,
+  FtInDims = 64 * PS_END, // 64 * 641
+  FtOutDims = kHalfDimensions * 2
+};
+
+static_assert(kHalfDimensions % 256 == 0,
+              "kHalfDimensions should be a multiple of 256");
+
+
+#ifdef IS_64BIT
+typedef uint64_t mask2_t;
+#else
+typedef uint32_t mask2_t;
+#endif
+
+typedef int8_t clipped_t;
+#if defined(USE_MMX) || (defined(USE_SSE2) && !defined(USE_AVX2))
+typedef int16_t weight_t;
+#else
+typedef int8_t weight_t;
+#endif
+
+typedef struct {
+  size_t size;
+  unsigned values[30];
+} IndexList;
+
+INLINE int orient(int c, int s) { return s ^ (c == white ? 0x00 : 0x3f); }
+
+INLINE unsigned make_index(int c, int s, int pc, int ksq) {
+  return orient(c, s) + PieceToIndex[c][pc] + PS_END * ksq;
+}
+
+static void half_kp_append_active_indices(const Board *pos, const int c,
+                                          IndexList *active) {
+  int ksq = pos->squares[c];
+  ksq = orient(c, ksq);
+  for (int i = 2; pos->pieces[i]; i++) {
+    int sq = pos->squares[i];
+    int pc = pos->pieces[i];
+    active->values[active->size++] = make_index(c, sq, pc, ksq);
+  }
+}
+
+// Record a feature change, cancelling it against the opposite one (A piece
+// moving back) so its column is not read twice
+INLINE void push_change(IndexList *list, IndexList *opposite, unsigned index) {
+  for (size_t k = 0; k < opposite->size; k++)
+    if (opposite->values[k] == index) {
+      opposite->values[k] = opposite->values[--opposite->size];
+      return;
+    }
+  list->values[list->size++] = index;
+}
+
+static void half_kp_append_changed_indices(const Board *pos, const int c,
+                                           const DirtyPiece *dp,
+                                           IndexList *removed,
+                                           IndexList *added) {
+  int ksq = pos->squares[c];
+  ksq = orient(c, ksq);
+  for (int i = 0; i < dp->dirtyNum; i++) {
+    int pc = dp->pc[i];
+    if (IS_KING(pc))
+      continue;
+    if (dp->from[i] != 64)
+      push_change(removed, added, make_index(c, dp->from[i], pc, ksq));
+    if (dp->to[i] != 64)
+      push_change(added, removed, make_index(c, dp->to[i], pc, ksq));
+  }
+}
+
+static void append_active_indices(const Board *pos, IndexList active[2]) {
+  for (unsigned c = 0; c < 2; c++)
+    half_kp_append_active_indices(pos, c, &active[c]);
+}
+
+// Changes since the closest computed accumulator, which is returned (NULL if
+// there is none within NNUE_HISTORY plies). A perspective whose king moved, or
+// with more changes than pieces, is reset to its active features instead.
+static const Accumulator *append_changed_indices(const Board *pos,
+                                                 IndexList removed[2],
+                                                 IndexList added[2],
+                                                 bool reset[2]) {
+  int ply = 1;
+  while (ply < NNUE_HISTORY && pos->nnue[ply] &&
+         !pos->nnue[ply]->accumulator.computedAccumulation)
+    ply++;
+  if (ply == NNUE_HISTORY || !pos->nnue[ply])
+    return NULL;
+
+  unsigned count = 0;
+  while (pos->pieces[count + 2])
+    count++;
+
+  for (unsigned c = 0; c < 2; c++) {
+    reset[c] = false;
+    for (int i = 0; i < ply && !reset[c]; i++) {
+      const DirtyPiece *dp = &pos->nnue[i]->dirtyPiece;
+      reset[c] = dp->dirtyNum && dp->pc[0] == (int)KING(c);
+    }
+
+    for (int i = 0; i < ply && !reset[c]; i++)
+      half_kp_append_changed_indices(pos, c, &pos->nnue[i]->dirtyPiece,
+                                     &removed[c], &added[c]);
+
+    if (reset[c] || removed[c].size + added[c].size >= count) {
+      reset[c] = true;
+      removed[c].size = added[c].size = 0;
+      half_kp_append_active_indices(pos, c, &added[c]);
+    }
+  }
+
+  return &pos->nnue[ply]->accumulator;
+}
+
+// InputLayer = InputSlice<256 * 2>
+// out: 512 x clipped_t
+
+// Hidden1Layer = ClippedReLu<AffineTransform<InputLayer, 32>>
+// 512 x clipped_t -> 32 x int32_t -> 32 x clipped_t
+
+// Hidden2Layer = ClippedReLu<AffineTransform<hidden1, 32>>
+// 32 x clipped_t -> 32 x int32_t -> 32 x clipped_t
+
+// OutputLayer = AffineTransform<HiddenLayer2, 1>
+// 32 x clipped_t -> 1 x int32_t
+
+// Weights in the layout of this variant's kernels: read by init_weights, or
+// mapped from a blob written by nnue_export. Each Board points to the weights
+// of its net.
+typedef struct NetWeights {
+  alignas(64) int16_t ft_biases[kHalfDimensions];
+  alignas(64) int16_t ft_weights[kHalfDimensions * FtInDims];
+#if !defined(USE_AVX512)
+  alignas(64) weight_t hidden1_weights[32 * 512];
+  alignas(64) weight_t hidden2_weights[32 * 32];
+#else
+  alignas(64) weight_t hidden1_weights[64 * 512];
+  alignas(64) weight_t hidden2_weights[64 * 32];
+#endif
+  alignas(64) weight_t output_weights[1 * 32];
+
+  alignas(64) int32_t hidden1_biases[32];
+  alignas(64) int32_t hidden2_biases[32];
+  int32_t output_biases[1];
+} NetWeights;
+
+INLINE const NetWeights *net_weights(const Board *pos) {
+  return (const NetWeights *)pos->weights;
+}
+
+INLINE int32_t affine_propagate(clipped_t *input, const int32_t *biases,
+                                const weight_t *weights) {
+#if defined(USE_AVX2)
+  __m256i *iv = (__m256i *)input;
+  __m256i *row = (__m256i *)weights;
+#if defined(USE_VNNI)
+  __m256i prod = dpbusd_256(_mm256_setzero_si256(), iv[0], row[0]);
+#else
+  __m256i prod = _mm256_maddubs_epi16(iv[0], row[0]);
+  prod = _mm256_madd_epi16(prod, _mm256_set1_epi16(1));
+#endif
+  __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(prod),
+                              _mm256_extracti128_si256(prod, 1));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x1b));
+  return _mm_cvtsi128_si32(sum) + _mm_extract_epi32(sum, 1) + biases[0];
+
+#elif defined(USE_SSE2)
+  __m128i *iv = (__m128i *)input;
+  __m128i *row = (__m128i *)weights;
+#if defined(AVOID_USE_SSSE3)
+  const __m128i kOnes = _mm_set1_epi16(1);
+  __m128i p0 = _mm_madd_epi16(_mm_maddubs_epi16(iv[0], row[0]), kOnes);
+  __m128i p1 = _mm_madd_epi16(_mm_maddubs_epi16(iv[1], row[1]), kOnes);
+  __m128i sum = _mm_add_epi32(p0, p1);
+#else
+  __m128i p0 = _mm_madd_epi16(iv[0], row[0]);
+  __m128i p1 = _mm_madd_epi16(iv[1], row[1]);
+  __m128i p2 = _mm_madd_epi16(iv[2], row[2]);
+  __m128i p3 = _mm_madd_epi16(iv[3], row[3]);
+  __m128i sum = _mm_add_epi32(_mm_add_epi32(p0, p1), _mm_add_epi32(p2, p3));
+#endif
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xb));
+#if defined(USE_SSE41)
+  return _mm_cvtsi128_si32(sum) + _mm_extract_epi32(sum, 1) + biases[0];
+#else
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x1));
+  return _mm_cvtsi128_si32(sum) + biases[0];
+#endif
+
+#elif defined(USE_MMX)
+  __m64 *iv = (__m64 *)input;
+  __m64 s0 = _mm_setzero_si64(), s1 = s0;
+  __m64 *row = (__m64 *)weights;
+  for (unsigned j = 0; j < 4; j++) {
+    s0 = _mm_add_pi32(s0, _mm_madd_pi16(row[2 * j], iv[2 * j]));
+    s1 = _mm_add_pi32(s1, _mm_madd_pi16(row[2 * j + 1], iv[2 * j + 1]));
+  }
+  __m64 sum = _mm_add_pi32(s0, s1);
+  sum = _mm_add_pi32(sum, _mm_unpackhi_pi32(sum, sum));
+  return _mm_cvtsi64_si32(sum) + biases[0];
+
+#elif defined(USE_NEON)
+  int8x8_t *iv = (int8x8_t *)input;
+  int32x4_t sum = {biases[0]};
+  int8x8_t *row = (int8x8_t *)weights;
+  int16x8_t p0 = vmull_s8(iv[0], row[0]);
+  int16x8_t p1 = vmull_s8(iv[1], row[1]);
+  p0 = vmlal_s8(p0, iv[2], row[2]);
+  sum = vpadalq_s16(sum, p0);
+  p1 = vmlal_s8(p1, iv[3], row[3]);
+  sum = vpadalq_s16(sum, p1);
+  return sum[0] + sum[1] + sum[2] + sum[3];
+
+#else
+  int32_t sum = biases[0];
+  for (unsigned j = 0; j < 32; j++)
+    sum += weights[j] * input[j];
+  return sum;
+
+#endif
+}
+
+static_assert(FtOutDims % 64 == 0, "FtOutDims not a multiple of 64");
+
+#ifdef VECTOR
+INLINE bool next_idx(unsigned *idx, unsigned *offset, mask2_t *v, mask_t *mask,
+                     unsigned inDims) {
+  while (*v == 0) {
+    *offset += 8 * sizeof(mask2_t);
+    if (*offset >= inDims)
+      return false;
+    memcpy(v, (char *)mask + (*offset / 8), sizeof(mask2_t));
+  }
+#ifdef IS_64BIT
+  *idx = *offset + bsf(*v);
+#else
+  *idx = *offset + bsf(*v);
+#endif
+  *v &= *v - 1;
+  return true;
+}
+
+#if defined(USE_MMX) && !defined(USE_SSE)
+INLINE int _mm_movemask_pi8(__m64 v) {
+  const __m64 powers = _mm_set_pi8(-128, 64, 32, 16, 8, 4, 2, 1);
+  __m64 m = _mm_and_si64(v, powers);
+  m = _mm_or_si64(m, _mm_srli_si64(m, 32));
+  m = _mm_or_si64(m, _mm_srli_pi32(m, 16));
+  m = _mm_or_si64(m, _mm_srli_pi16(m, 8));
+  return _mm_cvtsi64_si32(m) & 0xff;
+}
+#elif defined(USE_NEON)
+INLINE int neon_movemask(uint8x16_t v) {
+  const uint8_t __attribute__((aligned(16)))
+  powers[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+  const uint8x16_t kPowers = vld1q_u8(powers);
+
+  uint64x2_t mask = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(vandq_u8(v, kPowers))));
+  return vgetq_lane_u8((uint8x16_t)mask, 0) |
+         (vgetq_lane_u8((uint8x16_t)mask, 8) << 8);
+}
+#endif
+#endif
+
+// Positions of a batch that share a pass over the layer 1 weights (See
+// affine_txfm_lanes), as many as the registers hold the sums of
+#if defined(USE_AVX512)
+#define AFFINE_LANES 4
+#elif defined(USE_AVX2)
+#define AFFINE_LANES 2
+#endif
+
+#if defined(USE_AVX2) && !defined(USE_VNNI)
+// Inputs of the positions of affine_txfm_lanes clipped to 0..127, so an input
+// that is not positive adds 0, and the inputs positive in any of them
+INLINE void lanes_input(int8_t *const *input, mask_t *const *inMask,
+                        unsigned inDims, uint8_t (*clipped)[FtOutDims],
+                        mask_t *anyMask) {
+  for (unsigned l = 0; l < AFFINE_LANES; l++)
+    for (unsigned j = 0; j < inDims / (SIMD_WIDTH / 8); j++)
+      ((vec8_t *)clipped[l])[j] = vec_clip_8(((vec8_t *)input[l])[j]);
+
+  for (unsigned j = 0; j < inDims / (8 * sizeof(mask_t)); j++) {
+    anyMask[j] = 0;
+    for (unsigned l = 0; l < AFFINE_LANES; l++)
+      anyMask[j] |= inMask[l][j];
+  }
+}
+#endif
+
+#if defined(USE_VNNI)
+// Pack the sums to 8 bits and restore the order of the outputs
+#if defined(USE_AVX512)
+INLINE void vnni_output(__m512i out_0, __m512i out_1, void *output,
+                        mask_t *outMask, const bool calc_mask) {
+  __m512i out16 = _mm512_srai_epi16(_mm512_packs_epi32(out_0, out_1), SHIFT);
+  __m256i out8 = _mm256_packs_epi16(_mm512_castsi512_si256(out16),
+                                    _mm512_extracti64x4_epi64(out16, 1));
+  out8 = _mm256_permutevar8x32_epi32(out8,
+                                     _mm256_setr_epi32(0, 4, 2, 6, 1, 5, 3, 7));
+#else
+INLINE void vnni_output(__m256i out_0, __m256i out_1, __m256i out_2,
+                        __m256i out_3, void *output, mask_t *outMask,
+                        const bool calc_mask) {
+  __m256i out16_0 = _mm256_srai_epi16(_mm256_packs_epi32(out_0, out_1), SHIFT);
+  __m256i out16_1 = _mm256_srai_epi16(_mm256_packs_epi32(out_2, out_3), SHIFT);
+  __m256i out8 = _mm256_packs_epi16(out16_0, out16_1);
+  out8 = _mm256_permutevar8x32_epi32(out8,
+                                     _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+#endif
+
+  const __m256i kZero = _mm256_setzero_si256();
+  __m256i *outVec = (__m256i *)output;
+  outVec[0] = _mm256_max_epi8(out8, kZero);
+  if (calc_mask)
+    outMask[0] = (uint32_t)_mm256_movemask_epi8(_mm256_cmpgt_epi8(out8, kZero));
+}
+
+// Dot-product kernel: the weights are stored in blocks of 4 inputs (See
+// wt_idx), so vpdpbusd adds the 4 products of a block into every output.
+// Blocks without a positive input are skipped, inputs are clipped to 0..127.
+INLINE void affine_txfm(int8_t *input, void *output, unsigned inDims,
+                        unsigned outDims, const int32_t *biases,
+                        const weight_t *weights, mask_t *inMask,
+                        mask_t *outMask, const bool pack8_and_calc_mask) {
+  assert(outDims == 32);
+
+  (void)outDims;
+#if defined(USE_AVX512)
+  __m512i out_0 = ((__m512i *)biases)[0];
+  __m512i out_1 = ((__m512i *)biases)[1];
+#else
+  __m256i out_0 = ((__m256i *)biases)[0];
+  __m256i out_1 = ((__m256i *)biases)[1];
+  __m256i out_2 = ((__m256i *)biases)[2];
+  __m256i out_3 = ((__m256i *)biases)[3];
+#endif
+
+  for (unsigned offset = 0; offset < inDims; offset += 64) {
+    // One bit per block of 4 inputs with at least one of them positive
+    uint64_t v;
+    memcpy(&v, (char *)inMask + offset / 8, sizeof(uint64_t));
+    v = (v | v >> 1 | v >> 2 | v >> 3) & 0x1111111111111111ULL;
+
+    while (v) {
+      const unsigned block = (offset + bsf(v)) / 4;
+      v &= v - 1;
+
+      uint32_t factor;
+      memcpy(&factor, &input[4 * block], sizeof(uint32_t));
+#if defined(USE_AVX512)
+      const __m512i *w = (const __m512i *)&weights[128 * block];
+      const __m512i mul = _mm512_set1_epi32(factor);
+      out_0 = _mm512_dpbusd_epi32(out_0, mul, w[0]);
+      out_1 = _mm512_dpbusd_epi32(out_1, mul, w[1]);
+#else
+      const __m256i *w = (const __m256i *)&weights[128 * block];
+      const __m256i mul = _mm256_set1_epi32(factor);
+      out_0 = dpbusd_256(out_0, mul, w[0]);
+      out_1 = dpbusd_256(out_1, mul, w[1]);
+      out_2 = dpbusd_256(out_2, mul, w[2]);
+      out_3 = dpbusd_256(out_3, mul, w[3]);
+#endif
+    }
+  }
+
+#if defined(USE_AVX512)
+  vnni_output(out_0, out_1, output, outMask, pack8_and_calc_mask);
+#else
+  vnni_output(out_0, out_1, out_2, out_3, output, outMask, pack8_and_calc_mask);
+#endif
+}
+
+// Layer 1 of AFFINE_LANES positions in one pass over the weights: each block
+// of weights is loaded once for all of them, and every position accumulates
+// in its own registers. The inputs are clipped to 0..127, so a block without
+// a positive input of a position adds 0 to it.
+INLINE void affine_txfm_lanes(int8_t *const *input, void *const *output,
+                              unsigned inDims, const int32_t *biases,
+                              const weight_t *weights, mask_t *const *inMask,
+                              mask_t *const *outMask) {
+#if defined(USE_AVX512)
+  __m512i out[AFFINE_LANES][2];
+  for (unsigned l = 0; l < AFFINE_LANES; l++)
+    for (unsigned j = 0; j < 2; j++)
+      out[l][j] = ((__m512i *)biases)[j];
+#else
+  __m256i out[AFFINE_LANES][4];
+  for (unsigned l = 0; l < AFFINE_LANES; l++)
+    for (unsigned j = 0; j < 4; j++)
+      out[l][j] = ((__m256i *)biases)[j];
+#endif
+
+  for (unsigned offset = 0; offset < inDims; offset += 64) {
+    // Blocks with a positive input in any of the positions
+    uint64_t v = 0;
+    for (unsigned l = 0; l < AFFINE_LANES; l++) {
+      uint64_t m;
+      memcpy(&m, (char *)inMask[l] + offset / 8, sizeof(uint64_t));
+      v |= m;
+    }
+    v = (v | v >> 1 | v >> 2 | v >> 3) & 0x1111111111111111ULL;
+
+    while (v) {
+      const unsigned block = (offset + bsf(v)) / 4;
+      v &= v - 1;
+
+#if defined(USE_AVX512)
+      const __m512i *w = (const __m512i *)&weights[128 * block];
+      const __m512i w0 = w[0], w1 = w[1];
+#else
+      const __m256i *w = (const __m256i *)&weights[128 * block];
+      const __m256i w0 = w[0], w1 = w[1], w2 = w[2], w3 = w[3];
+#endif
+
+      for (unsigned l = 0; l < AFFINE_LANES; l++) {
+        uint32_t factor;
+        memcpy(&factor, &input[l][4 * block], sizeof(uint32_t));
+#if defined(USE_AVX512)
+        const __m512i mul = _mm512_set1_epi32(factor);
+        out[l][0] = _mm512_dpbusd_epi32(out[l][0], mul, w0);
+        out[l][1] = _mm512_dpbusd_epi32(out[l][1], mul, w1);
+#else
+        const __m256i mul = _mm256_set1_epi32(factor);
+        out[l][0] = dpbusd_256(out[l][0], mul, w0);
+        out[l][1] = dpbusd_256(out[l][1], mul, w1);
+        out[l][2] = dpbusd_256(out[l][2], mul, w2);
+        out[l][3] = dpbusd_256(out[l][3], mul, w3);
+#endif
+      }
+    }
+  }
+
+  for (unsigned l = 0; l < AFFINE_LANES; l++)
+#if defined(USE_AVX512)
+    vnni_output(out[l][0], out[l][1], output[l], outMask[l], true);
+#else
+    vnni_output(out[l][0], out[l][1], out[l][2], out[l][3], output[l],
+                outMask[l], true);
+#endif
+}
+#elif defined(USE_AVX512)
+INLINE void affine_txfm(int8_t *input, void *output, unsigned inDims,
+                        unsigned outDims, const int32_t *biases,
+                        const weight_t *weights, mask_t *inMask,
+                        mask_t *outMask, const bool pack8_and_calc_mask) {
+  assert(outDims == 32);
+
+  (void)outDims;
+  const __m512i kZero = _mm512_setzero_si512();
+  __m512i out_0 = ((__m512i *)biases)[0];
+  __m512i out_1 = ((__m512i *)biases)[1];
+  __m512i first, second;
+  mask2_t v;
+  unsigned idx;
+
+  memcpy(&v, inMask, sizeof(mask2_t));
+  for (unsigned offset = 0; offset < inDims;) {
+    if (!next_idx(&idx, &offset, &v, inMask, inDims))
+      break;
+    first = ((__m512i *)weights)[idx];
+    uint16_t factor = input[idx];
+    if (next_idx(&idx, &offset, &v, inMask, inDims)) {
+      second = ((__m512i *)weights)[idx];
+      factor |= input[idx] << 8;
+    } else {
+      second = kZero;
+    }
+    __m512i mul = _mm512_set1_epi16(factor), prod, signs;
+    prod = _mm512_maddubs_epi16(mul, _mm512_unpacklo_epi8(first, second));
+    signs = _mm512_srai_epi16(prod, 15);
+    out_0 = _mm512_add_epi32(out_0, _mm512_unpacklo_epi16(prod, signs));
+    out_1 = _mm512_add_epi32(out_1, _mm512_unpackhi_epi16(prod, signs));
+  }
+
+  __m512i out16 = _mm512_srai_epi16(_mm512_packs_epi32(out_0, out_1), SHIFT);
+
+  __m256i *outVec = (__m256i *)output;
+  const __m256i kZero256 = _mm256_setzero_si256();
+  outVec[0] = _mm256_packs_epi16(_mm512_castsi512_si256(out16),
+                                 _mm512_extracti64x4_epi64(out16, 1));
+  if (pack8_and_calc_mask)
+    outMask[0] =
+        (uint32_t)_mm256_movemask_epi8(_mm256_cmpgt_epi8(outVec[0], kZero256));
+  else
+    outVec[0] = _mm256_max_epi8(outVec[0], kZero256);
+}
+
+// Layer 1 of AFFINE_LANES positions, over the inputs positive in any of them
+INLINE void affine_txfm_lanes(int8_t *const *input, void *const *output,
+                              unsigned inDims, const int32_t *biases,
+                              const weight_t *weights, mask_t *const *inMask,
+                              mask_t *const *outMask) {
+  const __m512i kZero = _mm512_setzero_si512();
+  __m512i out[AFFINE_LANES][2];
+  alignas(64) uint8_t clipped[AFFINE_LANES][FtOutDims];
+  mask_t anyMask[FtOutDims / (8 * sizeof(mask_t))];
+  unsigned idx, idx2;
+
+  for (unsigned l = 0; l < AFFINE_LANES; l++)
+    for (unsigned j = 0; j < 2; j++)
+      out[l][j] = ((__m512i *)biases)[j];
+  lanes_input(input, inMask, inDims, clipped, anyMask);
+
+  mask2_t v;
+  memcpy(&v, anyMask, sizeof(mask2_t));
+  for (unsigned offset = 0; offset < inDims;) {
+    if (!next_idx(&idx, &offset, &v, anyMask, inDims))
+      break;
+    const bool pair = next_idx(&idx2, &offset, &v, anyMask, inDims);
+    const __m512i first = ((__m512i *)weights)[idx];
+    const __m512i second = pair ? ((__m512i *)weights)[idx2] : kZero;
+    const __m512i w = _mm512_unpacklo_epi8(first, second);
+
+    for (unsigned l = 0; l < AFFINE_LANES; l++) {
+      uint16_t factor = clipped[l][idx];
+      if (pair)
+        factor |= clipped[l][idx2] << 8;
+      __m512i mul = _mm512_set1_epi16(factor), prod, signs;
+      prod = _mm512_maddubs_epi16(mul, w);
+      signs = _mm512_srai_epi16(prod, 15);
+      out[l][0] =
+          _mm512_add_epi32(out[l][0], _mm512_unpacklo_epi16(prod, signs));
+      out[l][1] =
+          _mm512_add_epi32(out[l][1], _mm512_unpackhi_epi16(prod, signs));
+    }
+  }
+
+  const __m256i kZero256 = _mm256_setzero_si256();
+  for (unsigned l = 0; l < AFFINE_LANES; l++) {
+    __m512i out16 =
+        _mm512_srai_epi16(_mm512_packs_epi32(out[l][0], out[l][1]), SHIFT);
+    __m256i *outVec = (__m256i *)output[l];
+    outVec[0] = _mm256_packs_epi16(_mm512_castsi512_si256(out16),
+                                   _mm512_extracti64x4_epi64(out16, 1));
+    outMask[l][0] =
+        (uint32_t)_mm256_movemask_epi8(_mm256_cmpgt_epi8(outVec[0], kZero256));
+  }
+}
+#elif defined(USE_AVX2)
+INLINE void affine_txfm(int8_t *input, void *output, unsigned inDims,
+                        unsigned outDims, const int32_t *biases,
+                        const weight_t *weights, mask_t *inMask,
+                        mask_t *outMask, const bool pack8_and_calc_mask) {
+  assert(outDims == 32);
+
+  (void)outDims;
+  const __m256i kZero = _mm256_setzero_si256();
+  __m256i out_0 = ((__m256i *)biases)[0];
+  __m256i out_1 = ((__m256i *)biases)[1];
+  __m256i out_2 = ((__m256i *)biases)[2];
+  __m256i out_3 = ((__m256i *)biases)[3];
+  __m256i first, second;
+  mask2_t v;
+  unsigned idx;
+
+  memcpy(&v, inMask, sizeof(mask2_t));
+  for (unsigned offset = 0; offset < inDims;) {
+    if (!next_idx(&idx, &offset, &v, inMask, inDims))
+      break;
+    first = ((__m256i *)weights)[idx];
+    uint16_t factor = input[idx];
+    if (next_idx(&idx, &offset, &v, inMask, inDims)) {
+      second = ((__m256i *)weights)[idx];
+      factor |= input[idx] << 8;
+    } else {
+      second = kZero;
+    }
+    __m256i mul = _mm256_set1_epi16(factor), prod, signs;
+    prod = _mm256_maddubs_epi16(mul, _mm256_unpacklo_epi8(first, second));
+    signs = _mm256_cmpgt_epi16(kZero, prod);
+    out_0 = _mm256_add_epi32(out_0, _mm256_unpacklo_epi16(prod, signs));
+    out_1 = _mm256_add_epi32(out_1, _mm256_unpackhi_epi16(prod, signs));
+    prod = _mm256_maddubs_epi16(mul, _mm256_unpackhi_epi8(first, second));
+    signs = _mm256_cmpgt_epi16(kZero, prod);
+    out_2 = _mm256_add_epi32(out_2, _mm256_unpacklo_epi16(prod, signs));
+    out_3 = _mm256_add_epi32(out_3, _mm256_unpackhi_epi16(prod, signs));
+  }
+
+  __m256i out16_0 = _mm256_srai_epi16(_mm256_packs_epi32(out_0, out_1), SHIFT);
+  __m256i out16_1 = _mm256_srai_epi16(_mm256_packs_epi32(out_2, out_3), SHIFT);
+
+  __m256i *outVec = (__m256i *)output;
+  outVec[0] = _mm256_packs_epi16(out16_0, out16_1);
+  if (pack8_and_calc_mask)
+    outMask[0] = _mm256_movemask_epi8(_mm256_cmpgt_epi8(outVec[0], kZero));
+  else
+    outVec[0] = _mm256_max_epi8(outVec[0], kZero);
+}
+
+// Layer 1 of AFFINE_LANES positions, over the inputs positive in any of them
+INLINE void affine_txfm_lanes(int8_t *const *input, void *const *output,
+                              unsigned inDims, const int32_t *biases,
+                              const weight_t *weights, mask_t *const *inMask,
+                              mask_t *const *outMask) {
+  const __m256i kZero = _mm256_setzero_si256();
+  __m256i out[AFFINE_LANES][4];
+  alignas(32) uint8_t clipped[AFFINE_LANES][FtOutDims];
+  mask_t anyMask[FtOutDims / (8 * sizeof(mask_t))];
+  unsigned idx, idx2;
+
+  for (unsigned l = 0; l < AFFINE_LANES; l++)
+    for (unsigned j = 0; j < 4; j++)
+      out[l][j] = ((__m256i *)biases)[j];
+  lanes_input(input, inMask, inDims, clipped, anyMask);
+
+  mask2_t v;
+  memcpy(&v, anyMask, sizeof(mask2_t));
+  for (unsigned offset = 0; offset < inDims;) {
+    if (!next_idx(&idx, &offset, &v, anyMask, inDims))
+      break;
+    const bool pair = next_idx(&idx2, &offset, &v, anyMask, inDims);
+    const __m256i first = ((__m256i *)weights)[idx];
+    const __m256i second = pair ? ((__m256i *)weights)[idx2] : kZero;
+    const __m256i w_lo = _mm256_unpacklo_epi8(first, second);
+    const __m256i w_hi = _mm256_unpackhi_epi8(first, second);
+
+    for (unsigned l = 0; l < AFFINE_LANES; l++) {
+      uint16_t factor = clipped[l][idx];
+      if (pair)
+        factor |= clipped[l][idx2] << 8;
+      __m256i mul = _mm256_set1_epi16(factor), prod, signs;
+      prod = _mm256_maddubs_epi16(mul, w_lo);
+      signs = _mm256_cmpgt_epi16(kZero, prod);
+      out[l][0] =
+          _mm256_add_epi32(out[l][0], _mm256_unpacklo_epi16(prod, signs));
+      out[l][1] =
+          _mm256_add_epi32(out[l][1], _mm256_unpackhi_epi16(prod, signs));
+      prod = _mm256_maddubs_epi16(mul, w_hi);
+      signs = _mm256_cmpgt_epi16(kZero, prod);
+      out[l][2] =
+          _mm256_add_epi32(out[l][2], _mm256_unpacklo_epi16(prod, signs));
+      out[l][3] =
+          _mm256_add_epi32(out[l][3], _mm256_unpackhi_epi16(prod, signs));
+    }
+  }
+
+  for (unsigned l = 0; l < AFFINE_LANES; l++) {
+    __m256i out16_0 =
+        _mm256_srai_epi16(_mm256_packs_epi32(out[l][0], out[l][1]), SHIFT);
+    __m256i out16_1 =
+        _mm256_srai_epi16(_mm256_packs_epi32(out[l][2], out[l][3]), SHIFT);
+    __m256i *outVec = (__m256i *)output[l];
+    outVec[0] = _mm256_packs_epi16(out16_0, out16_1);
+    outMask[l][0] = _mm256_movemask_epi8(_mm256_cmpgt_epi8(outVec[0], kZero));
+  }
+}
+#elif AVOID_USE_SSSE3
+INLINE void affine_txfm(int8_t *input, void *output, unsigned inDims,
+                        unsigned outDims, const int32_t *biases,
+                        const weight_t *weights, mask_t *inMask,
+                        mask_t *outMask, const bool pack8_and_calc_mask) {
+  assert(outDims == 32);
+
+  const __m128i kZeros[2] = {0};
+  __m128i out_0 = ((__m128i *)biases)[0];
+  __m128i out_1 = ((__m128i *)biases)[1];
+  __m128i out_2 = ((__m128i *)biases)[2];
+  __m128i out_3 = ((__m128i *)biases)[3];
+  __m128i out_4 = ((__m128i *)biases)[4];
+  __m128i out_5 = ((__m128i *)biases)[5];
+  __m128i out_6 = ((__m128i *)biases)[6];
+  __m128i out_7 = ((__m128i *)biases)[7];
+  const __m128i *first, *second;
+  mask2_t v;
+  unsigned idx;
+
+  memcpy(&v, inMask, sizeof(mask2_t));
+  for (unsigned offset = 0; offset < inDims;) {
+    if (!next_idx(&idx, &offset, &v, inMask, inDims))
+      break;
+    first = (__m128i *)&weights[outDims * idx];
+    uint16_t factor = input[idx];
+    if (next_idx(&idx, &offset, &v, inMask, inDims)) {
+      second = (__m128i *)&weights[outDims * idx];
+      factor |= input[idx] << 8;
+    } else {
+      second = kZeros;
+    }
+    __m128i mul = _mm_set1_epi16(factor), prod, signs;
+    prod = _mm_maddubs_epi16(mul, _mm_unpacklo_epi8(first[0], second[0]));
+    signs = _mm_cmpgt_epi16(kZeros[0], prod);
+    out_0 = _mm_add_epi32(out_0, _mm_unpacklo_epi16(prod, signs));
+    out_1 = _mm_add_epi32(out_1, _mm_unpackhi_epi16(prod, signs));
+    prod = _mm_maddubs_epi16(mul, _mm_unpackhi_epi8(first[0], second[0]));
+    signs = _mm_cmpgt_epi16(kZeros[0], prod);
+    out_2 = _mm_add_epi32(out_2, _mm_unpacklo_epi16(prod, signs));
+    out_3 = _mm_add_epi32(out_3, _mm_unpackhi_epi16(prod, signs));
+    prod = _mm_maddubs_epi16(mul, _mm_unpacklo_epi8(first[1], second[1]));
+    signs = _mm_cmpgt_epi16(kZeros[0], prod);
+    out_4 = _mm_add_epi32(out_4, _mm_unpacklo_epi16(prod, signs));
+    out_5 = _mm_add_epi32(out_5, _mm_unpackhi_epi16(prod, signs));
+    prod = _mm_maddubs_epi16(mul, _mm_unpackhi_epi8(first[1], second[1]));
+    signs = _mm_cmpgt_epi16(kZeros[0], prod);
+    out_6 = _mm_add_epi32(out_6, _mm_unpacklo_epi16(prod, signs));
+    out_7 = _mm_add_epi32(out_7, _mm_unpackhi_epi16(prod, signs));
+  }
+
+  __m128i out16_0 = _mm_srai_epi16(_mm_packs_epi32(out_0, out_1), SHIFT);
+  __m128i out16_1 = _mm_srai_epi16(_mm_packs_epi32(out_2, out_3), SHIFT);
+  __m128i out16_2 = _mm_srai_epi16(_mm_packs_epi32(out_4, out_5), SHIFT);
+  __m128i out16_3 = _mm_srai_epi16(_mm_packs_epi32(out_6, out_7), SHIFT);
+
+  __m128i *outVec = (__m128i *)output;
+  if (pack8_and_calc_mask) {
+    outVec[0] = _mm_packs_epi16(out16_0, out16_1);
+    outMask[0] = _mm_movemask_epi8(_mm_cmpgt_epi8(outVec[0], kZeros[0]));
+    outVec[1] = _mm_packs_epi16(out16_2, out16_3);
+    outMask[1] = _mm_movemask_epi8(_mm_cmpgt_epi8(outVec[1], kZeros[0]));
+  } else {
+#if defined(USE_SSE41)
+    outVec[0] = _mm_max_epi8(_mm_packs_epi16(out16_0, out16_1), kZeros[0]);
+    outVec[1] = _mm_max_epi8(_mm_packs_epi16(out16_2, out16_3), kZeros[0]);
+#else
+    outVec[0] = _mm_packs_epi16(_mm_max_epi16(out16_0, kZeros[0]),
+                                _mm_max_epi16(out16_1, kZeros[0]));
+    outVec[1] = _mm_packs_epi16(_mm_max_epi16(out16_2, kZeros[0]),
+                                _mm_max_epi16(out16_3, kZeros[0]));
+#endif
+  }
+}
+#elif defined(USE_SSE2)
+INLINE void affine_txfm(clipped_t *input, void *output, unsigned inDims,
+                        unsigned outDims, const int32_t *biases,
+                        const weight_t *weights, mask_t *inMask,
+                        mask_t *outMask, const bool pack8_and_calc_mask) {
+  assert(outDims == 32);
+
+  const __m128i kZeros[4] = {0};
+  __m128i out_0 = ((__m128i *)biases)[0];
+  __m128i out_1 = ((__m128i *)biases)[1];
+  __m128i out_2 = ((__m128i *)biases)[2];
+  __m128i out_3 = ((__m128i *)biases)[3];
+  __m128i out_4 = ((__m128i *)biases)[4];
+  __m128i out_5 = ((__m128i *)biases)[5];
+  __m128i out_6 = ((__m128i *)biases)[6];
+  __m128i out_7 = ((__m128i *)biases)[7];
+  const __m128i *first, *second;
+  mask2_t v;
+  unsigned idx;
+
+  memcpy(&v, inMask, sizeof(mask2_t));
+  for (unsigned offset = 0; offset < inDims;) {
+    if (!next_idx(&idx, &offset, &v, inMask, inDims))
+      break;
+    first = (__m128i *)&weights[outDims * idx];
+    uint32_t factor = input[idx];
+    if (next_idx(&idx, &offset, &v, inMask, inDims)) {
+      second = (__m128i *)&weights[outDims * idx];
+      factor |= input[idx] << 16;
+    } else {
+      second = kZeros;
+    }
+    __m128i mul = _mm_set1_epi32(factor);
+    out_0 = _mm_add_epi32(
+        out_0, _mm_madd_epi16(mul, _mm_unpacklo_epi16(first[0], second[0])));
+    out_1 = _mm_add_epi32(
+        out_1, _mm_madd_epi16(mul, _mm_unpackhi_epi16(first[0], second[0])));
+    out_2 = _mm_add_epi32(
+        out_2, _mm_madd_epi16(mul, _mm_unpacklo_epi16(first[1], second[1])));
+    out_3 = _mm_add_epi32(
+        out_3, _mm_madd_epi16(mul, _mm_unpackhi_epi16(first[1], second[1])));
+    out_4 = _mm_add_epi32(
+        out_4, _mm_madd_epi16(mul, _mm_unpacklo_epi16(first[2], second[2])));
+    out_5 = _mm_add_epi32(
+        out_5, _mm_madd_epi16(mul, _mm_unpackhi_epi16(first[2], second[2])));
+    out_6 = _mm_add_epi32(
+        out_6, _mm_madd_epi16(mul, _mm_unpacklo_epi16(first[3], second[3])));
+    out_7 = _mm_add_epi32(
+        out_7, _mm_madd_epi16(mul, _mm_unpackhi_epi16(first[3], second[3])));
+  }
+
+  __m128i out16_0 = _mm_srai_epi16(_mm_packs_epi32(out_0, out_1), SHIFT);
+  __m128i out16_1 = _mm_srai_epi16(_mm_packs_epi32(out_2, out_3), SHIFT);
+  __m128i out16_2 = _mm_srai_epi16(_mm_packs_epi32(out_4, out_5), SHIFT);
+  __m128i out16_3 = _mm_srai_epi16(_mm_packs_epi32(out_6, out_7), SHIFT);
+
+  __m128i *outVec = (__m128i *)output;
+  if (pack8_and_calc_mask) {
+    outVec[0] = _mm_packs_epi16(out16_0, out16_1);
+    outMask[0] = _mm_movemask_epi8(_mm_cmpgt_epi8(outVec[0], kZeros[0]));
+    outVec[1] = _mm_packs_epi16(out16_2, out16_3);
+    outMask[1] = _mm_movemask_epi8(_mm_cmpgt_epi8(outVec[1], kZeros[0]));
+  } else {
+    const __m128i kx07f = _mm_set1_epi16(127);
+    outVec[0] = _mm_min_epi16(_mm_max_epi16(out16_0, kZeros[0]), kx07f);
+    outVec[1] = _mm_min_epi16(_mm_max_epi16(out16_1, kZeros[0]), kx07f);
+    outVec[2] = _mm_min_epi16(_mm_max_epi16(out16_2, kZeros[0]), kx07f);
+    outVec[3] = _mm_min_epi16(_mm_max_epi16(out16_3, kZeros[0]), kx07f);
+  }
+}
+#elif defined(USE_MMX)
+INLINE void affine_txfm(clipped_t *input, void *output, unsigned inDims,
+                        unsigned outDims, const int32_t *biases,
+                        const weight_t *weights, mask_t *inMask,
+                        mask_t *outMask, const bool pack8_and_calc_mask) {
+  assert(outDims == 32);
+
+#if 0
+  const __m64 kZeros[2] = { 0 };
+  for (unsigned t = 0; t < 4; t++) {
+    __m64 out_0 = ((__m64 *)biases)[4 * t + 0];
+    __m64 out_1 = ((__m64 *)biases)[4 * t + 1];
+    __m64 out_2 = ((__m64 *)biases)[4 * t + 2];
+    __m64 out_3 = ((__m64 *)biases)[4 * t + 3];
+    const __m64 *first, *second;
+    mask2_t v;
+    unsigned idx;
+
+    memcpy(&v, inMask, sizeof(mask2_t));
+    for (unsigned offset = 0; offset < inDims;) {
+      if (!next_idx(&idx, &offset, &v, inMask, inDims))
+        break;
+      first = &((__m64 *)&weights[outDims * idx])[2  * t];
+      uint32_t factor = input[idx];
+      if (next_idx(&idx, &offset, &v, inMask, inDims)) {
+        second = &((__m64 *)&weights[outDims * idx])[2 * t];
+        factor |= input[idx] << 16;
+      } else {
+        second = kZeros;
+      }
+      __m64 mul = _mm_set1_pi32(factor);
+      out_0 = _mm_add_pi32(out_0, _mm_madd_pi16(mul, _mm_unpacklo_pi16(first[0],second[0])));
+      out_1 = _mm_add_pi32(out_1, _mm_madd_pi16(mul, _mm_unpackhi_pi16(first[0],second[0])));
+      out_2 = _mm_add_pi32(out_2, _mm_madd_pi16(mul, _mm_unpacklo_pi16(first[1],second[1])));
+      out_3 = _mm_add_pi32(out_3, _mm_madd_pi16(mul, _mm_unpackhi_pi16(first[1],second[1])));
+    }
+
+    __m64 out16_0 = _mm_srai_pi16(_mm_packs_pi32(out_0, out_1), SHIFT);
+    __m64 out16_1 = _mm_srai_pi16(_mm_packs_pi32(out_2, out_3), SHIFT);
+
+    __m64 *outVec = (__m64 *)output;
+    if (pack8_and_calc_mask) {
+      outVec[t] = _mm_packs_pi16(out16_0, out16_1);
+      outMask[t] = _mm_movemask_pi8(_mm_cmpgt_pi8(outVec[t], kZeros[0]));
+    } else {
+#ifdef USE_SSE
+      const __m64 kx07f = _mm_set1_pi16(127);
+      outVec[2 * t] = _mm_min_pi16(_mm_max_pi16(out16_0, kZeros[0]), kx07f);
+      outVec[2 * t + 1] = _mm_min_pi16(_mm_max_pi16(out16_1, kZeros[0]), kx07f);
+#else
+      const __m64 k0x7f80 = _mm_set1_pi16(0x7f80);
+      const __m64 k0x0080 = _mm_set1_pi16(0x0080);
+      const __m64 k0x8000 = _mm_set1_pi16(-0x8000);
+      outVec[2 * t] = _mm_subs_pu16(_mm_add_pi16(_mm_adds_pi16(out16_0, k0x7f80), k0x0080), k0x8000);
+      outVec[2 * t + 1] = _mm_subs_pu16(_mm_add_pi16(_mm_adds_pi16(out16_1, k0x7f80), k0x0080), k0x8000);
+#endif
+    }
+  }
+#else
+  const __m64 kZeros[8] = {0};
+  __m64 out_0 = ((__m64 *)biases)[0];
+  __m64 out_1 = ((__m64 *)biases)[1];
+  __m64 out_2 = ((__m64 *)biases)[2];
+  __m64 out_3 = ((__m64 *)biases)[3];
+  __m64 out_4 = ((__m64 *)biases)[4];
+  __m64 out_5 = ((__m64 *)biases)[5];
+  __m64 out_6 = ((__m64 *)biases)[6];
+  __m64 out_7 = ((__m64 *)biases)[7];
+  __m64 out_8 = ((__m64 *)biases)[8];
+  __m64 out_9 = ((__m64 *)biases)[9];
+  __m64 out_10 = ((__m64 *)biases)[10];
+  __m64 out_11 = ((__m64 *)biases)[11];
+  __m64 out_12 = ((__m64 *)biases)[12];
+  __m64 out_13 = ((__m64 *)biases)[13];
+  __m64 out_14 = ((__m64 *)biases)[14];
+  __m64 out_15 = ((__m64 *)biases)[15];
+  const __m64 *first, *second;
+  mask2_t v;
+  unsigned idx;
+
+  memcpy(&v, inMask, sizeof(mask2_t));
+  for (unsigned offset = 0; offset < inDims;) {
+    if (!next_idx(&idx, &offset, &v, inMask, inDims))
+      break;
+    first = (__m64 *)&weights[outDims * idx];
+    uint32_t factor = input[idx];
+    if (next_idx(&idx, &offset, &v, inMask, inDims)) {
+      second = (__m64 *)&weights[outDims * idx];
+      factor |= input[idx] << 16;
+    } else {
+      second = kZeros;
+    }
+    __m64 mul = _mm_set1_pi32(factor);
+    out_0 = _mm_add_pi32(
+        out_0, _mm_madd_pi16(mul, _mm_unpacklo_pi16(first[0], second[0])));
+    out_1 = _mm_add_pi32(
+        out_1, _mm_madd_pi16(mul, _mm_unpackhi_pi16(first[0], second[0])));
+    out_2 = _mm_add_pi32(
+        out_2, _mm_madd_pi16(mul, _mm_unpacklo_pi16(first[1], second[1])));
+    out_3 = _mm_add_pi32(
+        out_3, _mm_madd_pi16(mul, _mm_unpackhi_pi16(first[1], second[1])));
+    out_4 = _mm_add_pi32(
+        out_4, _mm_madd_pi16(mul, _mm_unpacklo_pi16(first[2], second[2])));
+    out_5 = _mm_add_pi32(
+        out_5, _mm_madd_pi16(mul, _mm_unpackhi_pi16(first[2], second[2])));
+    out_6 = _mm_add_pi32(
+        out_6, _mm_madd_pi16(mul, _mm_unpacklo_pi16(first[3], second[3])));
+    out_7 = _mm_add_pi32(
+        out_7, _mm_madd_pi16(mul, _mm_unpackhi_pi16(first[3], second[3])));
+    out_8 = _mm_add_pi32(
+        out_8, _mm_madd_pi16(mul, _mm_unpacklo_pi16(first[4], second[4])));
+    out_9 = _mm_add_pi32(
+        out_9, _mm_madd_pi16(mul, _mm_unpackhi_pi16(first[4], second[4])));
+    out_10 = _mm_add_pi32(
+        out_10, _mm_madd_pi16(mul, _mm_unpacklo_pi16(first[5], second[5])));
+    out_11 = _mm_add_pi32(
+        out_11, _mm_madd_pi16(mul, _mm_unpackhi_pi16(first[5], second[5])));
+    out_12 = _mm_add_pi32(
+        out_12, _mm_madd_pi16(mul, _mm_unpacklo_pi16(first[6], second[6])));
+    out_13 = _mm_add_pi32(
+        out_13, _mm_madd_pi16(mul, _mm_unpackhi_pi16(first[6], second[6])));
+    out_14 = _mm_add_pi32(
+        out_14, _mm_madd_pi16(mul, _mm_unpacklo_pi16(first[7], second[7])));
+    out_15 = _mm_add_pi32(
+        out_15, _mm_madd_pi16(mul, _mm_unpackhi_pi16(first[7], second[7])));
+  }
+
+  __m64 out16_0 = _mm_srai_pi16(_mm_packs_pi32(out_0, out_1), SHIFT);
+  __m64 out16_1 = _mm_srai_pi16(_mm_packs_pi32(out_2, out_3), SHIFT);
+  __m64 out16_2 = _mm_srai_pi16(_mm_packs_pi32(out_4, out_5), SHIFT);
+  __m64 out16_3 = _mm_srai_pi16(_mm_packs_pi32(out_6, out_7), SHIFT);
+  __m64 out16_4 = _mm_srai_pi16(_mm_packs_pi32(out_8, out_9), SHIFT);
+  __m64 out16_5 = _mm_srai_pi16(_mm_packs_pi32(out_10, out_11), SHIFT);
+  __m64 out16_6 = _mm_srai_pi16(_mm_packs_pi32(out_12, out_13), SHIFT);
+  __m64 out16_7 = _mm_srai_pi16(_mm_packs_pi32(out_14, out_15), SHIFT);
+
+  __m64 *outVec = (__m64 *)output;
+  if (pack8_and_calc_mask) {
+    outVec[0] = _mm_packs_pi16(out16_0, out16_1);
+    outMask[0] = _mm_movemask_pi8(_mm_cmpgt_pi8(outVec[0], kZeros[0]));
+    outVec[1] = _mm_packs_pi16(out16_2, out16_3);
+    outMask[1] = _mm_movemask_pi8(_mm_cmpgt_pi8(outVec[1], kZeros[0]));
+    outVec[2] = _mm_packs_pi16(out16_4, out16_5);
+    outMask[2] = _mm_movemask_pi8(_mm_cmpgt_pi8(outVec[2], kZeros[0]));
+    outVec[3] = _mm_packs_pi16(out16_6, out16_7);
+    outMask[3] = _mm_movemask_pi8(_mm_cmpgt_pi8(outVec[3], kZeros[0]));
+  } else {
+#ifdef USE_SSE
+    const __m64 kx07f = _mm_set1_pi16(127);
+    outVec[0] = _mm_min_pi16(_mm_max_pi16(out16_0, kZeros[0]), kx07f);
+    outVec[1] = _mm_min_pi16(_mm_max_pi16(out16_1, kZeros[0]), kx07f);
+    outVec[2] = _mm_min_pi16(_mm_max_pi16(out16_2, kZeros[0]), kx07f);
+    outVec[3] = _mm_min_pi16(_mm_max_pi16(out16_3, kZeros[0]), kx07f);
+    outVec[4] = _mm_min_pi16(_mm_max_pi16(out16_4, kZeros[0]), kx07f);
+    outVec[5] = _mm_min_pi16(_mm_max_pi16(out16_5, kZeros[0]), kx07f);
+    outVec[6] = _mm_min_pi16(_mm_max_pi16(out16_6, kZeros[0]), kx07f);
+    outVec[7] = _mm_min_pi16(_mm_max_pi16(out16_7, kZeros[0]), kx07f);
+#else
+    const __m64 k0x7f80 = _mm_set1_pi16(0x7f80);
+    const __m64 k0x0080 = _mm_set1_pi16(0x0080);
+    const __m64 k0x8000 = _mm_set1_pi16(-0x8000);
+    outVec[0] = _mm_subs_pu16(
+        _mm_add_pi16(_mm_adds_pi16(out16_0, k0x7f80), k0x0080), k0x8000);
+    outVec[1] = _mm_subs_pu16(
+        _mm_add_pi16(_mm_adds_pi16(out16_1, k0x7f80), k0x0080), k0x8000);
+    outVec[2] = _mm_subs_pu16(
+        _mm_add_pi16(_mm_adds_pi16(out16_2, k0x7f80), k0x0080), k0x8000);
+    outVec[3] = _mm_subs_pu16(
+        _mm_add_pi16(_mm_adds_pi16(out16_3, k0x7f80), k0x0080), k0x8000);
+    outVec[4] = _mm_subs_pu16(
+        _mm_add_pi16(_mm_adds_pi16(out16_4, k0x7f80), k0x0080), k0x8000);
+    outVec[5] = _mm_subs_pu16(
+        _mm_add_pi16(_mm_adds_pi16(out16_5, k0x7f80), k0x0080), k0x8000);
+    outVec[6] = _mm_subs_pu16(
+        _mm_add_pi16(_mm_adds_pi16(out16_6, k0x7f80), k0x0080), k0x8000);
+    outVec[7] = _mm_subs_pu16(
+        _mm_add_pi16(_mm_adds_pi16(out16_7, k0x7f80), k0x0080), k0x8000);
+#endif
+  }
+#endif
+}
+#elif defined(USE_NEON)
+INLINE void affine_txfm(clipped_t *input, void *output, unsigned inDims,
+                        unsigned outDims, const int32_t *biases,
+                        const weight_t *weights, mask_t *inMask,
+                        mask_t *outMask, const bool pack8_and_calc_mask) {
+  assert(outDims == 32);
+
+  int32x4_t out_0 = ((int32x4_t *)biases)[0];
+  int32x4_t out_1 = ((int32x4_t *)biases)[1];
+  int32x4_t out_2 = ((int32x4_t *)biases)[2];
+  int32x4_t out_3 = ((int32x4_t *)biases)[3];
+  int32x4_t out_4 = ((int32x4_t *)biases)[4];
+  int32x4_t out_5 = ((int32x4_t *)biases)[5];
+  int32x4_t out_6 = ((int32x4_t *)biases)[6];
+  int32x4_t out_7 = ((int32x4_t *)biases)[7];
+  const int8x8_t *first;
+  mask2_t v;
+  unsigned idx;
+
+  memcpy(&v, inMask, sizeof(mask2_t));
+  for (unsigned offset = 0; offset < inDims;) {
+    if (!next_idx(&idx, &offset, &v, inMask, inDims))
+      break;
+    first = (int8x8_t *)&weights[outDims * idx];
+    int16_t factor = input[idx];
+
+    int16x8_t prod;
+    prod = vmulq_n_s16(vmovl_s8(first[0]), factor);
+    out_0 = vaddq_s32(out_0, vmovl_s16(vget_low_s16(prod)));
+    out_1 = vaddq_s32(out_1, vmovl_high_s16(prod));
+    prod = vmulq_n_s16(vmovl_s8(first[1]), factor);
+    out_2 = vaddq_s32(out_2, vmovl_s16(vget_low_s16(prod)));
+    out_3 = vaddq_s32(out_3, vmovl_high_s16(prod));
+    prod = vmulq_n_s16(vmovl_s8(first[2]), factor);
+    out_4 = vaddq_s32(out_4, vmovl_s16(vget_low_s16(prod)));
+    out_5 = vaddq_s32(out_5, vmovl_high_s16(prod));
+    prod = vmulq_n_s16(vmovl_s8(first[3]), factor);
+    out_6 = vaddq_s32(out_6, vmovl_s16(vget_low_s16(prod)));
+    out_7 = vaddq_s32(out_7, vmovl_high_s16(prod));
+  }
+
+  int16x8_t out16_0 =
+      vcombine_s16(vqshrn_n_s32(out_0, SHIFT), vqshrn_n_s32(out_1, SHIFT));
+  int16x8_t out16_1 =
+      vcombine_s16(vqshrn_n_s32(out_2, SHIFT), vqshrn_n_s32(out_3, SHIFT));
+  int16x8_t out16_2 =
+      vcombine_s16(vqshrn_n_s32(out_4, SHIFT), vqshrn_n_s32(out_5, SHIFT));
+  int16x8_t out16_3 =
+      vcombine_s16(vqshrn_n_s32(out_6, SHIFT), vqshrn_n_s32(out_7, SHIFT));
+
+  if (pack8_and_calc_mask) {
+    const int8x16_t kZero = {0};
+    int8x16_t *outVec = (int8x16_t *)output;
+    outVec[0] = vcombine_s8(vqmovn_s16(out16_0), vqmovn_s16(out16_1));
+    outMask[0] = neon_movemask(vcgtq_s8(outVec[0], kZero));
+    outVec[1] = vcombine_s8(vqmovn_s16(out16_2), vqmovn_s16(out16_3));
+    outMask[1] = neon_movemask(vcgtq_s8(outVec[1], kZero));
+  } else {
+    // The next step takes int8x8_t as input, so store as int8x8_t
+    const int8x8_t kZero = {0};
+    int8x8_t *outVec = (int8x8_t *)output;
+    outVec[0] = vmax_s8(vqmovn_s16(out16_0), kZero);
+    outVec[1] = vmax_s8(vqmovn_s16(out16_1), kZero);
+    outVec[2] = vmax_s8(vqmovn_s16(out16_2), kZero);
+    outVec[3] = vmax_s8(vqmovn_s16(out16_3), kZero);
+  }
+}
+#else /* generic fallback */
+INLINE void affine_txfm(clipped_t *input, void *output, unsigned inDims,
+                        unsigned outDims, const int32_t *biases,
+                        const weight_t *weights, mask_t *inMask,
+                        mask_t *outMask, const bool pack8_and_calc_mask) {
+  (void)inMask;
+  (void)outMask;
+  (void)pack8_and_calc_mask;
+
+  int32_t tmp[outDims];
+
+  for (unsigned i = 0; i < outDims; i++)
+    tmp[i] = biases[i];
+
+  for (unsigned idx = 0; idx < inDims; idx++)
+    if (input[idx])
+      for (unsigned i = 0; i < outDims; i++)
+        tmp[i] += (int8_t)input[idx] * weights[outDims * idx + i];
+
+  clipped_t *outVec = (clipped_t *)output;
+  for (unsigned i = 0; i < outDims; i++)
+    outVec[i] = clamp(tmp[i] >> SHIFT, 0, 127);
+}
+#endif
+
+#ifdef VECTOR
+#define TILE_HEIGHT (NUM_REGS * SIMD_WIDTH / 16)
+#endif
+
+// Calculate cumulative value without using difference calculation
+INLINE void refresh_accumulator(Board *pos) {
+  const NetWeights *net = net_weights(pos);
+  Accumulator *accumulator = &(pos->nnue[0]->accumulator);
+
+  IndexList activeIndices[2];
+  activeIndices[0].size = activeIndices[1].size = 0;
+  append_active_indices(pos, activeIndices);
+
+  for (unsigned c = 0; c < 2; c++) {
+#ifdef VECTOR
+    for (unsigned i = 0; i < kHalfDimensions / TILE_HEIGHT; i++) {
+      vec16_t *ft_biases_tile = (vec16_t *)&net->ft_biases[i * TILE_HEIGHT];
+      vec16_t *accTile =
+          (vec16_t *)&accumulator->accumulation[c][i * TILE_HEIGHT];
+      vec16_t acc[NUM_REGS];
+
+      for (unsigned j = 0; j < NUM_REGS; j++)
+        acc[j] = ft_biases_tile[j];
+
+      for (size_t k = 0; k < activeIndices[c].size; k++) {
+        unsigned index = activeIndices[c].values[k];
+        unsigned offset = kHalfDimensions * index + i * TILE_HEIGHT;
+        vec16_t *column = (vec16_t *)&net->ft_weights[offset];
+
+        for (unsigned j = 0; j < NUM_REGS; j++)
+          acc[j] = vec_add_16(acc[j], column[j]);
+      }
+
+      for (unsigned j = 0; j < NUM_REGS; j++)
+        accTile[j] = acc[j];
+    }
+#else
+    memcpy(accumulator->accumulation[c], net->ft_biases,
+           kHalfDimensions * sizeof(int16_t));
+
+    for (size_t k = 0; k < activeIndices[c].size; k++) {
+      unsigned index = activeIndices[c].values[k];
+      unsigned offset = kHalfDimensions * index;
+
+      for (unsigned j = 0; j < kHalfDimensions; j++)
+        accumulator->accumulation[c][j] += net->ft_weights[offset + j];
+    }
+#endif
+  }
+
+  accumulator->computedAccumulation = 1;
+}
+
+// Compute an accumulator from prevAcc, or from the biases for the reset
+// perspectives
+INLINE void apply_changed_indices(const NetWeights *net,
+                                  Accumulator *accumulator,
+                                  const Accumulator *prevAcc,
+                                  const IndexList removed_indices[2],
+                                  const IndexList added_indices[2],
+                                  const bool reset[2]) {
+#ifdef VECTOR
+  for (unsigned i = 0; i < kHalfDimensions / TILE_HEIGHT; i++) {
+    for (unsigned c = 0; c < 2; c++) {
+      vec16_t *accTile =
+          (vec16_t *)&accumulator->accumulation[c][i * TILE_HEIGHT];
+      vec16_t acc[NUM_REGS];
+
+      if (reset[c]) {
+        vec16_t *ft_b_tile = (vec16_t *)&net->ft_biases[i * TILE_HEIGHT];
+        for (unsigned j = 0; j < NUM_REGS; j++)
+          acc[j] = ft_b_tile[j];
+      } else {
+        vec16_t *prevAccTile =
+            (vec16_t *)&prevAcc->accumulation[c][i * TILE_HEIGHT];
+        for (unsigned j = 0; j < NUM_REGS; j++)
+          acc[j] = prevAccTile[j];
+
+        // Difference calculation for the deactivated features
+        for (unsigned k = 0; k < removed_indices[c].size; k++) {
+          unsigned index = removed_indices[c].values[k];
+          const unsigned offset = kHalfDimensions * index + i * TILE_HEIGHT;
+
+          vec16_t *column = (vec16_t *)&net->ft_weights[offset];
+          for (unsigned j = 0; j < NUM_REGS; j++)
+            acc[j] = vec_sub_16(acc[j], column[j]);
+        }
+      }
+
+      // Difference calculation for the activated features
+      for (unsigned k = 0; k < added_indices[c].size; k++) {
+        unsigned index = added_indices[c].values[k];
+        const unsigned offset = kHalfDimensions * index + i * TILE_HEIGHT;
+
+        vec16_t *column = (vec16_t *)&net->ft_weights[offset];
+        for (unsigned j = 0; j < NUM_REGS; j++)
+          acc[j] = vec_add_16(acc[j], column[j]);
+      }
+
+      for (unsigned j = 0; j < NUM_REGS; j++)
+        accTile[j] = acc[j];
+    }
+  }
+#else
+  for (unsigned c = 0; c < 2; c++) {
+    if (reset[c]) {
+      memcpy(accumulator->accumulation[c], net->ft_biases,
+             kHalfDimensions * sizeof(int16_t));
+    } else {
+      memcpy(accumulator->accumulation[c], prevAcc->accumulation[c],
+             kHalfDimensions * sizeof(int16_t));
+      // Difference calculation for the deactivated features
+      for (unsigned k = 0; k < removed_indices[c].size; k++) {
+        unsigned index = removed_indices[c].values[k];
+        const unsigned offset = kHalfDimensions * index;
+
+        for (unsigned j = 0; j < kHalfDimensions; j++)
+          accumulator->accumulation[c][j] -= net->ft_weights[offset + j];
+      }
+    }
+
+    // Difference calculation for the activated features
+    for (unsigned k = 0; k < added_indices[c].size; k++) {
+      unsigned index = added_indices[c].values[k];
+      const unsigned offset = kHalfDimensions * index;
+
+      for (unsigned j = 0; j < kHalfDimensions; j++)
+        accumulator->accumulation[c][j] += net->ft_weights[offset + j];
+    }
+  }
+#endif
+
+  accumulator->computedAccumulation = 1;
+}
+
+// Update both perspectives with numAdded and numRemoved changes each (At most
+// 2), one pass over the accumulator streaming the columns of both. The counts
+// are constants at the call sites, so the inner loops unroll.
+INLINE void fused_update(const NetWeights *net, Accumulator *accumulator,
+                         const Accumulator *prevAcc, const IndexList removed[2],
+                         const IndexList added[2], const unsigned numAdded,
+                         const unsigned numRemoved) {
+  const int16_t *addCols[2][2], *subCols[2][2];
+  for (unsigned c = 0; c < 2; c++) {
+    for (unsigned k = 0; k < numAdded; k++)
+      addCols[c][k] = &net->ft_weights[kHalfDimensions * added[c].values[k]];
+    for (unsigned k = 0; k < numRemoved; k++)
+      subCols[c][k] = &net->ft_weights[kHalfDimensions * removed[c].values[k]];
+  }
+
+#ifdef VECTOR
+  for (unsigned j = 0; j < kHalfDimensions / (SIMD_WIDTH / 16); j++)
+    for (unsigned c = 0; c < 2; c++) {
+      vec16_t acc = ((const vec16_t *)prevAcc->accumulation[c])[j];
+      for (unsigned k = 0; k < numRemoved; k++)
+        acc = vec_sub_16(acc, ((const vec16_t *)subCols[c][k])[j]);
+      for (unsigned k = 0; k < numAdded; k++)
+        acc = vec_add_16(acc, ((const vec16_t *)addCols[c][k])[j]);
+      ((vec16_t *)accumulator->accumulation[c])[j] = acc;
+    }
+#else
+  for (unsigned j = 0; j < kHalfDimensions; j++)
+    for (unsigned c = 0; c < 2; c++) {
+      int16_t acc = prevAcc->accumulation[c][j];
+      for (unsigned k = 0; k < numRemoved; k++)
+        acc -= subCols[c][k][j];
+      for (unsigned k = 0; k < numAdded; k++)
+        acc += addCols[c][k][j];
+      accumulator->accumulation[c][j] = acc;
+    }
+#endif
+
+  accumulator->computedAccumulation = 1;
+}
+
+// Calculate cumulative value using difference calculation if possible
+INLINE bool update_accumulator(Board *pos) {
+  Accumulator *accumulator = &(pos->nnue[0]->accumulator);
+  if (accumulator->computedAccumulation)
+    return true;
+
+  IndexList removed_indices[2], added_indices[2];
+  removed_indices[0].size = removed_indices[1].size = 0;
+  added_indices[0].size = added_indices[1].size = 0;
+  bool reset[2];
+  const Accumulator *prevAcc =
+      append_changed_indices(pos, removed_indices, added_indices, reset);
+  if (!prevAcc)
+    return false;
+
+  const NetWeights *net = net_weights(pos);
+
+  // Quiet moves, captures and promotions change the same features for both
+  // perspectives (The kings are not features)
+  const unsigned numAdded = added_indices[0].size;
+  const unsigned numRemoved = removed_indices[0].size;
+  if (!reset[0] && !reset[1] && added_indices[1].size == numAdded &&
+      removed_indices[1].size == numRemoved) {
+    if (numAdded == 1 && numRemoved == 1) {
+      fused_update(net, accumulator, prevAcc, removed_indices, added_indices,
+                   1, 1);
+      return true;
+    }
+    if (numAdded == 1 && numRemoved == 2) {
+      fused_update(net, accumulator, prevAcc, removed_indices, added_indices,
+                   1, 2);
+      return true;
+    }
+    if (numAdded == 2 && numRemoved == 2) {
+      fused_update(net, accumulator, prevAcc, removed_indices, added_indices,
+                   2, 2);
+      return true;
+    }
+  }
+
+  apply_changed_indices(net, accumulator, prevAcc, removed_indices,
+                        added_indices, reset);
+  return true;
+}
+
+// Convert input features
+INLINE void transform(Board *pos, clipped_t *output, mask_t *outMask) {
+  if (!update_accumulator(pos))
+    refresh_accumulator(pos);
+
+  int16_t(*accumulation)[2][NNUE_MAX_HALF_DIMS] =
+      &pos->nnue[0]->accumulator.accumulation;
+  (void)outMask; // avoid compiler warning
+
+  const int perspectives[2] = {pos->player, !pos->player};
+  for (unsigned p = 0; p < 2; p++) {
+    const unsigned offset = kHalfDimensions * p;
+
+#ifdef VECTOR
+    const unsigned numChunks = (16 * kHalfDimensions) / SIMD_WIDTH;
+    vec8_t *out = (vec8_t *)&output[offset];
+    for (unsigned i = 0; i < numChunks / 2; i++) {
+      vec16_t s0 = ((vec16_t *)(*accumulation)[perspectives[p]])[i * 2];
+      vec16_t s1 = ((vec16_t *)(*accumulation)[perspectives[p]])[i * 2 + 1];
+      out[i] = vec_packs(s0, s1);
+      *outMask++ = vec_mask_pos(out[i]);
+#ifdef USE_VNNI
+      // The dot-product kernels read whole blocks of inputs
+      out[i] = vec_clip_8(out[i]);
+#endif
+    }
+
+#else
+    for (unsigned i = 0; i < kHalfDimensions; i++) {
+      int16_t sum = (*accumulation)[perspectives[p]][i];
+      output[offset + i] = clamp(sum, 0, 127);
+    }
+
+#endif
+  }
+}
+
+struct NetData {
+  alignas(64) clipped_t input[FtOutDims];
+  clipped_t hidden1_out[32];
+#if (defined(USE_SSE2) || defined(USE_MMX)) && !defined(USE_AVX2)
+  int16_t hidden2_out[32];
+#else
+  int8_t hidden2_out[32];
+#endif
+};
+
+// Evaluation function
+static int evaluate_pos(Board *pos) {
+  const NetWeights *net = net_weights(pos);
+  int32_t out_value;
+  alignas(8) mask_t input_mask[FtOutDims / (8 * sizeof(mask_t))];
+  alignas(8) mask_t hidden1_mask[8 / sizeof(mask_t)] = {0};
+#ifdef ALIGNMENT_HACK // work around a bug in old gcc on Windows
+  uint8_t buf[sizeof(struct NetData) + 63];
+  struct NetData *b =
+      (struct NetData *)(buf + ((((uintptr_t)buf - 1) ^ 0x3f) & 0x3f));
+#define B(x) (b->x)
+#else
+  struct NetData buf;
+#define B(x) (buf.x)
+#endif
+
+  transform(pos, B(input), input_mask);
+
+  affine_txfm(B(input), B(hidden1_out), FtOutDims, 32, net->hidden1_biases,
+              net->hidden1_weights, input_mask, hidden1_mask, true);
+
+  affine_txfm(B(hidden1_out), B(hidden2_out), 32, 32, net->hidden2_biases,
+              net->hidden2_weights, hidden1_mask, NULL, false);
+
+  out_value = affine_propagate((int8_t *)B(hidden2_out), net->output_biases,
+                               net->output_weights);
+
+#if defined(USE_MMX)
+  _mm_empty();
+#endif
+
+  return out_value / FV_SCALE;
+}
+
+// Positions evaluated together by evaluate_batch
+#define BATCH_SIZE 32
+
+struct BatchData {
+  struct NetData net;
+  alignas(8) mask_t input_mask[FtOutDims / (8 * sizeof(mask_t))];
+  alignas(8) mask_t hidden1_mask[8 / sizeof(mask_t)];
+};
+
+// Evaluate positions of the same net one layer at a time, so each hidden layer
+// reuses its weights across the batch. Layer 1 runs on AFFINE_LANES positions
+// at once where the kernels have affine_txfm_lanes.
+static void evaluate_batch(Board **pos, int *scores, unsigned n) {
+  if (!n)
+    return;
+
+  const NetWeights *net = net_weights(pos[0]);
+#ifdef ALIGNMENT_HACK
+  uint8_t buf[BATCH_SIZE * sizeof(struct BatchData) + 63];
+  struct BatchData *b =
+      (struct BatchData *)(buf + ((((uintptr_t)buf - 1) ^ 0x3f) & 0x3f));
+#else
+  struct BatchData b[BATCH_SIZE];
+#endif
+
+  for (unsigned start = 0; start < n; start += BATCH_SIZE) {
+    const unsigned m = n - start < BATCH_SIZE ? n - start : BATCH_SIZE;
+
+    for (unsigned i = 0; i < m; i++) {
+      transform(pos[start + i], b[i].net.input, b[i].input_mask);
+      memset(b[i].hidden1_mask, 0, sizeof(b[i].hidden1_mask));
+    }
+
+    unsigned i = 0;
+#ifdef AFFINE_LANES
+    for (; i + AFFINE_LANES <= m; i += AFFINE_LANES) {
+      int8_t *input[AFFINE_LANES];
+      void *output[AFFINE_LANES];
+      mask_t *inMask[AFFINE_LANES], *outMask[AFFINE_LANES];
+      for (unsigned l = 0; l < AFFINE_LANES; l++) {
+        input[l] = b[i + l].net.input;
+        output[l] = b[i + l].net.hidden1_out;
+        inMask[l] = b[i + l].input_mask;
+        outMask[l] = b[i + l].hidden1_mask;
+      }
+      affine_txfm_lanes(input, output, FtOutDims, net->hidden1_biases,
+                        net->hidden1_weights, inMask, outMask);
+    }
+#endif
+    for (; i < m; i++)
+      affine_txfm(b[i].net.input, b[i].net.hidden1_out, FtOutDims, 32,
+                  net->hidden1_biases, net->hidden1_weights, b[i].input_mask,
+                  b[i].hidden1_mask, true);
+
+    for (unsigned i = 0; i < m; i++)
+      affine_txfm(b[i].net.hidden1_out, b[i].net.hidden2_out, 32, 32,
+                  net->hidden2_biases, net->hidden2_weights, b[i].hidden1_mask,
+                  NULL, false);
+
+    for (unsigned i = 0; i < m; i++)
+      scores[start + i] =
+          affine_propagate((int8_t *)b[i].net.hidden2_out, net->output_biases,
+                           net->output_weights) /
+          FV_SCALE;
+  }
+
+#if defined(USE_MMX)
+  _mm_empty();
+#endif
+}
+
+static void read_output_weights(weight_t *w, const char *d) {
+  for (unsigned i = 0; i < 32; i++) {
+    unsigned c = i;
+#if defined(USE_AVX512) && !defined(USE_VNNI)
+    unsigned b = c & 0x18;
+    b = (b << 1) | (b >> 1);
+    c = (c & ~0x18) | (b & 0x18);
+#endif
+    w[c] = *d++;
+  }
+}
+
+INLINE unsigned wt_idx(unsigned r, unsigned c, unsigned dims) {
+  (void)dims;
+
+#if defined(USE_AVX512)
+  if (dims > 32) {
+    unsigned b = c & 0x38;
+    b = (b << 1) | (b >> 2);
+    c = (c & ~0x38) | (b & 0x38);
+  }
+#if !defined(USE_VNNI)
+  else if (dims == 32) {
+    unsigned b = c & 0x18;
+    b = (b << 1) | (b >> 1);
+    c = (c & ~0x18) | (b & 0x18);
+  }
+#endif
+
+#elif defined(USE_AVX2)
+  if (dims > 32) {
+    unsigned b = c & 0x18;
+    b = (b << 1) | (b >> 1);
+    c = (c & ~0x18) | (b & 0x18);
+  }
+
+#endif
+
+#if defined(USE_VNNI)
+  // Blocks of 4 inputs holding the 4 weights of each output
+  return (c / 4) * 128 + r * 4 + (c & 3);
+
+#elif defined(USE_AVX512)
+  return c * 64 + r + (r & ~7);
+
+#else
+  return c * 32 + r;
+
+#endif
+}
+
+static const char *read_hidden_weights(weight_t *w, unsigned dims,
+                                       const char *d) {
+  for (unsigned r = 0; r < 32; r++)
+    for (unsigned c = 0; c < dims; c++)
+      w[wt_idx(r, c, dims)] = *d++;
+
+  return d;
+}
+
+#if defined(USE_AVX2) && !defined(USE_VNNI)
+static void permute_biases(int32_t *biases) {
+  __m128i *b = (__m128i *)biases;
+  __m128i tmp[8];
+#ifdef USE_AVX512
+  tmp[0] = b[0];
+  tmp[1] = b[2];
+  tmp[2] = b[4];
+  tmp[3] = b[6];
+  tmp[4] = b[1];
+  tmp[5] = b[3];
+  tmp[6] = b[5];
+  tmp[7] = b[7];
+#elif USE_AVX2
+  tmp[0] = b[0];
+  tmp[1] = b[4];
+  tmp[2] = b[1];
+  tmp[3] = b[5];
+  tmp[4] = b[2];
+  tmp[5] = b[6];
+  tmp[6] = b[3];
+  tmp[7] = b[7];
+#else
+#error
+#endif
+  memcpy(b, tmp, 8 * sizeof(__m128i));
+}
+#endif
+
+// Read the weights, starting at the feature transformer header
+static void init_weights(void *weights, const char *transformer) {
+  NetWeights *w = (NetWeights *)weights;
+  const char *d = transformer + 4;
+
+  // Read transformer
+  for (unsigned i = 0; i < kHalfDimensions; i++, d += 2)
+    w->ft_biases[i] = readu_le_u16(d);
+  for (unsigned i = 0; i < kHalfDimensions * FtInDims; i++, d += 2)
+    w->ft_weights[i] = readu_le_u16(d);
+
+  // Read network
+  d += 4;
+  for (unsigned i = 0; i < 32; i++, d += 4)
+    w->hidden1_biases[i] = readu_le_u32(d);
+  d = read_hidden_weights(w->hidden1_weights, 512, d);
+  for (unsigned i = 0; i < 32; i++, d += 4)
+    w->hidden2_biases[i] = readu_le_u32(d);
+  d = read_hidden_weights(w->hidden2_weights, 32, d);
+  for (unsigned i = 0; i < 1; i++, d += 4)
+    w->output_biases[i] = readu_le_u32(d);
+  read_output_weights(w->output_weights, d);
+
+#if defined(USE_AVX2) && !defined(USE_VNNI)
+  permute_biases(w->hidden1_biases);
+  permute_biases(w->hidden2_biases);
+#endif
+}
+
+// Compute the accumulator only, for the update benchmark of nnuetest
+static void compute_accumulator(Board *pos) {
+  if (!update_accumulator(pos))
+    refresh_accumulator(pos);
+}
+
+} // namespace NNUE_CONCAT(nnue_, NNUE_ARCH)
+
+extern const NNUEKernels NNUE_CONCAT(nnue_kernels_, NNUE_ARCH) = {
+    NNUE_STR(NNUE_ARCH),
+    sizeof(NNUE_CONCAT(nnue_, NNUE_ARCH)::NetWeights),
+    NNUE_CONCAT(nnue_, NNUE_ARCH)::init_weights,
+    NNUE_CONCAT(nnue_, NNUE_ARCH)::evaluate_pos,
+    NNUE_CONCAT(nnue_, NNUE_ARCH)::evaluate_batch,
+    NNUE_CONCAT(nnue_, NNUE_ARCH)::compute_accumulator};
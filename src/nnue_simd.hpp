@@ -0,0 +1,119 @@
+// SIMD types and operations of the NNUE kernels, for the instruction set the
+// including variant is compiled for (USE_* flags, see CMakeLists.txt)
+
+#ifndef NNUE_SIMD_H
+#define NNUE_SIMD_H
+
+#include <stdint.h>
+
+#if defined(USE_AVX2)
+#include <immintrin.h>
+
+#elif defined(USE_SSE41)
+#include <smmintrin.h>
+
+#elif defined(USE_SSSE3)
+#include <tmmintrin.h>
+
+#elif defined(USE_SSE2)
+#include <emmintrin.h>
+
+#elif defined(USE_SSE)
+#include <xmmintrin.h>
+
+#elif defined(USE_MMX)
+#include <mmintrin.h>
+
+#elif defined(USE_NEON)
+#include <arm_neon.h>
+#endif
+
+// USE_MMX generates _mm_empty() instructions, so undefine if not needed
+#if defined(USE_SSE2)
+#undef USE_MMX
+#endif
+
+// 256-bit vpdpbusd from AVX-VNNI or AVX512-VNNI (With AVX512VL)
+#if defined(USE_AVXVNNI)
+#define dpbusd_256(acc, a, b) _mm256_dpbusd_avx_epi32(acc, a, b)
+#elif defined(USE_VNNI)
+#define dpbusd_256(acc, a, b) _mm256_dpbusd_epi32(acc, a, b)
+#endif
+
+#define VECTOR
+
+#ifdef USE_AVX512
+#define SIMD_WIDTH 512
+typedef __m512i vec16_t;
+typedef __m512i vec8_t;
+typedef __mmask64 mask_t;
+#define vec_add_16(a, b) _mm512_add_epi16(a, b)
+#define vec_sub_16(a, b) _mm512_sub_epi16(a, b)
+#define vec_packs(a, b) _mm512_packs_epi16(a, b)
+#define vec_mask_pos(a) _mm512_cmpgt_epi8_mask(a, _mm512_setzero_si512())
+#define vec_clip_8(a) _mm512_max_epi8(a, _mm512_setzero_si512())
+#define NUM_REGS 8 // only 8 are needed
+
+#elif USE_AVX2
+#define SIMD_WIDTH 256
+typedef __m256i vec16_t;
+typedef __m256i vec8_t;
+typedef uint32_t mask_t;
+#define vec_add_16(a, b) _mm256_add_epi16(a, b)
+#define vec_sub_16(a, b) _mm256_sub_epi16(a, b)
+#define vec_packs(a, b) _mm256_packs_epi16(a, b)
+#define vec_mask_pos(a)                                                        \
+  _mm256_movemask_epi8(_mm256_cmpgt_epi8(a, _mm256_setzero_si256()))
+#define vec_clip_8(a) _mm256_max_epi8(a, _mm256_setzero_si256())
+#define NUM_REGS 16
+
+#elif USE_SSE2
+#define SIMD_WIDTH 128
+typedef __m128i vec16_t;
+typedef __m128i vec8_t;
+typedef uint16_t mask_t;
+#define vec_add_16(a, b) _mm_add_epi16(a, b)
+#define vec_sub_16(a, b) _mm_sub_epi16(a, b)
+#define vec_packs(a, b) _mm_packs_epi16(a, b)
+#define vec_mask_pos(a)                                                        \
+  _mm_movemask_epi8(_mm_cmpgt_epi8(a, _mm_setzero_si128()))
+#ifdef IS_64BIT
+#define NUM_REGS 16
+#else
+#define NUM_REGS 8
+#endif
+
+#elif USE_MMX
+#define SIMD_WIDTH 64
+typedef __m64 vec16_t;
+typedef __m64 vec8_t;
+typedef uint8_t mask_t;
+#define vec_add_16(a, b) _mm_add_pi16(a, b)
+#define vec_sub_16(a, b) _mm_sub_pi16(a, b)
+#define vec_packs(a, b) _mm_packs_pi16(a, b)
+#define vec_mask_pos(a) _mm_movemask_pi8(_mm_cmpgt_pi8(a, _mm_setzero_si64()))
+#define NUM_REGS 8
+
+#elif USE_NEON
+#define SIMD_WIDTH 128
+typedef int16x8_t vec16_t;
+typedef int8x16_t vec8_t;
+typedef uint16_t mask_t;
+#define vec_add_16(a, b) vaddq_s16(a, b)
+#define vec_sub_16(a, b) vsubq_s16(a, b)
+#define vec_packs(a, b) vcombine_s8(vqmovn_s16(a), vqmovn_s16(b))
+#define vec_mask_pos(a) neon_movemask(vcgtq_s8(a, vdupq_n_u8(0)))
+#ifdef IS_64BIT
+#define NUM_REGS 16
+#else
+#define NUM_REGS 8
+#endif
+
+#else
+#undef VECTOR
+#define SIMD_WIDTH 16 // dummy
+typedef uint8_t mask_t; // dummy
+
+#endif
+
+#endif
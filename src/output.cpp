@@ -0,0 +1,125 @@
+#include <atomic>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "output.hpp"
+
+namespace Maestro {
+
+namespace {
+
+// Lines waiting for the output thread. The producers append to a list under a
+// short lock, the output thread swaps the list out and writes it without the
+// lock, so a producer never waits for stdout.
+class OutputQueue {
+public:
+  OutputQueue() : _thread(&OutputQueue::writeLoop, this) {}
+
+  // Write the lines left, then stop the output thread
+  ~OutputQueue() {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _exit = true;
+    }
+    _wake.notify_one();
+    _thread.join();
+  }
+
+  OutputQueue(const OutputQueue &) = delete;
+  OutputQueue &operator=(const OutputQueue &) = delete;
+
+  bool push(std::string &line, bool droppable) {
+    bool sleeping;
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+
+      // A droppable line is stale by the time a GUI this far behind reads it
+      if (droppable && _posted - _written.load() >= Backlog)
+        return false;
+
+      _pending.push_back(std::move(line));
+      ++_posted;
+      sleeping = _sleeping;
+    }
+
+    // Only wake the output thread if it went to sleep
+    if (sleeping)
+      _wake.notify_one();
+
+    return true;
+  }
+
+  void sync() {
+    size_t posted;
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      posted = _posted;
+    }
+    for (size_t written; (written = _written.load()) < posted;)
+      _written.wait(written);
+  }
+
+private:
+  // Lines posted but not written beyond which droppable lines are dropped
+  static constexpr size_t Backlog = 256;
+
+  void writeLoop() {
+    std::vector<std::string> lines;
+    std::string buffer;
+
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _sleeping = true;
+        _wake.wait(lock, [this] { return !_pending.empty() || _exit; });
+        _sleeping = false;
+
+        if (_pending.empty())
+          break;
+
+        // Both lists keep their capacity, so steady state posts don't allocate
+        lines.swap(_pending);
+      }
+
+      // Coalesce the lines queued while the last write was blocked
+      buffer.clear();
+      for (const std::string &line : lines) {
+        buffer += line;
+        buffer += '\n';
+      }
+
+      std::cout.write(buffer.data(), buffer.size());
+      std::cout.flush();
+
+      _written += lines.size();
+      _written.notify_all();
+      lines.clear();
+    }
+  }
+
+  std::mutex _mutex;
+  std::condition_variable _wake;
+  std::vector<std::string> _pending;
+  size_t _posted = 0;
+  bool _sleeping = false, _exit = false;
+  alignas(64) std::atomic<size_t> _written{0};
+  std::thread _thread;
+};
+
+OutputQueue &queue() {
+  static OutputQueue queue;
+  return queue;
+}
+
+} // namespace
+
+void Output::post(std::string line) { queue().push(line, false); }
+
+bool Output::tryPost(std::string line) { return queue().push(line, true); }
+
+void Output::sync() { queue().sync(); }
+
+} // namespace Maestro
@@ -0,0 +1,58 @@
+#ifndef OUTPUT_HPP
+#pragma once
+#define OUTPUT_HPP
+
+#include <string>
+
+#include "utils.hpp"
+
+namespace Maestro {
+
+/******************************************\
+|==========================================|
+|               UCI Output                 |
+|==========================================|
+\******************************************/
+
+// Lines of the search are written to stdout by an output thread, so a GUI
+// reading slowly never stalls the search. Any thread can post: the search, and
+// the UCI and input threads for the lines that can be written during a search
+// (readyok ...), so they are never interleaved with the search output.
+
+namespace Output {
+
+// Queue a line (Without the newline). Never waits for stdout, the lines pile up
+// while the GUI reads slowly.
+void post(std::string line);
+
+// Queue a line that can be dropped (currmove, nodes): returns false if the
+// output is already too far behind for it to be useful
+bool tryPost(std::string line);
+
+// Wait until every posted line is written and flushed
+void sync();
+
+// Rate limit of a kind of line (currmove, nodes ...), owned by the producer
+class Throttle {
+public:
+  explicit Throttle(TimePt interval) : _interval(interval) {}
+
+  // Check if a line can be posted now, and if so start the next interval
+  bool ready() {
+    const TimePt now = getTimeMs();
+    if (now - _last < _interval)
+      return false;
+    _last = now;
+    return true;
+  }
+
+private:
+  TimePt _interval;
+  TimePt _last = 0;
+};
+
+} // namespace Output
+
+} // namespace Maestro
+
+#endif // OUTPUT_HPP
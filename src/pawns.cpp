@@ -0,0 +1,46 @@
+#include "bitboard.hpp"
+#include "defs.hpp"
+#include "pawns.hpp"
+#include "position.hpp"
+#include "utils.hpp"
+
+namespace Maestro {
+
+namespace Pawns {
+
+Entry *probe(const Position &pos, Table &table) {
+  const Key key = pos.pawnKey();
+  Entry *entry = table[key];
+
+  if (entry->key == key)
+    return entry;
+
+  entry->key = key;
+  entry->evaluate<WHITE>(pos);
+  entry->evaluate<BLACK>(pos);
+
+  return entry;
+}
+
+template <Colour us> void Entry::evaluate(const Position &pos) {
+  constexpr Colour them = ~us;
+
+  const Bitboard ourPawns = pos.pieces(us, PAWN);
+  const Bitboard theirPawns = pos.pieces(them, PAWN);
+
+  _passedPawns[us] = 0;
+
+  Bitboard pawns = ourPawns;
+  while (pawns) {
+    const Square sq = popLSB(pawns);
+
+    // Passed if no enemy pawn can stop it and it is the front pawn of its file
+    if (!(theirPawns & passedPawnSpan(us, sq)) &&
+        !(ourPawns & forwardFileBB(us, sq)))
+      _passedPawns[us] |= sq;
+  }
+}
+
+} // namespace Pawns
+
+} // namespace Maestro
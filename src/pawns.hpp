@@ -0,0 +1,52 @@
+#ifndef PAWNS_HPP
+#pragma once
+#define PAWNS_HPP
+
+#include "bitboard.hpp"
+#include "defs.hpp"
+#include "position.hpp"
+#include "utils.hpp"
+
+namespace Maestro {
+
+/******************************************\
+|==========================================|
+|             Pawn Hash Table              |
+|==========================================|
+\******************************************/
+
+// https://www.chessprogramming.org/Pawn_Hash_Table
+
+namespace Pawns {
+
+struct Entry;
+
+// Pawn hash table (One per search thread)
+using Table = HashTable<Entry, 16384>;
+
+// Pawn hash entry, stores the pawn structure features of a pawn configuration
+// (indexed by the pawn key)
+struct Entry {
+
+  // Check if a move pushes a passed pawn (Used by search and move ordering)
+  bool isPassedPush(Colour us, Move move) const {
+    return _passedPawns[us] & move.from();
+  }
+
+  Key key = ~Key(0);
+
+private:
+  friend Entry *probe(const Position &pos, Table &table);
+  template <Colour us> void evaluate(const Position &pos);
+
+  Bitboard _passedPawns[COLOUR_N];
+};
+
+// Probe the pawn hash table, computing the entry on a miss
+Entry *probe(const Position &pos, Table &table);
+
+} // namespace Pawns
+
+} // namespace Maestro
+
+#endif // PAWNS_HPP
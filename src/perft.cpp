@@ -1,11 +1,14 @@
 
 
+#include <chrono>
 #include <fstream>
 #include <iostream>
 #include <sstream>
 #include <string>
 #include <vector>
 
+#include "bitboard.hpp"
+#include "cpu.hpp"
 #include "defs.hpp"
 #include "history.hpp"
 #include "movegen.hpp"
@@ -124,6 +127,140 @@ std::vector<PerftPosition> readBenchFile(std::string filePath) {
   return positions;
 }
 
+void sliderBench(std::string filePath) {
+  std::cout << "\n\n	Slider Benchmark (" << Bitboards::sliderBackend()
+            << ")\n"
+            << std::endl;
+
+  // Random squares and occupancies (A quarter of the board occupied)
+  constexpr size_t samplesN = 4096;
+  constexpr int rounds = 1000;
+  std::vector<std::pair<Square, Bitboard>> samples(samplesN);
+  PRNG rng;
+  for (auto &[sq, occupied] : samples) {
+    sq = Square(rng.getRandomU64() & 63);
+    occupied = rng.getRandomU64() & rng.getRandomU64();
+  }
+
+  using Clock = std::chrono::steady_clock;
+  Bitboard sum = EMPTYBB;
+  Clock::time_point start = Clock::now();
+  for (int i = 0; i < rounds; ++i)
+    for (const auto &[sq, occupied] : samples)
+      sum += attacksBB<BISHOP>(sq, occupied) ^ attacksBB<ROOK>(sq, occupied);
+  const double ns =
+      std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+
+  // The checksum keeps the lookups from being optimised away
+  const double lookups = 2.0 * samplesN * rounds;
+  std::cout << "	Lookups:	" << lookups / ns << " /ns (" << ns / lookups
+            << " ns each, checksum " << std::hex << sum << std::dec << ")"
+            << std::endl;
+
+  // Perft of the bench positions
+  std::vector<PerftPosition> positions = readBenchFile(filePath);
+  Position pos;
+  BoardState st{};
+  U64 nodes = 0;
+  start = Clock::now();
+  for (const PerftPosition &p : positions) {
+    pos.set(p.fen, st);
+    nodes += perftDriver(pos, p.depth);
+  }
+  const double us =
+      std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+
+  std::cout << "	Perft:		" << nodes / us << " Mnps (" << nodes
+            << " nodes)" << std::endl;
+}
+
+// Pieces of the side not to move, as read by Position::attackedByBB
+struct AttackSample {
+  Bitboard pawns, knights, bishops, rooks, occupied;
+  Square king;
+  Colour colour;
+};
+
+// Collect the positions of the tree up to depth
+static void collectAttackSamples(Position &pos, int depth,
+                                 std::vector<AttackSample> &samples) {
+  const Colour them = ~pos.sideToMove();
+  samples.push_back({pos.pieces(them, PAWN), pos.pieces(them, KNIGHT),
+                     pos.pieces(them, BISHOP, QUEEN),
+                     pos.pieces(them, ROOK, QUEEN), pos.occupied(),
+                     pos.square<KING>(them), them});
+
+  if (depth == 0)
+    return;
+
+  BoardState st{};
+  for (Move move : MoveList<ALL>(pos)) {
+    pos.makeMove(move, st);
+    collectAttackSamples(pos, depth - 1, samples);
+    pos.unmakeMove(move);
+  }
+}
+
+// Time the attack map of every sample (ns per call)
+enum AttackMapMode { LOOKUPS, FILLS, DISPATCH };
+
+template <AttackMapMode mode>
+static double attackMapTime(const std::vector<AttackSample> &samples,
+                            Bitboard &sum) {
+  using Clock = std::chrono::steady_clock;
+  constexpr int rounds = 10;
+
+  sum = EMPTYBB;
+  Clock::time_point start = Clock::now();
+  for (int i = 0; i < rounds; ++i)
+    for (const AttackSample &s : samples) {
+      Bitboard attacks = pawnAttacksBB(s.colour, s.pawns) |
+                         knightAttacksBB(s.knights) | attacksBB<KING>(s.king);
+      if constexpr (mode == LOOKUPS)
+        attacks |= sliderLookupsBB(s.bishops, s.rooks, s.occupied);
+      else if constexpr (mode == DISPATCH)
+        attacks |= sliderAttackMapBB(s.bishops, s.rooks, s.occupied);
+#ifdef ATTACK_FILLS
+      else
+        attacks |= sliderFillsBB(s.bishops, s.rooks, s.occupied);
+#endif
+      sum += attacks;
+    }
+
+  return std::chrono::duration<double, std::nano>(Clock::now() - start)
+             .count() /
+         (double(rounds) * samples.size());
+}
+
+void attackMapBench(std::string filePath) {
+  std::cout << "\n\n	Attack Map Benchmark\n" << std::endl;
+
+  // Corpus of the trees of the bench positions
+  std::vector<PerftPosition> positions = readBenchFile(filePath);
+  std::vector<AttackSample> samples;
+  Position pos;
+  BoardState st{};
+  for (const PerftPosition &p : positions) {
+    pos.set(p.fen, st);
+    collectAttackSamples(pos, 3, samples);
+  }
+  std::cout << "	Positions:	" << samples.size() << std::endl;
+
+  Bitboard lookupSum, fillSum, sum;
+  std::cout << "	Lookups (" << Bitboards::sliderBackend()
+            << "):	" << attackMapTime<LOOKUPS>(samples, lookupSum)
+            << " ns per call" << std::endl;
+
+  if (CPU::features().avx2)
+    std::cout << "	Fills (avx2):	" << attackMapTime<FILLS>(samples, fillSum)
+              << " ns per call"
+              << (lookupSum == fillSum ? "" : " (Mismatch)") << std::endl;
+
+  std::cout << "	Engine:		" << attackMapTime<DISPATCH>(samples, sum)
+            << " ns per call" << (lookupSum == sum ? "" : " (Mismatch)")
+            << std::endl;
+}
+
 void perftBench(std::string filePath, ThreadPool &threads) {
   // Read bench file
   std::vector<PerftPosition> positions = readBenchFile(filePath);
@@ -21,8 +21,14 @@ struct PerftPosition {
 // Function to count the number of leaf nodes at a given depth (With Debugging
 // and Performance Information)
 void perftTest(Position &pos, int depth);
+// Read the positions of bench.csv
+std::vector<PerftPosition> readBenchFile(std::string filePath);
 // Function to test multiple position from bench.csv
 void perftBench(std::string filePath, ThreadPool &threads);
+// Slider attack lookups per ns and perft speed of the bench.csv positions
+void sliderBench(std::string filePath);
+// Attack map speed with slider lookups and fills over the trees of bench.csv
+void attackMapBench(std::string filePath);
 
 } // namespace Maestro
 
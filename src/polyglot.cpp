@@ -1,11 +1,11 @@
-#include <filesystem>
-#include <fstream>
+#include <algorithm>
 #include <iostream>
 #include <string>
 
 #include "defs.hpp"
 #include "movegen.hpp"
 #include "polyglot.hpp"
+#include "misc.hpp"
 
 namespace Maestro {
 
@@ -413,30 +413,43 @@ constexpr Key PolyKeys[781] = {
 constexpr int ToPolyPiece[PIECE_N] = {-1, 1, 3, 5, 7, 9, 11, -1,
                                       -1, 0, 2, 4, 6, 8, 10, -1};
 
-constexpr char PromotedPieceASCII[] = "nbrq";
-
 void PolyBook::init(const std::string_view &path) {
-  _entries.clear();
-  std::ifstream file(path.data(), std::ios::binary);
-  if (file.is_open()) {
-    auto size = std::filesystem::file_size(path);
-    _size = size / sizeof(Entry);
-    _entries.resize(_size);
-    file.read(reinterpret_cast<char *>(_entries.data()), size);
-    file.close();
-    std::cout << "info string Polyglot book loaded (" << path << ")"
-              << std::endl;
-  } else
+  clear();
+
+  const std::string file(path);
+  FD fd = open_file(file.c_str());
+  if (fd == FD_ERR) {
     std::cout << "info string Warning could not open polyglot book (" << path
               << ")" << std::endl;
+    return;
+  }
+
+  const size_t size = file_size(fd);
+  const void *data = size >= sizeof(Entry) ? map_file(fd, &_mapping) : nullptr;
+  close_file(fd);
+
+  if (!data) {
+    std::cout << "info string Warning could not map polyglot book (" << path
+              << ")" << std::endl;
+    return;
+  }
+
+  _entries = static_cast<const Entry *>(data);
+  _size = size / sizeof(Entry);
+  _rng = PRNG({Bitboard(getTimeMs()), 0x9DA07E6D9CD459C4ULL});
+
+  std::cout << "info string Polyglot book loaded (" << path << ", " << _size
+            << " entries)" << std::endl;
 }
 
 void PolyBook::clear() {
-  _entries.clear();
+  unmap_file(_entries, _mapping);
+  _entries = nullptr;
   _size = 0;
+  _mapping = {};
 }
 
-Key PolyBook::polyKey(const Position &pos) const {
+Key PolyBook::polyKey(const Position &pos) {
   int offset = 0;
   int polyPiece = NO_PIECE;
   Piece piece = NO_PIECE;
@@ -478,62 +491,85 @@ Key PolyBook::polyKey(const Position &pos) const {
   return key;
 }
 
-Move PolyBook::polyMoveToEngineMove(const Position &pos, U16 polyMove) const {
-  File from_file = File((polyMove >> 6) & 7);
-  Rank from_rank = Rank((polyMove >> 9) & 7);
-  File to_file = File((polyMove >> 0) & 7);
-  Rank to_rank = Rank((polyMove >> 3) & 7);
-  int promotedPiece = (polyMove >> 12) & 7;
+U16 PolyBook::engineMoveToPolyMove(Move move) {
+  const Square from = move.from();
+  Square to = move.to();
 
-  Square from_square = toSquare(from_file, from_rank);
-  Square to_square = toSquare(to_file, to_rank);
+  if (move.is<CASTLE>())
+    to = toSquare(to > from ? FILE_H : FILE_A, rankOf(from));
 
-  std::string move;
+  const int promoted = move.is<PROMOTION>() ? move.promoted() - KNIGHT + 1 : 0;
 
-  move += sq2Str(from_square) + sq2Str(to_square);
+  return U16(fileOf(to) | rankOf(to) << 3 | fileOf(from) << 6 |
+             rankOf(from) << 9 | promoted << 12);
+}
 
-  if (promotedPiece > 0) {
-    move += PromotedPieceASCII[promotedPiece];
-  }
+Move PolyBook::polyMoveToEngineMove(const Position &pos, U16 polyMove) const {
+  Square from = toSquare(File((polyMove >> 6) & 7), Rank((polyMove >> 9) & 7));
+  Square to = toSquare(File(polyMove & 7), Rank((polyMove >> 3) & 7));
+  int promoted = (polyMove >> 12) & 7;
+  const Colour us = pos.sideToMove();
+  Move move;
+
+  // Castling is stored as the king taking its own rook
+  if (pos.pieceOn(from) == toPiece(us, KING) &&
+      pos.pieceOn(to) == toPiece(us, ROOK))
+    move = Move::encode<CASTLE>(
+        from, relativeSquare(us, to > from ? G1 : C1));
+  else if (promoted)
+    move = Move::encode<PROMOTION>(from, to, PieceType(KNIGHT + promoted - 1));
+  else if (pos.pieceOn(from) == toPiece(us, PAWN) &&
+           to == pos.state()->enPassant)
+    move = Move::encode<EN_PASSANT>(from, to);
+  else
+    move = Move::encode(from, to);
+
+  // Books can hold moves of other positions with the same key
+  return pos.isPseudoLegal(move) && pos.isLegal(move) ? move : Move::none();
+}
 
-  // Generate all moves
-  Move moves[256];
-  Move *last = generateMoves<ALL>(moves, pos);
+Move PolyBook::probe(const Position &pos) {
+  if (!_size)
+    return Move::none();
 
-  for (Move *begin = moves; begin < last; ++begin) {
-    if (move == move2Str(*begin)) {
-      return *begin;
-    }
-  }
+  const Key key = polyKey(pos);
 
-  return Move::none();
-}
+  // First entry of the position
+  const Entry *first = std::partition_point(
+      _entries, _entries + _size,
+      [key](const Entry &e) { return __builtin_bswap64(e.key) < key; });
 
-Move PolyBook::probe(const Position &pos) const {
-  srand(getTimeMs());
+  Move bookMoves[MAX_MOVES];
+  U32 weights[MAX_MOVES];
+  U32 total = 0;
+  int count = 0;
 
-  Key pKey = polyKey(pos);
+  for (const Entry *e = first; e < _entries + _size && count < MAX_MOVES &&
+                               __builtin_bswap64(e->key) == key;
+       ++e) {
+    Move move = polyMoveToEngineMove(pos, __builtin_bswap16(e->move));
+    if (!move)
+      continue;
 
-  Move bookMoves[32]{};
+    bookMoves[count] = move;
+    weights[count] = __builtin_bswap16(e->weight);
+    total += weights[count++];
+  }
 
-  int index = 0;
-  for (const auto &entry : _entries) {
-    if (__builtin_bswap64(entry.key) == pKey) {
-      // Get move from the book and then convert to engine move format
-      Move move = polyMoveToEngineMove(pos, __builtin_bswap16(entry.move));
+  if (!count)
+    return Move::none();
 
-      if (move)
-        // Add moves to book moves
-        bookMoves[index++] = move;
-    }
-  }
+  // Pick a move with a probability proportional to its weight (Uniformly if
+  // none of them has a weight)
+  if (!total)
+    return bookMoves[_rng.getRandomU64() % count];
 
-  if (index != 0) {
-    int randomIndex = rand();
-    return bookMoves[randomIndex % index];
-  }
+  U32 pick = _rng.getRandomU64() % total;
+  int i = 0;
+  while (pick >= weights[i])
+    pick -= weights[i++];
 
-  return Move::none();
+  return bookMoves[i];
 }
 
 } // namespace Maestro
@@ -7,21 +7,30 @@
 #include "defs.hpp"
 #include "move.hpp"
 #include "position.hpp"
+#include "utils.hpp"
 
 namespace Maestro {
 
-// Polyglot book class
+// Polyglot book class. The book is memory mapped and probed with a binary
+// search on its sorted (big endian) keys
 class PolyBook {
 public:
+  PolyBook() = default;
+  PolyBook(const PolyBook &) = delete;
+  PolyBook &operator=(const PolyBook &) = delete;
+  ~PolyBook() { clear(); }
+
   void init(const std::string_view &path);
   void clear();
 
-  Move probe(const Position &pos) const;
+  Move probe(const Position &pos);
 
-private:
-  Key polyKey(const Position &pos) const;
-  Move polyMoveToEngineMove(const Position &pos, U16 polyMove) const;
+  // Polyglot key of a position
+  static Key polyKey(const Position &pos);
+  // Polyglot encoding of a move (Castling as the king taking its rook)
+  static U16 engineMoveToPolyMove(Move move);
 
+  // Entry of a book file (Big endian)
   struct Entry {
     Key key;
     U16 move;
@@ -29,10 +38,20 @@ private:
     U32 learn;
   };
 
-  size_t _size;
-  std::vector<Entry> _entries;
+private:
+  Move polyMoveToEngineMove(const Position &pos, U16 polyMove) const;
+
+  const Entry *_entries = nullptr;
+  size_t _size = 0;
+  // Mapping of the file (map_t of misc.hpp)
+#ifdef _WIN32
+  void *_mapping = nullptr;
+#else
+  size_t _mapping = 0;
+#endif
+  PRNG _rng;
 };
 
 } // namespace Maestro
 
-#endif
\ No newline at end of file
+#endif
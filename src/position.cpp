@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <cstddef>
 #include <cstring>
 #include <iostream>
 #include <sstream>
@@ -33,6 +34,14 @@ BoardState BoardState::copy(const BoardState &bs) {
   return *this;
 }
 
+void BoardState::clear() {
+  static const BoardState empty = {};
+  std::memcpy((void *)this, &empty, offsetof(BoardState, nnueData));
+  nnueData.accumulator.computedAccumulation = 0;
+  nnueData.dirtyPiece = {};
+  previous = nullptr;
+}
+
 /******************************************\
 |==========================================|
 |            Piece Manipulation            |
@@ -176,6 +185,43 @@ void Position::print() const {
   std::cout << "Fen string: " << fen() << std::endl;
 }
 
+std::string readEPDPosition(std::istream &is) {
+  std::string fen, field;
+  for (int i = 0; i < 4 && is >> field; ++i)
+    fen += (i ? " " : "") + field;
+  return fen;
+}
+
+// Check the board and side to move fields, Position::set expects them valid
+// (One king per side, at most 32 pieces for the NNUE lists)
+bool validBoard(const std::string &epd) {
+  std::istringstream is(epd);
+  std::string board, side;
+  if (!(is >> board >> side) || (side != "w" && side != "b"))
+    return false;
+
+  int rank = 7, file = 0, pieces = 0;
+  for (char c : board) {
+    if (c == '/') {
+      if (file != 8 || --rank < 0)
+        return false;
+      file = 0;
+    } else if (c >= '1' && c <= '8')
+      file += c - '0';
+    else if (std::string("PNBRQKpnbrqk").find(c) != std::string::npos)
+      ++file, ++pieces;
+    else
+      return false;
+
+    if (file > 8)
+      return false;
+  }
+
+  return rank == 0 && file == 8 && pieces <= 32 &&
+         std::count(board.begin(), board.end(), 'K') == 1 &&
+         std::count(board.begin(), board.end(), 'k') == 1;
+}
+
 // Set the position based on fen string
 void Position::set(const std::string &fen, BoardState &state) {
   // Initialize square and piece index
@@ -272,6 +318,8 @@ void Position::setState() const {
 
   st->pawnKey = initPawnKey();
 
+  st->materialKey = initMaterialKey();
+
   auto [whiteNPM, blackNPM] = initNonPawnMaterial();
 
   st->nonPawnMaterial[WHITE] = whiteNPM;
@@ -400,11 +448,23 @@ Key Position::initPawnKey() const {
   return key;
 }
 
+Key Position::initMaterialKey() const {
+  // Initialize hash key
+  Key key = 0ULL;
+  // Hash the count of each piece (Not their squares)
+  for (Colour c : {WHITE, BLACK})
+    for (PieceType pt = PAWN; pt <= KING; ++pt)
+      for (int i = 0; i < count(toPiece(c, pt)); ++i)
+        key ^= Zobrist::pieceSquareKeys[toPiece(c, pt)][i];
+  // Return hash key
+  return key;
+}
+
 std::pair<int, int> Position::initNonPawnMaterial() const {
   // Initialize non pawn material
   int whiteNPM = 0, blackNPM = 0;
   // Loop through all pieces
-  for (PieceType pt = KNIGHT; pt <= KING; ++pt) {
+  for (PieceType pt = KNIGHT; pt < KING; ++pt) {
     // Update non pawn material
     whiteNPM += PieceValue[pt] * count(toPiece(WHITE, pt));
     blackNPM += PieceValue[pt] * count(toPiece(BLACK, pt));
@@ -465,40 +525,11 @@ Bitboard Position::sqAttackedByBB(Square sq, Bitboard occupied) const {
 
 // Private functions
 Bitboard Position::attackedByBB(Colour enemy) const {
-  Square attacker;
-  Bitboard attacks = EMPTYBB;
-  const Bitboard occ = occupied();
-
-  // Knight attacks
-  Bitboard knights = pieces(enemy, KNIGHT);
-  while (knights) {
-    attacker = popLSB(knights);
-    attacks |= attacksBB<KNIGHT>(attacker);
-  }
-
-  // Pawn attacks
-  Bitboard pawns = pieces(enemy, PAWN);
-  attacks |= (enemy == WHITE) ? pawnAttacksBB<WHITE>(pawns)
-                              : pawnAttacksBB<BLACK>(pawns);
-
-  // King attacks
-  attacks |= attacksBB<KING>(square<KING>(enemy));
-
-  // Bishop and Queen attacks
-  Bitboard bishops = pieces(enemy, BISHOP, QUEEN);
-  while (bishops) {
-    attacker = popLSB(bishops);
-    attacks |= attacksBB<BISHOP>(attacker, occ);
-  }
-
-  // Rook and Queen attacks
-  Bitboard rooks = pieces(enemy, ROOK, QUEEN);
-  while (rooks) {
-    attacker = popLSB(rooks);
-    attacks |= attacksBB<ROOK>(attacker, occ);
-  }
-
-  return attacks;
+  return pawnAttacksBB(enemy, pieces(enemy, PAWN)) |
+         knightAttacksBB(pieces(enemy, KNIGHT)) |
+         attacksBB<KING>(square<KING>(enemy)) |
+         sliderAttackMapBB(pieces(enemy, BISHOP, QUEEN),
+                           pieces(enemy, ROOK, QUEEN), occupied());
 }
 
 Bitboard Position::sliderBlockers(Bitboard sliders, Square sq,
@@ -534,12 +565,13 @@ Bitboard Position::sliderBlockers(Bitboard sliders, Square sq,
 
 void Position::makeMove(Move move, BoardState &state) {
   // Reset new state
-  state = {};
+  state.clear();
   state.copy(*st);
 
   // Get Hash Key (And change sides)
   Key hashKey = st->key ^ Zobrist::sideKey;
   Key pawnKey = st->pawnKey;
+  Key materialKey = st->materialKey;
 
   state.previous = st;
   st = &state;
@@ -597,6 +629,8 @@ void Position::makeMove(Move move, BoardState &state) {
     else
       pawnKey ^= Zobrist::pieceSquareKeys[cap][capSq];
 
+    materialKey ^= Zobrist::pieceSquareKeys[cap][count(cap)];
+
     dp.dirtyNum = 2; // 1 piece moved, 1 piece captured
     dp.pc[1] = Eval::toNNUEPiece(cap);
     dp.from[1] = capSq;
@@ -658,6 +692,9 @@ void Position::makeMove(Move move, BoardState &state) {
 
       pawnKey ^= Zobrist::pieceSquareKeys[piece][to];
 
+      materialKey ^= Zobrist::pieceSquareKeys[piece][count(piece)] ^
+                     Zobrist::pieceSquareKeys[promotedTo][count(promotedTo) - 1];
+
       st->nonPawnMaterial[side] += PieceValue[pieceTypeOf(promotedTo)];
     }
     // Update fifty move rule
@@ -691,6 +728,9 @@ void Position::makeMove(Move move, BoardState &state) {
   // Update state pawn hash key
   st->pawnKey = pawnKey;
 
+  // Update state material hash key
+  st->materialKey = materialKey;
+
   // Update repetition
   st->repetition = 0;
   int end = std::min(st->plies, st->fiftyMove);
@@ -708,7 +748,12 @@ void Position::makeMove(Move move, BoardState &state) {
     }
   }
 
-  refreshMasks(*this);
+  // Slider checks (Direct, discovered or by the castling rook), the other
+  // masks wait for their first use
+  const Square ksq = square<KING>(enemy);
+  st->sliderCheck =
+      (attacksBB<BISHOP>(ksq, occupied()) & pieces(side, BISHOP, QUEEN)) ||
+      (attacksBB<ROOK>(ksq, occupied()) & pieces(side, ROOK, QUEEN));
 }
 
 void Position::unmakeMove(Move move) {
@@ -754,10 +799,15 @@ void Position::unmakeMove(Move move) {
 }
 
 void Position::makeNullMove(BoardState &state) {
-  state = {};
+  state.clear();
   // Copy current board state to new state partially
   state.copy(*st);
 
+  // Null moves don't change the pieces, keep their keys
+  state.key = st->key;
+  state.pawnKey = st->pawnKey;
+  state.materialKey = st->materialKey;
+
   state.previous = st;
   st = &state;
 
@@ -775,8 +825,6 @@ void Position::makeNullMove(BoardState &state) {
 
   // Update repetition
   st->repetition = 0;
-
-  refreshMasks(*this);
 }
 
 void Position::unmakeNullMove() {
@@ -797,6 +845,8 @@ bool Position::isLegal(Move move) const {
   if (!isPseudoLegal(move))
     return false;
 
+  ensureMasks();
+
   // Handle enpassant
   if (move.is<EN_PASSANT>()) {
     Square ksq = square<KING>(us);
@@ -858,12 +908,17 @@ bool Position::isPseudoLegal(Move move) const {
 
     if (move.is<NORMAL>() && !isCapture && !isSinglePush && !isDoublePush)
       return false;
+
+    // Pawns reaching the last rank must promote
+    if (rankOf(to) == relativeRank(us, RANK_8))
+      return false;
   }
   // If destination square is unreachable by the piece
   else if (!(attacksBB(pieceTypeOf(piece), from, occupied()) & to))
     return false;
 
   if (isInCheck()) {
+    ensureMasks();
     if (pieceTypeOf(piece) != KING) {
       if (!(st->checkMask & to))
         return false;
@@ -969,24 +1024,19 @@ bool Position::SEE(Move move, int threshold) const {
 bool Position::givesCheck(Move move) const {
   Square from = move.from();
   Square to = move.to();
-  PieceType pt = pieceTypeOn(from);
   Colour us = _sideToMove;
   Square enemyKing = square<KING>(~us);
 
-  if (attacksBB(pt, to, occupied()) & enemyKing)
-    return true;
-
-  Bitboard attackers = attacksBB<BISHOP>(enemyKing, pieces(us, BISHOP, QUEEN)) |
-                       attacksBB<ROOK>(enemyKing, pieces(us, ROOK, QUEEN));
+  ensureMasks();
 
-  attackers &= lineBB[enemyKing][from];
+  // Direct check
+  if (st->checkSquares[pieceTypeOn(from)] & to)
+    return true;
 
-  if (attackers) {
-    Square sq = popLSB(attackers);
-    Bitboard b = betweenBB[sq][enemyKing] & occupied();
-    if (b and !moreThanOne(b))
-      return !aligned(from, to, enemyKing) || move.is<CASTLE>();
-  }
+  // Discovered check
+  if ((st->discoverers & from) &&
+      (!aligned(from, to, enemyKing) || move.is<CASTLE>()))
+    return true;
 
   Square capsq, rto;
   Bitboard b;
@@ -997,7 +1047,7 @@ bool Position::givesCheck(Move move) const {
   case PROMOTION:
     return attacksBB(move.promoted(), to, occupied() ^ from) & enemyKing;
   case EN_PASSANT:
-    capsq = enPassantTarget(us);
+    capsq = enPassantTarget(~us);
     b = (occupied() ^ from ^ capsq) | to;
     return (attacksBB<BISHOP>(enemyKing, b) & pieces(us, BISHOP, QUEEN)) |
            (attacksBB<ROOK>(enemyKing, b) & pieces(us, ROOK, QUEEN));
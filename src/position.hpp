@@ -3,6 +3,7 @@
 #define POSITION_HPP
 
 #include <deque>
+#include <iosfwd>
 #include <memory>
 #include <string>
 
@@ -42,6 +43,10 @@ struct BoardState {
 
   BoardState copy(const BoardState &bs);
 
+  // Reset to a new state, leaving the accumulator values (Only read once
+  // computedAccumulation is set) uncleared
+  void clear();
+
   // Copied when making new move
   Square enPassant;
   int plies;
@@ -54,12 +59,21 @@ struct BoardState {
   // Not copied when making new move
   Key key;
   Key pawnKey;
+  Key materialKey;
   Piece captured = NO_PIECE;
   int repetition;
+  // Legality masks, computed on first use (See Position::ensureMasks). Only
+  // the checks are known before.
+  bool masksReady = false;
+  bool sliderCheck = false;
   Bitboard checkMask = FULLBB;
   Bitboard rookPin, bishopPin, kingBan, kingAttacks, available, attacked,
       pinned[COLOUR_N], pinners[COLOUR_N];
   bool enPassantPin = false;
+  // Squares a piece type checks the enemy king from, and the pieces that give
+  // a discovered check when moving off the line to the king
+  Bitboard checkSquares[PIECE_TYPE_N];
+  Bitboard discoverers;
 
   NNUEdata nnueData;
 
@@ -67,8 +81,8 @@ struct BoardState {
   BoardState *previous;
 };
 
-// Move history (Ideas from Stockfish)
-using StateListPtr = std::unique_ptr<std::deque<BoardState>>;
+// Move history (Ideas from Stockfish), shared by the engine and the search
+using StateListPtr = std::shared_ptr<std::deque<BoardState>>;
 
 /******************************************\
 |==========================================|
@@ -78,6 +92,14 @@ using StateListPtr = std::unique_ptr<std::deque<BoardState>>;
 
 class Thread;
 
+// Read the position of a FEN or EPD line, its first four fields (The move
+// counters or the opcodes are left in is)
+std::string readEPDPosition(std::istream &is);
+
+// Check the board and side to move fields of a FEN, Position::set expects them
+// valid
+bool validBoard(const std::string &fen);
+
 class Position {
 public:
   Position() = default;
@@ -92,6 +114,7 @@ public:
   // Init Keys
   Key initKey() const;
   Key initPawnKey() const;
+  Key initMaterialKey() const;
 
   // Output
   void print() const;
@@ -111,6 +134,7 @@ public:
   int fiftyMove() const;
   Key key() const;
   Key pawnKey() const;
+  Key materialKey() const;
   Score psq() const;
   int gamePhase() const;
   Bitboard attacked() const;
@@ -118,6 +142,8 @@ public:
   Bitboard pinners(Colour us) const;
   template <Colour us> Bitboard pinned() const;
   Bitboard pinned(Colour us) const;
+  Bitboard checkSquares(PieceType pt) const;
+  Bitboard discoverers() const;
 
   // Get Thread
   Thread *thread() const;
@@ -185,6 +211,9 @@ public:
   // Gives check
   bool givesCheck(Move move) const;
 
+  // Compute the legality masks of the state if not done yet
+  void ensureMasks() const;
+
   // Position has repeated
   bool hasRepeated() const;
 
@@ -226,19 +255,27 @@ private:
 
 // Get the pinners of a colour
 template <Colour us> Bitboard Position::pinners() const {
+  ensureMasks();
   return st->pinners[us];
 }
 
 // Get the pinners of a colour
-inline Bitboard Position::pinners(Colour us) const { return st->pinners[us]; }
+inline Bitboard Position::pinners(Colour us) const {
+  ensureMasks();
+  return st->pinners[us];
+}
 
 // Get the pinned pieces of a colour
 template <Colour us> Bitboard Position::pinned() const {
+  ensureMasks();
   return st->pinned[us];
 }
 
 // Get the pinned pieces of a colour
-inline Bitboard Position::pinned(Colour us) const { return st->pinned[us]; }
+inline Bitboard Position::pinned(Colour us) const {
+  ensureMasks();
+  return st->pinned[us];
+}
 
 // Get square of a piece type
 template <PieceType pt> Square Position::square(Colour us) const {
@@ -306,8 +343,30 @@ inline void Position::castleRook(Square from, Square to, Square &rookFrom,
 // State getter
 inline BoardState *Position::state() const { return st; }
 
+void refreshMasks(const Position &pos);
+
+inline void Position::ensureMasks() const {
+  if (!st->masksReady)
+    refreshMasks(*this);
+}
+
 // Get attacked squares
-inline Bitboard Position::attacked() const { return st->attacked; }
+inline Bitboard Position::attacked() const {
+  ensureMasks();
+  return st->attacked;
+}
+
+// Get the squares a piece type gives check from
+inline Bitboard Position::checkSquares(PieceType pt) const {
+  ensureMasks();
+  return st->checkSquares[pt];
+}
+
+// Get the pieces giving a discovered check when moving
+inline Bitboard Position::discoverers() const {
+  ensureMasks();
+  return st->discoverers;
+}
 
 // Get squares of a piece type
 inline const Square *Position::squares(Colour c, PieceType pt) const {
@@ -326,11 +385,16 @@ inline Key Position::key() const { return st->key; }
 // Get pawn hash key
 inline Key Position::pawnKey() const { return st->pawnKey; }
 
+// Returns the material hash key
+inline Key Position::materialKey() const { return st->materialKey; }
+
 // Get fifty move counter
 inline int Position::fiftyMove() const { return st->fiftyMove; }
 
 // Check if the position is in check
-inline bool Position::isInCheck() const { return (st->checkMask != FULLBB); }
+inline bool Position::isInCheck() const {
+  return st->checkMask != FULLBB || st->sliderCheck;
+}
 
 // Check if move is capture
 inline bool Position::isCapture(Move move) const {
@@ -416,6 +480,7 @@ inline int Position::count(Piece pc) const { return _pieceCount[pc]; }
 
 // Returns blockers for king
 inline Bitboard Position::blockersForKing() const {
+  ensureMasks();
   return st->bishopPin & occupied(_sideToMove) |
          st->rookPin & occupied(_sideToMove);
 }
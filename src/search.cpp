@@ -1,8 +1,9 @@
-#include <iostream>
+#include <string>
 
 #include "eval.hpp"
 #include "history.hpp"
 #include "movepicker.hpp"
+#include "output.hpp"
 #include "search.hpp"
 #include "uci.hpp"
 
@@ -34,9 +35,6 @@ void TimeManager::init(Limits &limits, Colour us, int ply) {
   // Cap time allocation using move overhead
   optimumTime = std::min(optimumTime, time - MOVE_OVERHEAD);
   maximumTime = std::min(maximumTime, time - MOVE_OVERHEAD);
-
-  std::cout << "Optimum: " << optimumTime << std::endl;
-  std::cout << "Maximum: " << maximumTime << std::endl;
 }
 
 // Update the total search time and check if its exceeded
@@ -71,13 +69,27 @@ bool SearchWorker::checkTM(Depth &lastBestMoveDepth, int &pvStability,
 }
 
 // Check if we should stop the search
-void SearchWorker::checkTime() const {
-  if (isMainThread() && _completedDepth >= 4 &&
+void SearchWorker::checkTime() {
+  if (!isMainThread())
+    return;
+
+  checkPonderhit();
+
+  if (_completedDepth >= 4 && !limits.ponder &&
       ((limits.isUsingTM() && tm.elapsed() >= tm.maximum()) ||
-       (limits.movetime && tm.elapsed() >= limits.movetime)))
+       (limits.movetime && tm.elapsed() >= limits.movetime) ||
+       (limits.nodes && threads.nodesSearched() >= limits.nodes)))
     threads.stop = threads.abortedSearch = true;
 }
 
+// The time limits of a ponder search apply from ponderhit
+void SearchWorker::checkPonderhit() {
+  if (limits.ponder && !threads.ponder) {
+    limits.ponder = false;
+    tm.restart(threads.ponderhitTime);
+  }
+}
+
 void SearchWorker::getPV(SearchWorker &best, Depth depth) const {
   auto &rootMoves = best.rootMoves;
   auto &pos = best.rootPos;
@@ -92,6 +104,10 @@ void SearchWorker::getPV(SearchWorker &best, Depth depth) const {
   if (v == -VAL_INFINITE)
     v = VAL_ZERO;
 
+  // Report the tablebase score unless the search found a mate
+  if (sharedState.tbConfig.rootInTB && std::abs(v) < VAL_MATE_BOUND)
+    v = rootMoves[0].tbScore;
+
   bool isExact = !updated;
 
   std::string pv;
@@ -109,11 +125,15 @@ void SearchWorker::getPV(SearchWorker &best, Depth depth) const {
   info.selDepth = rootMoves[0].selDepth;
   info.timeMs = tm.elapsed() + 1;
   info.nodes = nodes;
+  info.tbHits = threads.tbHitsSearched();
   info.nps = nodes * 1000 / info.timeMs;
   info.pv = pv;
   info.hashFull = tt.hashFull();
 
-  UCI::uciReport(info);
+  if (sharedState.report)
+    sharedState.report(info, best.rootMoves[0].pv[0]);
+  else
+    UCI::uciReport(info);
 }
 
 void SearchWorker::updatePV(Move *pv, Move best, const Move *childPV) const {
@@ -140,7 +160,13 @@ void SearchWorker::startSearch() {
 
   tm.init(limits, rootPos.sideToMove(), rootPos.gamePlies());
 
-  tt.newSearch();
+  if (limits.time[rootPos.sideToMove()] && !sharedState.report) {
+    Output::post("info string Optimum: " + std::to_string(tm.optimum()) +
+                 " ms Maximum: " + std::to_string(tm.maximum()) + " ms");
+  }
+
+  if (sharedState.newHashGen)
+    tt.newSearch();
 
   if (rootMoves.empty()) {
     rootMoves.emplace_back(Move::none());
@@ -149,7 +175,7 @@ void SearchWorker::startSearch() {
     iterativeDeepening();
   }
 
-  while (!threads.stop && limits.infinite) {
+  while (!threads.stop && (limits.infinite || threads.ponder)) {
   }
 
   threads.stop = true;
@@ -167,8 +193,8 @@ void SearchWorker::startSearch() {
   if (best != this)
     getPV(*best, best->completedDepth());
 
-  auto bestMove = move2Str(best->rootMoves[0].pv[0]);
-  std::cout << "bestmove " << bestMove << std::endl;
+  if (!sharedState.report)
+    Output::post("bestmove " + move2Str(best->rootMoves[0].pv[0]));
 }
 
 void SearchWorker::iterativeDeepening() {
@@ -230,7 +256,10 @@ void SearchWorker::iterativeDeepening() {
     if (!isMainThread())
       continue;
 
-    if (limits.isUsingTM() && !threads.stop && _completedDepth >= 4 &&
+    checkPonderhit();
+
+    if (limits.isUsingTM() && !threads.stop && !limits.ponder &&
+        _completedDepth >= 4 &&
         (checkTM(lastBestMoveDepth, pvStability, bestValue) ||
          tm.elapsed() >= tm.maximum()))
       threads.stop = true;
@@ -281,7 +310,9 @@ void SearchWorker::aspirationWindows(SearchStack *ss, Value &bestValue) {
   }
 }
 
-Value SearchWorker::evaluate(Position &pos) { return Eval::evaluate(pos); }
+Value SearchWorker::evaluate(Position &pos) {
+  return Eval::evaluate(pos, materialTable, sharedState.net);
+}
 
 template <NodeType nodeType>
 Value SearchWorker::search(Position &pos, SearchStack *ss, Depth depth,
@@ -308,9 +339,11 @@ Value SearchWorker::search(Position &pos, SearchStack *ss, Depth depth,
   Key hashKey;
   Move move, bestMove, excludedMove;
   Value bestValue, value, probCutBeta, hist, seeMargin[2];
+  Value maxValue = VAL_INFINITE;
   int moveCount;
-  bool ttCapture, isCapture, givesCheck, improving, oppWorsening;
+  bool ttCapture, isCapture, givesCheck, improving, oppWorsening, passedPush;
   Depth R, newDepth, extensions;
+  Pawns::Entry *pawnEntry;
 
   MoveArray captures, quiets;
 
@@ -393,6 +426,58 @@ Value SearchWorker::search(Position &pos, SearchStack *ss, Depth depth,
       return ttData.value;
   }
 
+  // Tablebase probe
+  const Tablebases::Config &tbConfig = sharedState.tbConfig;
+  if (!rootNode && !excludedMove && tbConfig.cardinality) {
+    const int pieces = countBits(pos.occupied());
+
+    if (pieces <= tbConfig.cardinality &&
+        (pieces < tbConfig.cardinality || depth >= tbConfig.probeDepth) &&
+        pos.fiftyMove() == 0 && !pos.canCastle(ANY_SIDE)) {
+      Tablebases::ProbeState err;
+      const Tablebases::WDLScore wdl = Tablebases::probeWDL(pos, &err);
+
+      if (err != Tablebases::FAIL) {
+        tbHits.fetch_add(1, std::memory_order_relaxed);
+
+        const int drawScore = tbConfig.useRule50 ? 1 : 0;
+
+        // Wins and losses are scored just outside the mate range
+        value = wdl < -drawScore  ? -VAL_MATE_BOUND + ss->ply + 1
+                : wdl > drawScore ? VAL_MATE_BOUND - ss->ply - 1
+                                  : VAL_ZERO + 2 * wdl * drawScore;
+
+        const TTFlag flag = wdl < -drawScore  ? FLAG_UPPER
+                            : wdl > drawScore ? FLAG_LOWER
+                                              : FLAG_EXACT;
+
+        if (flag == FLAG_EXACT ||
+            (flag == FLAG_LOWER ? value >= beta : value <= alpha)) {
+          ttWriter.write(hashKey, TTable::valueToTT(value, ss->ply), ss->ttPV,
+                         flag, std::min(MAX_PLY - 1, depth + 6), Move::none(),
+                         VAL_NONE, tt._gen);
+          return value;
+        }
+
+        if (pvNode) {
+          if (flag == FLAG_LOWER)
+            bestValue = value, alpha = std::max(alpha, bestValue);
+          else
+            maxValue = value;
+        }
+      }
+    }
+  }
+
+  // KPK positions are solved by the bitbase, no need to search them
+  if (!rootNode && !excludedMove && !pos.nonPawnMaterial() &&
+      pos.count<PAWN>() == 1)
+    return evaluate(pos);
+
+  // Static Exchange Evaluation Pruning Margins (Also used in check)
+  seeMargin[0] = -20 * depth * depth;
+  seeMargin[1] = -64 * depth;
+
   // Static Evaluation
   if (ss->inCheck) {
     ss->staticEval = (ss - 2)->staticEval;
@@ -413,10 +498,6 @@ Value SearchWorker::search(Position &pos, SearchStack *ss, Depth depth,
 
   oppWorsening = ss->staticEval + (ss - 1)->staticEval > 2;
 
-  // Static Exchange Evaluation Pruning Margins
-  seeMargin[0] = -20 * depth * depth;
-  seeMargin[1] = -64 * depth;
-
   // Reverse Futility pruning (If eval is well enough, assume the eval will hold
   // above beta or cause a cutoff)
   if (!pvNode && !ss->ttPV && depth <= 8 && !excludedMove &&
@@ -524,7 +605,10 @@ moves_loop:
 
   Continuation *ch[] = {(ss - 1)->ch, (ss - 2)->ch, (ss - 3)->ch, (ss - 4)->ch};
 
-  MovePicker mp(pos, ttData.move, depth, ss->ply, ht, kt, cht, ch);
+  // Passed pawns of the position, for the move ordering and the extensions
+  pawnEntry = Pawns::probe(pos, pawnTable);
+
+  MovePicker mp(pos, ttData.move, depth, ss->ply, ht, kt, cht, ch, pawnEntry);
 
   while ((move = mp.next()) != Move::none()) {
 
@@ -542,7 +626,8 @@ moves_loop:
       (ss + 1)->pv = nullptr;
 
     // Output current move to UCI
-    if (rootNode && isMainThread() && tm.elapsed() > 2500) {
+    if (rootNode && isMainThread() && tm.elapsed() > 2500 &&
+        !sharedState.report) {
       UCI::uciReportCurrentMove(depth, move, moveCount);
       UCI::uciReportNodes(threads, tt.hashFull(), tm.elapsed());
     }
@@ -553,13 +638,16 @@ moves_loop:
     isCapture = pos.isCapture(move);
     givesCheck = pos.givesCheck(move);
     hist = isCapture ? cht.probe(pos, move) : ht.probe(pos, move);
+    // Advanced passed pawn pushes are too dangerous to prune or reduce
+    passedPush = !isCapture && pawnEntry->isPassedPush(us, move) &&
+                 relativeRank(us, move.to()) >= RANK_6;
 
     if (!rootNode && pos.nonPawnMaterial(pos.sideToMove()) > 0 &&
         bestValue >= -VAL_MATE_BOUND) {
       if (moveCount >= (3 + depth * depth) / (2 - improving))
         mp.skipQuietMoves();
 
-      if (!isCapture) {
+      if (!isCapture && !passedPush) {
 
         Depth lmrDepth = std::max(0, depth - (2 + (moveCount > 6) * depth / 3));
         Depth fmpMargin = 100 + 50 * lmrDepth;
@@ -639,7 +727,7 @@ moves_loop:
     // Prefetch the next entry in the TT
     TTable::prefetch(tt.firstEntry(pos.key()));
 
-    if (depth >= 2 && moveCount > 1 && !isCapture) {
+    if (depth >= 2 && moveCount > 1 && !isCapture && !passedPush) {
       // Late move reductions
       R = 1 + (moveCount > 6) * depth / 3;
       // Don't go below depth 1
@@ -728,6 +816,10 @@ moves_loop:
     updateContinuations(ss - 1, pos, (ss - 1)->currentMove,
                         -statBonus(depth + 1));
 
+  // Tablebase upper bound
+  if (pvNode)
+    bestValue = std::min(bestValue, maxValue);
+
   // Write to TT, save static eval
   if (!excludedMove && !rootNode)
     ttWriter.write(hashKey, TTable::valueToTT(bestValue, ss->ply), ss->ttPV,
@@ -4,20 +4,25 @@
 
 #include <atomic>
 #include <condition_variable>
+#include <functional>
 #include <mutex>
 
 #include "defs.hpp"
 #include "hash.hpp"
 #include "history.hpp"
+#include "material.hpp"
 #include "move.hpp"
+#include "pawns.hpp"
 
 #include "position.hpp"
+#include "syzygy.hpp"
 #include "utils.hpp"
 
 namespace Maestro {
 
 class ThreadPool;
 class TTable;
+struct PrintInfo;
 
 /******************************************\
 |==========================================|
@@ -27,8 +32,9 @@ class TTable;
 
 struct Limits {
   TimePt time[COLOUR_N], inc[COLOUR_N], movetime, startTime;
+  U64 nodes;
   int movesToGo, depth;
-  bool perft, infinite;
+  bool perft, infinite, ponder;
 
   bool isUsingTM() const { return time[WHITE] || time[BLACK]; }
 };
@@ -48,6 +54,9 @@ public:
 
   TimePt elapsed() const { return getTimeMs() - startTime; }
 
+  // Start counting from ponderhit (The allocation only depends on the clock)
+  void restart(TimePt start) { startTime = start; }
+
   void clear() {
     startTime = optimumTime = maximumTime = 0;
   } // Clear time manager
@@ -78,6 +87,8 @@ struct RootMove {
   Value prevScore = -VAL_INFINITE;
   U64 effort = 0;
   int selDepth = 0;
+  int tbRank = 0;
+  Value tbScore = 0;
   std::vector<Move> pv;
 };
 
@@ -116,6 +127,14 @@ struct SearchState {
 
   ThreadPool &threads;
   TTable &tt;
+  const NNUENet *net = nullptr; // Evaluation net, set before searching
+  Tablebases::Config tbConfig;
+  // Start a new hash generation per search, off when concurrent searches
+  // share the hash (Its owner starts one generation for them all)
+  bool newHashGen = true;
+  // Receives the info and the best move of each depth in place of the UCI
+  // output (No currmove or bestmove either), for searches run by a tool
+  std::function<void(const PrintInfo &, Move)> report;
 };
 
 /******************************************\
@@ -150,6 +169,7 @@ public:
   bool isMainThread() const { return threadId == 0; }
 
   int completedDepth() const { return _completedDepth; }
+  Move bestMove() const { return rootMoves[0].pv[0]; }
   int selDepth() const { return _selDepth; }
 
   TimeManager tm;
@@ -159,6 +179,9 @@ public:
   CaptureHistoryTable cht;
   ContinuationHistoryTable ct;
 
+  Pawns::Table pawnTable;
+  Material::Table materialTable;
+
 private:
   void iterativeDeepening();
   void searchPosition(SearchStack *ss, Value &bestValue);
@@ -169,7 +192,8 @@ private:
 
   bool checkTM(Depth &lastBestMoveDepth, int &pvStability,
                int &bestValue) const;
-  void checkTime() const;
+  void checkTime();
+  void checkPonderhit();
 
   template <NodeType nodeType>
   Value search(Position &pos, SearchStack *ss, Depth depth, Value alpha,
@@ -194,7 +218,7 @@ private:
   TTable &tt;
 
   Depth _selDepth, _completedDepth;
-  std::atomic<U64> nodes;
+  std::atomic<U64> nodes, tbHits;
 
   Position rootPos;
   BoardState rootState;
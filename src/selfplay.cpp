@@ -0,0 +1,558 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include "hash.hpp"
+#include "movegen.hpp"
+#include "polyglot.hpp"
+#include "position.hpp"
+#include "search.hpp"
+#include "selfplay.hpp"
+#include "thread.hpp"
+#include "uci.hpp"
+
+namespace Maestro {
+
+namespace {
+
+// The side to move resigns once its score is below -RESIGN_SCORE for
+// RESIGN_MOVES moves in a row
+constexpr Value RESIGN_SCORE = 1000;
+constexpr int RESIGN_MOVES = 4;
+
+constexpr const char *CONFIG_NAMES[2] = {"A", "B"};
+
+// Start position and book moves of a pair of games
+struct Opening {
+  std::string fen;
+  std::vector<Move> moves;
+};
+
+// Read the openings of the book, one per pair of games. Returns false if
+// there are none.
+bool readOpenings(const SelfPlayOptions &options, size_t pairs,
+                  std::vector<Opening> &openings) {
+  if (options.book.empty()) {
+    openings.push_back({std::string(startPos), {}});
+    return true;
+  }
+
+  if (options.book.size() > 4 &&
+      options.book.substr(options.book.size() - 4) == ".bin") {
+    PolyBook book;
+    book.init(options.book);
+
+    // A line of the book for each pair, picked by weight
+    for (size_t i = 0; i < pairs; ++i) {
+      StateListPtr states(new std::deque<BoardState>(1));
+      Position pos;
+      pos.set(startPos.data(), states->back());
+
+      Opening opening{std::string(startPos), {}};
+      for (int ply = 0; ply < options.bookPlies; ++ply) {
+        const Move move = book.probe(pos);
+        if (!move)
+          break;
+        opening.moves.push_back(move);
+        states->emplace_back();
+        pos.makeMove(move, states->back());
+      }
+
+      if (opening.moves.empty())
+        break;
+      openings.push_back(std::move(opening));
+    }
+
+    return !openings.empty();
+  }
+
+  // The first four fields of each EPD line, in file order
+  std::ifstream in(options.book);
+  std::string line;
+  while (std::getline(in, line)) {
+    std::istringstream is(line);
+    const std::string fen = readEPDPosition(is);
+
+    if (!fen.empty() && validBoard(fen))
+      openings.push_back({fen, {}});
+  }
+
+  return !openings.empty();
+}
+
+// A configuration of the engine, with its own threads, histories and hash
+class Player {
+public:
+  explicit Player(const SearchState &settings)
+      : _search(settings, [this](const PrintInfo &info, Move) {
+          _score = info.score;
+          _depth = info.depth;
+        }) {}
+
+  // Apply an option of the configuration, false if it is not supported or
+  // the value is not valid
+  bool setOption(const std::string &name, const std::string &value) {
+    SearchState &state = _search.state();
+    if (compareStr(name, "Hash"))
+      return parseNumber(value, _hash) && _hash > 0;
+    if (compareStr(name, "Threads"))
+      return parseNumber(value, _threadCount) && _threadCount > 0;
+    if (compareStr(name, "SyzygyProbeDepth")) {
+      // Same range as the UCI option, the depth is kept if out of it
+      Depth depth;
+      if (!parseNumber(value, depth) || depth < 1 || depth > 100)
+        return false;
+      state.tbConfig.probeDepth = depth;
+      return true;
+    }
+    if (compareStr(name, "EvalFile")) {
+      const bool embedded = value.empty() || value == EVAL_FILE;
+      NNUENet *net = nnue_load(embedded ? nullptr : value.c_str());
+      if (!net)
+        return false;
+      _net.reset(net, nnue_free);
+      state.net = net;
+      return true;
+    }
+    return false;
+  }
+
+  // A player of the same configuration, sharing its net
+  std::unique_ptr<Player> clone() const {
+    auto player = std::make_unique<Player>(_search.state());
+    player->_net = _net;
+    player->_hash = _hash;
+    player->_threadCount = _threadCount;
+    return player;
+  }
+
+  size_t threadCount() const { return _threadCount; }
+
+  // Start the threads and allocate the hash, once the options are set (Cleared
+  // by newGame)
+  void init() { _search.init(_threadCount, _hash); }
+
+  // Nothing learnt from the previous game
+  void newGame() { _search.clear(); }
+
+  // Search the position, returns the move the engine would play
+  Move search(Position &pos, StateListPtr &states, const Limits &limits) {
+    _score = VAL_ZERO;
+    _depth = 0;
+    return _search.search(pos, states, limits);
+  }
+
+  // Score and depth of the last search
+  Value score() const { return _score; }
+  Depth depth() const { return _depth; }
+
+private:
+  // Loaded for EvalFile, outlives the threads (The engine's net otherwise)
+  std::shared_ptr<NNUENet> _net;
+  PrivateSearch _search;
+  size_t _hash = 16, _threadCount = 1;
+
+  Value _score = VAL_ZERO;
+  Depth _depth = 0;
+};
+
+// Moves and result of a played game
+struct Game {
+  std::string fen;
+  int startPly = 0;
+  std::vector<std::string> moves, comments; // SAN and comment of each move
+  std::string result = "*", reason;
+};
+
+// Score of a move for the PGN comments: +0.35, or +M5 for a mate in 5
+std::string scoreComment(Value score) {
+  std::ostringstream os;
+  if (std::abs(score) >= VAL_MATE_BOUND)
+    os << (score > 0 ? "+M" : "-M")
+       << (score > 0 ? VAL_MATE - score + 1 : VAL_MATE + score) / 2;
+  else
+    os << std::showpos << std::fixed << std::setprecision(2) << score / 100.0;
+  return os.str();
+}
+
+// Only kings, or a king and a minor piece against a king
+bool insufficientMaterial(const Position &pos) {
+  return !pos.pieces(PAWN, ROOK, QUEEN) &&
+         countBits(pos.pieces(KNIGHT, BISHOP)) <= 1;
+}
+
+// Play a game from the opening, players is indexed by colour
+Game play(const Opening &opening, Player *players[COLOUR_N],
+          const SelfPlayOptions &options) {
+  constexpr const char *COLOUR_NAMES[COLOUR_N] = {"White", "Black"};
+
+  StateListPtr states(new std::deque<BoardState>(1));
+  Position pos;
+  pos.set(opening.fen, states->back());
+
+  Game game;
+  game.fen = pos.fen();
+  game.startPly = pos.gamePlies();
+
+  for (Move move : opening.moves) {
+    game.moves.push_back(moveToSan(pos, move));
+    game.comments.push_back("book");
+    states->emplace_back();
+    pos.makeMove(move, states->back());
+  }
+
+  players[WHITE]->newGame();
+  players[BLACK]->newGame();
+
+  TimePt clock[COLOUR_N] = {options.time, options.time};
+  int losing[COLOUR_N] = {};
+
+  while (true) {
+    const Colour us = pos.sideToMove();
+    // Result of a loss of the side to move
+    const std::string lost = us == WHITE ? "0-1" : "1-0";
+
+    if (MoveList<ALL>(pos).empty()) {
+      game.result = pos.isInCheck() ? lost : "1/2-1/2";
+      game.reason = pos.isInCheck()
+                        ? std::string(COLOUR_NAMES[~us]) + " mates"
+                        : "Draw by stalemate";
+      break;
+    }
+
+    if (pos.fiftyMove() > 99 || pos.isDraw(0) || insufficientMaterial(pos)) {
+      game.result = "1/2-1/2";
+      game.reason = pos.fiftyMove() > 99 ? "Draw by the 50 moves rule"
+                    : pos.isDraw(0)      ? "Draw by 3-fold repetition"
+                                         : "Draw by insufficient material";
+      break;
+    }
+
+    Limits limits{};
+    limits.movetime = options.movetime;
+    limits.nodes = options.nodes;
+    if (options.time) {
+      limits.time[WHITE] = clock[WHITE];
+      limits.time[BLACK] = clock[BLACK];
+      limits.inc[WHITE] = limits.inc[BLACK] = options.inc;
+    }
+    limits.startTime = getTimeMs();
+
+    Player &player = *players[us];
+    const Move move = player.search(pos, states, limits);
+
+    if (options.time &&
+        (clock[us] -= getTimeMs() - limits.startTime) < 0) {
+      game.result = lost;
+      game.reason = std::string(COLOUR_NAMES[us]) + " loses on time";
+      break;
+    }
+    clock[us] += options.inc;
+
+    losing[us] = player.score() <= -RESIGN_SCORE ? losing[us] + 1 : 0;
+    if (losing[us] >= RESIGN_MOVES) {
+      game.result = lost;
+      game.reason = std::string(COLOUR_NAMES[us]) + " resigns";
+      break;
+    }
+
+    game.moves.push_back(moveToSan(pos, move));
+    game.comments.push_back(scoreComment(player.score()) + "/" +
+                            std::to_string(player.depth()));
+    states->emplace_back();
+    pos.makeMove(move, states->back());
+  }
+
+  return game;
+}
+
+// Start position as written by Position::fen
+const std::string &startFen() {
+  static const std::string fen = [] {
+    BoardState state;
+    Position pos;
+    pos.set(startPos.data(), state);
+    return pos.fen();
+  }();
+  return fen;
+}
+
+// Append a game to the PGN file, lines of at most 80 characters
+void writePGN(std::ostream &out, const Game &game, size_t round,
+              const std::string &white, const std::string &black,
+              const std::string &timeControl) {
+  out << "[Event \"Maestro self-play\"]\n"
+      << "[Site \"?\"]\n"
+      << "[Date \"????.??.??\"]\n"
+      << "[Round \"" << round << "\"]\n"
+      << "[White \"" << white << "\"]\n"
+      << "[Black \"" << black << "\"]\n"
+      << "[Result \"" << game.result << "\"]\n";
+  if (game.fen != startFen())
+    out << "[FEN \"" << game.fen << "\"]\n"
+        << "[SetUp \"1\"]\n";
+  out << "[PlyCount \"" << game.moves.size() << "\"]\n"
+      << "[Termination \"" << game.reason << "\"]\n"
+      << "[TimeControl \"" << timeControl << "\"]\n\n";
+
+  std::string line;
+  auto write = [&](const std::string &token) {
+    if (!line.empty() && line.size() + 1 + token.size() > 80) {
+      out << line << '\n';
+      line.clear();
+    }
+    line += (line.empty() ? "" : " ") + token;
+  };
+
+  for (size_t i = 0; i < game.moves.size(); ++i) {
+    const int ply = game.startPly + int(i);
+    if (ply % 2 == 0)
+      write(std::to_string(ply / 2 + 1) + ".");
+    else if (i == 0)
+      write(std::to_string(ply / 2 + 1) + "...");
+    write(game.moves[i]);
+    write("{" + game.comments[i] + "}");
+  }
+  write("{" + game.reason + "}");
+  write(game.result);
+
+  out << line << "\n\n";
+}
+
+// Elo difference of a score
+double scoreToElo(double score) {
+  return 400 * std::log10(score / (1 - score));
+}
+
+// Score of an Elo difference
+double eloToScore(double elo) { return 1 / (1 + std::pow(10, -elo / 400)); }
+
+// Results of A against B. The games of an opening are paired, the SPRT uses
+// the pentanomial of the pairs (Their score 0, 1/4 ... 1).
+class MatchStats {
+public:
+  explicit MatchStats(size_t games) : _scores(games, -1) {}
+
+  // Add the score of A (0, 1/2 or 1) of a game
+  void add(size_t game, double score) {
+    _scores[game] = score;
+    (score == 1 ? _wins : score == 0 ? _losses : _draws)++;
+
+    const size_t other = game ^ 1;
+    if (other < _scores.size() && _scores[other] >= 0)
+      ++_pairs[int(2 * (score + _scores[other]))];
+  }
+
+  size_t games() const { return _wins + _losses + _draws; }
+
+  std::string score() const {
+    std::ostringstream os;
+    os << _wins << " - " << _losses << " - " << _draws << " ["
+       << std::fixed << std::setprecision(3)
+       << (_wins + _draws / 2.0) / std::max<size_t>(games(), 1) << "] "
+       << games();
+    return os.str();
+  }
+
+  // Elo difference with its 95% interval, and the likelihood of superiority
+  std::string elo() const {
+    const double n = games();
+    const double score = (_wins + _draws / 2.0) / n;
+
+    std::ostringstream os;
+    os << std::fixed << std::setprecision(2);
+
+    if (score <= 0 || score >= 1) {
+      os << (score > 0 ? "+inf" : "-inf");
+    } else {
+      const double variance = (_wins * std::pow(1 - score, 2) +
+                               _losses * std::pow(score, 2) +
+                               _draws * std::pow(0.5 - score, 2)) /
+                              n;
+      const double margin = 1.95996 * std::sqrt(variance / n);
+      os << scoreToElo(score) << " +/- "
+         << (scoreToElo(std::min(score + margin, 1 - 1e-9)) -
+             scoreToElo(std::max(score - margin, 1e-9))) /
+                2;
+    }
+
+    const double decisive = _wins + _losses;
+    os << ", LOS "
+       << (decisive ? 50 * (1 + std::erf((double(_wins) - _losses) /
+                                         std::sqrt(2 * decisive)))
+                    : 50.0)
+       << " %";
+    return os.str();
+  }
+
+  std::string pentanomial() const {
+    std::ostringstream os;
+    os << "[" << _pairs[0] << ", " << _pairs[1] << ", " << _pairs[2] << ", "
+       << _pairs[3] << ", " << _pairs[4] << "]";
+    return os.str();
+  }
+
+  // Log-likelihood ratio of elo1 against elo0, normal approximation of the
+  // pentanomial
+  double llr(double elo0, double elo1) const {
+    double n = 0, mean = 0, variance = 0;
+    for (int i = 0; i < 5; ++i)
+      n += _pairs[i], mean += _pairs[i] * i / 4.0;
+
+    if (!n)
+      return 0;
+    mean /= n;
+
+    for (int i = 0; i < 5; ++i)
+      variance += _pairs[i] * std::pow(i / 4.0 - mean, 2);
+    variance /= n;
+
+    if (variance <= 0)
+      return 0;
+
+    const double s0 = eloToScore(elo0), s1 = eloToScore(elo1);
+    return n * (s1 - s0) * (2 * mean - s0 - s1) / (2 * variance);
+  }
+
+private:
+  std::vector<double> _scores;
+  size_t _wins = 0, _losses = 0, _draws = 0;
+  size_t _pairs[5] = {};
+};
+
+} // namespace
+
+void runSelfPlay(const SelfPlayOptions &options, const SearchState &settings) {
+  const size_t games = std::max(options.games, 1);
+
+  std::vector<Opening> openings;
+  if (!readOpenings(options, (games + 1) / 2, openings)) {
+    std::cout << "info string No opening in " << options.book << std::endl;
+    return;
+  }
+
+  // The options are set on a player of each configuration before starting
+  // anything, the players of the games are cloned from it
+  size_t playerThreads = 1;
+  std::unique_ptr<Player> configs[2];
+  for (int c = 0; c < 2; ++c) {
+    configs[c] = std::make_unique<Player>(settings);
+    for (const auto &[name, value] : options.config[c])
+      if (!configs[c]->setOption(name, value)) {
+        std::cout << "info string Invalid option " << name << "=" << value
+                  << " of " << CONFIG_NAMES[c]
+                  << " (Hash, Threads, SyzygyProbeDepth or EvalFile)"
+                  << std::endl;
+        return;
+      }
+    playerThreads = std::max(playerThreads, configs[c]->threadCount());
+  }
+
+  const size_t concurrency = std::min(
+      games, options.concurrency > 0
+                 ? size_t(options.concurrency)
+                 : std::max<size_t>(1, std::thread::hardware_concurrency() /
+                                           playerThreads));
+
+  // Each game runner has a player of each configuration
+  std::vector<std::unique_ptr<Player>> players[2];
+  for (size_t i = 0; i < concurrency; ++i)
+    for (int c = 0; c < 2; ++c)
+      players[c].emplace_back(configs[c]->clone())->init();
+
+  // PGN time control: base+inc or a time per move (s), or nodes per move
+  std::ostringstream timeControl;
+  if (options.time)
+    timeControl << options.time / 1000.0 << "+" << options.inc / 1000.0;
+  else if (options.nodes)
+    timeControl << "N/" << options.nodes;
+  else
+    timeControl << "1/" << options.movetime / 1000.0;
+
+  for (int c = 0; c < 2; ++c) {
+    std::cout << "info string " << CONFIG_NAMES[c] << ":";
+    for (const auto &[name, value] : options.config[c])
+      std::cout << " " << name << "=" << value;
+    std::cout << (options.config[c].empty() ? " engine options" : "")
+              << std::endl;
+  }
+
+  std::ofstream pgn;
+  if (!options.pgn.empty())
+    pgn.open(options.pgn, std::ios::app);
+
+  const double lower = std::log(0.05 / 0.95), upper = std::log(0.95 / 0.05);
+
+  MatchStats stats(games);
+  std::atomic<size_t> next{0};
+  std::atomic_bool decided{false};
+  std::mutex mutex;
+  const TimePt start = getTimeMs();
+
+  // Each runner plays the next game until there is none left, A is white in
+  // the first game of a pair
+  std::vector<std::thread> runners;
+  for (size_t r = 0; r < concurrency; ++r)
+    runners.emplace_back([&, r] {
+      for (size_t i; !decided && (i = next++) < games;) {
+        const bool aWhite = i % 2 == 0;
+        Player *colours[COLOUR_N] = {players[!aWhite][r].get(),
+                                     players[aWhite][r].get()};
+
+        const Game game =
+            play(openings[i / 2 % openings.size()], colours, options);
+
+        const double whiteScore = game.result == "1-0"   ? 1
+                                  : game.result == "0-1" ? 0
+                                                         : 0.5;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        stats.add(i, aWhite ? whiteScore : 1 - whiteScore);
+
+        const std::string white = CONFIG_NAMES[!aWhite];
+        const std::string black = CONFIG_NAMES[aWhite];
+
+        std::cout << "info string Game " << i + 1 << " (" << white << " vs "
+                  << black << "): " << game.result << " {" << game.reason
+                  << "}" << std::endl;
+        std::cout << "info string Score of A vs B: " << stats.score()
+                  << std::endl;
+
+        if (pgn.is_open())
+          writePGN(pgn, game, i + 1, "Maestro " + white, "Maestro " + black,
+                   timeControl.str());
+
+        const double llr = stats.llr(options.elo0, options.elo1);
+        if (options.sprt && (llr <= lower || llr >= upper))
+          decided = true;
+      }
+    });
+
+  for (std::thread &runner : runners)
+    runner.join();
+
+  std::cout << "info string Score of A vs B: " << stats.score() << " in "
+            << getTimeMs() - start << " ms" << std::endl;
+  std::cout << "info string Elo difference: " << stats.elo() << std::endl;
+  std::cout << "info string Pentanomial " << stats.pentanomial() << std::endl;
+
+  if (options.sprt) {
+    const double llr = stats.llr(options.elo0, options.elo1);
+    std::cout << "info string SPRT (" << options.elo0 << ", " << options.elo1
+              << "): LLR " << std::fixed << std::setprecision(2) << llr << " ("
+              << lower << ", " << upper << ") "
+              << (llr >= upper   ? "H1 accepted"
+                  : llr <= lower ? "H0 accepted"
+                                 : "inconclusive")
+              << std::defaultfloat << std::endl;
+  }
+}
+
+} // namespace Maestro
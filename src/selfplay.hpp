@@ -0,0 +1,56 @@
+#ifndef SELFPLAY_HPP
+#pragma once
+#define SELFPLAY_HPP
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "defs.hpp"
+#include "utils.hpp"
+
+namespace Maestro {
+
+struct SearchState;
+
+/******************************************\
+|==========================================|
+|                Self-Play                 |
+|==========================================|
+\******************************************/
+
+struct SelfPlayOptions {
+  // Games played, in pairs of an opening with the colours swapped
+  int games = 2;
+  // Limit of each move: time (ms) or nodes, or a clock of time + inc (ms)
+  TimePt movetime = 0, time = 0, inc = 0;
+  U64 nodes = 0;
+  // Games played at once (0 for the hardware threads over the search threads
+  // of a player)
+  int concurrency = 0;
+  // Openings: the positions of an EPD file, or lines of a polyglot book (.bin
+  // extension) of up to bookPlies plies. The start position if empty.
+  std::string book;
+  int bookPlies = 8;
+  // File the games are appended to, in PGN (None if empty)
+  std::string pgn;
+  // SPRT of elo0 against elo1 (alpha = beta = 0.05), the match stops once a
+  // hypothesis is accepted
+  bool sprt = false;
+  double elo0 = 0, elo1 = 5;
+  // Options of the configurations A and B (setoption name and value)
+  std::vector<std::pair<std::string, std::string>> config[2];
+};
+
+// Play games between two configurations of the engine, each game on its own
+// thread with a thread pool and hash per player. The tables (Bitboards,
+// Zobrist keys, endgames, tablebases) are shared read-only by all the games,
+// and the net by the players of a configuration (The engine's, unless it sets
+// EvalFile). Reports the score, the Elo difference and the SPRT of A against
+// B. The settings (Tablebases, net) are taken from the engine
+// search state, the options of each configuration apply on top.
+void runSelfPlay(const SelfPlayOptions &options, const SearchState &settings);
+
+} // namespace Maestro
+
+#endif // SELFPLAY_HPP
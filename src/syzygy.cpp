@@ -0,0 +1,1578 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "bitbase.hpp"
+#include "bitboard.hpp"
+#include "defs.hpp"
+#include "endgame.hpp"
+#include "movegen.hpp"
+#include "position.hpp"
+#include "search.hpp"
+#include "syzygy.hpp"
+#include "utils.hpp"
+
+#include "misc.hpp"
+
+namespace Maestro::Tablebases {
+
+int maxCardinality;
+
+namespace {
+
+constexpr int TB_PIECES = 7;
+constexpr int MAX_DTZ = 1 << 18;
+
+enum Endian { BIG_ENDIAN_TB, LITTLE_ENDIAN_TB };
+enum TBType { WDL, DTZ };
+
+// Table flags, stored in the first byte of each table
+enum TBFlag {
+  STM = 1,
+  MAPPED = 2,
+  WIN_PLIES = 4,
+  LOSS_PLIES = 8,
+  WIDE = 16,
+  SINGLE_VALUE = 128
+};
+
+WDLScore operator-(WDLScore d) { return WDLScore(-int(d)); }
+
+Square operator^(Square sq, int i) { return Square(int(sq) ^ i); }
+
+const std::string_view pieceChars = " PNBRQK  pnbrqk";
+
+int mapPawns[SQ_N];
+int mapB1H1H7[SQ_N];
+int mapA1D1D4[SQ_N];
+int mapKK[10][SQ_N];
+
+int binomial[6][SQ_N];
+int leadPawnIdx[6][SQ_N];
+int leadPawnsSize[6][4];
+
+// Search paths of the tablebase files
+std::string tbPaths;
+
+// Compare two pawn squares, the leading pawn has the highest mapPawns value
+bool pawnsComp(Square i, Square j) { return mapPawns[i] < mapPawns[j]; }
+
+// Signed distance of a square from the a1-h8 diagonal (Below is negative)
+int offA1H8(Square sq) { return int(rankOf(sq)) - fileOf(sq); }
+
+// Search value of a WDL score (Wins and losses are below the mate range)
+constexpr Value WDLToValue[] = {-VAL_MATE_BOUND + 1, VAL_ZERO - 2, VAL_ZERO,
+                                VAL_ZERO + 2, VAL_MATE_BOUND - 1};
+
+/******************************************\
+|==========================================|
+|              Data Reading                |
+|==========================================|
+\******************************************/
+
+template <typename T, int Half = sizeof(T) / 2, int End = sizeof(T) - 1>
+void swapEndian(T &x) {
+  static_assert(std::is_unsigned_v<T>, "Argument of swapEndian not unsigned");
+  uint8_t tmp, *c = (uint8_t *)&x;
+  for (int i = 0; i < Half; ++i)
+    tmp = c[i], c[i] = c[End - i], c[End - i] = tmp;
+}
+
+template <> void swapEndian<uint8_t>(uint8_t &) {}
+
+// Read a number of the given endianness (Pointers may be unaligned)
+template <typename T, Endian E> T number(void *addr) {
+  T v;
+  std::memcpy(&v, addr, sizeof(T));
+
+  const uint16_t one = 1;
+  const bool littleEndian = *(const uint8_t *)&one == 1;
+
+  if ((E == LITTLE_ENDIAN_TB) != littleEndian)
+    swapEndian(v);
+  return v;
+}
+
+// DTZ tables don't store the score of zeroing moves, but it can be recovered
+// from the WDL score of the position
+int dtzBeforeZeroing(WDLScore wdl) {
+  return wdl == WDL_WIN            ? 1
+         : wdl == WDL_CURSED_WIN   ? 101
+         : wdl == WDL_BLESSED_LOSS ? -101
+         : wdl == WDL_LOSS         ? -1
+                                   : 0;
+}
+
+// Sign of a number (-1, 0, 1)
+template <typename T> int signOf(T val) { return (T(0) < val) - (val < T(0)); }
+
+// Little endian numbers used by sparseIndex to point into blockLength
+struct SparseEntry {
+  char block[4];  // Number of block
+  char offset[2]; // Offset within the block
+};
+
+static_assert(sizeof(SparseEntry) == 6, "SparseEntry must be 6 bytes");
+
+// Huffman symbol
+using Sym = uint16_t;
+
+// Recursive pairing tree entry, the first 12 bits are the left symbol and the
+// second 12 bits are the right symbol
+struct LR {
+  enum Side { LEFT, RIGHT };
+
+  uint8_t lr[3];
+
+  template <Side S> Sym get() const {
+    return S == LEFT ? ((lr[1] & 0xF) << 8) | lr[0] : (lr[2] << 4) | (lr[1] >> 4);
+  }
+};
+
+static_assert(sizeof(LR) == 3, "LR tree entry must be 3 bytes");
+
+/******************************************\
+|==========================================|
+|               Table Files                |
+|==========================================|
+\******************************************/
+
+// Open a tablebase file from one of the search paths
+FD openTBFile(const std::string &name) {
+#ifndef _WIN32
+  constexpr char sep = ':';
+#else
+  constexpr char sep = ';';
+#endif
+
+  std::stringstream ss(tbPaths);
+  std::string path;
+
+  while (std::getline(ss, path, sep)) {
+    const FD fd = open_file((path + "/" + name).c_str());
+    if (fd != FD_ERR)
+      return fd;
+  }
+
+  return FD_ERR;
+}
+
+// Memory map a tablebase file and check its header
+uint8_t *mapTBFile(const std::string &name, const void **baseAddress,
+                   map_t *mapping, TBType type) {
+  *baseAddress = nullptr;
+
+  const FD fd = openTBFile(name);
+  if (fd == FD_ERR)
+    return nullptr;
+
+  // Tables are made of 64 byte blocks plus a 16 byte header
+  if (file_size(fd) % 64 != 16) {
+    std::cerr << "Corrupt tablebase file " << name << std::endl;
+    close_file(fd);
+    return nullptr;
+  }
+
+  *baseAddress = map_file(fd, mapping);
+  close_file(fd);
+
+  if (!*baseAddress)
+    return nullptr;
+
+  constexpr uint8_t magics[][4] = {{0xD7, 0x66, 0x0C, 0xA5},
+                                   {0x71, 0xE8, 0x23, 0x5D}};
+
+  const uint8_t *data = (const uint8_t *)*baseAddress;
+
+  if (std::memcmp(data, magics[type == WDL], 4)) {
+    std::cerr << "Corrupt tablebase file " << name << std::endl;
+    unmap_file(*baseAddress, *mapping);
+    *baseAddress = nullptr;
+    return nullptr;
+  }
+
+  // Skip the magic header
+  return (uint8_t *)data + 4;
+}
+
+/******************************************\
+|==========================================|
+|              Table Entries               |
+|==========================================|
+\******************************************/
+
+// Low level indexing information of a table, there are 8, 4 or 2 per file
+// depending on the table type and pawns. Populated when the file is mapped.
+struct PairsData {
+  uint8_t flags;                    // Table flags (TBFlag)
+  uint8_t maxSymLen;                // Maximum length of the Huffman symbols
+  uint8_t minSymLen;                // Minimum length of the Huffman symbols
+  uint32_t numBlocks;               // Number of blocks in the file
+  size_t blockSize;                 // Block size in bytes
+  size_t span;                      // Values between sparseIndex entries
+  Sym *lowestSym;                   // Lowest symbol of each length
+  LR *btree;                        // Left and right symbols of each symbol
+  uint16_t *blockLength;            // Number of values (-1) of each block
+  uint32_t blockLengthSize;         // Padded size of blockLength
+  SparseEntry *sparseIndex;         // Partial indices into blockLength
+  size_t sparseIndexSize;           // Size of sparseIndex
+  uint8_t *data;                    // Start of the compressed data
+  std::vector<uint64_t> base64;     // 64 bit padded lowest symbol of each length
+  std::vector<uint8_t> symlen;      // Number of values (-1) of each symbol
+  Piece pieces[TB_PIECES];          // Piece order, defining the groups
+  uint64_t groupIdx[TB_PIECES + 1]; // Start index of each group
+  int groupLen[TB_PIECES + 1];      // Number of pieces of each group
+  uint16_t mapIdx[4];               // DTZ value maps (Win, loss, cursed, blessed)
+};
+
+// Tablebase file entry, created at init if the file exists. The pairs data is
+// populated on first access when the file is mapped.
+template <TBType Type> struct TBTable {
+  using Ret = std::conditional_t<Type == WDL, WDLScore, int>;
+
+  static constexpr int sides = Type == WDL ? 2 : 1;
+
+  std::atomic<bool> ready = false;
+  const void *baseAddress = nullptr;
+  uint8_t *map = nullptr;
+  map_t mapping{};
+  Key key, key2;
+  int pieceCount;
+  bool hasPawns;
+  bool hasUniquePieces;
+  uint8_t pawnCount[COLOUR_N]; // Leading colour / other colour
+  PairsData items[sides][4];   // Side to move / file (A to D, or A only)
+
+  PairsData *get(int stm, int f) { return &items[stm % sides][hasPawns ? f : 0]; }
+
+  TBTable() = default;
+  explicit TBTable(const std::string &code);
+  explicit TBTable(const TBTable<WDL> &wdl);
+
+  ~TBTable() {
+    if (baseAddress)
+      unmap_file(baseAddress, mapping);
+  }
+};
+
+template <> TBTable<WDL>::TBTable(const std::string &code) : TBTable() {
+  int counts[COLOUR_N][PIECE_TYPE_N] = {};
+  Colour c = WHITE;
+
+  for (char ch : code) {
+    if (ch == 'v') {
+      c = BLACK;
+      continue;
+    }
+    ++counts[c][pieceChars.find(ch)];
+  }
+
+  key = Endgames::materialKey(code, WHITE);
+  key2 = Endgames::materialKey(code, BLACK);
+  pieceCount = int(code.size()) - 1;
+  hasPawns = counts[WHITE][PAWN] || counts[BLACK][PAWN];
+
+  hasUniquePieces = false;
+  for (Colour side : {WHITE, BLACK})
+    for (PieceType pt = PAWN; pt < KING; ++pt)
+      if (counts[side][pt] == 1)
+        hasUniquePieces = true;
+
+  // The leading colour is the side with less pawns (Better compression)
+  const bool w = !counts[BLACK][PAWN] ||
+                 (counts[WHITE][PAWN] && counts[BLACK][PAWN] >= counts[WHITE][PAWN]);
+
+  pawnCount[0] = counts[w ? WHITE : BLACK][PAWN];
+  pawnCount[1] = counts[w ? BLACK : WHITE][PAWN];
+}
+
+template <> TBTable<DTZ>::TBTable(const TBTable<WDL> &wdl) : TBTable() {
+  key = wdl.key;
+  key2 = wdl.key2;
+  pieceCount = wdl.pieceCount;
+  hasPawns = wdl.hasPawns;
+  hasUniquePieces = wdl.hasUniquePieces;
+  pawnCount[0] = wdl.pawnCount[0];
+  pawnCount[1] = wdl.pawnCount[1];
+}
+
+// Owner of the table entries, with a hash lookup by material key
+class TBTables {
+
+  struct Entry {
+    Key key;
+    TBTable<WDL> *wdl;
+    TBTable<DTZ> *dtz;
+
+    template <TBType Type> TBTable<Type> *get() const {
+      return (TBTable<Type> *)(Type == WDL ? (void *)wdl : (void *)dtz);
+    }
+  };
+
+  static constexpr int size = 1 << 12; // Indexed by the lowest 12 bits of the key
+  static constexpr int overflow = 1;   // Entries allowed past the last bucket
+
+  Entry hashTable[size + overflow];
+
+  std::deque<TBTable<WDL>> wdlTable;
+  std::deque<TBTable<DTZ>> dtzTable;
+
+  void insert(Key key, TBTable<WDL> *wdl, TBTable<DTZ> *dtz) {
+    uint32_t homeBucket = uint32_t(key) & (size - 1);
+    Entry entry{key, wdl, dtz};
+
+    // Keep the last bucket empty so lookups always terminate
+    for (uint32_t bucket = homeBucket; bucket < size + overflow - 1; ++bucket) {
+      const Key otherKey = hashTable[bucket].key;
+      if (otherKey == key || !hashTable[bucket].get<WDL>()) {
+        hashTable[bucket] = entry;
+        return;
+      }
+
+      // Robin Hood hashing, move entries closer to their home bucket
+      const uint32_t otherHomeBucket = uint32_t(otherKey) & (size - 1);
+      if (otherHomeBucket > homeBucket) {
+        std::swap(entry, hashTable[bucket]);
+        key = otherKey;
+        homeBucket = otherHomeBucket;
+      }
+    }
+
+    std::cerr << "Tablebase hash table size too low" << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+
+public:
+  template <TBType Type> TBTable<Type> *get(Key key) {
+    for (const Entry *entry = &hashTable[uint32_t(key) & (size - 1)];; ++entry)
+      if (entry->key == key || !entry->get<Type>())
+        return entry->get<Type>();
+  }
+
+  void clear() {
+    std::memset(hashTable, 0, sizeof(hashTable));
+    wdlTable.clear();
+    dtzTable.clear();
+  }
+
+  size_t count() const { return wdlTable.size(); }
+
+  void add(const std::vector<PieceType> &pieces);
+};
+
+TBTables tbTables;
+
+// Add the table of the given pieces if its WDL file exists
+void TBTables::add(const std::vector<PieceType> &pieces) {
+  std::string code;
+
+  for (PieceType pt : pieces)
+    code += pieceChars[pt];
+
+  // KRK -> KRvK
+  code.insert(code.find('K', 1), "v");
+
+  const FD fd = openTBFile(code + ".rtbw");
+  if (fd == FD_ERR)
+    return;
+
+  close_file(fd);
+
+  maxCardinality = std::max(int(pieces.size()), maxCardinality);
+
+  wdlTable.emplace_back(code);
+  dtzTable.emplace_back(wdlTable.back());
+
+  // Insert both colour versions (KRvK and KvKR)
+  insert(wdlTable.back().key, &wdlTable.back(), &dtzTable.back());
+  insert(wdlTable.back().key2, &wdlTable.back(), &dtzTable.back());
+}
+
+/******************************************\
+|==========================================|
+|              Decompression               |
+|==========================================|
+\******************************************/
+
+// Decompress the value at the given index. Values are Huffman coded symbols
+// stored in blocks, each symbol expanding recursively into a pair of symbols.
+int decompressPairs(PairsData *d, uint64_t idx) {
+  // All positions of the table store the same value
+  if (d->flags & SINGLE_VALUE)
+    return d->minSymLen;
+
+  // Find the block containing idx, starting from the nearest sparse index
+  // entry k which points to the value at k * span + span / 2
+  const uint32_t k = uint32_t(idx / d->span);
+
+  uint32_t block = number<uint32_t, LITTLE_ENDIAN_TB>(&d->sparseIndex[k].block);
+  int offset = number<uint16_t, LITTLE_ENDIAN_TB>(&d->sparseIndex[k].offset);
+
+  offset += int(idx % d->span) - int(d->span / 2);
+
+  // Move to the previous or next blocks until idx is inside the block
+  while (offset < 0)
+    offset += d->blockLength[--block] + 1;
+
+  while (offset > d->blockLength[block])
+    offset -= d->blockLength[block++] + 1;
+
+  // Start of the block of Huffman symbols
+  uint32_t *ptr = (uint32_t *)(d->data + uint64_t(block) * d->blockSize);
+
+  uint64_t buf64 = number<uint64_t, BIG_ENDIAN_TB>(ptr);
+  ptr += 2;
+  int buf64Size = 64;
+  Sym sym;
+
+  while (true) {
+    int len = 0; // Symbol length - minSymLen
+
+    // Find the symbol length, base64 is decreasing with the length
+    while (buf64 < d->base64[len])
+      ++len;
+
+    // Symbols of the same length are consecutive integers
+    sym = Sym((buf64 - d->base64[len]) >> (64 - len - d->minSymLen));
+    sym += number<Sym, LITTLE_ENDIAN_TB>(&d->lowestSym[len]);
+
+    // The offset is within the values of this symbol
+    if (offset < d->symlen[sym] + 1)
+      break;
+
+    // Consume the symbol and refill the buffer
+    offset -= d->symlen[sym] + 1;
+    len += d->minSymLen;
+    buf64 <<= len;
+    buf64Size -= len;
+
+    if (buf64Size <= 32) {
+      buf64Size += 32;
+      buf64 |= uint64_t(number<uint32_t, BIG_ENDIAN_TB>(ptr++)) << (64 - buf64Size);
+    }
+  }
+
+  // Expand the symbol into its left and right children until reaching a leaf
+  while (d->symlen[sym]) {
+    const Sym left = d->btree[sym].get<LR::LEFT>();
+
+    if (offset < d->symlen[left] + 1)
+      sym = left;
+    else {
+      offset -= d->symlen[left] + 1;
+      sym = d->btree[sym].get<LR::RIGHT>();
+    }
+  }
+
+  return d->btree[sym].get<LR::LEFT>();
+}
+
+// DTZ tables only store one side to move
+bool checkDtzStm(TBTable<WDL> *, int, File) { return true; }
+
+bool checkDtzStm(TBTable<DTZ> *entry, int stm, File f) {
+  const uint8_t flags = entry->get(stm, f)->flags;
+  return (flags & STM) == stm || (entry->key == entry->key2 && !entry->hasPawns);
+}
+
+// Map a decompressed value to a WDL score
+WDLScore mapScore(TBTable<WDL> *, File, int value, WDLScore) {
+  return WDLScore(value - 2);
+}
+
+// Map a decompressed value to a DTZ score in plies
+int mapScore(TBTable<DTZ> *entry, File f, int value, WDLScore wdl) {
+  constexpr int WDLMap[] = {1, 3, 0, 2, 0};
+
+  const uint8_t flags = entry->get(0, f)->flags;
+
+  uint8_t *map = entry->map;
+  const uint16_t *idx = entry->get(0, f)->mapIdx;
+
+  // Values are sorted by frequency for each WDL score
+  if (flags & MAPPED) {
+    if (flags & WIDE)
+      value = ((uint16_t *)map)[idx[WDLMap[wdl + 2]] + value];
+    else
+      value = map[idx[WDLMap[wdl + 2]] + value];
+  }
+
+  // Convert moves to plies
+  if ((wdl == WDL_WIN && !(flags & WIN_PLIES)) ||
+      (wdl == WDL_LOSS && !(flags & LOSS_PLIES)) || wdl == WDL_CURSED_WIN ||
+      wdl == WDL_BLESSED_LOSS)
+    value *= 2;
+
+  return value + 1;
+}
+
+/******************************************\
+|==========================================|
+|               Indexing                   |
+|==========================================|
+\******************************************/
+
+// Compute the index of the position in the table and decompress its value.
+// Groups of k identical pieces on sorted squares s1 < ... < sk are encoded as
+// binomial[1][s1] + ... + binomial[k][sk].
+template <typename T, typename Ret = typename T::Ret>
+Ret doProbeTable(const Position &pos, T *entry, WDLScore wdl, ProbeState *result) {
+  Square squares[TB_PIECES];
+  Piece pieces[TB_PIECES];
+  uint64_t idx;
+  int next = 0, size = 0, leadPawnsCnt = 0;
+  PairsData *d;
+  Bitboard b, leadPawns = 0;
+  File tbFile = FILE_A;
+
+  // Symmetric tables only store white to move
+  const bool symmetricBlackToMove =
+      entry->key == entry->key2 && pos.sideToMove() == BLACK;
+
+  // Tables are stored with white as the stronger side
+  const bool blackStronger = pos.materialKey() != entry->key;
+
+  const bool flip = symmetricBlackToMove || blackStronger;
+  const int flipColour = flip * 8;
+  const int flipSquares = flip * 56;
+  const int stm = flip ^ pos.sideToMove();
+
+  // Tables with pawns are split by the file of the leading pawn, which is the
+  // pawn with the highest mapPawns value (Nearest the edge, lowest rank)
+  if (entry->hasPawns) {
+    const Piece pc = Piece(entry->get(0, 0)->pieces[0] ^ flipColour);
+
+    leadPawns = b = pos.pieces(colourOf(pc), PAWN);
+    do
+      squares[size++] = popLSB(b) ^ flipSquares;
+    while (b);
+
+    leadPawnsCnt = size;
+
+    std::swap(squares[0],
+              *std::max_element(squares, squares + leadPawnsCnt, pawnsComp));
+
+    tbFile = File(fileDistToEdge(squares[0]));
+  }
+
+  if (!checkDtzStm(entry, stm, tbFile))
+    return *result = CHANGE_STM, Ret();
+
+  // Add the remaining pieces, mapped to the table colour and squares
+  b = pos.occupied() ^ leadPawns;
+  do {
+    const Square sq = popLSB(b);
+    squares[size] = sq ^ flipSquares;
+    pieces[size++] = Piece(pos.pieceOn(sq) ^ flipColour);
+  } while (b);
+
+  d = entry->get(stm, tbFile);
+
+  // Reorder the pieces to match the table order
+  for (int i = leadPawnsCnt; i < size - 1; ++i)
+    for (int j = i + 1; j < size; ++j)
+      if (d->pieces[i] == pieces[j]) {
+        std::swap(pieces[i], pieces[j]);
+        std::swap(squares[i], squares[j]);
+        break;
+      }
+
+  // Mirror so the leading piece is on files A-D
+  if (fileOf(squares[0]) > FILE_D)
+    for (int i = 0; i < size; ++i)
+      squares[i] = flipFile(squares[i]);
+
+  // Encode the leading pawns in ascending mapPawns order
+  if (entry->hasPawns) {
+    idx = leadPawnIdx[leadPawnsCnt][squares[0]];
+
+    std::stable_sort(squares + 1, squares + leadPawnsCnt, pawnsComp);
+
+    for (int i = 1; i < leadPawnsCnt; ++i)
+      idx += binomial[i][mapPawns[squares[i]]];
+
+    goto encodeRemaining;
+  }
+
+  // Without pawns, mirror so the leading piece is on ranks 1-4
+  if (rankOf(squares[0]) > RANK_4)
+    for (int i = 0; i < size; ++i)
+      squares[i] = flipRank(squares[i]);
+
+  // Mirror along the a1-h8 diagonal so the first leading piece off the
+  // diagonal is below it
+  for (int i = 0; i < d->groupLen[0]; ++i) {
+    if (!offA1H8(squares[i]))
+      continue;
+
+    if (offA1H8(squares[i]) > 0)
+      for (int j = i; j < size; ++j)
+        squares[j] = Square(((squares[j] >> 3) | (squares[j] << 3)) & 63);
+    break;
+  }
+
+  // Encode the leading group, three unique pieces are encoded together and
+  // otherwise just the two kings (462 legal placements)
+  if (entry->hasUniquePieces) {
+    const int adjust1 = (squares[1] > squares[0]) + (squares[2] > squares[0]);
+    const int adjust2 = (squares[2] > squares[0]) + (squares[2] > squares[1]);
+
+    // First piece below the diagonal
+    if (offA1H8(squares[0]))
+      idx = (mapA1D1D4[squares[0]] * 63 + (squares[1] - adjust1)) * 62 +
+            squares[2] - adjust2;
+
+    // First piece on the diagonal, second below
+    else if (offA1H8(squares[1]))
+      idx = (6 * 63 + rankOf(squares[0]) * 28 + mapB1H1H7[squares[1]]) * 62 +
+            squares[2] - adjust2;
+
+    // First two pieces on the diagonal, third below
+    else if (offA1H8(squares[2]))
+      idx = 6 * 63 * 62 + 4 * 28 * 62 + rankOf(squares[0]) * 7 * 28 +
+            (rankOf(squares[1]) - adjust1) * 28 + mapB1H1H7[squares[2]];
+
+    // All three pieces on the diagonal
+    else
+      idx = 6 * 63 * 62 + 4 * 28 * 62 + 4 * 7 * 28 + rankOf(squares[0]) * 7 * 6 +
+            (rankOf(squares[1]) - adjust1) * 6 + (rankOf(squares[2]) - adjust2);
+  } else
+    idx = mapKK[mapA1D1D4[squares[0]]][squares[1]];
+
+encodeRemaining:
+  idx *= d->groupIdx[0];
+  Square *groupSq = squares + d->groupLen[0];
+
+  // Encode the remaining pawns and pieces, each group in ascending order
+  bool remainingPawns = entry->hasPawns && entry->pawnCount[1];
+
+  while (d->groupLen[++next]) {
+    std::stable_sort(groupSq, groupSq + d->groupLen[next]);
+    uint64_t n = 0;
+
+    // Skip the squares taken by the previous groups
+    for (int i = 0; i < d->groupLen[next]; ++i) {
+      const auto adjust = std::count_if(
+          squares, groupSq, [&](Square sq) { return groupSq[i] > sq; });
+      n += binomial[i + 1][groupSq[i] - adjust - 8 * remainingPawns];
+    }
+
+    remainingPawns = false;
+    idx += n * d->groupIdx[next];
+    groupSq += d->groupLen[next];
+  }
+
+  return mapScore(entry, tbFile, decompressPairs(d, idx), wdl);
+}
+
+// Split the pieces into encoding groups. Groups are pieces of the same type and
+// colour, except the leading group which holds three unique pieces (or the two
+// kings) without pawns. With pawns, the pawns come first.
+template <typename T> void setGroups(T &e, PairsData *d, int order[], File f) {
+  int n = 0, firstLen = e.hasPawns ? 0 : e.hasUniquePieces ? 3 : 2;
+  d->groupLen[n] = 1;
+
+  for (int i = 1; i < e.pieceCount; ++i)
+    if (--firstLen > 0 || d->pieces[i] == d->pieces[i - 1])
+      d->groupLen[n]++;
+    else
+      d->groupLen[++n] = 1;
+
+  d->groupLen[++n] = 0; // Zero terminated
+
+  // The encoding order of the groups is stored in the table, the leading
+  // group is at order[0] and the remaining pawns at order[1]
+  const bool pp = e.hasPawns && e.pawnCount[1]; // Pawns on both sides
+  int next = pp ? 2 : 1;
+  int freeSquares = 64 - d->groupLen[0] - (pp ? d->groupLen[1] : 0);
+  uint64_t idx = 1;
+
+  for (int k = 0; next < n || k == order[0] || k == order[1]; ++k)
+    if (k == order[0]) {
+      d->groupIdx[0] = idx;
+      idx *= e.hasPawns         ? leadPawnsSize[d->groupLen[0]][f]
+             : e.hasUniquePieces ? 31332
+                                 : 462;
+    } else if (k == order[1]) {
+      d->groupIdx[1] = idx;
+      idx *= binomial[d->groupLen[1]][48 - d->groupLen[0]];
+    } else {
+      d->groupIdx[next] = idx;
+      idx *= binomial[d->groupLen[next]][freeSquares];
+      freeSquares -= d->groupLen[next++];
+    }
+
+  d->groupIdx[n] = idx;
+}
+
+// Number of values represented by a symbol, expanding its children
+uint8_t setSymlen(PairsData *d, Sym s, std::vector<bool> &visited) {
+  visited[s] = true;
+  const Sym sr = d->btree[s].get<LR::RIGHT>();
+
+  if (sr == 0xFFF)
+    return 0;
+
+  const Sym sl = d->btree[s].get<LR::LEFT>();
+
+  if (!visited[sl])
+    d->symlen[sl] = setSymlen(d, sl, visited);
+
+  if (!visited[sr])
+    d->symlen[sr] = setSymlen(d, sr, visited);
+
+  return d->symlen[sl] + d->symlen[sr] + 1;
+}
+
+// Read the block sizes and the Huffman code of a table
+uint8_t *setSizes(PairsData *d, uint8_t *data) {
+  d->flags = *data++;
+
+  if (d->flags & SINGLE_VALUE) {
+    d->numBlocks = d->blockLengthSize = 0;
+    d->span = d->sparseIndexSize = 0;
+    d->minSymLen = *data++; // The single value
+    return data;
+  }
+
+  // The last group index is the table size
+  const uint64_t tbSize =
+      d->groupIdx[std::find(d->groupLen, d->groupLen + 7, 0) - d->groupLen];
+
+  d->blockSize = size_t(1) << *data++;
+  d->span = size_t(1) << *data++;
+  d->sparseIndexSize = size_t((tbSize + d->span - 1) / d->span);
+  const auto padding = number<uint8_t, LITTLE_ENDIAN_TB>(data++);
+  d->numBlocks = number<uint32_t, LITTLE_ENDIAN_TB>(data);
+  data += sizeof(uint32_t);
+  d->blockLengthSize = d->numBlocks + padding;
+  d->maxSymLen = *data++;
+  d->minSymLen = *data++;
+  d->lowestSym = (Sym *)data;
+  d->base64.resize(d->maxSymLen - d->minSymLen + 1);
+
+  // Longer canonical codes have lower values, base64[i] is the lowest symbol
+  // of length i padded to 64 bits
+  for (int i = int(d->base64.size()) - 2; i >= 0; --i)
+    d->base64[i] = (d->base64[i + 1] +
+                    number<Sym, LITTLE_ENDIAN_TB>(&d->lowestSym[i]) -
+                    number<Sym, LITTLE_ENDIAN_TB>(&d->lowestSym[i + 1])) /
+                   2;
+
+  for (size_t i = 0; i < d->base64.size(); ++i)
+    d->base64[i] <<= 64 - i - d->minSymLen;
+
+  data += d->base64.size() * sizeof(Sym);
+  d->symlen.resize(number<uint16_t, LITTLE_ENDIAN_TB>(data));
+  data += sizeof(uint16_t);
+  d->btree = (LR *)data;
+
+  // Expand the recursive pairing symbols
+  std::vector<bool> visited(d->symlen.size());
+
+  for (Sym sym = 0; sym < d->symlen.size(); ++sym)
+    if (!visited[sym])
+      d->symlen[sym] = setSymlen(d, sym, visited);
+
+  return data + d->symlen.size() * sizeof(LR) + (d->symlen.size() & 1);
+}
+
+uint8_t *setDtzMap(TBTable<WDL> &, uint8_t *data, File) { return data; }
+
+// Read the DTZ value maps of each file
+uint8_t *setDtzMap(TBTable<DTZ> &e, uint8_t *data, File maxFile) {
+  e.map = data;
+
+  for (File f = FILE_A; f <= maxFile; ++f) {
+    const uint8_t flags = e.get(0, f)->flags;
+    if (!(flags & MAPPED))
+      continue;
+
+    if (flags & WIDE) {
+      data += uintptr_t(data) & 1; // Word alignment
+      for (int i = 0; i < 4; ++i) {
+        e.get(0, f)->mapIdx[i] =
+            uint16_t((uint16_t *)data - (uint16_t *)e.map + 1);
+        data += 2 * number<uint16_t, LITTLE_ENDIAN_TB>(data) + 2;
+      }
+    } else {
+      for (int i = 0; i < 4; ++i) {
+        e.get(0, f)->mapIdx[i] = uint16_t(data - e.map + 1);
+        data += *data + 1;
+      }
+    }
+  }
+
+  return data += uintptr_t(data) & 1; // Word alignment
+}
+
+// Populate the pairs data of an entry from its mapped file
+template <typename T> void set(T &e, uint8_t *data) {
+  PairsData *d;
+
+  data++; // Flags (Split / has pawns)
+
+  const int sides = T::sides == 2 && e.key != e.key2 ? 2 : 1;
+  const File maxFile = e.hasPawns ? FILE_D : FILE_A;
+
+  const bool pp = e.hasPawns && e.pawnCount[1]; // Pawns on both sides
+
+  for (File f = FILE_A; f <= maxFile; ++f) {
+    for (int i = 0; i < sides; ++i)
+      *e.get(i, f) = PairsData();
+
+    int order[][2] = {{*data & 0xF, pp ? *(data + 1) & 0xF : 0xF},
+                      {*data >> 4, pp ? *(data + 1) >> 4 : 0xF}};
+    data += 1 + pp;
+
+    for (int k = 0; k < e.pieceCount; ++k, ++data)
+      for (int i = 0; i < sides; ++i)
+        e.get(i, f)->pieces[k] = Piece(i ? *data >> 4 : *data & 0xF);
+
+    for (int i = 0; i < sides; ++i)
+      setGroups(e, e.get(i, f), order[i], f);
+  }
+
+  data += uintptr_t(data) & 1; // Word alignment
+
+  for (File f = FILE_A; f <= maxFile; ++f)
+    for (int i = 0; i < sides; ++i)
+      data = setSizes(e.get(i, f), data);
+
+  data = setDtzMap(e, data, maxFile);
+
+  for (File f = FILE_A; f <= maxFile; ++f)
+    for (int i = 0; i < sides; ++i) {
+      (d = e.get(i, f))->sparseIndex = (SparseEntry *)data;
+      data += d->sparseIndexSize * sizeof(SparseEntry);
+    }
+
+  for (File f = FILE_A; f <= maxFile; ++f)
+    for (int i = 0; i < sides; ++i) {
+      (d = e.get(i, f))->blockLength = (uint16_t *)data;
+      data += d->blockLengthSize * sizeof(uint16_t);
+    }
+
+  for (File f = FILE_A; f <= maxFile; ++f)
+    for (int i = 0; i < sides; ++i) {
+      data = (uint8_t *)((uintptr_t(data) + 0x3F) & ~0x3F); // 64 byte alignment
+      (d = e.get(i, f))->data = data;
+      data += d->numBlocks * d->blockSize;
+    }
+}
+
+// Map the file of an entry on first access (Thread safe)
+template <TBType Type> const void *mapped(TBTable<Type> &e, const Position &pos) {
+  static std::mutex mutex;
+
+  if (e.ready.load(std::memory_order_acquire))
+    return e.baseAddress; // Null if the file is missing
+
+  std::scoped_lock<std::mutex> lock(mutex);
+
+  if (e.ready.load(std::memory_order_relaxed))
+    return e.baseAddress;
+
+  // Pieces of each colour in decreasing order, e.g. KRvK
+  std::string w, b;
+  for (PieceType pt = KING; pt >= PAWN; pt = PieceType(pt - 1)) {
+    w += std::string(pos.count(toPiece(WHITE, pt)), pieceChars[pt]);
+    b += std::string(pos.count(toPiece(BLACK, pt)), pieceChars[pt]);
+  }
+
+  const std::string name = (e.key == pos.materialKey() ? w + 'v' + b : b + 'v' + w) +
+                           (Type == WDL ? ".rtbw" : ".rtbz");
+
+  uint8_t *data = mapTBFile(name, &e.baseAddress, &e.mapping, Type);
+
+  if (data)
+    set(e, data);
+
+  e.ready.store(true, std::memory_order_release);
+  return e.baseAddress;
+}
+
+template <TBType Type, typename Ret = typename TBTable<Type>::Ret>
+Ret probeTable(const Position &pos, ProbeState *result, WDLScore wdl = WDL_DRAW) {
+  // KvK
+  if (countBits(pos.occupied()) == 2)
+    return Ret(WDL_DRAW);
+
+  TBTable<Type> *entry = tbTables.get<Type>(pos.materialKey());
+
+  if (!entry || !mapped(*entry, pos))
+    return *result = FAIL, Ret();
+
+  return doProbeTable(pos, entry, wdl, result);
+}
+
+// Positions with a winning (or drawing) capture may store any value for better
+// compression, so captures are searched and the best result is the true one.
+// DTZ tables don't store zeroing moves, so pawn moves are searched for DTZ.
+template <bool checkZeroingMoves>
+WDLScore search(Position &pos, ProbeState *result) {
+  WDLScore value, bestValue = WDL_LOSS;
+  BoardState st{};
+
+  MoveList<ALL> moveList(pos);
+  const size_t totalCount = moveList.size();
+  size_t moveCount = 0;
+
+  for (Move move : moveList) {
+    if (!pos.isCapture(move) &&
+        (!checkZeroingMoves || pos.movedPieceType(move) != PAWN))
+      continue;
+
+    ++moveCount;
+
+    pos.makeMove(move, st);
+    value = -search<false>(pos, result);
+    pos.unmakeMove(move);
+
+    if (*result == FAIL)
+      return WDL_DRAW;
+
+    if (value > bestValue) {
+      bestValue = value;
+
+      if (value >= WDL_WIN) {
+        *result = ZEROING_BEST_MOVE; // Winning zeroing move
+        return value;
+      }
+    }
+  }
+
+  // All legal moves have been searched, the stored value may be wrong (Tables
+  // don't store en passant rights)
+  const bool noMoreMoves = moveCount && moveCount == totalCount;
+
+  if (noMoreMoves)
+    value = bestValue;
+  else {
+    value = probeTable<WDL>(pos, result);
+
+    if (*result == FAIL)
+      return WDL_DRAW;
+  }
+
+  // The stored value is a "don't care" if the best zeroing move is better
+  if (bestValue >= value)
+    return *result = (bestValue > WDL_DRAW || noMoreMoves ? ZEROING_BEST_MOVE
+                                                          : OK),
+           bestValue;
+
+  return *result = OK, value;
+}
+
+} // namespace
+
+/******************************************\
+|==========================================|
+|              Initialisation              |
+|==========================================|
+\******************************************/
+
+void init(const std::string &paths) {
+  tbTables.clear();
+  maxCardinality = 0;
+  tbPaths = paths;
+
+  if (paths.empty() || paths == "<empty>")
+    return;
+
+  // mapB1H1H7 encodes a square below the a1-h8 diagonal to 0..27
+  int code = 0;
+  for (Square sq = A1; sq <= H8; ++sq)
+    if (offA1H8(sq) < 0)
+      mapB1H1H7[sq] = code++;
+
+  // mapA1D1D4 encodes a square of the a1-d1-d4 triangle to 0..9
+  std::vector<Square> diagonal;
+  code = 0;
+  for (Square sq : {A1, B1, C1, D1, A2, B2, C2, D2, A3, B3, C3, D3, A4, B4, C4, D4})
+    if (offA1H8(sq) < 0)
+      mapA1D1D4[sq] = code++;
+    else if (!offA1H8(sq))
+      diagonal.push_back(sq);
+
+  // Diagonal squares are encoded last
+  for (Square sq : diagonal)
+    mapA1D1D4[sq] = code++;
+
+  // mapKK encodes the 462 legal placements of two kings with the first king
+  // in the a1-d1-d4 triangle (Not above the diagonal if the first is on it)
+  std::vector<std::pair<int, Square>> bothOnDiagonal;
+  code = 0;
+  for (int idx = 0; idx < 10; ++idx)
+    for (Square s1 = A1; s1 <= D4; ++s1)
+      if (mapA1D1D4[s1] == idx && (idx || s1 == B1)) {
+        for (Square s2 = A1; s2 <= H8; ++s2)
+          if ((pseudoAttacks[KING][s1] | s1) & s2)
+            continue; // Illegal position
+
+          else if (!offA1H8(s1) && offA1H8(s2) > 0)
+            continue; // First on the diagonal, second above
+
+          else if (!offA1H8(s1) && !offA1H8(s2))
+            bothOnDiagonal.emplace_back(idx, s2);
+
+          else
+            mapKK[idx][s2] = code++;
+      }
+
+  // Both kings on the diagonal are encoded last
+  for (auto [idx, sq] : bothOnDiagonal)
+    mapKK[idx][sq] = code++;
+
+  // binomial[k][n] is the number of ways to choose k squares out of n
+  binomial[0][0] = 1;
+
+  for (int n = 1; n < 64; ++n)
+    for (int k = 0; k < 6 && k <= n; ++k)
+      binomial[k][n] = (k > 0 ? binomial[k - 1][n - 1] : 0) +
+                       (k < n ? binomial[k][n - 1] : 0);
+
+  // mapPawns encodes squares a2-h7 to 0..47, the number of squares available
+  // for the other pawns when the leading pawn is on the square
+  int availableSquares = 47;
+
+  // Leading pawn group encoding (Up to 5 leading pawns)
+  for (int leadPawnsCnt = 1; leadPawnsCnt <= 5; ++leadPawnsCnt)
+    for (File f = FILE_A; f <= FILE_D; ++f) {
+      // Tables are split by file, the index restarts on each file
+      int idx = 0;
+
+      for (Rank r = RANK_2; r <= RANK_7; ++r) {
+        const Square sq = toSquare(f, r);
+
+        if (leadPawnsCnt == 1) {
+          mapPawns[sq] = availableSquares--;
+          mapPawns[flipFile(sq)] = availableSquares--;
+        }
+
+        leadPawnIdx[leadPawnsCnt][sq] = idx;
+        idx += binomial[leadPawnsCnt - 1][mapPawns[sq]];
+      }
+
+      leadPawnsSize[leadPawnsCnt][f] = idx;
+    }
+
+  // Add the tables whose WDL file exists
+  for (PieceType p1 = PAWN; p1 < KING; ++p1) {
+    tbTables.add({KING, p1, KING});
+
+    for (PieceType p2 = PAWN; p2 <= p1; ++p2) {
+      tbTables.add({KING, p1, p2, KING});
+      tbTables.add({KING, p1, KING, p2});
+
+      for (PieceType p3 = PAWN; p3 < KING; ++p3)
+        tbTables.add({KING, p1, p2, KING, p3});
+
+      for (PieceType p3 = PAWN; p3 <= p2; ++p3) {
+        tbTables.add({KING, p1, p2, p3, KING});
+
+        for (PieceType p4 = PAWN; p4 <= p3; ++p4) {
+          tbTables.add({KING, p1, p2, p3, p4, KING});
+
+          for (PieceType p5 = PAWN; p5 <= p4; ++p5)
+            tbTables.add({KING, p1, p2, p3, p4, p5, KING});
+
+          for (PieceType p5 = PAWN; p5 < KING; ++p5)
+            tbTables.add({KING, p1, p2, p3, p4, KING, p5});
+        }
+
+        for (PieceType p4 = PAWN; p4 < KING; ++p4) {
+          tbTables.add({KING, p1, p2, p3, KING, p4});
+
+          for (PieceType p5 = PAWN; p5 <= p4; ++p5)
+            tbTables.add({KING, p1, p2, p3, KING, p4, p5});
+        }
+      }
+
+      for (PieceType p3 = PAWN; p3 <= p1; ++p3)
+        for (PieceType p4 = PAWN; p4 <= (p1 == p3 ? p2 : p3); ++p4)
+          tbTables.add({KING, p1, p2, KING, p3, p4});
+    }
+  }
+
+  std::cout << "info string Found " << tbTables.count() << " tablebases"
+            << std::endl;
+}
+
+/******************************************\
+|==========================================|
+|                 Probing                  |
+|==========================================|
+\******************************************/
+
+WDLScore probeWDL(Position &pos, ProbeState *result) {
+  *result = OK;
+  return search<false>(pos, result);
+}
+
+int probeDTZ(Position &pos, ProbeState *result) {
+  *result = OK;
+  const WDLScore wdl = search<true>(pos, result);
+
+  // DTZ tables don't store draws
+  if (*result == FAIL || wdl == WDL_DRAW)
+    return 0;
+
+  // The stored value can't be used when the best move is zeroing
+  if (*result == ZEROING_BEST_MOVE)
+    return dtzBeforeZeroing(wdl);
+
+  int dtz = probeTable<DTZ>(pos, result, wdl);
+
+  if (*result == FAIL)
+    return 0;
+
+  if (*result != CHANGE_STM)
+    return (dtz + 100 * (wdl == WDL_BLESSED_LOSS || wdl == WDL_CURSED_WIN)) *
+           signOf(wdl);
+
+  // The table stores the other side to move, find the best DTZ of a 1-ply
+  // search instead
+  BoardState st{};
+  int minDTZ = 0xFFFF;
+
+  for (Move move : MoveList<ALL>(pos)) {
+    const bool zeroing = pos.isCapture(move) || pos.movedPieceType(move) == PAWN;
+
+    pos.makeMove(move, st);
+
+    // Zeroing moves take the DTZ before the move, from the sign of the result
+    dtz = zeroing ? -dtzBeforeZeroing(search<false>(pos, result))
+                  : -probeDTZ(pos, result);
+
+    // Mating moves have a DTZ of 1
+    if (dtz == 1 && pos.isInCheck() && MoveList<ALL>(pos).empty())
+      minDTZ = 1;
+
+    if (!zeroing)
+      dtz += signOf(dtz);
+
+    // Skip draws, and only pick positive values when winning
+    if (dtz < minDTZ && signOf(dtz) == signOf(wdl))
+      minDTZ = dtz;
+
+    pos.unmakeMove(move);
+
+    if (*result == FAIL)
+      return 0;
+  }
+
+  // No legal moves, mated
+  return minDTZ == 0xFFFF ? -1 : minDTZ;
+}
+
+bool rootProbe(Position &pos, std::vector<RootMove> &rootMoves, bool rule50) {
+  ProbeState result = OK;
+  BoardState st{};
+
+  const int cnt50 = pos.fiftyMove();
+
+  // A repetition since the last zeroing move makes the win uncertain
+  const bool rep = pos.hasRepeated();
+
+  const int bound = rule50 ? (MAX_DTZ - 100) : 1;
+  int dtz;
+
+  for (RootMove &rm : rootMoves) {
+    pos.makeMove(rm.pv[0], st);
+
+    // Zeroing moves, the DTZ is one of -101/-1/0/1/101
+    if (pos.fiftyMove() == 0)
+      dtz = dtzBeforeZeroing(-probeWDL(pos, &result));
+
+    // Draw by repetition or fifty moves
+    else if (pos.isDraw(1))
+      dtz = 0;
+
+    // DTZ of the new position, corrected by one ply
+    else {
+      dtz = -probeDTZ(pos, &result);
+      dtz = dtz > 0 ? dtz + 1 : dtz < 0 ? dtz - 1 : dtz;
+    }
+
+    // Mating moves have a DTZ of 1
+    if (pos.isInCheck() && dtz == 2 && MoveList<ALL>(pos).empty())
+      dtz = 1;
+
+    pos.unmakeMove(rm.pv[0]);
+
+    if (result == FAIL)
+      return false;
+
+    // Certain wins are ranked equally, losses are ranked equally unless a
+    // fifty move draw is in sight
+    const int r = dtz > 0 ? (dtz + cnt50 <= 99 && !rep ? MAX_DTZ
+                                                       : MAX_DTZ - (dtz + cnt50))
+                  : dtz < 0 ? (-dtz * 2 + cnt50 < 100 ? -MAX_DTZ
+                                                      : -MAX_DTZ + (-dtz + cnt50))
+                            : 0;
+    rm.tbRank = r;
+
+    // Cursed wins score at least 1 cp, growing as the real win gets closer
+    rm.tbScore = r >= bound ? VAL_MATE_BOUND - 1
+                 : r > 0 ? Value((std::max(3, r - (MAX_DTZ - 200)) *
+                                  PieceValue[PAWN]) / 200)
+                 : r == 0 ? VAL_ZERO
+                 : r > -bound ? Value((std::min(-3, r + (MAX_DTZ - 200)) *
+                                       PieceValue[PAWN]) / 200)
+                              : -VAL_MATE_BOUND + 1;
+  }
+
+  return true;
+}
+
+bool rootProbeWDL(Position &pos, std::vector<RootMove> &rootMoves,
+                  bool rule50) {
+  constexpr int WDLToRank[] = {-MAX_DTZ, -MAX_DTZ + 101, 0, MAX_DTZ - 101,
+                               MAX_DTZ};
+
+  ProbeState result = OK;
+  BoardState st{};
+  WDLScore wdl;
+
+  for (RootMove &rm : rootMoves) {
+    pos.makeMove(rm.pv[0], st);
+
+    wdl = pos.isDraw(1) ? WDL_DRAW : -probeWDL(pos, &result);
+
+    pos.unmakeMove(rm.pv[0]);
+
+    if (result == FAIL)
+      return false;
+
+    rm.tbRank = WDLToRank[wdl + 2];
+
+    if (!rule50)
+      wdl = wdl > WDL_DRAW ? WDL_WIN : wdl < WDL_DRAW ? WDL_LOSS : WDL_DRAW;
+    rm.tbScore = WDLToValue[wdl + 2];
+  }
+
+  return true;
+}
+
+void rankRootMoves(Position &pos, std::vector<RootMove> &rootMoves,
+                   Config &config) {
+  config.rootInTB = false;
+  config.cardinality = maxCardinality;
+
+  if (rootMoves.empty())
+    return;
+
+  bool dtzAvailable = true;
+
+  if (config.cardinality >= countBits(pos.occupied()) &&
+      !pos.canCastle(ANY_SIDE)) {
+    // Rank the moves using the DTZ tables
+    config.rootInTB = rootProbe(pos, rootMoves, config.useRule50);
+
+    // Fall back to the WDL tables
+    if (!config.rootInTB) {
+      dtzAvailable = false;
+      config.rootInTB = rootProbeWDL(pos, rootMoves, config.useRule50);
+    }
+  }
+
+  if (config.rootInTB) {
+    std::stable_sort(rootMoves.begin(), rootMoves.end(),
+                     [](const RootMove &a, const RootMove &b) {
+                       return a.tbRank > b.tbRank;
+                     });
+
+    // Only search the moves which preserve the best result
+    const int best = rootMoves[0].tbRank;
+    rootMoves.erase(std::find_if(rootMoves.begin(), rootMoves.end(),
+                                 [best](const RootMove &rm) {
+                                   return rm.tbRank != best;
+                                 }),
+                    rootMoves.end());
+
+    // Probe in search only when DTZ is missing and the root is winning
+    if (dtzAvailable || rootMoves[0].tbScore <= VAL_ZERO)
+      config.cardinality = 0;
+  } else
+    for (RootMove &rm : rootMoves)
+      rm.tbRank = 0;
+}
+
+
+/******************************************\
+|==========================================|
+|             Tablebase Test               |
+|==========================================|
+\******************************************/
+
+namespace {
+
+// 3 piece positions: the kings, a white piece and the side to move
+constexpr unsigned TEST_SIZE = 2 * 64 * 64 * 64;
+constexpr unsigned TERMINAL_DRAW = TEST_SIZE; // Child where the piece is taken
+constexpr int ILLEGAL = -3, UNKNOWN = -2, DRAW = -1;
+
+unsigned testIndex(Square wksq, Square sq, Square bksq, Colour stm) {
+  return wksq | sq << 6 | bksq << 12 | stm << 18;
+}
+
+std::string toFen(Square wksq, Square sq, char piece, Square bksq,
+                  Colour stm) {
+  std::string fen;
+
+  for (Rank r = RANK_8; r >= RANK_1; --r) {
+    int empty = 0;
+    for (File f = FILE_A; f <= FILE_H; ++f) {
+      const Square s = toSquare(f, r);
+      const char c = s == wksq ? 'K' : s == sq ? piece : s == bksq ? 'k' : 0;
+      if (!c) {
+        ++empty;
+        continue;
+      }
+      if (empty)
+        fen += std::to_string(empty), empty = 0;
+      fen += c;
+    }
+    if (empty)
+      fen += std::to_string(empty);
+    if (r != RANK_1)
+      fen += '/';
+  }
+
+  return fen + (stm == WHITE ? " w - - 0 1" : " b - - 0 1");
+}
+
+bool isLegal(PieceType pt, Square wksq, Square sq, Square bksq, Colour stm) {
+  if (wksq == sq || bksq == sq || distance(wksq, bksq) <= 1)
+    return false;
+  if (pt == PAWN && (rankOf(sq) == RANK_1 || rankOf(sq) == RANK_8))
+    return false;
+
+  // Black can't be in check with white to move
+  const Bitboard attacks = pt == PAWN ? pawnAttacksBB<WHITE>(sq)
+                                      : attacksBB(pt, sq, squareBB(wksq));
+  return stm == BLACK || !(attacks & bksq);
+}
+
+// Index of the position after a move, TERMINAL_DRAW if the piece was taken
+unsigned childIndex(const Position &pos, PieceType pt) {
+  if (pos.count<ALL_PIECES>() == 2)
+    return TERMINAL_DRAW;
+  return testIndex(pos.square<KING>(WHITE), getLSB(pos.pieces(WHITE, pt)),
+                   pos.square<KING>(BLACK), pos.sideToMove());
+}
+
+// Distance to mate (Plies) of the KQvK or KRvK positions by retrograde
+// analysis with the move generator, independent of the tables
+struct KXKSolve {
+  std::vector<int> dtm;
+  std::vector<std::vector<unsigned>> children;
+};
+
+KXKSolve solveKXK(PieceType pt, char piece) {
+  KXKSolve solve{std::vector<int>(TEST_SIZE, ILLEGAL),
+                 std::vector<std::vector<unsigned>>(TEST_SIZE)};
+  Position pos;
+  BoardState st{}, next{};
+
+  for (unsigned idx = 0; idx < TEST_SIZE; ++idx) {
+    const Square wksq = Square(idx & 0x3F), sq = Square((idx >> 6) & 0x3F),
+                 bksq = Square((idx >> 12) & 0x3F);
+    const Colour stm = Colour(idx >> 18);
+
+    if (!isLegal(pt, wksq, sq, bksq, stm))
+      continue;
+
+    pos.set(toFen(wksq, sq, piece, bksq, stm), st);
+    MoveList<ALL> moves(pos);
+
+    // Black is mated, or stalemated
+    if (moves.empty()) {
+      solve.dtm[idx] = pos.isInCheck() ? 0 : DRAW;
+      continue;
+    }
+
+    solve.dtm[idx] = UNKNOWN;
+    for (Move move : moves) {
+      pos.makeMove(move, next);
+      solve.children[idx].push_back(childIndex(pos, pt));
+      pos.unmakeMove(move);
+    }
+  }
+
+  // White wins at an odd ply by a move to a loss of the previous ply, black
+  // loses at an even one when all its moves reach wins of at most the
+  // previous ply
+  for (int ply = 1, changed = true; changed; ++ply) {
+    changed = false;
+    for (unsigned idx = 0; idx < TEST_SIZE; ++idx) {
+      if (solve.dtm[idx] != UNKNOWN || (idx >> 18) != unsigned(~ply & 1))
+        continue;
+
+      const std::vector<unsigned> &children = solve.children[idx];
+      const bool result =
+          idx >> 18 == WHITE
+              ? std::any_of(children.begin(), children.end(),
+                            [&](unsigned c) {
+                              return c != TERMINAL_DRAW &&
+                                     solve.dtm[c] == ply - 1;
+                            })
+              : std::all_of(children.begin(), children.end(), [&](unsigned c) {
+                  return c != TERMINAL_DRAW && solve.dtm[c] >= 0 &&
+                         solve.dtm[c] < ply;
+                });
+      if (result)
+        solve.dtm[idx] = ply, changed = true;
+    }
+  }
+
+  std::replace(solve.dtm.begin(), solve.dtm.end(), UNKNOWN, DRAW);
+  return solve;
+}
+
+} // namespace
+
+void verify() {
+  std::cout << "\n\n	Syzygy Tablebase Test\n" << std::endl;
+  TimePt start = getTimeMs();
+
+  const PieceType types[] = {QUEEN, ROOK, PAWN};
+  const char *names[] = {"KQvK", "KRvK", "KPvK"};
+  const char pieces[] = {'Q', 'R', 'P'};
+
+  U64 positions = 0, wdlErrors = 0, dtzErrors = 0, rootErrors = 0;
+  int missing = 0;
+  Position pos;
+  BoardState st{}, next{};
+  ProbeState result;
+
+  auto mismatch = [&](U64 &errors, const char *what, int value, int expected) {
+    if (++errors <= 10)
+      std::cout << "	Mismatch (" << what << "): " << pos.fen() << " " << value
+                << " Expected: " << expected << std::endl;
+  };
+
+  for (int t = 0; t < 3; ++t) {
+    const PieceType pt = types[t];
+
+    // The tables are only present if a probe succeeds
+    pos.set(toFen(E1, D2, pieces[t], E8, WHITE), st);
+    probeWDL(pos, &result);
+    if (maxCardinality < 3 || result == FAIL) {
+      std::cout << "	" << names[t] << ":	Missing" << std::endl;
+      ++missing;
+      continue;
+    }
+
+    // KPvK is checked against the KPK bitbase, which has no distances
+    Bitbases::waitForInit();
+    const KXKSolve solve = pt == PAWN ? KXKSolve{} : solveKXK(pt, pieces[t]);
+    U64 tablePositions = 0;
+
+    for (unsigned idx = 0; idx < TEST_SIZE; ++idx) {
+      const Square wksq = Square(idx & 0x3F), sq = Square((idx >> 6) & 0x3F),
+                   bksq = Square((idx >> 12) & 0x3F);
+      const Colour stm = Colour(idx >> 18);
+
+      if (!isLegal(pt, wksq, sq, bksq, stm))
+        continue;
+
+      pos.set(toFen(wksq, sq, pieces[t], bksq, stm), st);
+      ++tablePositions;
+
+      int dtm = DRAW;
+      WDLScore expected = WDL_DRAW;
+      if (pt == PAWN) {
+        const int flip = fileOf(sq) > FILE_D ? 7 : 0;
+        if (Bitbases::probe(Square(wksq ^ flip), Square(sq ^ flip),
+                            Square(bksq ^ flip), stm))
+          expected = stm == WHITE ? WDL_WIN : WDL_LOSS;
+      } else if ((dtm = solve.dtm[idx]) >= 0)
+        expected = stm == WHITE ? WDL_WIN : WDL_LOSS;
+
+      const WDLScore wdl = probeWDL(pos, &result);
+      if (result == FAIL || wdl != expected)
+        mismatch(wdlErrors, "WDL", wdl, expected);
+
+      // Stored distances are in moves or in plies, so they may be one ply
+      // longer than the distance to mate
+      const int dtz = probeDTZ(pos, &result);
+      const bool dtzOk =
+          pt == PAWN ? signOf(dtz) == signOf(expected)
+          : dtm < 0  ? dtz == 0
+          : dtm == 0 ? dtz == -1
+                     : std::abs(dtz) - dtm <= 1 && std::abs(dtz) >= dtm &&
+                           signOf(dtz) == signOf(expected);
+      if (result == FAIL || !dtzOk)
+        mismatch(dtzErrors, "DTZ", dtz, expected == WDL_DRAW ? 0 : dtm);
+
+      // The ranked root moves must be exactly the ones keeping the best
+      // result
+      if (pt == PAWN || idx % 61 || solve.children[idx].empty())
+        continue;
+
+      std::vector<RootMove> rootMoves;
+      int best = -1, bestCount = 0;
+      for (Move move : MoveList<ALL>(pos))
+        rootMoves.emplace_back(move);
+
+      // Outcome of a move for the side to move: 0 loss, 1 draw, 2 win
+      auto outcome = [&](unsigned child) {
+        return child == TERMINAL_DRAW || solve.dtm[child] < 0 ? 1
+               : stm == WHITE                                 ? 2
+                                                              : 0;
+      };
+
+      for (unsigned child : solve.children[idx]) {
+        const int o = outcome(child);
+        bestCount = o > best ? 1 : bestCount + (o == best);
+        best = std::max(best, o);
+      }
+
+      Config config;
+      rankRootMoves(pos, rootMoves, config);
+
+      bool rootOk = config.rootInTB && int(rootMoves.size()) == bestCount;
+      for (const RootMove &rm : rootMoves) {
+        pos.makeMove(rm.pv[0], next);
+        const unsigned child = childIndex(pos, pt);
+        pos.unmakeMove(rm.pv[0]);
+
+        rootOk &= outcome(child) == best;
+      }
+      if (!rootOk)
+        mismatch(rootErrors, "Root moves", rootMoves.size(), bestCount);
+    }
+
+    positions += tablePositions;
+    std::cout << "	" << names[t] << ":	" << tablePositions << " positions"
+              << std::endl;
+  }
+
+  const U64 errors = wdlErrors + dtzErrors + rootErrors;
+  U64 duration = getTimeMs() - start;
+
+  std::cout << "\n==========================================\n" << std::endl;
+  std::cout << "	Positions:	" << positions << std::endl;
+  std::cout << "	Mismatches:	" << wdlErrors << " WDL, " << dtzErrors
+            << " DTZ, " << rootErrors << " root moves" << std::endl;
+  std::cout << "	Duration:	" << duration << " ms" << std::endl;
+  std::cout << "	Result:		"
+            << (errors      ? "Failed"
+                : missing   ? "Skipped (Set SyzygyPath to the KQvK, KRvK and "
+                              "KPvK tables)"
+                            : "Passed")
+            << std::endl;
+  std::cout << "\n==========================================\n\n";
+}
+
+} // namespace Maestro::Tablebases
@@ -0,0 +1,80 @@
+#ifndef SYZYGY_HPP
+#pragma once
+#define SYZYGY_HPP
+
+#include <string>
+#include <vector>
+
+#include "defs.hpp"
+#include "position.hpp"
+
+namespace Maestro {
+
+struct RootMove;
+
+/******************************************\
+|==========================================|
+|           Syzygy Tablebases              |
+|        (Based on Stockfish tbprobe)      |
+|==========================================|
+\******************************************/
+
+// https://www.chessprogramming.org/Syzygy_Bases
+
+namespace Tablebases {
+
+// Win/Draw/Loss score (Cursed wins and blessed losses are draws under the
+// fifty move rule)
+enum WDLScore {
+  WDL_LOSS = -2,
+  WDL_BLESSED_LOSS = -1,
+  WDL_DRAW = 0,
+  WDL_CURSED_WIN = 1,
+  WDL_WIN = 2,
+};
+
+// Possible states after a probing operation
+enum ProbeState {
+  FAIL = 0,              // Probe failed (missing file table)
+  OK = 1,                // Probe successful
+  CHANGE_STM = -1,       // DTZ should check the other side
+  ZEROING_BEST_MOVE = 2, // Best move zeroes DTZ (capture or pawn move)
+};
+
+// Search configuration, set up for each search by rankRootMoves
+struct Config {
+  int cardinality = 0;
+  Depth probeDepth = 1;
+  bool rootInTB = false;
+  bool useRule50 = true;
+};
+
+// Largest number of pieces of the tablebases found
+extern int maxCardinality;
+
+// Find the tablebase files in the given paths (Separated by ':' or ';' on
+// Windows)
+void init(const std::string &paths);
+
+// Probe the WDL and DTZ tables (Relative to the side to move)
+WDLScore probeWDL(Position &pos, ProbeState *result);
+int probeDTZ(Position &pos, ProbeState *result);
+
+// Rank the root moves using DTZ (or WDL if DTZ is missing) tables
+bool rootProbe(Position &pos, std::vector<RootMove> &rootMoves, bool rule50);
+bool rootProbeWDL(Position &pos, std::vector<RootMove> &rootMoves,
+                  bool rule50);
+
+// Rank the root moves and set up the search configuration
+void rankRootMoves(Position &pos, std::vector<RootMove> &rootMoves,
+                   Config &config);
+
+// Check the KQvK, KRvK and KPvK tables against a retrograde solve and the KPK
+// bitbase
+void verify();
+
+} // namespace Tablebases
+
+} // namespace Maestro
+
+#endif // SYZYGY_HPP
@@ -5,6 +5,7 @@
 #include "move.hpp"
 #include "movegen.hpp"
 #include "search.hpp"
+#include "syzygy.hpp"
 #include "thread.hpp"
 #include "uci.hpp"
 
@@ -115,8 +116,6 @@ void ThreadPool::set(size_t n, SearchState &sharedState) {
                                    threads.size())); // Create worker threads
   }
 
-  clear();
-
   main()->waitForThread(); // Wait for main thread to finish
   waitForThreads();        // Wait for all threads to finish
 }
@@ -179,14 +178,18 @@ void ThreadPool::startThinking(Position &pos, StateListPtr &s, Limits limits) {
   for (const Move &m : legalMoves)
     rootMoves.emplace_back(m);
 
+  // Rank the root moves with the tablebases
+  Tablebases::Config &tbConfig = main()->worker->sharedState.tbConfig;
+  Tablebases::rankRootMoves(pos, rootMoves, tbConfig);
+
   if (s.get())
-    states = std::move(s);
+    states = s;
 
   for (auto &&th : threads) {
     th->startJob([&] {
       th->worker->limits = limits;
-      th->worker->nodes = 0;
-      th->worker->rootDepth = 0;
+      th->worker->nodes = th->worker->tbHits = 0;
+      th->worker->rootDepth = th->worker->_completedDepth = 0;
       th->worker->rootMoves = rootMoves;
       th->worker->rootPos.set(pos.fen(), th->worker->rootState);
       th->worker->rootState = states->back();
@@ -223,4 +226,45 @@ U64 ThreadPool::nodesSearched() const {
   return accumulate(&SearchWorker::nodes);
 }
 
+// Return tablebase hits
+U64 ThreadPool::tbHitsSearched() const {
+  return accumulate(&SearchWorker::tbHits);
+}
+
+/******************************************\
+|==========================================|
+|              Private Search              |
+|==========================================|
+\******************************************/
+
+PrivateSearch::PrivateSearch(const SearchState &settings, Report report,
+                             TTable *sharedTT)
+    : _state(_threads, sharedTT ? *sharedTT : _tt), _ownTT(!sharedTT) {
+  _state.net = settings.net;
+  _state.tbConfig = settings.tbConfig;
+  _state.newHashGen = _ownTT;
+  _state.report = std::move(report);
+}
+
+void PrivateSearch::init(size_t threadCount, size_t hashMB) {
+  _threads.set(threadCount, _state);
+  if (_ownTT)
+    _tt.resize(hashMB);
+}
+
+void PrivateSearch::clear() {
+  if (_ownTT)
+    _tt.clear(_threads);
+  _threads.clear();
+}
+
+Move PrivateSearch::search(Position &pos, StateListPtr &states,
+                           const Limits &limits) {
+  _threads.stop = _threads.abortedSearch = _threads.ponder = false;
+  _threads.startThinking(pos, states, limits);
+  _threads.main()->waitForThread();
+
+  return _threads.getBestThread()->worker->bestMove();
+}
+
 } // namespace Maestro
\ No newline at end of file
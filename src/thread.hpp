@@ -66,6 +66,7 @@ public:
   void startThinking(Position &pos, StateListPtr &states, Limits limits);
   void clear();
   size_t size() const { return threads.size(); }
+  // Create n threads, their histories are not cleared (See clear)
   void set(size_t n, SearchState &sharedState);
 
   void startJob(size_t threadId, std::function<void()> f);
@@ -76,8 +77,13 @@ public:
 
   Thread *main() const { return threads.front().get(); }
   U64 nodesSearched() const;
+  U64 tbHitsSearched() const;
 
   std::atomic_bool stop, abortedSearch;
+  // Searching the expected reply of the opponent, the time limits apply from
+  // ponderhit (Set before ponder is cleared)
+  std::atomic_bool ponder;
+  std::atomic<TimePt> ponderhitTime{0};
 
 private:
   StateListPtr states;
@@ -91,6 +97,43 @@ private:
   }
 };
 
+/******************************************\
+|==========================================|
+|              Private Search              |
+|==========================================|
+\******************************************/
+
+// Searches run by a tool next to the engine (EPD runner, selfplay), with their
+// own threads, histories and hash (Or a shared one). The settings are copied
+// from the engine search state, and the info of each depth goes to report.
+class PrivateSearch {
+public:
+  using Report = std::function<void(const PrintInfo &, Move)>;
+
+  PrivateSearch(const SearchState &settings, Report report,
+                TTable *sharedTT = nullptr);
+
+  PrivateSearch(const PrivateSearch &) = delete;
+  PrivateSearch &operator=(const PrivateSearch &) = delete;
+
+  // Start the threads and allocate the hash (Unless shared), cleared by clear
+  void init(size_t threadCount, size_t hashMB);
+  // Nothing learnt from the previous searches (The shared hash is kept)
+  void clear();
+  // Search until the limits, returns the best move
+  Move search(Position &pos, StateListPtr &states, const Limits &limits);
+
+  SearchState &state() { return _state; }
+  const SearchState &state() const { return _state; }
+  ThreadPool &threads() { return _threads; }
+
+private:
+  ThreadPool _threads;
+  TTable _tt;
+  SearchState _state;
+  bool _ownTT;
+};
+
 } // namespace Maestro
 
 #endif // THREAD_HPP
\ No newline at end of file
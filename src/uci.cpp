@@ -1,62 +1,299 @@
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <thread>
 
 #include "defs.hpp"
 #include "engine.hpp"
 #include "movegen.hpp"
+#include "output.hpp"
 #include "uci.hpp"
 #include "utils.hpp"
 
 namespace Maestro {
 
+namespace {
+
+// Parse the limit of each search of a tool: ms, or nodes with an n suffix
+bool parseLimit(std::string_view token, TimePt &movetime, U64 &nodes) {
+  if (!token.empty() && token.back() == 'n')
+    return parseNumber(token.substr(0, token.size() - 1), nodes) && nodes;
+  return parseNumber(token, movetime) && movetime > 0;
+}
+
+} // namespace
+
 // Main loop of the chess engine
-void UCI::loop() {
-  std::string input, token;
+void UCI::loop(int argc, char *argv[]) {
+  // Commands given as arguments run in order (Each search finishes before the
+  // next command), then the engine exits
+  if (argc > 1) {
+    for (int i = 1; i < argc && execute(argv[i]); ++i)
+      engine.waitForSearchFinish();
+    engine.waitForSearchFinish();
+    return;
+  }
 
-  do {
-    std::getline(std::cin, input);
+  // Read the input on its own thread, so a command that takes a while (Hash
+  // resize, net loading ...) doesn't hold back stop or isready
+  std::thread input(&UCI::readInput, this);
+
+  while (true) {
+    const Command command = popCommand();
+
+    busy = true;
+    bool running = true;
+    if (command.reply)
+      running = execute(command.line, command.received);
+    else
+      // An isready answered early still loads the net and clears the tables
+      // before the next go
+      engine.prepareSearch();
+    busy = false;
+
+    if (!running)
+      break;
+  }
+
+  input.join();
+}
 
-    std::istringstream is(input);
+// Read the commands until quit or the end of the input
+void UCI::readInput() {
+  std::string line, token;
 
+  while (true) {
+    // The end of the input quits
+    if (!std::getline(std::cin, line))
+      line = "quit";
+
+    const TimePt received = getTimeMs();
+    std::istringstream is(line);
     token.clear();
-    is >> std::skipws >> token;
-
-    if (token == "uci") {
-      std::cout << "id name " << NAME << std::endl;
-      std::cout << "id author " << AUTHOR << std::endl;
-      std::cout << "version " << VERSION << std::endl;
-      std::cout << "uciok" << std::endl;
-
-      // Communicate supported options
-      std::cout << "option Hash type spin default 64 min 1 max 256\n";
-      std::cout << "option Threads type spin default 1 min 1 max 12\n";
-    } else if (token == "isready") {
-      std::cout << "readyok" << std::endl;
-    } else if (token == "quit" || token == "stop") {
+    is >> token;
+
+    // Act on these at once. They are queued too, to apply in order to a go
+    // still waiting in the queue (An isready answered here without a reply).
+    bool reply = true;
+    if (token == "stop" || token == "quit")
       engine.stop();
-    } else if (token == "ucinewgame") {
-      engine.clear();
-    } else if (token == "go") {
-      go(is);
-    } else if (token == "position") {
-      pos(is);
-    } else if (token == "b") {
-      engine.print();
-    } else if (token == "bench" || token == "test") {
-      engine.bench();
-    } else if (token == "setoption") {
-      setOption(is);
+    else if (token == "ponderhit")
+      engine.ponderhit(received);
+    else if (token == "isready" && busy) {
+      Output::post("readyok");
+      reply = false;
     }
-  } while (token != "quit");
+
+    pushCommand(line, received, reply);
+
+    if (token == "quit")
+      break;
+  }
+}
+
+void UCI::pushCommand(const std::string &line, TimePt received, bool reply) {
+  {
+    std::lock_guard<std::mutex> lock(commandMutex);
+    commands.push_back({line, received, reply});
+  }
+  commandCv.notify_one();
+}
+
+Command UCI::popCommand() {
+  std::unique_lock<std::mutex> lock(commandMutex);
+  commandCv.wait(lock, [&] { return !commands.empty(); });
+  Command command = std::move(commands.front());
+  commands.pop_front();
+  return command;
+}
+
+// Execute a UCI command, returns false on quit
+bool UCI::execute(const std::string &input, TimePt received) {
+  std::istringstream is(input);
+  std::string token;
+
+  is >> std::skipws >> token;
+
+  // The protocol lines go through the output queue (A search can be running),
+  // written before the direct output of the next commands
+  if (token == "uci") {
+    std::ostringstream os;
+    os << "id name " << NAME << "\n";
+    os << "id author " << AUTHOR << "\n";
+    os << "version " << VERSION << "\n";
+    os << "uciok\n";
+
+    // Communicate supported options
+    os << "option name Hash type spin default 64 min 1 max 256\n";
+    os << "option name Threads type spin default 1 min 1 max 12\n";
+    os << "option name SyzygyPath type string default <empty>\n";
+    os << "option name SyzygyProbeDepth type spin default 1 min 1 max 100\n";
+    os << "option name EvalFile type string default " << EVAL_FILE;
+    Output::post(os.str());
+    Output::sync();
+  } else if (token == "isready") {
+    engine.prepareSearch();
+    Output::post("readyok");
+    Output::sync();
+  } else if (token == "quit" || token == "stop") {
+    engine.stop();
+  } else if (token == "ponderhit") {
+    engine.ponderhit(received);
+  } else if (token == "ucinewgame") {
+    engine.clear();
+  } else if (token == "go") {
+    go(is, received);
+  } else if (token == "position") {
+    pos(is);
+  } else if (token == "b") {
+    engine.print();
+  } else if (token == "bench" || token == "test") {
+    engine.bench();
+  } else if (token == "sliderbench") {
+    engine.sliderBench();
+  } else if (token == "attackbench") {
+    engine.attackMapBench();
+  } else if (token == "stoplatency") {
+    engine.stopLatency();
+  } else if (token == "bitbase") {
+    engine.verifyBitbase();
+  } else if (token == "tbtest") {
+    engine.verifyTablebases();
+  } else if (token == "nnuetest") {
+    engine.testNNUE();
+  } else if (token == "halfkatest") {
+    // halfkatest [file], the synthetic net is kept in file if given
+    std::string file;
+    is >> file;
+    engine.testHalfKA(file);
+  } else if (token == "evalbatch") {
+    std::string file, output;
+    if (is >> file) {
+      is >> output;
+      engine.evalBatch(file, output);
+    }
+  } else if (token == "makebook") {
+    // makebook <input> <output> [depth <plies>] [threads <n>] [memory <MB>]
+    std::string input, output;
+    BookOptions options;
+    bool valid = bool(is >> input >> output);
+
+    while (valid && is >> token) {
+      if (token == "depth")
+        valid = is >> token && parseNumber(token, options.depth) &&
+                options.depth > 0;
+      else if (token == "threads")
+        valid = is >> token && parseNumber(token, options.threads) &&
+                options.threads >= 0;
+      else if (token == "memory")
+        valid = is >> token && parseNumber(token, options.memory) &&
+                options.memory > 0;
+      else
+        valid = false;
+    }
+
+    if (valid)
+      engine.makeBook(input, output, options);
+    else
+      std::cout << "info string Usage: makebook <input> <output> [depth "
+                   "<plies>] [threads <n>] [memory <MB>]"
+                << std::endl;
+  } else if (token == "epd") {
+    // epd <file> <ms, or nodes with an n suffix> [threads] [hash <MB>]
+    // [sharedhash]
+    std::string file, limit;
+    EPDOptions options;
+    bool valid = is >> file >> limit &&
+                 parseLimit(limit, options.movetime, options.nodes);
+
+    while (valid && is >> token) {
+      if (token == "hash")
+        valid = is >> token && parseNumber(token, options.hash) && options.hash;
+      else if (token == "sharedhash")
+        options.sharedHash = true;
+      else
+        valid = parseNumber(token, options.threads) && options.threads >= 0;
+    }
+
+    if (valid)
+      engine.runEPD(file, options);
+    else
+      std::cout << "info string Usage: epd <file> <ms, or nodes with an n "
+                   "suffix> [threads] [hash <MB>] [sharedhash]"
+                << std::endl;
+  } else if (token == "selfplay") {
+    // selfplay <games> <ms, nodes with an n suffix, or base+inc ms>
+    // [concurrency <n>] [book <file>] [plies <n>] [pgn <file>]
+    // [sprt <elo0> <elo1>] [a|b <option>=<value>]
+    std::string games, limit;
+    SelfPlayOptions options;
+    bool valid = is >> games >> limit && parseNumber(games, options.games) &&
+                 options.games > 0;
+
+    if (valid) {
+      const std::string_view clock(limit);
+      const size_t plus = clock.find('+');
+      valid = plus == std::string_view::npos
+                  ? parseLimit(limit, options.movetime, options.nodes)
+                  : parseNumber(clock.substr(0, plus), options.time) &&
+                        parseNumber(clock.substr(plus + 1), options.inc) &&
+                        options.time > 0 && options.inc >= 0;
+    }
+
+    while (valid && is >> token) {
+      if (token == "concurrency")
+        valid = is >> token && parseNumber(token, options.concurrency) &&
+                options.concurrency >= 0;
+      else if (token == "book")
+        valid = bool(is >> options.book);
+      else if (token == "plies")
+        valid = is >> token && parseNumber(token, options.bookPlies) &&
+                options.bookPlies >= 0;
+      else if (token == "pgn")
+        valid = bool(is >> options.pgn);
+      else if (token == "sprt")
+        valid = options.sprt = is >> token &&
+                               parseNumber(token, options.elo0) &&
+                               is >> token &&
+                               parseNumber(token, options.elo1) &&
+                               options.elo0 < options.elo1;
+      else if (token == "a" || token == "b") {
+        // <name>=<value>
+        std::string option;
+        const size_t eq = is >> option ? option.find('=') : 0;
+        valid = eq > 0 && eq != std::string::npos;
+        if (valid)
+          options.config[token == "b"].emplace_back(option.substr(0, eq),
+                                                    option.substr(eq + 1));
+      } else
+        valid = false;
+    }
+
+    if (valid)
+      engine.selfPlay(options);
+    else
+      std::cout << "info string Usage: selfplay <games> <ms, nodes with an n "
+                   "suffix, or base+inc ms> [concurrency <n>] [book <file>] "
+                   "[plies <n>] [pgn <file>] [sprt <elo0> <elo1>] "
+                   "[a|b <option>=<value>]"
+                << std::endl;
+  } else if (token == "exportnet") {
+    std::string path;
+    if (is >> path)
+      engine.exportNet(path);
+  } else if (token == "setoption") {
+    setOption(is);
+  }
+
+  return token != "quit";
 }
 
 // Parse UCI limits
-Limits UCI::parseLimits(std::istringstream &is) {
+Limits UCI::parseLimits(std::istringstream &is, TimePt received) {
   Limits limits{};
   std::string token;
 
-  limits.startTime = getTimeMs();
+  limits.startTime = received;
 
   while (is >> token) {
     if (token == "wtime") {
@@ -73,8 +310,12 @@ Limits UCI::parseLimits(std::istringstream &is) {
       is >> limits.movesToGo;
     } else if (token == "movetime") {
       is >> limits.movetime;
+    } else if (token == "nodes") {
+      is >> limits.nodes;
     } else if (token == "infinite") {
       limits.infinite = true;
+    } else if (token == "ponder") {
+      limits.ponder = true;
     } else if (token == "perft") {
       limits.perft = true;
       is >> limits.depth;
@@ -85,9 +326,9 @@ Limits UCI::parseLimits(std::istringstream &is) {
 }
 
 // Parse the UCI go command
-void UCI::go(std::istringstream &is) {
+void UCI::go(std::istringstream &is, TimePt received) {
 
-  Limits limits = parseLimits(is);
+  Limits limits = parseLimits(is, received);
 
   if (limits.perft)
     engine.perft(limits);
@@ -142,24 +383,62 @@ Move UCI::toMove(const Position &pos, const std::string &move) {
   if (move == "null")
     return Move::null();
 
-  MoveList<ALL> moves(pos);
+  if (move.size() < 4 || move.size() > 5 || move[0] < 'a' || move[0] > 'h' ||
+      move[1] < '1' || move[1] > '8' || move[2] < 'a' || move[2] > 'h' ||
+      move[3] < '1' || move[3] > '8')
+    return Move::none();
 
-  for (const Move &m : moves)
-    if (move == move2Str(m))
-      return m;
+  // Decode the move without generating the moves, then check it like a hash
+  // move
+  const Square from = toSquare(File(move[0] - 'a'), Rank(move[1] - '1'));
+  const Square to = toSquare(File(move[2] - 'a'), Rank(move[3] - '1'));
+  const PieceType piece = pieceTypeOf(pos.pieceOn(from));
+  Move m;
+
+  if (move.size() == 5) {
+    const size_t promoted = std::string_view("nbrq").find(move[4]);
+    if (promoted == std::string_view::npos)
+      return Move::none();
+    m = Move::encode<PROMOTION>(from, to, PieceType(KNIGHT + promoted));
+  } else if (piece == KING && std::abs(fileOf(to) - fileOf(from)) == 2)
+    m = Move::encode<CASTLE>(from, to);
+  else if (piece == PAWN && to == pos.state()->enPassant)
+    m = Move::encode<EN_PASSANT>(from, to);
+  else
+    m = Move::encode(from, to);
 
-  return Move::none();
+  return pos.isPseudoLegal(m) && pos.isLegal(m) ? m : Move::none();
 }
 
+namespace {
+
+// At most one currmove and nodes line per interval (ms), they are dropped
+// rather than queued when the GUI falls behind
+constexpr TimePt REPORT_INTERVAL = 100;
+
+Output::Throttle currMoveRate(REPORT_INTERVAL), nodesRate(REPORT_INTERVAL);
+
+} // namespace
+
 void UCI::uciReportCurrentMove(Depth depth, Move move, int currmove) {
-  std::cout << "info depth " << depth << " currmove " << move2Str(move)
-            << " currmovenumber " << currmove << std::endl;
+  if (!currMoveRate.ready())
+    return;
+
+  std::ostringstream os;
+  os << "info depth " << depth << " currmove " << move2Str(move)
+     << " currmovenumber " << currmove;
+  Output::tryPost(os.str());
 }
 
 void UCI::uciReportNodes(ThreadPool &threads, int hashFull, TimePt elapsed) {
+  if (!nodesRate.ready())
+    return;
+
   U64 nodes = threads.nodesSearched();
-  std::cout << "info nodes " << nodes << " nps " << nodes * 1000 / elapsed
-            << " hashfull " << hashFull << std::endl;
+  std::ostringstream os;
+  os << "info nodes " << nodes << " nps " << nodes * 1000 / elapsed
+     << " hashfull " << hashFull;
+  Output::tryPost(os.str());
 }
 
 void UCI::uciReport(const PrintInfo &info) {
@@ -169,11 +448,13 @@ void UCI::uciReport(const PrintInfo &info) {
 
   std::string type = abs(info.score) >= VAL_MATE_BOUND ? "mate" : "cp";
 
-  std::cout << "info"
-            << " depth " << info.depth << " seldepth " << info.selDepth
-            << " score " << type << " " << score << " time " << info.timeMs
-            << " nodes " << info.nodes << " nps " << info.nps << " hashfull "
-            << info.hashFull << " pv " << info.pv << std::endl;
+  std::ostringstream os;
+  os << "info"
+     << " depth " << info.depth << " seldepth " << info.selDepth << " score "
+     << type << " " << score << " time " << info.timeMs << " nodes "
+     << info.nodes << " nps " << info.nps << " tbhits " << info.tbHits
+     << " hashfull " << info.hashFull << " pv " << info.pv;
+  Output::post(os.str());
 }
 
 } // namespace Maestro
\ No newline at end of file
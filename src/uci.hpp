@@ -2,6 +2,10 @@
 #pragma once
 #define UCI_HPP
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
 #include <string>
 
 #include "defs.hpp"
@@ -43,10 +47,18 @@ struct PrintInfo {
   Value score;
   U64 nodes;
   U64 nps;
+  U64 tbHits;
   std::string_view pv;
   int hashFull;
 };
 
+// Command read by the input thread
+struct Command {
+  std::string line;
+  TimePt received; // Time control of a go starts when it is read
+  bool reply = true; // False for an isready the input thread answered
+};
+
 /******************************************\
 |==========================================|
 |                 UCI Class                |
@@ -55,20 +67,25 @@ struct PrintInfo {
 
 class UCI {
 public:
-  // Main loop of the chess engine
-  void loop();
+  explicit UCI(bool startupProfile = false) : engine(startupProfile) {}
+
+  // Main loop of the chess engine (Runs the commands given as arguments, if
+  // any, instead of reading them)
+  void loop(int argc, char *argv[]);
+  // Execute a UCI command, returns false on quit
+  bool execute(const std::string &input, TimePt received = getTimeMs());
 
   // UCI command parsing
 
   // Parse the UCI go command
-  void go(std::istringstream &is);
+  void go(std::istringstream &is, TimePt received);
   // Parse the UCI position command
   void pos(std::istringstream &is);
 
   // UCI helper functions
 
   // Parse go time controls
-  Limits parseLimits(std::istringstream &is);
+  Limits parseLimits(std::istringstream &is, TimePt received);
   // Parse move
   static Move toMove(const Position &pos, const std::string &move);
 
@@ -87,7 +104,19 @@ private:
   // Parse the UCI setoption command
   void setOption(std::istringstream &is);
 
+  // Input thread: answers stop, isready, ponderhit and quit at once, and queues
+  // every command for the UCI thread
+  void readInput();
+  void pushCommand(const std::string &line, TimePt received,
+                   bool reply = true);
+  Command popCommand();
+
   Engine engine;
+
+  std::deque<Command> commands;
+  std::mutex commandMutex;
+  std::condition_variable commandCv;
+  std::atomic_bool busy{false}; // The UCI thread is running a command
 };
 
 } // namespace Maestro
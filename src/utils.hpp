@@ -4,8 +4,11 @@
 
 #include <algorithm>
 #include <array>
+#include <charconv>
 #include <chrono>
 #include <cstdint>
+#include <string_view>
+#include <vector>
 
 #include "defs.hpp"
 #include "move.hpp"
@@ -228,6 +231,13 @@ inline bool compareStr(std::string str1, std::string str2) {
   return toLower(str1) == toLower(str2);
 }
 
+// Parse a whole token as a number, false if it is not one
+template <typename T> bool parseNumber(std::string_view token, T &value) {
+  const char *end = token.data() + token.size();
+  const auto [last, error] = std::from_chars(token.data(), end, value);
+  return error == std::errc() && last == end;
+}
+
 // Convert score to a string (Format: {first} {second})
 inline std::string score2Str(Score score) {
   return std::to_string(score.first) + " " + std::to_string(score.second);
@@ -283,7 +293,13 @@ private:
 |==========================================|
 \******************************************/
 
-extern Array<int, SQ_N, SQ_N> dist;
+inline constexpr Array<int, SQ_N, SQ_N> dist = [] {
+  Array<int, SQ_N, SQ_N> d{};
+  for (Square sq1 = A1; sq1 <= H8; ++sq1)
+    for (Square sq2 = A1; sq2 <= H8; ++sq2)
+      d[sq1][sq2] = std::max(rankDist(sq1, sq2), fileDist(sq1, sq2));
+  return d;
+}();
 
 // Distance between two squares (dist = max(rankDist, fileDist))
 constexpr int distance(Square sq1, Square sq2) { return dist[sq1][sq2]; }